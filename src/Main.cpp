@@ -1,4 +1,10 @@
 #include "MainComponent.h"
+#include "processor/AnalysisEngine.h"
+#include "processor/AnalysisService.h"
+#include "processor/FolderWatcher.h"
+#include "processor/WorkerProcess.h"
+#include "util/Trace.h"
+#include <iostream>
 
 class NormalizeApplication final : public juce::JUCEApplication
 {
@@ -12,7 +18,99 @@ public:
     void initialise (const juce::String& commandLine) override
     {
         // This method is where you should put your application's initialisation code..
-        juce::ignoreUnused (commandLine);
+
+        // Launched by a BatchEngine as an isolated worker, no window then
+        auto worker = std::make_unique<norm::WorkerProcess>();
+        if (worker->initialiseFromCommandLine (commandLine, norm::worker::CommandLineId))
+        {
+            workerProcess = std::move (worker);
+            return;
+        }
+
+        // Headless analysis of one file, or of stdin with "-":
+        // --analyse <file>|- [--rate=<Hz> --channels=<n> [--format=s16le]]
+        // stdin carries a WAV header unless a rate is given, then it is raw
+        // PCM in an ffmpeg sample format: u8, s16le, s24le, s32le or f32le.
+        juce::ArgumentList arguments (getApplicationName(), commandLine);
+        if (arguments.containsOption ("--analyse"))
+        {
+            setApplicationReturnValue (analyse (arguments) ? 0 : 1);
+            quit();
+            return;
+        }
+
+        // Resident analyser for local tools, see AnalysisService.h:
+        // --serve <socket> [--workers=<n>] [--tags-only]
+        if (arguments.containsOption ("--serve"))
+        {
+            const auto socketFile = getFileAfterOption (arguments, "--serve");
+            if (socketFile == juce::File())
+            {
+                std::cerr << "--serve needs a socket path" << std::endl;
+                setApplicationReturnValue (1);
+                quit();
+                return;
+            }
+
+            norm::AnalysisService::Options options;
+            if (arguments.containsOption ("--workers"))
+                options.numberOfWorkers = arguments.getValueForOption ("--workers").getIntValue();
+            options.batchOptions.tagsOnly = arguments.containsOption ("--tags-only");
+
+            analysisService = std::make_unique<norm::AnalysisService> (options);
+            if (!analysisService->start (socketFile))
+            {
+                setApplicationReturnValue (1);
+                quit();
+            }
+            return;
+        }
+
+        // Headless drop folder:
+        // --watch <folder> [--target=<LUFS>] [--output=<folder>] [--tags-only]
+        //         [--trace=<file>]
+        // With an output folder the dropped files stay as they are and the
+        // normalised ones go to a mirror tree there. With --tags-only FLAC,
+        // Ogg and MP3 files only get ReplayGain tags. --trace writes a Chrome
+        // trace of this process on exit, in builds with NORM_TRACE.
+        if (arguments.containsOption ("--watch"))
+        {
+            const auto folder = getFileAfterOption (arguments, "--watch");
+            if (! folder.isDirectory())
+            {
+                if (folder == juce::File())
+                    std::cerr << "--watch needs a folder" << std::endl;
+                else
+                    std::cerr << folder.getFullPathName() << " is not a folder" << std::endl;
+                setApplicationReturnValue (1);
+                quit();
+                return;
+            }
+
+            norm::BatchEngine::Options options;
+            options.mode = norm::BatchEngine::Mode::normalise;
+            if (arguments.containsOption ("--target"))
+                options.targetLoudness = arguments.getValueForOption ("--target").getFloatValue();
+            if (arguments.containsOption ("--output"))
+            {
+                options.sourceDirectory = folder;
+                options.outputDirectory = arguments.getFileForOption ("--output");
+            }
+            options.tagsOnly = arguments.containsOption ("--tags-only");
+            if (arguments.containsOption ("--trace"))
+            {
+               #if NORM_TRACE
+                traceFile = arguments.getFileForOption ("--trace");
+                norm::Tracer::getInstance().setEnabled (true);
+               #else
+                std::cerr << "--trace is ignored, this build has no trace points (NORM_TRACE=0)" << std::endl;
+               #endif
+            }
+
+            watchService = std::make_unique<norm::WatchFolderService> (folder, options);
+            watchService->start();
+            return;
+        }
 
         mainWindow.reset (new MainWindow (getApplicationName()));
     }
@@ -20,6 +118,13 @@ public:
     void shutdown() override
     {
         mainWindow = nullptr;
+        workerProcess = nullptr;
+        watchService = nullptr;
+        analysisService = nullptr;
+
+        // The workers are gone, nothing records any more
+        if (traceFile != juce::File())
+            norm::Tracer::getInstance().writeChromeTrace (traceFile);
     }
 
     void systemRequestedQuit() override
@@ -65,7 +170,85 @@ public:
     };
 
 private:
+    // ArgumentList only gives a long option a value in the --option=<path>
+    // form, for --option <path> take the next raw argument. Empty if there
+    // is neither.
+    static juce::File getFileAfterOption (const juce::ArgumentList& arguments, const juce::String& option)
+    {
+        if (arguments.getValueForOption (option).isNotEmpty())
+            return arguments.getFileForOption (option);
+
+        const int index = arguments.indexOfOption (option);
+        if (index >= 0 && index + 1 < arguments.size() && ! arguments[index + 1].isOption())
+            return arguments[index + 1].resolveAsFile();
+
+        return {};
+    }
+
+    // Prints the loudness of what --analyse names
+    static bool analyse (const juce::ArgumentList& arguments)
+    {
+        // "-" looks like an option to ArgumentList, take the raw argument
+        const int index = arguments.indexOfOption ("--analyse");
+        juce::String source = arguments.getValueForOption ("--analyse");
+        if (source.isEmpty() && index + 1 < arguments.size())
+            source = arguments[index + 1].text;
+
+        norm::AnalysisEngine engine;
+        norm::AnalysisEngine::Result result;
+
+        if (source == "-")
+        {
+            norm::StandardInputStream input;
+            std::unique_ptr<norm::PcmStreamReader> reader;
+
+            if (arguments.containsOption ("--rate"))
+            {
+                norm::PcmStreamReader::Format format;
+                format.sampleRate = arguments.getValueForOption ("--rate").getDoubleValue();
+                format.numberOfChannels = arguments.containsOption ("--channels")
+                                        ? arguments.getValueForOption ("--channels").getIntValue()
+                                        : 2;
+                const auto sampleFormat = norm::PcmStreamReader::parseSampleFormat (
+                    arguments.containsOption ("--format") ? arguments.getValueForOption ("--format")
+                                                          : juce::String ("s16le"));
+                if (!sampleFormat.has_value())
+                {
+                    std::cerr << "Unknown sample format" << std::endl;
+                    return false;
+                }
+                format.sampleFormat = *sampleFormat;
+                reader = std::make_unique<norm::PcmStreamReader> (input, format);
+            }
+            else
+            {
+                reader = norm::PcmStreamReader::createForWav (input);
+            }
+
+            if (reader != nullptr)
+                result = engine.analyseStream (*reader);
+        }
+        else
+        {
+            result = engine.analyse (juce::File::getCurrentWorkingDirectory().getChildFile (source));
+        }
+
+        if (!result.ok)
+        {
+            std::cerr << "Unable to analyse " << source << std::endl;
+            return false;
+        }
+
+        std::cout << "Integrated loudness: " << juce::String (result.integratedLoudness, 2) << " LUFS" << std::endl
+                  << "Sample peak: " << juce::String (juce::Decibels::gainToDecibels (result.samplePeak), 2) << " dBFS" << std::endl;
+        return true;
+    }
+
     std::unique_ptr<MainWindow> mainWindow;
+    std::unique_ptr<norm::WorkerProcess> workerProcess;
+    std::unique_ptr<norm::WatchFolderService> watchService;
+    std::unique_ptr<norm::AnalysisService> analysisService;
+    juce::File traceFile;
 };
 
 START_JUCE_APPLICATION (NormalizeApplication)
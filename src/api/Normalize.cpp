@@ -0,0 +1,325 @@
+#include "Normalize.h"
+#include <processor/FilterProcessor.h>
+#include <processor/LKFSProcessor.h>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace norm
+{
+    namespace
+    {
+        constexpr double minimumSampleRate = 8000.0;
+        constexpr double maximumSampleRate = 768000.0;
+        constexpr int maximumChannels = 64;
+        // Frames converted at a time for anything but planar float
+        constexpr size_t scratchFrames = 1024;
+
+        template <typename Sample>
+        float toFloat(Sample sample)
+        {
+            if constexpr (std::is_same_v<Sample, float>)        return sample;
+            else if constexpr (std::is_same_v<Sample, int16_t>) return (float)sample * (1.f / 32768.f);
+            else                                                return (float)sample * (1.f / 2147483648.f);
+        }
+    }
+
+    // K-weights the caller's samples itself and hands LKFS the energy of each
+    // 100ms block, as LaneAnalyser does, so a block may end anywhere in a
+    // buffer and no buffer has to be copied into an AudioBuffer first. The
+    // filter keeps its memory between calls, the energy of a block is the
+    // sum over the pieces it came in.
+    class EmbeddedAnalyser
+    {
+    public:
+        EmbeddedAnalyser(double sampleRate, int numberOfChannels)
+            : mSampleRate(sampleRate)
+            , mNumberOfChannels(numberOfChannels)
+            , mSamplesPerBlock((int)(sampleRate / 10.0))
+            , mScratch(scratchFrames * (size_t)numberOfChannels)
+        {
+            for (int ch = 0; ch < numberOfChannels; ch++)
+            {
+                mScratchChannels.push_back(mScratch.data() + (size_t)ch * scratchFrames);
+            }
+            mLKFS.setShortTermEnabled(true);
+            reset();
+        }
+
+        void reset()
+        {
+            mLKFS.reset(mSampleRate, mNumberOfChannels);
+
+            const auto& layout = mLKFS.getChannelLayout();
+            mChannels.clear();
+            mWeights.clear();
+            for (int ch = 0; ch < mNumberOfChannels; ch++)
+            {
+                const float weight = LKFS::getChannelWeight(layout.getTypeOfChannel(ch));
+                if (weight > 0.f)
+                {
+                    mChannels.push_back(ch);
+                    mWeights.push_back(weight);
+                }
+            }
+            mChannelData.assign(mChannels.size(), nullptr);
+            mFilterBank.reset(mSampleRate, (int)mChannels.size());
+
+            mPosition = 0;
+            mBlockEnergy = 0.f;
+            mBlockPeak = 0.f;
+        }
+
+        template <typename Sample>
+        void pushPlanar(const Sample* const* channels, size_t frames)
+        {
+            if constexpr (std::is_same_v<Sample, float>)
+            {
+                filter(channels, frames);
+            }
+            else
+            {
+                for (size_t done = 0; done < frames; done += scratchFrames)
+                {
+                    const size_t n = std::min(frames - done, scratchFrames);
+                    for (size_t ch = 0; ch < mScratchChannels.size(); ch++)
+                    {
+                        const Sample* source = channels[ch] + done;
+                        float* dest = mScratchChannels[ch];
+                        for (size_t s = 0; s < n; s++) dest[s] = toFloat(source[s]);
+                    }
+                    filter(mScratchChannels.data(), n);
+                }
+            }
+        }
+
+        template <typename Sample>
+        void pushInterleaved(const Sample* samples, size_t frames)
+        {
+            const auto numberOfChannels = (size_t)mNumberOfChannels;
+            for (size_t done = 0; done < frames; done += scratchFrames)
+            {
+                const size_t n = std::min(frames - done, scratchFrames);
+                const Sample* source = samples + done * numberOfChannels;
+                for (size_t ch = 0; ch < numberOfChannels; ch++)
+                {
+                    float* dest = mScratchChannels[ch];
+                    for (size_t s = 0; s < n; s++) dest[s] = toFloat(source[s * numberOfChannels + ch]);
+                }
+                filter(mScratchChannels.data(), n);
+            }
+        }
+
+        const LKFS& getLKFS() const { return mLKFS; }
+        // Counts the block still being filled too
+        float getSamplePeak() const { return juce::jmax(mLKFS.getSamplePeak(), mBlockPeak); }
+
+    private:
+        void filter(const float* const* channels, size_t frames)
+        {
+            size_t done = 0;
+            while (done < frames)
+            {
+                const int n = (int)std::min(frames - done, (size_t)(mSamplesPerBlock - mPosition));
+
+                for (size_t i = 0; i < mChannels.size(); i++)
+                {
+                    mChannelData[i] = channels[mChannels[i]] + done;
+                }
+                mBlockEnergy += mFilterBank.processEnergy(mChannelData.data(), mWeights.data(), n);
+
+                // The peak is over every channel, the LFE too
+                for (int ch = 0; ch < mNumberOfChannels; ch++)
+                {
+                    const auto range = juce::FloatVectorOperations::findMinAndMax(channels[ch] + done, n);
+                    mBlockPeak = juce::jmax(mBlockPeak, -range.getStart(), range.getEnd());
+                }
+
+                mPosition += n;
+                done += (size_t)n;
+
+                if (mPosition == mSamplesPerBlock)
+                {
+                    mLKFS.processNext100msEnergy(mBlockEnergy, mBlockPeak);
+                    mPosition = 0;
+                    mBlockEnergy = 0.f;
+                    mBlockPeak = 0.f;
+                }
+            }
+        }
+
+        const double mSampleRate;
+        const int mNumberOfChannels;
+        const int mSamplesPerBlock;
+
+        LKFS mLKFS;
+        KWFilterBank mFilterBank;
+        std::vector<int> mChannels;
+        std::vector<float> mWeights;
+        std::vector<const float*> mChannelData;
+
+        // The block being filled
+        int mPosition = 0;
+        float mBlockEnergy = 0.f;
+        float mBlockPeak = 0.f;
+
+        std::vector<float> mScratch;
+        std::vector<float*> mScratchChannels;
+    };
+}
+
+//==============================================================================
+
+struct norm_analyzer
+{
+    norm_analyzer(double sampleRate, int numberOfChannels)
+        : analyser(sampleRate, numberOfChannels)
+        , numberOfChannels(numberOfChannels)
+    {}
+
+    norm::EmbeddedAnalyser analyser;
+    const int numberOfChannels;
+};
+
+namespace
+{
+    template <typename Push>
+    int push(norm_sample_format format, Push&& pushSamples)
+    {
+        // Nothing thrown may leave through a C interface
+        try
+        {
+            switch (format)
+            {
+                case NORM_SAMPLE_FLOAT32: pushSamples(float{});   return NORM_OK;
+                case NORM_SAMPLE_INT16:   pushSamples(int16_t{}); return NORM_OK;
+                case NORM_SAMPLE_INT32:   pushSamples(int32_t{}); return NORM_OK;
+            }
+            return NORM_ERROR_INVALID_ARGUMENT;
+        }
+        catch (...)
+        {
+            return NORM_ERROR_INTERNAL;
+        }
+    }
+
+    template <typename Get>
+    int get(const norm_analyzer* analyzer, double* value, Get&& getValue)
+    {
+        if (analyzer == nullptr || value == nullptr) return NORM_ERROR_INVALID_ARGUMENT;
+
+        *value = (double)getValue(analyzer->analyser);
+        return NORM_OK;
+    }
+}
+
+extern "C"
+{
+
+int norm_get_api_version(void)
+{
+    return NORM_API_VERSION;
+}
+
+norm_analyzer* norm_analyzer_create(double sample_rate, int channels)
+{
+    if (!(sample_rate >= norm::minimumSampleRate && sample_rate <= norm::maximumSampleRate)
+        || channels < 1 || channels > norm::maximumChannels)
+    {
+        return nullptr;
+    }
+
+    try
+    {
+        return new norm_analyzer(sample_rate, channels);
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+void norm_analyzer_destroy(norm_analyzer* analyzer)
+{
+    delete analyzer;
+}
+
+int norm_analyzer_reset(norm_analyzer* analyzer)
+{
+    if (analyzer == nullptr) return NORM_ERROR_INVALID_ARGUMENT;
+
+    try
+    {
+        analyzer->analyser.reset();
+        return NORM_OK;
+    }
+    catch (...)
+    {
+        return NORM_ERROR_INTERNAL;
+    }
+}
+
+int norm_analyzer_push_planar(norm_analyzer* analyzer,
+                              const void* const* channels,
+                              norm_sample_format format,
+                              size_t frames)
+{
+    if (analyzer == nullptr) return NORM_ERROR_INVALID_ARGUMENT;
+    if (frames == 0) return NORM_OK;
+    if (channels == nullptr) return NORM_ERROR_INVALID_ARGUMENT;
+    for (int ch = 0; ch < analyzer->numberOfChannels; ch++)
+    {
+        if (channels[ch] == nullptr) return NORM_ERROR_INVALID_ARGUMENT;
+    }
+
+    return push(format, [&](auto sample)
+    {
+        using Sample = decltype(sample);
+        analyzer->analyser.pushPlanar(reinterpret_cast<const Sample* const*>(channels), frames);
+    });
+}
+
+int norm_analyzer_push_interleaved(norm_analyzer* analyzer,
+                                   const void* samples,
+                                   norm_sample_format format,
+                                   size_t frames)
+{
+    if (analyzer == nullptr) return NORM_ERROR_INVALID_ARGUMENT;
+    if (frames == 0) return NORM_OK;
+    if (samples == nullptr) return NORM_ERROR_INVALID_ARGUMENT;
+
+    return push(format, [&](auto sample)
+    {
+        using Sample = decltype(sample);
+        analyzer->analyser.pushInterleaved(static_cast<const Sample*>(samples), frames);
+    });
+}
+
+int norm_analyzer_get_momentary(const norm_analyzer* analyzer, double* lufs)
+{
+    return get(analyzer, lufs, [](const norm::EmbeddedAnalyser& a) { return a.getLKFS().getMomentaryLoudness(); });
+}
+
+int norm_analyzer_get_short_term(const norm_analyzer* analyzer, double* lufs)
+{
+    return get(analyzer, lufs, [](const norm::EmbeddedAnalyser& a) { return a.getLKFS().getShortTermLoudness(); });
+}
+
+int norm_analyzer_get_integrated(const norm_analyzer* analyzer, double* lufs)
+{
+    return get(analyzer, lufs, [](const norm::EmbeddedAnalyser& a) { return a.getLKFS().getIntegratedLoudnessSoFar(); });
+}
+
+int norm_analyzer_get_loudness_range(const norm_analyzer* analyzer, double* lu)
+{
+    return get(analyzer, lu, [](const norm::EmbeddedAnalyser& a) { return a.getLKFS().getLoudnessRange(); });
+}
+
+int norm_analyzer_get_sample_peak(const norm_analyzer* analyzer, double* peak)
+{
+    return get(analyzer, peak, [](const norm::EmbeddedAnalyser& a) { return a.getSamplePeak(); });
+}
+
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+/*  C interface to the loudness measurement, for programs that want to meter
+    audio they already hold in memory, in their own process: a playout
+    server, a render hook. Built as the NormalizeEngine shared library, which
+    only contains the measurement and juce_core / juce_audio_basics, nothing
+    of the application.
+
+    An analyzer measures one stream after the other: push its samples in
+    pieces of any size, query whenever, reset for the next stream. Planar
+    float samples are filtered where they are, nothing is copied; any other
+    layout or format is converted a few thousand samples at a time into a
+    small buffer of the analyzer's own. The analyzer never keeps a pointer it
+    was given once the call returns.
+
+    Loudness values are in LUFS, negative infinity until there has been
+    enough audio to measure; the loudness range is in LU. An analyzer is not
+    thread safe, but different analyzers can be used on different threads.
+
+    The channel layout is the default for the channel count, e.g. 5.1 for 6
+    channels, so an LFE channel in the usual place is left out and surround
+    channels are weighted as ITU-R BS.1770 says.
+
+    Plain C, stable ABI: only functions, opaque handles and ints cross it.
+*/
+
+#include <stddef.h>
+
+#if defined(NORM_API_STATIC)
+ #define NORM_API
+#elif defined(_WIN32)
+ #if defined(NORM_API_BUILD)
+  #define NORM_API __declspec(dllexport)
+ #else
+  #define NORM_API __declspec(dllimport)
+ #endif
+#else
+ #define NORM_API __attribute__((visibility("default")))
+#endif
+
+/* Raised whenever a function is added, never changes what is there */
+#define NORM_API_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct norm_analyzer norm_analyzer;
+
+typedef enum norm_sample_format
+{
+    /* -1 to 1 full scale */
+    NORM_SAMPLE_FLOAT32 = 0,
+    NORM_SAMPLE_INT16 = 1,
+    NORM_SAMPLE_INT32 = 2
+} norm_sample_format;
+
+typedef enum norm_status
+{
+    NORM_OK = 0,
+    NORM_ERROR_INVALID_ARGUMENT = -1,
+    NORM_ERROR_INTERNAL = -2
+} norm_status;
+
+/* NORM_API_VERSION of the library actually loaded */
+NORM_API int norm_get_api_version(void);
+
+/* Sample rate between 8000 and 768000 Hz, 1 to 64 channels. NULL if the
+   arguments are out of range. */
+NORM_API norm_analyzer* norm_analyzer_create(double sample_rate, int channels);
+/* NULL is fine */
+NORM_API void norm_analyzer_destroy(norm_analyzer* analyzer);
+/* Forgets everything measured, for the next stream of the same format */
+NORM_API int norm_analyzer_reset(norm_analyzer* analyzer);
+
+/* channels[c] points to frames samples of channel c */
+NORM_API int norm_analyzer_push_planar(norm_analyzer* analyzer,
+                                       const void* const* channels,
+                                       norm_sample_format format,
+                                       size_t frames);
+/* frames * channels samples, channel after channel in every frame */
+NORM_API int norm_analyzer_push_interleaved(norm_analyzer* analyzer,
+                                            const void* samples,
+                                            norm_sample_format format,
+                                            size_t frames);
+
+/* The last 400ms */
+NORM_API int norm_analyzer_get_momentary(const norm_analyzer* analyzer, double* lufs);
+/* The last 3s */
+NORM_API int norm_analyzer_get_short_term(const norm_analyzer* analyzer, double* lufs);
+/* Gated over everything since the reset */
+NORM_API int norm_analyzer_get_integrated(const norm_analyzer* analyzer, double* lufs);
+/* EBU Tech 3342, 0 until there have been 3s of audio */
+NORM_API int norm_analyzer_get_loudness_range(const norm_analyzer* analyzer, double* lu);
+/* Largest absolute sample value since the reset, 1 is full scale */
+NORM_API int norm_analyzer_get_sample_peak(const norm_analyzer* analyzer, double* peak);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,8 +1,263 @@
-/*  After selecting a starting folder, this should be a list of all files
-    that are to be normalized. The reason it gets its own class is that each
-    list element should have an option to exclude it (and possibly other
-    options), which is done simplest by deriving a class from juce::ListBox and
-    juce::ListBoxModel.
-*/
-
-#include "FileList.h"
\ No newline at end of file
+#include "FileList.h"
+#include <algorithm>
+#include <functional>
+
+namespace norm
+{
+    int FileListData::add(const juce::File& file)
+    {
+        const auto path = file.getFullPathName();
+        auto [it, isNew] = mIndex.try_emplace(path.toStdString(), (int)mPaths.size());
+        if (!isNew) return it->second;
+
+        mPaths.push_back(path);
+        mNames.push_back(file.getFileName());
+        mStates.push_back((juce::uint8)State::pending);
+        mLoudness.push_back(0);
+        mGain.push_back(0);
+        mExcluded.push_back(0);
+        mOrder.push_back(it->second);
+        return it->second;
+    }
+    int FileListData::apply(const Update& update)
+    {
+        const int index = add(update.file);
+        mStates[(size_t)index] = (juce::uint8)update.state;
+        mLoudness[(size_t)index] = update.loudness;
+        mGain[(size_t)index] = update.gain;
+        return index;
+    }
+    void FileListData::setExcluded(int row, bool shouldBeExcluded)
+    {
+        mExcluded[(size_t)mOrder[(size_t)row]] = shouldBeExcluded ? 1 : 0;
+    }
+
+    FileListData::Sorter FileListData::makeSorter(Column column, bool ascending) const
+    {
+        // Only the permutation moves, and every comparison reads a single
+        // column, which is what the struct of arrays is for
+        auto sortOn = [&](const auto& values, auto less) -> Sorter
+        {
+            return [order = mOrder, values, less, ascending]() mutable
+            {
+                std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+                {
+                    return ascending ? less(values[(size_t)a], values[(size_t)b])
+                                     : less(values[(size_t)b], values[(size_t)a]);
+                });
+                return std::move(order);
+            };
+        };
+
+        switch (column)
+        {
+            case Column::name:
+                return sortOn(mNames, [](const juce::String& a, const juce::String& b)
+                {
+                    return a.compareNatural(b) < 0;
+                });
+            case Column::state:
+                return sortOn(mStates, std::less<juce::uint8>());
+            case Column::loudness:
+                return sortOn(mLoudness, std::less<float>());
+            case Column::gain:
+                return sortOn(mGain, std::less<float>());
+        }
+        return [order = mOrder] { return order; };
+    }
+    void FileListData::setOrder(std::vector<int> order)
+    {
+        // Indices only ever grow, whatever came after the copy is new
+        for (int index = (int)order.size(); index < (int)mPaths.size(); index++)
+            order.push_back(index);
+        mOrder = std::move(order);
+    }
+    juce::Array<juce::File> FileListData::getIncludedFiles() const
+    {
+        juce::Array<juce::File> files;
+        for (int index : mOrder)
+        {
+            if (mExcluded[(size_t)index] == 0) files.add(juce::File(mPaths[(size_t)index]));
+        }
+        return files;
+    }
+
+    FileListData::State FileListData::toState(FileStatus status)
+    {
+        switch (status)
+        {
+            case FileStatus::analysed:    return State::analysed;
+            case FileStatus::written:     return State::written;
+            case FileStatus::verified:    return State::verified;
+            case FileStatus::failed:      return State::failed;
+            case FileStatus::quarantined: return State::quarantined;
+        }
+        return State::pending;
+    }
+    juce::String FileListData::toString(State state)
+    {
+        switch (state)
+        {
+            case State::pending:     return "pending";
+            case State::analysed:    return "analysed";
+            case State::written:     return "written";
+            case State::verified:    return "verified";
+            case State::failed:      return "failed";
+            case State::quarantined: return "quarantined";
+        }
+        return {};
+    }
+
+    //==========================================================================
+
+    FileList::FileList()
+        : juce::ListBox("FileList")
+    {
+        setModel(this);
+        setRowHeight(mRowHeight);
+        setMultipleSelectionEnabled(true);
+        startTimerHz(60);
+    }
+    FileList::~FileList()
+    {
+        stopTimer();
+        setModel(nullptr);
+    }
+
+    void FileList::post(FileListData::Update update)
+    {
+        // Once overflowing, stay there until drained, or a later state of a
+        // file could overtake an earlier one
+        if (!mHasOverflow && mUpdates.tryPush(std::move(update))) return;
+
+        std::lock_guard<std::mutex> lock(mOverflowMutex);
+        mOverflow.push_back(std::move(update));
+        mHasOverflow = true;
+    }
+    void FileList::sortBy(FileListData::Column column, bool ascending)
+    {
+        drainUpdates();
+
+        const int generation = ++mSortGeneration;
+        mSortPool.addJob([sorter = mData.makeSorter(column, ascending),
+                          list = juce::Component::SafePointer<FileList>(this),
+                          generation]
+        {
+            auto order = sorter();
+            juce::MessageManager::callAsync([list, generation, order = std::move(order)]() mutable
+            {
+                // Gone, or sorted differently since
+                if (list != nullptr && list->mSortGeneration == generation)
+                    list->applyOrder(std::move(order));
+            });
+        });
+    }
+    void FileList::applyOrder(std::vector<int> order)
+    {
+        mData.setOrder(std::move(order));
+        deselectAllRows();
+        updateContent();
+        repaint();
+    }
+
+    void FileList::timerCallback()
+    {
+        const int rowsBefore = mData.size();
+        if (!drainUpdates()) return;
+
+        // One repaint per frame, however many files changed in it
+        if (mData.size() != rowsBefore) updateContent();
+        repaint();
+    }
+    bool FileList::drainUpdates()
+    {
+        bool changed = false;
+
+        // Bounded, so a flood of updates cannot stall the message thread for
+        // more than a frame or so. The rest waits for the next one.
+        const size_t maxUpdates = mUpdates.getCapacity();
+        for (size_t i = 0; i < maxUpdates; i++)
+        {
+            auto update = mUpdates.tryPop();
+            if (!update.has_value())
+            {
+                // The queue is empty, overflow is next in line
+                if (mHasOverflow) changed |= drainOverflow();
+                break;
+            }
+
+            mData.apply(*update);
+            changed = true;
+        }
+
+        return changed;
+    }
+    bool FileList::drainOverflow()
+    {
+        std::vector<FileListData::Update> overflow;
+        {
+            std::lock_guard<std::mutex> lock(mOverflowMutex);
+            overflow.swap(mOverflow);
+            mHasOverflow = false;
+        }
+
+        for (const auto& update : overflow) mData.apply(update);
+        return !overflow.empty();
+    }
+
+    int FileList::getNumRows()
+    {
+        return mData.size();
+    }
+    void FileList::paintListBoxItem(int rowNumber,
+                                    juce::Graphics& g,
+                                    int width,
+                                    int height,
+                                    bool rowIsSelected)
+    {
+        if (!juce::isPositiveAndBelow(rowNumber, mData.size())) return;
+
+        const auto& lookAndFeel = getLookAndFeel();
+        if (rowIsSelected)
+        {
+            g.fillAll(lookAndFeel.findColour(juce::TextEditor::highlightColourId));
+        }
+
+        const bool excluded = mData.isExcluded(rowNumber);
+        auto textColour = lookAndFeel.findColour(juce::ListBox::textColourId);
+        if (excluded) textColour = textColour.withMultipliedAlpha(0.4f);
+        g.setColour(textColour);
+
+        juce::Rectangle<int> area(0, 0, width, height);
+
+        auto tick = area.removeFromLeft(mExcludeWidth).withSizeKeepingCentre(12, 12);
+        g.drawRect(tick);
+        if (!excluded) g.fillRect(tick.reduced(3));
+
+        const auto state = mData.getState(rowNumber);
+        auto gainArea = area.removeFromRight(mValueWidth);
+        auto loudnessArea = area.removeFromRight(mValueWidth);
+        auto stateArea = area.removeFromRight(mValueWidth + 20);
+
+        g.drawText(mData.getName(rowNumber), area.reduced(2, 0),
+                   juce::Justification::centredLeft, true);
+        g.drawText(FileListData::toString(state), stateArea,
+                   juce::Justification::centredLeft, true);
+
+        if (state != FileListData::State::pending && state != FileListData::State::failed)
+        {
+            g.drawText(juce::String(mData.getLoudness(rowNumber), 1) + " LUFS", loudnessArea,
+                       juce::Justification::centredRight, true);
+            g.drawText(juce::String(mData.getGain(rowNumber), 1) + " dB", gainArea,
+                       juce::Justification::centredRight, true);
+        }
+    }
+    void FileList::listBoxItemClicked(int row, const juce::MouseEvent& event)
+    {
+        if (!juce::isPositiveAndBelow(row, mData.size())) return;
+        if (event.x >= mExcludeWidth) return;
+
+        mData.setExcluded(row, !mData.isExcluded(row));
+        repaintRow(row);
+    }
+}
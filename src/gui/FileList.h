@@ -0,0 +1,143 @@
+#pragma once
+
+/*  The list of all files that are to be normalized. It gets its own class
+    because each list element has an option to exclude it, which is done
+    simplest by deriving a class from juce::ListBox and juce::ListBoxModel.
+
+    Batches can hold a few hundred thousand files, so the ListBox only ever
+    paints the rows on screen, and the data behind it is kept as one array per
+    column. Batch workers and scanners never touch either directly: they post
+    updates to a lock-free queue, which the message thread drains once per
+    frame, followed by at most one repaint. Sorting that many names would
+    drop frames as well, so it runs on a thread of its own and only the
+    sorted permutation is swapped in.
+*/
+
+#include "processor/BatchJournal.h"
+#include "util/MPSCQueue.h"
+#include <juce_gui_basics/juce_gui_basics.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace norm
+{
+
+// Struct of arrays, indexed by the order files were added. Display rows go
+// through a permutation, so sorting never moves the columns themselves.
+class FileListData
+{
+public:
+    enum class State : juce::uint8
+    {
+        pending, analysed, written, verified, failed, quarantined
+    };
+
+    enum class Column { name, state, loudness, gain };
+
+    struct Update
+    {
+        juce::File file;
+        State state = State::pending;
+        float loudness = 0;
+        float gain = 0;
+    };
+
+public:
+    // Adds the file if it is new. Returns its index.
+    int apply(const Update& update);
+    int add(const juce::File& file);
+
+    int size() const { return (int)mOrder.size(); }
+
+    // All of these take display rows
+    const juce::String& getPath(int row) const { return mPaths[(size_t)mOrder[(size_t)row]]; }
+    const juce::String& getName(int row) const { return mNames[(size_t)mOrder[(size_t)row]]; }
+    State getState(int row) const { return (State)mStates[(size_t)mOrder[(size_t)row]]; }
+    float getLoudness(int row) const { return mLoudness[(size_t)mOrder[(size_t)row]]; }
+    float getGain(int row) const { return mGain[(size_t)mOrder[(size_t)row]]; }
+    bool isExcluded(int row) const { return mExcluded[(size_t)mOrder[(size_t)row]] != 0; }
+    void setExcluded(int row, bool shouldBeExcluded);
+
+    // A sort of the rows as they are now, safe to run on any thread: it
+    // works on copies of the permutation and the column
+    using Sorter = std::function<std::vector<int>()>;
+    Sorter makeSorter(Column column, bool ascending) const;
+    // Takes what a sorter returned. Files added later go to the end until
+    // the next sort.
+    void setOrder(std::vector<int> order);
+    void sortBy(Column column, bool ascending) { setOrder(makeSorter(column, ascending)()); }
+    juce::Array<juce::File> getIncludedFiles() const;
+
+    static State toState(FileStatus status);
+    static juce::String toString(State state);
+
+private:
+    std::vector<juce::String> mPaths;
+    std::vector<juce::String> mNames;
+    std::vector<juce::uint8> mStates;
+    std::vector<float> mLoudness;
+    std::vector<float> mGain;
+    std::vector<juce::uint8> mExcluded;
+
+    // display row -> index
+    std::vector<int> mOrder;
+    // path -> index
+    std::unordered_map<std::string, int> mIndex;
+};
+
+class FileList final : public juce::ListBox,
+                       private juce::ListBoxModel,
+                       private juce::Timer
+{
+public:
+    FileList();
+    ~FileList() override;
+
+    // Thread safe and lock-free unless the queue overflows, for workers
+    void post(FileListData::Update update);
+    // Returns at once, the rows change once the sort is done
+    void sortBy(FileListData::Column column, bool ascending);
+
+    // Message thread only
+    const FileListData& getData() const { return mData; }
+
+    int getNumRows() override;
+    void paintListBoxItem(int rowNumber,
+                          juce::Graphics& g,
+                          int width,
+                          int height,
+                          bool rowIsSelected) override;
+    void listBoxItemClicked(int row, const juce::MouseEvent& event) override;
+
+private:
+    void timerCallback() override;
+    // Applies what was posted, up to a queue full. Returns whether anything
+    // changed.
+    bool drainUpdates();
+    bool drainOverflow();
+    void applyOrder(std::vector<int> order);
+
+    FileListData mData;
+
+    MPSCQueue<FileListData::Update> mUpdates { 1 << 16 };
+    // Rarely used: only if workers outrun the message thread by a whole queue
+    std::mutex mOverflowMutex;
+    std::vector<FileListData::Update> mOverflow;
+    std::atomic<bool> mHasOverflow { false };
+
+    juce::ThreadPool mSortPool { 1 };
+    // Only the latest sort is applied. Message thread only.
+    int mSortGeneration = 0;
+
+    static constexpr int mRowHeight = 20;
+    static constexpr int mExcludeWidth = 24;
+    static constexpr int mValueWidth = 70;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FileList)
+};
+
+} // namespace norm
@@ -0,0 +1,277 @@
+#include "AnalysisEngine.h"
+#include "util/Logger.h"
+#include <cmath>
+#include <limits>
+
+namespace norm
+{
+    AnalysisEngine::AnalysisEngine() {}
+    AnalysisEngine::~AnalysisEngine() {}
+
+    bool AnalysisEngine::prepare(const juce::File& file, bool keepAudioInMemory)
+    {
+        if (!mFileHandler.openFile(file, keepAudioInMemory)) return false;
+
+        const int numberOfChannels = (int)mFileHandler.getNumberOfChannels();
+        const int samplesPerBlock = mFileHandler.getSamplesPerBlock();
+
+        EXPECT_OR_RETURN (numberOfChannels > 0 && samplesPerBlock > 0,
+                          false,
+                          "File {} has no audio to analyse",
+                          file.getFullPathName().toStdString());
+
+        mLKFS.reset(mFileHandler.getSampleRate(),
+                    numberOfChannels,
+                    mFileHandler.getChannelLayout());
+        mBuffer.setSize(numberOfChannels, samplesPerBlock, false, false, true);
+        return true;
+    }
+
+    AnalysisEngine::Result AnalysisEngine::analyse(const juce::File& file,
+                                                   bool keepAudioInMemory)
+    {
+        Result result;
+
+        try
+        {
+            if (!prepare(file, keepAudioInMemory)) return result;
+
+            while (mFileHandler.readNextBlock(&mBuffer))
+            {
+                mLKFS.processNext100ms(mBuffer);
+                result.blocksRead++;
+            }
+
+            result.samplePeak = mLKFS.getSamplePeak();
+            result.integratedLoudness = mLKFS.getIntegratedLoudness();
+            result.histogram = mLKFS.getHistogram();
+            result.lengthInSamples = mFileHandler.getLengthInSamples();
+            result.ok = true;
+        }
+        catch (const std::exception&)
+        {
+            MY_LOG_WARNING("Analysis of {} failed",
+                           file.getFullPathName().toStdString());
+        }
+
+        return result;
+    }
+
+    AnalysisEngine::Result AnalysisEngine::preview(const juce::File& file,
+                                                   const PreviewOptions& options)
+    {
+        Result result;
+        result.isPreview = true;
+
+        try
+        {
+            if (!prepare(file, false)) return result;
+
+            const juce::int64 blocksInFile = mFileHandler.getNumberOfBlocks();
+            const int windowsPerProbe = juce::jmax(1, options.windowsPerProbe);
+            const int blocksPerProbe =
+                mWarmUpBlocks + mBlocksPerWindow - 1 + windowsPerProbe;
+            // Probes must not overlap, otherwise this is just a slow full read
+            const juce::int64 strideBlocks = juce::jmax(
+                (juce::int64)blocksPerProbe,
+                (juce::int64)std::llround(options.strideSeconds * 10.0));
+
+            // Too short to be worth skipping anything
+            if (blocksInFile < 2 * strideBlocks)
+            {
+                Result full = analyse(file);
+                full.isPreview = true;
+                return full;
+            }
+
+            for (juce::int64 start = 0;
+                 start + blocksPerProbe <= blocksInFile;
+                 start += strideBlocks)
+            {
+                mLKFS.markDiscontinuity(mWarmUpBlocks);
+                if (!mFileHandler.seekToBlock(start)) break;
+
+                for (int b = 0; b < blocksPerProbe; b++)
+                {
+                    if (!mFileHandler.readNextBlock(&mBuffer)) break;
+                    mLKFS.processNext100ms(mBuffer);
+                    result.blocksRead++;
+                }
+            }
+
+            result.samplePeak = mLKFS.getSamplePeak();
+            const auto gated = mLKFS.getGatedLoudness();
+            result.integratedLoudness = gated.integratedLoudness;
+            result.errorEstimate = estimateError(
+                gated, blocksInFile - mBlocksPerWindow + 1);
+            result.ok = true;
+        }
+        catch (const std::exception&)
+        {
+            MY_LOG_WARNING("Preview of {} failed",
+                           file.getFullPathName().toStdString());
+        }
+
+        return result;
+    }
+
+    AnalysisEngine::Result AnalysisEngine::analyseBlocks(const juce::File& file,
+                                                         juce::int64 firstBlock,
+                                                         juce::int64 numberOfBlocks)
+    {
+        Result result;
+
+        try
+        {
+            if (!prepare(file, false)) return result;
+
+            jassert(firstBlock == 0 || firstBlock >= mBlocksPerWindow - 1);
+
+            // The first window ending in the range starts 3 blocks before it,
+            // the filters settle before that
+            juce::int64 start = 0;
+            if (firstBlock > 0)
+            {
+                start = juce::jmax((juce::int64)0,
+                                   firstBlock - (mBlocksPerWindow - 1) - mRangeWarmUpBlocks);
+                mLKFS.markDiscontinuity((int)(firstBlock - (mBlocksPerWindow - 1) - start));
+                if (!mFileHandler.seekToBlock(start)) return result;
+            }
+
+            for (juce::int64 b = start; b < firstBlock + numberOfBlocks; b++)
+            {
+                if (!mFileHandler.readNextBlock(&mBuffer)) break;
+                mLKFS.processNext100ms(mBuffer);
+                result.blocksRead++;
+            }
+
+            // A range of silence is fine, it just adds nothing to the file
+            result.samplePeak = mLKFS.getSamplePeak();
+            result.histogram = mLKFS.getHistogram();
+            result.integratedLoudness = result.histogram.getIntegratedLoudness();
+            result.lengthInSamples = mFileHandler.getLengthInSamples();
+            result.ok = true;
+        }
+        catch (const std::exception&)
+        {
+            MY_LOG_WARNING("Analysis of blocks {} to {} of {} failed",
+                           firstBlock, firstBlock + numberOfBlocks,
+                           file.getFullPathName().toStdString());
+        }
+
+        return result;
+    }
+
+    AnalysisEngine::Result AnalysisEngine::analyseStream(PcmStreamReader& reader)
+    {
+        Result result;
+
+        const auto& format = reader.getFormat();
+        const int samplesPerBlock = (int)std::floor(format.sampleRate / 10.0);
+        EXPECT_OR_RETURN (reader.isValid() && samplesPerBlock > 0,
+                          result,
+                          "Stream of {} channels at {} Hz has no audio to analyse",
+                          format.numberOfChannels, format.sampleRate);
+
+        try
+        {
+            mLKFS.reset(format.sampleRate, format.numberOfChannels);
+            mBuffer.setSize(format.numberOfChannels, samplesPerBlock, false, false, true);
+
+            while (reader.read(mBuffer, samplesPerBlock) == samplesPerBlock)
+            {
+                mLKFS.processNext100ms(mBuffer);
+                result.blocksRead++;
+            }
+
+            result.samplePeak = mLKFS.getSamplePeak();
+            result.integratedLoudness = mLKFS.getIntegratedLoudness();
+            result.histogram = mLKFS.getHistogram();
+            result.lengthInSamples = reader.getSamplesRead();
+            result.ok = true;
+        }
+        catch (const std::exception&)
+        {
+            MY_LOG_WARNING("Analysis of the stream failed after {} samples",
+                           reader.getSamplesRead());
+        }
+
+        return result;
+    }
+
+    AnalysisEngine::Result AnalysisEngine::normalise(const juce::File& file,
+                                                     float targetLoudness)
+    {
+        Result result = analyse(file, true);
+        if (!result.ok) return result;
+
+        const auto record = GainModel::forTrack(result.integratedLoudness, targetLoudness);
+        result.appliedGain = record.appliedGain;
+        result.written = applyGainAndWrite(record);
+        result.limiterGainReductionDB =
+            mFileHandler.getWriteStage().getMaxGainReductionDB();
+        result.ok = result.written;
+        return result;
+    }
+    void AnalysisEngine::setLimiter(std::optional<TruePeakLimiter::Options> options)
+    {
+        mFileHandler.getWriteStage().setLimiter(options);
+    }
+    bool AnalysisEngine::applyGainAndWrite(const LoudnessRecord& record,
+                                           const juce::File& target)
+    {
+        mFileHandler.setLoudnessRecord(record);
+        return target == juce::File() ? mFileHandler.writeFile()
+                                      : mFileHandler.writeFile(target);
+    }
+    std::optional<LoudnessRecord> AnalysisEngine::readTaggedRecord(const juce::File& file)
+    {
+        if (!mFileHandler.openFile(file, false)) return std::nullopt;
+        return mFileHandler.getTaggedRecord();
+    }
+    bool AnalysisEngine::verify(const juce::File& file,
+                                juce::int64 expectedLengthInSamples)
+    {
+        if (!mFileHandler.openFile(file, false)) return false;
+
+        EXPECT_OR_RETURN (mFileHandler.getLengthInSamples() == expectedLengthInSamples,
+                          false,
+                          "{} has {} samples after writing, expected {}",
+                          file.getFullPathName().toStdString(),
+                          mFileHandler.getLengthInSamples(),
+                          expectedLengthInSamples);
+        return true;
+    }
+
+    float AnalysisEngine::estimateError(const LKFS::GatedLoudness& gated,
+                                        juce::int64 windowsInFile)
+    {
+        const double n = (double)gated.numberOfGatedBlocks;
+        if (n < 2 || gated.gatedEnergyMean <= 0)
+        {
+            return std::numeric_limits<float>::infinity();
+        }
+
+        // The probes are a sample of the file's gating blocks. Standard error
+        // of their mean energy, with the finite population correction, turned
+        // into dB around the estimate (d(10 log10 x) = 4.34 dx / x).
+        const double N = juce::jmax((double)windowsInFile, n);
+        const double populationCorrection = std::sqrt((N - n) / juce::jmax(1.0, N - 1.0));
+        const double standardError = std::sqrt(gated.gatedEnergyVariance * n / (n - 1.0) / n)
+                                   * populationCorrection;
+        const double relativeError = standardError / gated.gatedEnergyMean;
+
+        return (float)(1.96 * 10.0 / std::log(10.0) * relativeError);
+    }
+
+    bool AnalysisEngine::needsFullAnalysis(const Result& preview,
+                                           float targetLoudness,
+                                           float toleranceDB)
+    {
+        if (!preview.ok) return true;
+        if (!preview.isPreview) return false;
+
+        const float distance = std::fabs(preview.integratedLoudness - targetLoudness);
+        return distance <= toleranceDB + preview.errorEstimate;
+    }
+}
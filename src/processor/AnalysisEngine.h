@@ -0,0 +1,113 @@
+#pragma once
+
+/*  Drives one FileHandler and one LKFS over a file: the read - analyse loop
+    that every caller would otherwise have to write. Keeps both around between
+    files, so an instance per worker thread can be reused for a whole batch.
+
+    Besides the full analysis there is a preview mode for triage of large
+    libraries: it seeks through the file and only measures a probe every few
+    seconds, then reports the integrated loudness of those probes together
+    with an estimate of how far off it could be.
+
+    Streams, e.g. stdin, are analysed in a single forward pass through a
+    PcmStreamReader, never held in memory nor written to a file first.
+*/
+
+#include "FileHandler.h"
+#include "LKFSProcessor.h"
+#include "PcmStreamReader.h"
+#include <juce_core/juce_core.h>
+#include <juce_audio_basics/juce_audio_basics.h>
+
+namespace norm
+{
+
+class AnalysisEngine
+{
+public:
+    struct Result
+    {
+        bool ok = false;
+        float integratedLoudness = 0;
+        float samplePeak = 0;
+        // Half width of a ~95% confidence interval in dB. 0 for full analysis.
+        float errorEstimate = 0;
+        bool isPreview = false;
+        juce::int64 blocksRead = 0;
+        juce::int64 lengthInSamples = 0;
+        // Gating state of a full analysis, to merge with other files'
+        GatingHistogram histogram;
+        // Only set by normalise
+        float appliedGain = 0;
+        bool written = false;
+        // By the true-peak limiter, if there is one
+        float limiterGainReductionDB = 0;
+    };
+
+    struct PreviewOptions
+    {
+        // Distance between the starts of two probes
+        double strideSeconds = 10.0;
+        // Consecutive 400ms gating blocks measured per probe
+        int windowsPerProbe = 1;
+    };
+
+public:
+    AnalysisEngine();
+    ~AnalysisEngine();
+
+    // Keep the audio in memory to apply gain and write the file afterwards
+    Result analyse(const juce::File& file, bool keepAudioInMemory = false);
+    Result preview(const juce::File& file, const PreviewOptions& options);
+    // Full analysis of the 400ms windows that end in the given range of
+    // 100ms blocks, so several workers can share a long file. The histograms
+    // of consecutive ranges merge into the file's; the integrated loudness
+    // here is that of the range alone. firstBlock is 0 or at least 3, the
+    // blocks before it are read again for the first window and to settle
+    // the filters.
+    Result analyseBlocks(const juce::File& file,
+                         juce::int64 firstBlock,
+                         juce::int64 numberOfBlocks);
+    // Full analysis of everything the reader delivers until its stream ends.
+    // A last block shorter than 100ms is left out, as it is for files.
+    Result analyseStream(PcmStreamReader& reader);
+    // Full analysis, then gain to reach the target and write the file back
+    Result normalise(const juce::File& file, float targetLoudness);
+    // Second half of normalise, for the file last analysed with
+    // keepAudioInMemory. Returns whether the file was written. Without a
+    // target the file is replaced.
+    bool applyGainAndWrite(const LoudnessRecord& record, const juce::File& target = {});
+    // What an earlier run recorded in the file's tags, without decoding it
+    std::optional<LoudnessRecord> readTaggedRecord(const juce::File& file);
+    // Reads back the header of a written file: it must open as audio and
+    // have the same length as before
+    bool verify(const juce::File& file, juce::int64 expectedLengthInSamples);
+
+    // Whether a preview is too close to the target to trust, i.e. the file
+    // should get a full analysis before deciding on a gain
+    static bool needsFullAnalysis(const Result& preview,
+                                  float targetLoudness,
+                                  float toleranceDB);
+
+    // Limits the true peak of everything normalise writes, nothing disables it
+    void setLimiter(std::optional<TruePeakLimiter::Options> options);
+
+    FileHandler& getFileHandler() { return mFileHandler; }
+
+private:
+    bool prepare(const juce::File& file, bool keepAudioInMemory);
+    static float estimateError(const LKFS::GatedLoudness& gated,
+                               juce::int64 windowsInFile);
+
+    FileHandler mFileHandler;
+    LKFS mLKFS;
+    juce::AudioBuffer<float> mBuffer;
+
+    // The filters need a block to settle after every seek
+    static constexpr int mWarmUpBlocks = 1;
+    // Enough for a range to match the same blocks of a full analysis
+    static constexpr int mRangeWarmUpBlocks = 10;
+    static constexpr int mBlocksPerWindow = 4;
+};
+
+} // namespace norm
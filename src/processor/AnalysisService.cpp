@@ -0,0 +1,600 @@
+#include "AnalysisService.h"
+#include "util/Logger.h"
+#include <cstring>
+#include <map>
+
+#if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+ #define NORM_HAS_UNIX_SOCKETS 1
+ #include <cerrno>
+ #include <poll.h>
+ #include <sys/socket.h>
+ #include <sys/time.h>
+ #include <sys/un.h>
+ #include <unistd.h>
+#else
+ #define NORM_HAS_UNIX_SOCKETS 0
+#endif
+
+namespace norm
+{
+    namespace
+    {
+        // Larger messages are taken for garbage and end the connection
+        constexpr juce::uint32 maxMessageSize = 64 * 1024 * 1024;
+
+       #if NORM_HAS_UNIX_SOCKETS
+        bool sendAll(int fd, const void* data, size_t size)
+        {
+           #ifdef MSG_NOSIGNAL
+            constexpr int flags = MSG_NOSIGNAL;
+           #else
+            constexpr int flags = 0;
+           #endif
+
+            const char* bytes = static_cast<const char*>(data);
+            while (size > 0)
+            {
+                const ssize_t sent = ::send(fd, bytes, size, flags);
+                if (sent < 0 && errno == EINTR) continue;
+                if (sent <= 0) return false;
+                bytes += sent;
+                size -= (size_t)sent;
+            }
+            return true;
+        }
+        bool receiveAll(int fd, void* data, size_t size)
+        {
+            char* bytes = static_cast<char*>(data);
+            while (size > 0)
+            {
+                const ssize_t received = ::recv(fd, bytes, size, 0);
+                if (received < 0 && errno == EINTR) continue;
+                if (received <= 0) return false;
+                bytes += received;
+                size -= (size_t)received;
+            }
+            return true;
+        }
+
+        bool writeMessage(int fd, const juce::MemoryBlock& message)
+        {
+            // One send for the length and the body, messages are small
+            juce::MemoryOutputStream frame((size_t)message.getSize() + 4);
+            frame.writeInt((int)message.getSize());
+            frame << message;
+            return sendAll(fd, frame.getData(), frame.getDataSize());
+        }
+        bool readMessage(int fd, juce::MemoryBlock& message)
+        {
+            char header[4];
+            if (!receiveAll(fd, header, 4)) return false;
+
+            const juce::uint32 size = juce::ByteOrder::littleEndianInt(header);
+            EXPECT_OR_RETURN (size <= maxMessageSize,
+                              false,
+                              "Message of {} bytes refused", size);
+
+            message.setSize(size);
+            return size == 0 || receiveAll(fd, message.getData(), size);
+        }
+
+        bool makeAddress(const juce::File& socketFile, sockaddr_un& address)
+        {
+            const auto path = socketFile.getFullPathName().toStdString();
+            EXPECT_OR_RETURN (path.size() < sizeof(address.sun_path),
+                              false,
+                              "Socket path {} is too long", path);
+
+            std::memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+            return true;
+        }
+       #endif
+    }
+
+    namespace service
+    {
+        juce::MemoryBlock encode(const std::vector<Request>& requests)
+        {
+            juce::MemoryOutputStream stream;
+            stream.writeInt((int)requests.size());
+            for (const auto& request : requests)
+            {
+                stream.writeInt64(request.id);
+                stream.writeInt((int)request.kind);
+                stream.writeString(request.file.getFullPathName());
+                stream.writeFloat(request.targetLoudness);
+                stream.writeDouble(request.format.sampleRate);
+                stream.writeInt(request.format.numberOfChannels);
+                stream.writeInt((int)request.format.sampleFormat);
+                stream.writeInt64(request.offset);
+                stream.writeInt64(request.size);
+            }
+            return stream.getMemoryBlock();
+        }
+        std::optional<std::vector<Request>> decodeRequests(const juce::MemoryBlock& message)
+        {
+            juce::MemoryInputStream stream(message, false);
+
+            const int count = stream.readInt();
+            // Every request takes more than 40 bytes
+            if (count < 0 || (size_t)count > message.getSize() / 40) return std::nullopt;
+
+            // A message cut short reads as zeros, not as an error
+            constexpr juce::int64 headSize = 12;
+            constexpr juce::int64 tailSize = 36;
+
+            std::vector<Request> requests((size_t)count);
+            for (auto& request : requests)
+            {
+                if (stream.getNumBytesRemaining() < headSize) return std::nullopt;
+                request.id = stream.readInt64();
+                const int kind = stream.readInt();
+                if (kind < (int)Kind::analyse || kind > (int)Kind::analyseSamples) return std::nullopt;
+                request.kind = (Kind)kind;
+
+                const auto path = stream.readString();
+                if (!juce::File::isAbsolutePath(path)) return std::nullopt;
+                request.file = juce::File(path);
+
+                if (stream.getNumBytesRemaining() < tailSize) return std::nullopt;
+                request.targetLoudness = stream.readFloat();
+                request.format.sampleRate = stream.readDouble();
+                request.format.numberOfChannels = stream.readInt();
+                const int sampleFormat = stream.readInt();
+                if (sampleFormat < (int)PcmStreamReader::SampleFormat::uint8
+                    || sampleFormat > (int)PcmStreamReader::SampleFormat::float32)
+                {
+                    return std::nullopt;
+                }
+                request.format.sampleFormat = (PcmStreamReader::SampleFormat)sampleFormat;
+                request.offset = stream.readInt64();
+                request.size = stream.readInt64();
+            }
+            return requests;
+        }
+        juce::MemoryBlock encode(const Response& response)
+        {
+            juce::MemoryOutputStream stream;
+            stream.writeInt64(response.id);
+            stream.writeBool(response.ok);
+            stream.writeInt((int)response.status);
+            stream.writeFloat(response.loudness);
+            stream.writeFloat(response.samplePeak);
+            stream.writeFloat(response.gain);
+            return stream.getMemoryBlock();
+        }
+        std::optional<Response> decodeResponse(const juce::MemoryBlock& message)
+        {
+            if (message.getSize() != 25) return std::nullopt;
+            juce::MemoryInputStream stream(message, false);
+
+            Response response;
+            response.id = stream.readInt64();
+            response.ok = stream.readBool();
+            response.status = (FileStatus)stream.readInt();
+            response.loudness = stream.readFloat();
+            response.samplePeak = stream.readFloat();
+            response.gain = stream.readFloat();
+            return response;
+        }
+    }
+
+    //==========================================================================
+
+    bool AnalysisService::isAvailable()
+    {
+        return NORM_HAS_UNIX_SOCKETS != 0;
+    }
+
+    AnalysisService::AnalysisService(Options options)
+        : mOptions(std::move(options))
+    {
+    }
+    AnalysisService::~AnalysisService()
+    {
+        stop();
+    }
+
+    bool AnalysisService::start(const juce::File& socketFile)
+    {
+       #if NORM_HAS_UNIX_SOCKETS
+        if (mListener.joinable()) return true;
+
+        sockaddr_un address;
+        if (!makeAddress(socketFile, address)) return false;
+
+        mListenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        EXPECT_OR_RETURN (mListenFd >= 0, false, "Unable to create a socket: {}", std::strerror(errno));
+
+        // A socket file left behind by an earlier run would fail the bind
+        ::unlink(address.sun_path);
+        if (::bind(mListenFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+            || ::listen(mListenFd, SOMAXCONN) != 0
+            || ::pipe(mWakeUpFds) != 0)
+        {
+            MY_LOG_WARNING("Unable to listen on {}: {}",
+                           socketFile.getFullPathName().toStdString(), std::strerror(errno));
+            ::close(mListenFd);
+            mListenFd = -1;
+            return false;
+        }
+        mSocketFile = socketFile;
+
+        {
+            std::lock_guard<std::mutex> lock(mJobMutex);
+            mShouldExit = false;
+        }
+        for (int w = 0; w < juce::jmax(1, mOptions.numberOfWorkers); w++)
+            mWorkers.emplace_back([this] { runWorker(); });
+        mListener = std::thread([this] { runListener(); });
+
+        MY_LOG_INFO("Serving analysis on {}", socketFile.getFullPathName().toStdString());
+        return true;
+       #else
+        juce::ignoreUnused(socketFile);
+        MY_LOG_WARNING("Unix domain sockets are not available on this platform");
+        return false;
+       #endif
+    }
+
+    void AnalysisService::stop()
+    {
+       #if NORM_HAS_UNIX_SOCKETS
+        if (!mListener.joinable()) return;
+
+        const char wakeUp = 0;
+        juce::ignoreUnused(::write(mWakeUpFds[1], &wakeUp, 1));
+        mListener.join();
+
+        {
+            std::lock_guard<std::mutex> lock(mJobMutex);
+            mShouldExit = true;
+            mJobs.clear();
+        }
+        mJobCondition.notify_all();
+        mDrainCondition.notify_all();
+
+        // Unblocks the connections' reads, and workers writing to a client
+        // that stopped reading
+        {
+            std::lock_guard<std::mutex> lock(mConnectionMutex);
+            for (auto& connection : mConnections) ::shutdown(connection->fd, SHUT_RDWR);
+        }
+        for (auto& worker : mWorkers) worker.join();
+        mWorkers.clear();
+        for (auto& connection : mConnections)
+        {
+            if (connection->thread.joinable()) connection->thread.join();
+        }
+        mConnections.clear();
+
+        ::close(mListenFd);
+        ::close(mWakeUpFds[0]);
+        ::close(mWakeUpFds[1]);
+        mListenFd = mWakeUpFds[0] = mWakeUpFds[1] = -1;
+        mSocketFile.deleteFile();
+       #endif
+    }
+
+    AnalysisService::Connection::~Connection()
+    {
+       #if NORM_HAS_UNIX_SOCKETS
+        if (fd >= 0) ::close(fd);
+       #endif
+    }
+
+    void AnalysisService::runListener()
+    {
+       #if NORM_HAS_UNIX_SOCKETS
+        for (;;)
+        {
+            pollfd fds[2] = { { mListenFd, POLLIN, 0 }, { mWakeUpFds[0], POLLIN, 0 } };
+            if (::poll(fds, 2, -1) < 0)
+            {
+                if (errno == EINTR) continue;
+                MY_LOG_ERROR("Waiting for connections failed: {}", std::strerror(errno));
+                return;
+            }
+            if (fds[1].revents != 0) return;
+            if ((fds[0].revents & POLLIN) == 0) continue;
+
+            const int fd = ::accept(mListenFd, nullptr, nullptr);
+            if (fd < 0) continue;
+
+           #if defined(SO_NOSIGPIPE)
+            const int on = 1;
+            ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+           #endif
+
+            // A worker must not wait forever for a client to read
+            const timeval timeout { mOptions.sendTimeoutMs / 1000, (mOptions.sendTimeoutMs % 1000) * 1000 };
+            ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            pruneConnections();
+
+            auto connection = std::make_shared<Connection>();
+            connection->fd = fd;
+            std::lock_guard<std::mutex> lock(mConnectionMutex);
+            connection->thread = std::thread([this, connection] { runConnection(connection); });
+            mConnections.push_back(std::move(connection));
+        }
+       #endif
+    }
+
+    void AnalysisService::pruneConnections()
+    {
+       #if NORM_HAS_UNIX_SOCKETS
+        std::lock_guard<std::mutex> lock(mConnectionMutex);
+        for (auto it = mConnections.begin(); it != mConnections.end();)
+        {
+            auto& connection = *it;
+            if (!connection->finished)
+            {
+                ++it;
+                continue;
+            }
+
+            connection->thread.join();
+            it = mConnections.erase(it);
+        }
+       #endif
+    }
+
+    void AnalysisService::runConnection(std::shared_ptr<Connection> connection)
+    {
+       #if NORM_HAS_UNIX_SOCKETS
+        const int maxOutstanding = juce::jmax(1, mOptions.maxOutstandingRequests);
+
+        juce::MemoryBlock message;
+        for (;;)
+        {
+            // Nothing more is read until the client has taken its responses
+            {
+                std::unique_lock<std::mutex> lock(mJobMutex);
+                mDrainCondition.wait(lock, [&]
+                {
+                    return mShouldExit || connection->broken || connection->outstanding < maxOutstanding;
+                });
+                if (mShouldExit || connection->broken) break;
+            }
+
+            if (!readMessage(connection->fd, message)) break;
+
+            auto requests = service::decodeRequests(message);
+            if (!requests.has_value() || requests->size() > (size_t)service::maxRequestsPerBatch)
+            {
+                MY_LOG_WARNING("Malformed request, closing the connection");
+                break;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mJobMutex);
+                if (mShouldExit) break;
+                for (auto& request : *requests)
+                    mJobs.push_back({ connection, std::move(request) });
+                connection->outstanding += (int)requests->size();
+            }
+            mJobCondition.notify_all();
+        }
+        connection->finished = true;
+       #else
+        juce::ignoreUnused(connection);
+       #endif
+    }
+
+    void AnalysisService::runWorker()
+    {
+        AnalysisEngine engine;
+        engine.setLimiter(mOptions.batchOptions.limiter);
+        engine.getFileHandler().setSignalResidualGain(mOptions.batchOptions.signalResidualGain);
+
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mJobMutex);
+                mJobCondition.wait(lock, [this] { return mShouldExit || !mJobs.empty(); });
+                if (mShouldExit) return;
+
+                job = std::move(mJobs.front());
+                mJobs.pop_front();
+            }
+
+            auto& connection = *job.connection;
+            if (!connection.broken)
+            {
+                const auto response = process(engine, job.request);
+
+               #if NORM_HAS_UNIX_SOCKETS
+                bool sent = false;
+                {
+                    std::lock_guard<std::mutex> lock(connection.writeMutex);
+                    sent = !connection.broken && writeMessage(connection.fd, service::encode(response));
+                }
+
+                // Gone, or not reading: the connection's thread wakes up
+                // from its read and ends it
+                if (!sent && !connection.broken.exchange(true))
+                {
+                    MY_LOG_WARNING("A client did not take its response, dropping the connection");
+                    ::shutdown(connection.fd, SHUT_RDWR);
+                }
+               #else
+                juce::ignoreUnused(response);
+               #endif
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mJobMutex);
+                connection.outstanding--;
+            }
+            mDrainCondition.notify_all();
+        }
+    }
+
+    service::Response AnalysisService::process(AnalysisEngine& engine, const service::Request& request)
+    {
+        service::Response response;
+        response.id = request.id;
+
+        switch (request.kind)
+        {
+            case service::Kind::analyse:
+            {
+                const auto result = engine.analyse(request.file);
+                response.ok = result.ok;
+                response.status = result.ok ? FileStatus::analysed : FileStatus::failed;
+                response.loudness = result.integratedLoudness;
+                response.samplePeak = result.samplePeak;
+                break;
+            }
+            case service::Kind::normalise:
+            {
+                auto options = mOptions.batchOptions;
+                options.mode = BatchEngine::Mode::normalise;
+                options.targetLoudness = request.targetLoudness;
+                options.gainMode = BatchEngine::GainMode::track;
+
+                const auto result = BatchEngine::processFile(engine, request.file, options,
+                                                             std::nullopt, std::nullopt, {});
+                response.ok = result.status != FileStatus::failed
+                           && result.status != FileStatus::quarantined;
+                response.status = result.status;
+                response.loudness = result.loudness;
+                response.gain = result.gain;
+                break;
+            }
+            case service::Kind::analyseSamples:
+            {
+                // Mapped, not read: the samples stay where the client put them
+                const juce::Range<juce::int64> range(request.offset, request.offset + request.size);
+                juce::MemoryMappedFile mapped(request.file, range, juce::MemoryMappedFile::readOnly);
+                // The mapping starts on a page boundary at or before offset
+                EXPECT_OR_RETURN (request.offset >= 0 && request.size > 0
+                                  && mapped.getData() != nullptr
+                                  && mapped.getRange().getStart() <= range.getStart()
+                                  && mapped.getRange().getEnd() >= range.getEnd(),
+                                  response,
+                                  "Unable to map {} bytes of {}",
+                                  request.size, request.file.getFullPathName().toStdString());
+
+                const char* samples = static_cast<const char*>(mapped.getData())
+                                    + (range.getStart() - mapped.getRange().getStart());
+                juce::MemoryInputStream stream(samples, (size_t)request.size, false);
+                PcmStreamReader reader(stream, request.format, request.size);
+                const auto result = engine.analyseStream(reader);
+                response.ok = result.ok;
+                response.status = result.ok ? FileStatus::analysed : FileStatus::failed;
+                response.loudness = result.integratedLoudness;
+                response.samplePeak = result.samplePeak;
+                break;
+            }
+        }
+
+        return response;
+    }
+
+    //==========================================================================
+
+    AnalysisClient::AnalysisClient() {}
+    AnalysisClient::~AnalysisClient()
+    {
+        disconnect();
+    }
+
+    bool AnalysisClient::connect(const juce::File& socketFile)
+    {
+        disconnect();
+
+       #if NORM_HAS_UNIX_SOCKETS
+        sockaddr_un address;
+        if (!makeAddress(socketFile, address)) return false;
+
+        mFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        EXPECT_OR_RETURN (mFd >= 0, false, "Unable to create a socket: {}", std::strerror(errno));
+
+        if (::connect(mFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            MY_LOG_WARNING("Unable to connect to {}: {}",
+                           socketFile.getFullPathName().toStdString(), std::strerror(errno));
+            disconnect();
+            return false;
+        }
+
+       #if defined(SO_NOSIGPIPE)
+        const int on = 1;
+        ::setsockopt(mFd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+       #endif
+        return true;
+       #else
+        juce::ignoreUnused(socketFile);
+        return false;
+       #endif
+    }
+    void AnalysisClient::disconnect()
+    {
+       #if NORM_HAS_UNIX_SOCKETS
+        if (mFd >= 0) ::close(mFd);
+       #endif
+        mFd = -1;
+    }
+
+    std::optional<std::vector<service::Response>> AnalysisClient::submit(std::vector<service::Request> requests)
+    {
+       #if NORM_HAS_UNIX_SOCKETS
+        if (mFd < 0) return std::nullopt;
+
+        std::vector<service::Response> responses(requests.size());
+        for (size_t start = 0; start < requests.size(); start += service::maxRequestsPerBatch)
+        {
+            const size_t end = juce::jmin(requests.size(), start + (size_t)service::maxRequestsPerBatch);
+            if (!submitBatch(requests, start, end, responses))
+            {
+                disconnect();
+                return std::nullopt;
+            }
+        }
+        return responses;
+       #else
+        juce::ignoreUnused(requests);
+        return std::nullopt;
+       #endif
+    }
+    bool AnalysisClient::submitBatch(std::vector<service::Request>& requests, size_t start, size_t end,
+                                     std::vector<service::Response>& responses)
+    {
+       #if NORM_HAS_UNIX_SOCKETS
+        std::map<juce::int64, size_t> indices;
+        for (size_t i = start; i < end; i++)
+        {
+            requests[i].id = mNextId++;
+            indices[requests[i].id] = i;
+        }
+
+        const std::vector<service::Request> batch(requests.begin() + (std::ptrdiff_t)start,
+                                                  requests.begin() + (std::ptrdiff_t)end);
+        if (!writeMessage(mFd, service::encode(batch))) return false;
+
+        juce::MemoryBlock message;
+        while (!indices.empty())
+        {
+            if (!readMessage(mFd, message)) return false;
+
+            const auto response = service::decodeResponse(message);
+            if (!response.has_value()) continue;
+
+            const auto index = indices.find(response->id);
+            if (index == indices.end()) continue;
+
+            responses[index->second] = *response;
+            indices.erase(index);
+        }
+        return true;
+       #else
+        juce::ignoreUnused(requests, start, end, responses);
+        return false;
+       #endif
+    }
+}
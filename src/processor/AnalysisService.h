@@ -0,0 +1,190 @@
+#pragma once
+
+/*  A resident analyser for other tools on the same machine. Instead of
+    starting a process per file, paying for start-up, format registration
+    and threads every time, a client connects to a Unix domain socket and
+    sends requests; a pool of workers, each with an AnalysisEngine that stays
+    warm between requests, answers them.
+
+    Messages are a 4 byte little-endian length followed by a body written
+    with juce's stream functions, as the worker process pipe does. A request
+    message carries a batch of any number of requests. Every request gets a
+    response message of its own, as soon as its worker is done, so responses
+    come in the order they finish; the id ties them to their request.
+
+    A connection has a bounded number of requests in the queue: past that,
+    the service stops reading from it until responses have gone out, so a
+    client that sends faster than it reads is held up by its own socket.
+    A client that does not take its responses within the send timeout is
+    dropped.
+
+    Samples do not have to travel over the socket at all: a client writes
+    them to a file in shared memory (e.g. under /dev/shm) and names it in
+    the request, the worker maps it and reads the samples in place.
+
+    POSIX only, isAvailable() is false on Windows.
+*/
+
+#include "AnalysisEngine.h"
+#include "BatchEngine.h"
+#include "PcmStreamReader.h"
+#include <juce_core/juce_core.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace norm
+{
+
+namespace service
+{
+    // Larger batches end the connection, AnalysisClient splits them
+    inline constexpr int maxRequestsPerBatch = 1024;
+
+    enum class Kind
+    {
+        // Loudness and peak of a file
+        analyse,
+        // The file gets the gain to the target, as a batch would give it
+        normalise,
+        // Loudness and peak of raw PCM in a shared memory file
+        analyseSamples
+    };
+
+    struct Request
+    {
+        juce::int64 id = 0;
+        Kind kind = Kind::analyse;
+        juce::File file;
+        // Normalise only
+        float targetLoudness = -23.f;
+        // analyseSamples only: the bytes from offset on, size long, are
+        // interleaved samples in this format
+        PcmStreamReader::Format format;
+        juce::int64 offset = 0;
+        juce::int64 size = 0;
+    };
+
+    struct Response
+    {
+        juce::int64 id = 0;
+        bool ok = false;
+        FileStatus status = FileStatus::failed;
+        float loudness = 0;
+        float samplePeak = 0;
+        float gain = 0;
+    };
+
+    juce::MemoryBlock encode(const std::vector<Request>& requests);
+    std::optional<std::vector<Request>> decodeRequests(const juce::MemoryBlock& message);
+    juce::MemoryBlock encode(const Response& response);
+    std::optional<Response> decodeResponse(const juce::MemoryBlock& message);
+}
+
+class AnalysisService
+{
+public:
+    struct Options
+    {
+        int numberOfWorkers = juce::SystemStats::getNumCpus();
+        // For normalise requests, apart from the target each request brings
+        BatchEngine::Options batchOptions;
+        // Requests of one connection queued or in work before the service
+        // stops reading from it
+        int maxOutstandingRequests = 4 * service::maxRequestsPerBatch;
+        // A response that cannot be sent within this drops the connection
+        int sendTimeoutMs = 5000;
+    };
+
+    static bool isAvailable();
+
+public:
+    explicit AnalysisService(Options options);
+    ~AnalysisService();
+
+    // Listens on socketFile, replacing whatever is there. Returns at once,
+    // requests are served on threads of the service's own.
+    bool start(const juce::File& socketFile);
+    // Closes every connection, requests not yet answered are dropped
+    void stop();
+
+private:
+    // Closed once neither its thread nor a worker with an answer for it
+    // holds it any more
+    struct Connection
+    {
+        ~Connection();
+
+        int fd = -1;
+        std::mutex writeMutex;
+        std::thread thread;
+        std::atomic<bool> finished { false };
+        // A response could not be sent, the rest are not even worked on
+        std::atomic<bool> broken { false };
+        // Guarded by mJobMutex
+        int outstanding = 0;
+    };
+
+    struct Job
+    {
+        std::shared_ptr<Connection> connection;
+        service::Request request;
+    };
+
+    void runListener();
+    void runConnection(std::shared_ptr<Connection> connection);
+    void runWorker();
+    service::Response process(AnalysisEngine& engine, const service::Request& request);
+    // Joins the threads of connections that have ended
+    void pruneConnections();
+
+    const Options mOptions;
+    juce::File mSocketFile;
+    int mListenFd = -1;
+    // Written to on stop to wake the listener
+    int mWakeUpFds[2] = { -1, -1 };
+
+    std::mutex mJobMutex;
+    std::condition_variable mJobCondition;
+    std::deque<Job> mJobs;
+    bool mShouldExit = false;
+    // Connections wait on it for their outstanding requests to drain
+    std::condition_variable mDrainCondition;
+
+    std::mutex mConnectionMutex;
+    std::vector<std::shared_ptr<Connection>> mConnections;
+
+    std::thread mListener;
+    std::vector<std::thread> mWorkers;
+};
+
+// The client side, for tools and tests. One request batch at a time.
+class AnalysisClient
+{
+public:
+    AnalysisClient();
+    ~AnalysisClient();
+
+    bool connect(const juce::File& socketFile);
+    void disconnect();
+    bool isConnected() const { return mFd >= 0; }
+
+    // Sends the requests, in batches of maxRequestsPerBatch, and waits for
+    // all of their responses, which come back in the order of the requests.
+    // The ids are assigned here. Nothing if the connection failed.
+    std::optional<std::vector<service::Response>> submit(std::vector<service::Request> requests);
+
+private:
+    bool submitBatch(std::vector<service::Request>& requests, size_t start, size_t end,
+                     std::vector<service::Response>& responses);
+
+    int mFd = -1;
+    juce::int64 mNextId = 1;
+};
+
+} // namespace norm
@@ -0,0 +1,768 @@
+#include "BatchEngine.h"
+#include "LaneAnalyser.h"
+#include "OutputTree.h"
+#include "TagWriter.h"
+#include "WorkerProcess.h"
+#include "util/Logger.h"
+#include "util/Trace.h"
+#include <cmath>
+#include <map>
+#include <thread>
+
+namespace norm
+{
+    namespace
+    {
+        BatchEngine::Options analyseOnly(BatchEngine::Options options)
+        {
+            options.mode = BatchEngine::Mode::analyse;
+            return options;
+        }
+    }
+
+    BatchEngine::BatchEngine(Options options)
+        : mOptions(std::move(options))
+        , mMeasureOptions(analyseOnly(mOptions))
+        , mPending(juce::jmax(1, mOptions.numberOfWorkers))
+    {
+        mProbeFormats.registerBasicFormats();
+    }
+    BatchEngine::~BatchEngine() {}
+
+    std::vector<BatchEngine::FileResult> BatchEngine::run(
+        const juce::Array<juce::File>& files)
+    {
+        return run([&files](const AddFile& add)
+        {
+            for (const auto& file : files) add(file);
+        });
+    }
+    std::vector<BatchEngine::FileResult> BatchEngine::run(const FileSource& source)
+    {
+        mShouldCancel = false;
+        mResults.clear();
+        mMeasured.clear();
+        mMeasuring = mOptions.mode == Mode::normalise
+                  && mOptions.gainMode == GainMode::album;
+        {
+            std::lock_guard<std::mutex> lock(mPendingMutex);
+            mPending.clear();
+            mMeasuredSizes.clear();
+            mSourceFinished = false;
+            mNumberOfSkipped = 0;
+        }
+
+        if (mOptions.journalFile != juce::File())
+        {
+            mJournal.open(mOptions.journalFile);
+        }
+
+        std::thread producer([this, &source]
+        {
+            source([this](const juce::File& file) { addFile(file); });
+
+            {
+                std::lock_guard<std::mutex> lock(mPendingMutex);
+                mSourceFinished = true;
+            }
+            mPendingCondition.notify_all();
+        });
+
+        runWorkers();
+        producer.join();
+
+        if (mMeasuring && !mShouldCancel)
+        {
+            planAlbums();
+            runWorkers();
+        }
+        mMeasuring = false;
+
+        MY_LOG_INFO("Batch of {} files, {} already complete in the journal",
+                    mResults.size() + (size_t)mNumberOfSkipped, mNumberOfSkipped);
+
+        mJournal.close();
+        return std::move(mResults);
+    }
+    void BatchEngine::cancel()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mPendingMutex);
+            mShouldCancel = true;
+        }
+        mPendingCondition.notify_all();
+
+        {
+            std::lock_guard<std::mutex> lock(mReadyMutex);
+        }
+        mReadyCondition.notify_all();
+    }
+
+    BatchEngine::FileResult BatchEngine::processFile(
+        AnalysisEngine& engine,
+        const juce::File& file,
+        const Options& options,
+        const std::optional<BatchJournal::Entry>& previous,
+        std::optional<AlbumGain> albumGain,
+        const StateCallback& onStateChange)
+    {
+        NORM_TRACE_SCOPE("BatchEngine::processFile");
+
+        FileResult result;
+        result.file = file;
+
+        auto reportState = [&](FileStatus status)
+        {
+            result.status = status;
+            if (onStateChange) onStateChange(result);
+        };
+
+        const bool normalise = options.mode == Mode::normalise;
+        const bool tagsOnly = normalise && options.tagsOnly && TagWriter::canWrite(file);
+
+        // In mirror mode everything goes to the output tree, the source is
+        // only read
+        const OutputTree output(options.sourceDirectory, options.outputDirectory);
+        const bool mirror = normalise && output.isEnabled();
+        const auto destination = mirror ? output.getOutputFile(file) : file;
+        EXPECT_OR_RETURN (destination != juce::File(),
+                          result,
+                          "{} is not under {}, it has no place in the output",
+                          file.getFullPathName().toStdString(),
+                          options.sourceDirectory.getFullPathName().toStdString());
+
+        auto cloneToOutput = [&]
+        {
+            const auto method = OutputTree::clone(file, destination, options.allowHardlinks);
+            if (method.has_value())
+            {
+                MY_LOG_INFO("{} needs no gain, {} into the output",
+                            file.getFullPathName().toStdString(),
+                            OutputTree::toString(*method));
+            }
+            return method.has_value();
+        };
+
+        // Normalised by an earlier run, the header is enough to tell
+        if (normalise && options.taggedToleranceDB >= 0.f)
+        {
+            const auto tagged = engine.readTaggedRecord(file);
+            // Files of an album end up at the album's gain, not the target
+            const float expected = tagged.has_value() && albumGain.has_value()
+                                 ? tagged->sourceLoudness + albumGain->gain
+                                 : options.targetLoudness;
+            if (GainModel::isAlreadyNormalised(tagged,
+                                               expected,
+                                               options.taggedToleranceDB))
+            {
+                MY_LOG_INFO("{} is tagged as normalised already",
+                            file.getFullPathName().toStdString());
+                result.loudness = tagged->sourceLoudness;
+                result.gain = tagged->appliedGain;
+                result.status = !mirror || cloneToOutput() ? FileStatus::verified
+                                                           : FileStatus::failed;
+                return result;
+            }
+        }
+
+        const auto analysis = engine.analyse(file, normalise && !tagsOnly);
+        if (!analysis.ok) return result;
+
+        // Gain is always planned from the source, a file we normalised
+        // before only gets the difference
+        const auto& tagged = engine.getFileHandler().getTaggedRecord();
+        const float taggedGain = tagged.has_value() ? tagged->getSampleGain() : 0.f;
+        const float sourceLoudness = analysis.integratedLoudness - taggedGain;
+
+        if (!normalise) return makeAnalysedResult(file, analysis, tagged, options);
+
+        const auto record = albumGain.has_value()
+                          ? LoudnessRecord { sourceLoudness, albumGain->gain }
+                          : GainModel::forTrack(sourceLoudness, options.targetLoudness);
+        result.loudness = record.sourceLoudness;
+        result.gain = record.appliedGain;
+
+        // A crash between writing the file and journaling it leaves the file
+        // at the previously planned loudness. Applying gain again would
+        // overshoot, so recognise it and only verify.
+        const bool alreadyWritten =
+            !mirror
+            && previous.has_value()
+            && previous->status == FileStatus::analysed
+            && std::abs(previous->gain) > mRecoveryToleranceDB
+            && std::abs(analysis.integratedLoudness
+                        - (previous->loudness + previous->gain)) < mRecoveryToleranceDB;
+
+        // Gain this small changes nothing audible, the output can share the
+        // source's data. Unless the limiter would have acted on the file:
+        // the sample peak is allowed for up to 3 dB of inter-sample overshoot.
+        const float gainToApply = record.appliedGain - taggedGain;
+        const bool needsNoGain =
+            mirror
+            && std::abs(gainToApply) <= options.cloneToleranceDB
+            && (!options.limiter.has_value()
+                || juce::Decibels::gainToDecibels(analysis.samplePeak) + gainToApply
+                   <= options.limiter->ceilingDB - 3.f);
+
+        if (needsNoGain)
+        {
+            reportState(FileStatus::analysed);
+            if (!cloneToOutput())
+            {
+                result.status = FileStatus::failed;
+                return result;
+            }
+            reportState(FileStatus::written);
+        }
+        else if (alreadyWritten)
+        {
+            MY_LOG_INFO("{} was written before the batch was interrupted",
+                        file.getFullPathName().toStdString());
+            result.loudness = previous->loudness;
+            result.gain = previous->gain;
+            reportState(FileStatus::written);
+        }
+        else if (tagsOnly)
+        {
+            reportState(FileStatus::analysed);
+
+            // A copy of its own, the tags are edited in place
+            auto signalled = record;
+            signalled.signalledGain = record.appliedGain - taggedGain;
+
+            // In album mode the record's gain is the album's. The track
+            // fields keep what the file would get on its own, for players
+            // in track mode.
+            const auto fields = albumGain.has_value()
+                ? GainModel::makeAlbumGainFields(signalled,
+                                                 options.targetLoudness - sourceLoudness - taggedGain,
+                                                 analysis.samplePeak,
+                                                 albumGain->peak)
+                : GainModel::makeGainFields(signalled, analysis.samplePeak);
+
+            const bool written =
+                (!mirror || OutputTree::clone(file, destination, false).has_value())
+                && engine.getFileHandler().writeTags(destination, signalled, fields);
+            if (!written)
+            {
+                result.status = FileStatus::failed;
+                return result;
+            }
+            reportState(FileStatus::written);
+        }
+        else
+        {
+            reportState(FileStatus::analysed);
+
+            if (!engine.applyGainAndWrite(record, mirror ? destination : juce::File()))
+            {
+                result.status = FileStatus::failed;
+                return result;
+            }
+            reportState(FileStatus::written);
+        }
+
+        result.status = engine.verify(destination, analysis.lengthInSamples)
+                      ? FileStatus::verified
+                      : FileStatus::failed;
+        return result;
+    }
+
+    BatchEngine::FileResult BatchEngine::makeAnalysedResult(
+        const juce::File& file,
+        const AnalysisEngine::Result& analysis,
+        const std::optional<LoudnessRecord>& tagged,
+        const Options& options)
+    {
+        FileResult result;
+        result.file = file;
+        if (!analysis.ok) return result;
+
+        const float taggedGain = tagged.has_value() ? tagged->getSampleGain() : 0.f;
+        const auto record = GainModel::forTrack(analysis.integratedLoudness,
+                                                options.targetLoudness);
+        result.loudness = record.sourceLoudness;
+        result.gain = record.appliedGain;
+        result.histogram = analysis.histogram;
+        result.histogram.applyGain(-taggedGain);
+        result.samplePeak = analysis.samplePeak;
+        result.status = FileStatus::analysed;
+        return result;
+    }
+
+    bool BatchEngine::isComplete(FileStatus status, Mode mode)
+    {
+        switch (status)
+        {
+            // Analysed files still need their gain in normalise mode
+            case FileStatus::analysed:    return mode == Mode::analyse;
+            case FileStatus::written:
+            case FileStatus::verified:
+            case FileStatus::failed:
+            case FileStatus::quarantined: return true;
+        }
+        return false;
+    }
+
+    void BatchEngine::runWorkers()
+    {
+        if (mOptions.isolation == Isolation::processes)
+            runProcesses();
+        else if (mOptions.shareLanes && getWorkerOptions().mode == Mode::analyse)
+            runLanes();
+        else
+            runThreads();
+    }
+
+    void BatchEngine::runThreads()
+    {
+        // Files may still be coming in, so no fewer workers for short lists
+        const int numberOfWorkers = juce::jmax(1, mOptions.numberOfWorkers);
+
+        // One thread reads ahead for every worker, if asked to and possible
+        std::unique_ptr<UringReader> reader;
+        if (mOptions.ioBackend == IoBackend::uring)
+        {
+            UringReader::Options readerOptions;
+            readerOptions.queueDepth = mOptions.ioQueueDepth;
+            reader = std::make_unique<UringReader>(readerOptions);
+            if (!reader->isAvailable()) reader.reset();
+        }
+
+        std::thread readAhead;
+        if (reader != nullptr)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mReadyMutex);
+                mReady.clear();
+                mReadAheadFinished = false;
+            }
+            // Enough to keep every worker busy, without holding the library
+            readAhead = std::thread([this, &reader, numberOfWorkers]
+            {
+                runReadAhead(*reader, 2 * (size_t)numberOfWorkers);
+            });
+        }
+
+        std::vector<std::thread> workers;
+        for (int w = 0; w < numberOfWorkers; w++)
+        {
+            workers.emplace_back([this, &reader, w]
+            {
+                AnalysisEngine engine;
+                engine.setLimiter(mOptions.limiter);
+                engine.getFileHandler().setSignalResidualGain(mOptions.signalResidualGain);
+                const StateCallback onStateChange = [this](const FileResult& state)
+                {
+                    recordState(state);
+                };
+                auto takeNext = [&]
+                {
+                    if (reader != nullptr)
+                    {
+                        if (auto ready = takeReadyFile(engine.getFileHandler())) return ready;
+                    }
+                    // Also once the reader gave up on its ring: the files it
+                    // never took are read through streams
+                    return takeNextFile(w);
+                };
+
+                while (auto pending = takeNext())
+                {
+                    if (pending->split != nullptr)
+                    {
+                        processSegment(engine, *pending);
+                        continue;
+                    }
+
+                    finish(processFile(engine,
+                                       pending->file,
+                                       getWorkerOptions(),
+                                       pending->previous,
+                                       pending->albumGain,
+                                       onStateChange));
+                }
+            });
+        }
+
+        for (auto& worker : workers) worker.join();
+        if (readAhead.joinable()) readAhead.join();
+    }
+
+    void BatchEngine::runReadAhead(UringReader& reader, size_t maxReady)
+    {
+        // Taken from the pending queue, not read completely yet
+        std::multimap<juce::File, PendingFile> inFlight;
+
+        reader.run([&](bool mayWait) -> std::optional<juce::File>
+                   {
+                       auto pending = takeNextFile(0, mayWait);
+                       // Segments are read in part, by the worker itself
+                       while (pending.has_value() && pending->split != nullptr)
+                       {
+                           pushReadyFile({ std::move(*pending) }, maxReady);
+                           pending = takeNextFile(0, mayWait);
+                       }
+                       if (!pending.has_value()) return std::nullopt;
+
+                       const auto file = pending->file;
+                       inFlight.emplace(file, std::move(*pending));
+                       return file;
+                   },
+                   [&](UringReader::Completed&& completed)
+                   {
+                       const auto it = inFlight.find(completed.file);
+                       jassert(it != inFlight.end());
+
+                       ReadyFile ready { std::move(it->second),
+                                         std::move(completed.data),
+                                         completed.ok };
+                       inFlight.erase(it);
+                       pushReadyFile(std::move(ready), maxReady);
+                   });
+
+        {
+            std::lock_guard<std::mutex> lock(mReadyMutex);
+            mReadAheadFinished = true;
+        }
+        mReadyCondition.notify_all();
+    }
+    void BatchEngine::pushReadyFile(ReadyFile&& ready, size_t maxReady)
+    {
+        {
+            NORM_TRACE_SCOPE("BatchEngine::waitForRoom");
+            std::unique_lock<std::mutex> lock(mReadyMutex);
+            mReadyCondition.wait(lock, [&]
+            {
+                return mShouldCancel || mReady.size() < maxReady;
+            });
+            mReady.push_back(std::move(ready));
+        }
+        mReadyCondition.notify_all();
+    }
+
+    void BatchEngine::processSegment(AnalysisEngine& engine, const PendingFile& segment)
+    {
+        const auto analysis = engine.analyseBlocks(segment.file,
+                                                   segment.firstBlock,
+                                                   segment.numberOfBlocks);
+        auto& split = *segment.split;
+        {
+            std::lock_guard<std::mutex> lock(split.mutex);
+            if (analysis.ok)
+            {
+                auto& merged = split.analysis;
+                merged.histogram.merge(analysis.histogram);
+                merged.samplePeak = juce::jmax(merged.samplePeak, analysis.samplePeak);
+                merged.blocksRead += analysis.blocksRead;
+                merged.lengthInSamples = analysis.lengthInSamples;
+                split.tagged = engine.getFileHandler().getTaggedRecord();
+            }
+            split.ok = split.ok && analysis.ok;
+
+            if (--split.remaining > 0) return;
+        }
+
+        // The last segment, the others are done with the split
+        auto& merged = split.analysis;
+        merged.integratedLoudness = merged.histogram.getIntegratedLoudness();
+        // Like a full analysis, a file with nothing above the gates fails
+        merged.ok = split.ok && std::isfinite(merged.integratedLoudness);
+        finish(makeAnalysedResult(segment.file, merged, split.tagged, getWorkerOptions()));
+    }
+
+    void BatchEngine::runLanes()
+    {
+        // Files may still be coming in, so no fewer workers for short lists
+        const int numberOfWorkers = juce::jmax(1, mOptions.numberOfWorkers);
+
+        std::vector<std::thread> workers;
+        for (int w = 0; w < numberOfWorkers; w++)
+        {
+            workers.emplace_back([this, w]
+            {
+                // Analysis needs neither the journal's entry nor an album gain
+                LaneAnalyser analyser;
+                analyser.run([this, w]() -> std::optional<juce::File>
+                             {
+                                 if (auto pending = takeNextFile(w)) return pending->file;
+                                 return std::nullopt;
+                             },
+                             [this](const LaneAnalyser::Result& lane)
+                             {
+                                 finish(makeAnalysedResult(lane.file,
+                                                           lane.analysis,
+                                                           lane.tagged,
+                                                           getWorkerOptions()));
+                             });
+            });
+        }
+
+        for (auto& worker : workers) worker.join();
+    }
+
+    void BatchEngine::runProcesses()
+    {
+        // Files may still be coming in, so no fewer workers for short lists
+        const int numberOfWorkers = juce::jmax(1, mOptions.numberOfWorkers);
+
+        std::vector<std::thread> supervisors;
+        for (int w = 0; w < numberOfWorkers; w++)
+        {
+            supervisors.emplace_back([this, w]
+            {
+                auto connection = std::make_unique<WorkerConnection>();
+                const StateCallback onStateChange = [this](const FileResult& state)
+                {
+                    recordState(state);
+                };
+
+                while (auto pending = takeNextFile(w))
+                {
+                    const auto& file = pending->file;
+
+                    if (!connection->isAlive())
+                    {
+                        connection = std::make_unique<WorkerConnection>();
+                        if (!connection->launch(mOptions.workerExecutable,
+                                                mOptions.workerTimeoutMs))
+                        {
+                            MY_LOG_WARNING("Unable to launch worker process {}",
+                                           mOptions.workerExecutable.getFullPathName().toStdString());
+                            finish({ file, FileStatus::failed, 0, 0 });
+                            continue;
+                        }
+                    }
+
+                    const worker::Job job { file,
+                                            getWorkerOptions(),
+                                            pending->previous,
+                                            pending->albumGain };
+                    auto result = connection->process(job,
+                                                      mOptions.fileTimeoutMs,
+                                                      onStateChange);
+
+                    if (result.has_value())
+                    {
+                        finish(*result);
+                    }
+                    else
+                    {
+                        MY_LOG_WARNING("Worker died on {}, file quarantined",
+                                       file.getFullPathName().toStdString());
+                        finish({ file, FileStatus::quarantined, 0, 0 });
+                    }
+                }
+            });
+        }
+
+        for (auto& supervisor : supervisors) supervisor.join();
+    }
+
+    void BatchEngine::addFile(const juce::File& file)
+    {
+        auto previous = mJournal.find(file);
+        // Written files are still measured, they count towards their album
+        const bool isDone = previous.has_value()
+                         && isComplete(previous->status, mOptions.mode)
+                         && !(mMeasuring && (previous->status == FileStatus::written
+                                             || previous->status == FileStatus::verified));
+        if (isDone)
+        {
+            std::lock_guard<std::mutex> lock(mPendingMutex);
+            mNumberOfSkipped++;
+            return;
+        }
+
+        const auto size = measureFile(file);
+        if (mMeasuring)
+        {
+            std::lock_guard<std::mutex> lock(mPendingMutex);
+            mMeasuredSizes[file] = size;
+        }
+
+        // Segments only make sense for threads that measure, lanes and
+        // worker processes take whole files
+        const bool canSplit = mOptions.isolation == Isolation::threads
+                           && !mOptions.shareLanes
+                           && getWorkerOptions().mode == Mode::analyse
+                           && mOptions.segmentSeconds > 0.0;
+        const juce::int64 segmentBlocks = juce::jmax(
+            (juce::int64)4, (juce::int64)std::llround(mOptions.segmentSeconds * 10.0));
+
+        if (canSplit && size.numberOfBlocks >= 2 * segmentBlocks)
+        {
+            const juce::int64 numberOfSegments = size.numberOfBlocks / segmentBlocks;
+            auto split = std::make_shared<SplitFile>();
+            split->remaining = (int)numberOfSegments;
+
+            MY_LOG_INFO("{} is analysed in {} segments",
+                        file.getFullPathName().toStdString(), numberOfSegments);
+
+            // The last segment takes the rest of the file
+            for (juce::int64 i = 0; i < numberOfSegments; i++)
+            {
+                const juce::int64 firstBlock = i * segmentBlocks;
+                const juce::int64 numberOfBlocks = i == numberOfSegments - 1
+                                                 ? size.numberOfBlocks - firstBlock
+                                                 : segmentBlocks;
+                const FileSize segmentSize { size.cost * (double)numberOfBlocks
+                                                        / (double)size.numberOfBlocks,
+                                             numberOfBlocks };
+                queueFile({ file, previous, std::nullopt, split, firstBlock, numberOfBlocks },
+                          segmentSize);
+            }
+            return;
+        }
+
+        queueFile({ file, previous }, size);
+    }
+    BatchEngine::FileSize BatchEngine::measureFile(const juce::File& file)
+    {
+        if (!mOptions.scheduleBySize) return {};
+
+        // Decoders stay out of this process when the batch isolates them
+        if (mOptions.isolation == Isolation::processes)
+            return { (double)file.getSize() };
+
+        std::unique_ptr<juce::AudioFormatReader> reader(mProbeFormats.createReaderFor(file));
+        // Fails quickly in the worker too
+        if (reader == nullptr) return {};
+
+        const int samplesPerBlock = (int)std::floor(reader->sampleRate / 10.0);
+        return { (double)reader->lengthInSamples * reader->numChannels,
+                 samplesPerBlock > 0 ? reader->lengthInSamples / samplesPerBlock : 0 };
+    }
+    void BatchEngine::queueFile(PendingFile&& pending, const FileSize& size)
+    {
+        mPending.push(std::move(pending), size.cost);
+
+        // Taking the lock orders this against a worker about to wait, it
+        // either sees the file or gets the notification
+        {
+            std::lock_guard<std::mutex> lock(mPendingMutex);
+        }
+        mPendingCondition.notify_one();
+    }
+    std::optional<BatchEngine::PendingFile> BatchEngine::takeNextFile(int worker, bool wait)
+    {
+        for (;;)
+        {
+            if (mShouldCancel) return std::nullopt;
+            if (auto pending = mPending.tryPop(worker)) return pending;
+            if (!wait) return std::nullopt;
+
+            NORM_TRACE_SCOPE("BatchEngine::waitForFile");
+            std::unique_lock<std::mutex> lock(mPendingMutex);
+            mPendingCondition.wait(lock, [this]
+            {
+                return mShouldCancel || !mPending.isEmpty() || mSourceFinished;
+            });
+
+            // Otherwise someone else may have taken it, then wait again
+            if (mShouldCancel || (mPending.isEmpty() && mSourceFinished)) return std::nullopt;
+        }
+    }
+
+    std::optional<BatchEngine::PendingFile> BatchEngine::takeReadyFile(FileHandler& fileHandler)
+    {
+        std::optional<ReadyFile> ready;
+        {
+            NORM_TRACE_SCOPE("BatchEngine::waitForReadyFile");
+            std::unique_lock<std::mutex> lock(mReadyMutex);
+            mReadyCondition.wait(lock, [this]
+            {
+                return mShouldCancel || !mReady.empty() || mReadAheadFinished;
+            });
+
+            if (mShouldCancel || mReady.empty()) return std::nullopt;
+
+            ready = std::move(mReady.front());
+            mReady.pop_front();
+        }
+        mReadyCondition.notify_all();
+
+        // Too large or unreadable, the decoder tries the disk itself
+        if (ready->isRead)
+            fileHandler.setPrefetchedData(ready->pending.file, std::move(ready->data));
+        return std::move(ready->pending);
+    }
+
+    void BatchEngine::planAlbums()
+    {
+        mMeasuring = false;
+
+        std::map<juce::String, std::vector<const FileResult*>> albums;
+        for (const auto& measured : mMeasured)
+        {
+            albums[measured.file.getParentDirectory().getFullPathName()].push_back(&measured);
+        }
+
+        std::vector<FileResult> failed;
+        {
+            std::lock_guard<std::mutex> lock(mPendingMutex);
+            for (const auto& [directory, tracks] : albums)
+            {
+                GatingHistogram album;
+                for (const auto* track : tracks) album.merge(track->histogram);
+
+                const float loudness = album.getIntegratedLoudness();
+                if (!std::isfinite(loudness))
+                {
+                    MY_LOG_WARNING("Album {} has nothing above the gates",
+                                   directory.toStdString());
+                    for (const auto* track : tracks) failed.push_back({ track->file });
+                    continue;
+                }
+
+                AlbumGain albumGain;
+                albumGain.gain = mOptions.targetLoudness - loudness;
+                for (const auto* track : tracks) albumGain.peak = juce::jmax(albumGain.peak, track->samplePeak);
+                MY_LOG_INFO("Album {} of {} files at {} LUFS, gain {} dB",
+                            directory.toStdString(), tracks.size(), loudness, albumGain.gain);
+
+                for (const auto* track : tracks)
+                {
+                    auto previous = mJournal.find(track->file);
+                    if (previous.has_value() && isComplete(previous->status, mOptions.mode))
+                    {
+                        mNumberOfSkipped++;
+                        continue;
+                    }
+                    const auto size = mMeasuredSizes.find(track->file);
+                    mPending.push({ track->file, previous, albumGain },
+                                  size != mMeasuredSizes.end() ? size->second.cost : 0.0);
+                }
+            }
+        }
+
+        mMeasured.clear();
+        mMeasuredSizes.clear();
+        for (const auto& result : failed) finish(result);
+    }
+
+    void BatchEngine::recordState(const FileResult& result)
+    {
+        mJournal.record(result.file, { result.status, result.loudness, result.gain });
+    }
+    void BatchEngine::finish(const FileResult& result)
+    {
+        // Measured for an album, the file's own result comes with its gain
+        if (mMeasuring && result.status == FileStatus::analysed)
+        {
+            std::lock_guard<std::mutex> lock(mResultMutex);
+            mMeasured.push_back(result);
+            return;
+        }
+
+        recordState(result);
+
+        if (mOptions.collectResults)
+        {
+            std::lock_guard<std::mutex> lock(mResultMutex);
+            mResults.push_back(result);
+        }
+
+        if (mCallback) mCallback(result);
+    }
+}
@@ -0,0 +1,287 @@
+#pragma once
+
+/*  Runs a list of files through analysis or normalisation on several workers.
+    Workers are either threads in this process, each owning an AnalysisEngine,
+    or separate worker processes (see WorkerProcess.h), so that a file that
+    crashes the decoder only takes down one worker instead of the batch.
+
+    With a journal file set, every state a file goes through (analysed,
+    written, verified) is recorded there, and files the journal already has
+    as complete are skipped, so a batch can be resumed. A file is never given
+    gain twice: one journaled as analysed but not written is re-measured and
+    recognised if the earlier run managed to write it after all.
+
+    In album mode normalisation takes two passes. The first only measures
+    every file; the gating histograms of the files in one directory are then
+    merged into the album's loudness, and the second pass writes each file
+    with the album's gain.
+
+    With an output directory the originals are never touched: every file
+    goes to the same place in a mirror tree, and one that needs no gain is
+    cloned there instead of written (see OutputTree.h).
+
+    In tags only mode, compressed files are not written at all: their gain
+    goes into ReplayGain tags, which only takes a few kilobytes of writes.
+
+    Files wait in a queue per worker, longest first by what their headers
+    say, and idle workers steal from the others (see WorkStealingQueue.h).
+    A long file is not left to hold up the end of the batch: the analysis
+    pass splits it into segments for several workers and merges their
+    gating histograms.
+*/
+
+#include "AnalysisEngine.h"
+#include "BatchJournal.h"
+#include "UringReader.h"
+#include "util/WorkStealingQueue.h"
+#include <juce_core/juce_core.h>
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace norm
+{
+
+class BatchEngine
+{
+public:
+    enum class Mode { analyse, normalise };
+    enum class Isolation { threads, processes };
+    enum class GainMode { track, album };
+    enum class IoBackend { streams, uring };
+
+    struct Options
+    {
+        Mode mode = Mode::analyse;
+        float targetLoudness = -23.f;
+        // Album: the files of a directory share one gain. Normalise only.
+        GainMode gainMode = GainMode::track;
+        // Keeps normalised files under a true-peak ceiling, e.g. -1 dBTP
+        std::optional<TruePeakLimiter::Options> limiter;
+        // Files whose tags say they are this close to the target already are
+        // not decoded at all. Negative to always analyse.
+        float taggedToleranceDB = 0.1f;
+        // Mirror mode: files under sourceDirectory are written to the same
+        // path under outputDirectory and the originals are left alone.
+        // Normalise only, see OutputTree.h.
+        juce::File sourceDirectory;
+        juce::File outputDirectory;
+        // Mirrored files that need less gain than this are cloned, not
+        // decoded and written again
+        float cloneToleranceDB = 0.05f;
+        // Clones may share the original's inode when a reflink is not
+        // possible: editing one in place then edits the other
+        bool allowHardlinks = true;
+        // MP3 gain comes in 1.5 dB steps, the rest goes into a ReplayGain
+        // tag for the player. See Mp3GainWriter.h.
+        bool signalResidualGain = true;
+        // FLAC, Ogg Vorbis and MP3 files keep their audio as it is and only
+        // get ReplayGain tags for the player to apply, see TagWriter.h.
+        // Other formats are written as usual. Normalise only.
+        bool tagsOnly = false;
+        int numberOfWorkers = juce::SystemStats::getNumCpus();
+        // Off for batches that never end, results then only go to the callback
+        bool collectResults = true;
+        Isolation isolation = Isolation::threads;
+        // Every worker thread analyses several files at once, see
+        // LaneAnalyser.h. Pays off for libraries of short mono and stereo
+        // files. Only for the analysis pass with Isolation::threads.
+        bool shareLanes = false;
+        // Isolation::threads only: one more thread reads the files ahead for
+        // the workers through io_uring, see UringReader.h. Streams are used
+        // where io_uring is not available, and with shareLanes.
+        IoBackend ioBackend = IoBackend::streams;
+        int ioQueueDepth = 32;
+        // Longer files are started first, by the length in their headers (by
+        // their size with Isolation::processes, this process decodes
+        // nothing). Off to take files in the order they come.
+        bool scheduleBySize = true;
+        // Analysis with Isolation::threads and without shareLanes: a file
+        // longer than two segments is measured in segments of this length
+        // on several workers at once. 0 never splits a file.
+        double segmentSeconds = 600.0;
+
+        // Resume information, nothing is recorded if this is left empty
+        juce::File journalFile;
+
+        // Only used with Isolation::processes
+        juce::File workerExecutable =
+            juce::File::getSpecialLocation(juce::File::currentExecutableFile);
+        // Worker is considered dead without a ping for this long, 0 = default
+        int workerTimeoutMs = 0;
+        // A single file may take this long before its worker is killed and
+        // the file quarantined, 0 = no limit
+        int fileTimeoutMs = 0;
+    };
+
+    struct FileResult
+    {
+        juce::File file;
+        FileStatus status = FileStatus::failed;
+        float loudness = 0;
+        float gain = 0;
+        // Of the source, before any gain an earlier run applied. Only set in
+        // analyse mode.
+        GatingHistogram histogram;
+        // Of the file as it is. Only set in analyse mode.
+        float samplePeak = 0;
+    };
+
+    // What the files of an album share in album mode
+    struct AlbumGain
+    {
+        float gain = 0;
+        // Largest sample peak of the album's files as they are, for the
+        // ReplayGain album field
+        float peak = 0;
+    };
+
+    // Called from worker threads whenever a file is finished
+    using ResultCallback = std::function<void(const FileResult&)>;
+    // Called for the states a file passes through before the final one
+    using StateCallback = std::function<void(const FileResult&)>;
+
+    // Feeds files to a running batch, e.g. straight from a DirectoryScanner,
+    // so work starts with the first file found. Runs on a thread of its own,
+    // the batch ends once it returns and every file it added is done.
+    using AddFile = std::function<void(const juce::File&)>;
+    using FileSource = std::function<void(const AddFile& addFile)>;
+
+public:
+    explicit BatchEngine(Options options);
+    ~BatchEngine();
+
+    // Blocks until every file is done or cancel() is called. Files the journal
+    // has as complete are not processed again and not part of the result.
+    std::vector<FileResult> run(const juce::Array<juce::File>& files);
+    std::vector<FileResult> run(const FileSource& source);
+    void cancel();
+    void setResultCallback(ResultCallback callback) { mCallback = std::move(callback); }
+
+    // What a worker, thread or process, does with a single file. previous is
+    // what the journal knew about the file when the batch started. Returns
+    // the final state. With an album gain the file gets that instead of the
+    // gain to reach the target on its own.
+    static FileResult processFile(AnalysisEngine& engine,
+                                  const juce::File& file,
+                                  const Options& options,
+                                  const std::optional<BatchJournal::Entry>& previous,
+                                  std::optional<AlbumGain> albumGain,
+                                  const StateCallback& onStateChange);
+
+    // The analyse mode result of processFile, from an analysis and what the
+    // file's tags said
+    static FileResult makeAnalysedResult(const juce::File& file,
+                                         const AnalysisEngine::Result& analysis,
+                                         const std::optional<LoudnessRecord>& tagged,
+                                         const Options& options);
+
+    // Whether a file in this state needs no more work in the given mode
+    static bool isComplete(FileStatus status, Mode mode);
+
+private:
+    void runWorkers();
+    void runThreads();
+    void runLanes();
+    // Reads the pending files into memory until the source is done
+    void runReadAhead(UringReader& reader, size_t maxReady);
+    void runProcesses();
+    // Merges what the first pass measured into album gains and queues the
+    // files again for the second pass
+    void planAlbums();
+    const Options& getWorkerOptions() const { return mMeasuring ? mMeasureOptions : mOptions; }
+
+    // What the segments of one file measured so far, the last one to finish
+    // reports the file
+    struct SplitFile
+    {
+        std::mutex mutex;
+        int remaining = 0;
+        bool ok = true;
+        AnalysisEngine::Result analysis;
+        std::optional<LoudnessRecord> tagged;
+    };
+
+    struct PendingFile
+    {
+        juce::File file;
+        std::optional<BatchJournal::Entry> previous;
+        std::optional<AlbumGain> albumGain;
+        // Set for a segment of a split file, blocks as in
+        // AnalysisEngine::analyseBlocks
+        std::shared_ptr<SplitFile> split;
+        juce::int64 firstBlock = 0;
+        juce::int64 numberOfBlocks = 0;
+    };
+
+    struct ReadyFile
+    {
+        PendingFile pending;
+        juce::MemoryBlock data;
+        bool isRead = false;
+    };
+
+    struct FileSize
+    {
+        // Samples over all channels, the order files are taken in
+        double cost = 0;
+        // 100ms blocks, 0 if unknown
+        juce::int64 numberOfBlocks = 0;
+    };
+
+    void addFile(const juce::File& file);
+    // From the header, on the source's thread
+    FileSize measureFile(const juce::File& file);
+    void queueFile(PendingFile&& pending, const FileSize& size);
+    // Waits for the next file, nothing once the source is done and all its
+    // files are taken. Without waiting, nothing if no file is pending now.
+    // Takes the worker's own files first, then steals another's.
+    std::optional<PendingFile> takeNextFile(int worker, bool wait = true);
+    // The same for workers behind the read-ahead thread. The file's bytes go
+    // to the file handler, if they could be read.
+    std::optional<PendingFile> takeReadyFile(FileHandler& fileHandler);
+    void pushReadyFile(ReadyFile&& ready, size_t maxReady);
+    // Measures one segment, and reports the file if it was the last
+    void processSegment(AnalysisEngine& engine, const PendingFile& segment);
+    void recordState(const FileResult& result);
+    void finish(const FileResult& result);
+
+    const Options mOptions;
+    // The first pass of album mode, only analyses
+    const Options mMeasureOptions;
+    bool mMeasuring = false;
+    ResultCallback mCallback;
+    BatchJournal mJournal;
+
+    std::mutex mPendingMutex;
+    std::condition_variable mPendingCondition;
+    WorkStealingQueue<PendingFile> mPending;
+    bool mSourceFinished = false;
+    // Headers are only read by the source's thread
+    juce::AudioFormatManager mProbeFormats;
+    // For the album pass, the files come from the measured results then
+    std::map<juce::File, FileSize> mMeasuredSizes;
+    int mNumberOfSkipped = 0;
+    std::atomic<bool> mShouldCancel { false };
+
+    std::mutex mReadyMutex;
+    std::condition_variable mReadyCondition;
+    std::deque<ReadyFile> mReady;
+    bool mReadAheadFinished = false;
+
+    std::mutex mResultMutex;
+    std::vector<FileResult> mResults;
+    std::vector<FileResult> mMeasured;
+
+    // Loudness difference below which a file counts as already written
+    static constexpr float mRecoveryToleranceDB = 0.05f;
+};
+
+} // namespace norm
@@ -0,0 +1,226 @@
+#include "BatchJournal.h"
+#include "util/Logger.h"
+
+#if JUCE_WINDOWS
+ #include <io.h>
+#else
+ #include <unistd.h>
+#endif
+
+namespace norm
+{
+    namespace
+    {
+        const juce::String separator = "\t";
+
+        std::FILE* openForAppending(const juce::File& file)
+        {
+           #if JUCE_WINDOWS
+            return _wfopen(file.getFullPathName().toWideCharPointer(), L"ab");
+           #else
+            return std::fopen(file.getFullPathName().toRawUTF8(), "ab");
+           #endif
+        }
+
+        bool syncToDisk(std::FILE* stream)
+        {
+            if (std::fflush(stream) != 0) return false;
+           #if JUCE_WINDOWS
+            return _commit(_fileno(stream)) == 0;
+           #else
+            return fsync(fileno(stream)) == 0;
+           #endif
+        }
+    }
+
+    BatchJournal::BatchJournal() {}
+    BatchJournal::~BatchJournal()
+    {
+        close();
+    }
+
+    bool BatchJournal::open(const juce::File& journalFile, int commitIntervalMs)
+    {
+        close();
+
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        const bool endsWithTornLine = !load(journalFile);
+
+        mStream = openForAppending(journalFile);
+        EXPECT_OR_RETURN (mStream != nullptr,
+                          false,
+                          "Unable to open journal {}",
+                          journalFile.getFullPathName().toStdString());
+
+        // Otherwise the first new record would be glued to the torn one
+        if (endsWithTornLine) std::fputc('\n', mStream);
+
+        mCommitInterval = std::chrono::milliseconds(juce::jmax(1, commitIntervalMs));
+        mShouldExit = false;
+        mRecorded = mCommitted = 0;
+        mCommitter = std::thread([this] { runCommitter(); });
+        return true;
+    }
+    void BatchJournal::close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mShouldExit = true;
+        }
+        mCommitRequested.notify_all();
+        if (mCommitter.joinable()) mCommitter.join();
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mStream != nullptr)
+        {
+            std::fclose(mStream);
+            mStream = nullptr;
+        }
+    }
+
+    bool BatchJournal::isOpen() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mStream != nullptr;
+    }
+
+    void BatchJournal::record(const juce::File& file, const Entry& entry)
+    {
+        const auto path = file.getFullPathName();
+        const auto line = statusToString(entry.status) + separator
+                        + juce::String(entry.loudness) + separator
+                        + juce::String(entry.gain) + separator
+                        + path + "\n";
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mEntries[path.toStdString()] = entry;
+
+        if (mStream == nullptr) return;
+
+        mPending += line.toStdString();
+        mRecorded++;
+
+        if (mPending.size() > mMaxPendingBytes) mCommitRequested.notify_one();
+    }
+    void BatchJournal::commit()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (mStream == nullptr) return;
+
+        const auto target = mRecorded;
+        mCommitRequested.notify_one();
+        mCommitDone.wait(lock, [&] { return mCommitted >= target || mShouldExit; });
+    }
+    std::optional<BatchJournal::Entry> BatchJournal::find(const juce::File& file) const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        auto it = mEntries.find(file.getFullPathName().toStdString());
+        if (it == mEntries.end()) return std::nullopt;
+        return it->second;
+    }
+
+    void BatchJournal::runCommitter()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        for (;;)
+        {
+            mCommitRequested.wait_for(lock, mCommitInterval);
+
+            if (!mPending.empty())
+            {
+                // Group commit: everything that piled up goes out with a
+                // single fsync, and recording continues meanwhile
+                std::string text;
+                text.swap(mPending);
+                const auto batchEnd = mRecorded;
+
+                lock.unlock();
+                writeAndSync(text);
+                lock.lock();
+
+                mCommitted = batchEnd;
+                mCommitDone.notify_all();
+            }
+
+            if (mShouldExit && mPending.empty()) break;
+        }
+
+        mCommitDone.notify_all();
+    }
+    void BatchJournal::writeAndSync(const std::string& text)
+    {
+        // Only ever called from the committer thread, the stream stays open
+        // until that thread is joined
+        const bool written =
+            std::fwrite(text.data(), 1, text.size(), mStream) == text.size();
+
+        if (!written || !syncToDisk(mStream))
+        {
+            MY_LOG_WARNING("Writing the batch journal failed");
+        }
+    }
+
+    juce::String BatchJournal::statusToString(FileStatus status)
+    {
+        switch (status)
+        {
+            case FileStatus::analysed:    return "analysed";
+            case FileStatus::written:     return "written";
+            case FileStatus::verified:    return "verified";
+            case FileStatus::failed:      return "failed";
+            case FileStatus::quarantined: return "quarantined";
+        }
+        return {};
+    }
+    std::optional<FileStatus> BatchJournal::statusFromString(const juce::String& text)
+    {
+        if (text == "analysed")    return FileStatus::analysed;
+        if (text == "written")     return FileStatus::written;
+        if (text == "verified")    return FileStatus::verified;
+        if (text == "failed")      return FileStatus::failed;
+        if (text == "quarantined") return FileStatus::quarantined;
+        return std::nullopt;
+    }
+
+    bool BatchJournal::load(const juce::File& journalFile)
+    {
+        mEntries.clear();
+        if (!journalFile.existsAsFile()) return true;
+
+        const auto text = journalFile.loadFileAsString();
+        juce::StringArray lines;
+        lines.addLines(text);
+
+        // A torn line can only be the last one, it has no newline yet
+        const bool endsCleanly = text.isEmpty() || text.endsWithChar('\n');
+        if (!endsCleanly && !lines.isEmpty())
+        {
+            lines.remove(lines.size() - 1);
+        }
+
+        for (const auto& line : lines)
+        {
+            // the path goes last, it may contain anything but a newline
+            auto fields = juce::StringArray::fromTokens(line, separator, {});
+            if (fields.size() < 4) continue;
+
+            auto status = statusFromString(fields[0]);
+            if (!status.has_value()) continue;
+
+            Entry entry;
+            entry.status = *status;
+            entry.loudness = fields[1].getFloatValue();
+            entry.gain = fields[2].getFloatValue();
+
+            fields.removeRange(0, 3);
+            const auto path = fields.joinIntoString(separator);
+
+            mEntries[path.toStdString()] = entry;
+        }
+
+        return endsCleanly;
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+/*  Append-only record of what a batch did to each file, so an interrupted
+    batch can be resumed without touching files that are already finished.
+    One line per state change, the last line for a file wins when loading.
+
+    Records are buffered and written by a background thread, which makes them
+    durable with one fsync per group of records instead of one per record.
+    Workers never wait for the disk unless they ask for it with commit().
+*/
+
+#include <juce_core/juce_core.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace norm
+{
+
+enum class FileStatus
+{
+    analysed,       // loudness measured, nothing written yet
+    written,        // gain applied and the file replaced on disk
+    verified,       // the written file was read back successfully
+    failed,         // the file could not be processed, e.g. not audio
+    quarantined     // processing it took down a worker process
+};
+
+class BatchJournal
+{
+public:
+    struct Entry
+    {
+        FileStatus status = FileStatus::failed;
+        // Loudness as measured before any gain, and the gain to reach the
+        // target. Kept across state changes of the same file.
+        float loudness = 0;
+        float gain = 0;
+    };
+
+public:
+    BatchJournal();
+    ~BatchJournal();
+
+    // Loads whatever the file already holds, then appends to it
+    bool open(const juce::File& journalFile, int commitIntervalMs = 20);
+    // Commits everything recorded so far
+    void close();
+    // Thread safe
+    bool isOpen() const;
+
+    // Thread safe and non-blocking
+    void record(const juce::File& file, const Entry& entry);
+    // Blocks until everything recorded before the call is on disk
+    void commit();
+    // O(1), thread safe
+    std::optional<Entry> find(const juce::File& file) const;
+
+    static juce::String statusToString(FileStatus status);
+    static std::optional<FileStatus> statusFromString(const juce::String& text);
+
+private:
+    // Returns false if the last line was torn by a crash
+    bool load(const juce::File& journalFile);
+    void runCommitter();
+    void writeAndSync(const std::string& text);
+
+    mutable std::mutex mMutex;
+    std::unordered_map<std::string, Entry> mEntries;
+
+    std::FILE* mStream = nullptr;
+    std::string mPending;
+    juce::uint64 mRecorded = 0;
+    juce::uint64 mCommitted = 0;
+    bool mShouldExit = false;
+    std::chrono::milliseconds mCommitInterval { 20 };
+    std::condition_variable mCommitRequested;
+    std::condition_variable mCommitDone;
+    std::thread mCommitter;
+
+    // Commit early instead of waiting for the interval once this much piled up
+    static constexpr size_t mMaxPendingBytes = 64 * 1024;
+};
+
+} // namespace norm
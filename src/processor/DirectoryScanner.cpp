@@ -0,0 +1,237 @@
+#include "DirectoryScanner.h"
+#include "util/Logger.h"
+#include <thread>
+
+namespace norm
+{
+    namespace
+    {
+        const juce::String separator = "\t";
+    }
+
+    bool ScanSnapshot::load(const juce::File& file)
+    {
+        mEntries.clear();
+        if (!file.existsAsFile()) return false;
+
+        juce::StringArray lines;
+        lines.addLines(file.loadFileAsString());
+
+        for (const auto& line : lines)
+        {
+            // the path goes last, it may contain anything but a newline
+            auto fields = juce::StringArray::fromTokens(line, separator, {});
+            if (fields.size() < 3) continue;
+
+            Entry entry;
+            entry.size = fields[0].getLargeIntValue();
+            entry.modificationTimeMs = fields[1].getLargeIntValue();
+
+            fields.removeRange(0, 2);
+            mEntries[fields.joinIntoString(separator).toStdString()] = entry;
+        }
+
+        return true;
+    }
+    bool ScanSnapshot::save(const juce::File& file) const
+    {
+        EXPECT_OR_RETURN (mComplete,
+                          false,
+                          "Not saving scan snapshot {}, the scan was incomplete",
+                          file.getFullPathName().toStdString());
+
+        juce::TemporaryFile temporary(file);
+
+        {
+            juce::FileOutputStream stream(temporary.getFile());
+            EXPECT_OR_RETURN (stream.openedOk(),
+                              false,
+                              "Unable to write scan snapshot {}",
+                              file.getFullPathName().toStdString());
+
+            for (const auto& [path, entry] : mEntries)
+            {
+                stream << juce::String(entry.size) << separator
+                       << juce::String(entry.modificationTimeMs) << separator
+                       << juce::String(path) << "\n";
+            }
+
+            stream.flush();
+            if (stream.getStatus().failed()) return false;
+        }
+
+        return temporary.overwriteTargetFileWithTemporary();
+    }
+
+    void ScanSnapshot::add(const juce::File& file, const Entry& entry)
+    {
+        mEntries[file.getFullPathName().toStdString()] = entry;
+    }
+    std::optional<ScanSnapshot::Entry> ScanSnapshot::find(const juce::File& file) const
+    {
+        auto it = mEntries.find(file.getFullPathName().toStdString());
+        if (it == mEntries.end()) return std::nullopt;
+        return it->second;
+    }
+    juce::Array<juce::File> ScanSnapshot::getRemoved(const ScanSnapshot& newer) const
+    {
+        juce::Array<juce::File> removed;
+        for (const auto& [path, entry] : mEntries)
+        {
+            if (newer.mEntries.count(path) == 0) removed.add(juce::File(path));
+        }
+        return removed;
+    }
+
+    //==========================================================================
+
+    DirectoryScanner::DirectoryScanner(Options options)
+        : mOptions(std::move(options))
+    {
+    }
+    DirectoryScanner::~DirectoryScanner() {}
+
+    ScanSnapshot DirectoryScanner::scan(const juce::File& root,
+                                        const FileCallback& onFile,
+                                        const ScanSnapshot* previous)
+    {
+        ScanSnapshot snapshot;
+        snapshot.mComplete = false;
+        EXPECT_OR_RETURN (root.isDirectory(),
+                          snapshot,
+                          "{} is not a directory",
+                          root.getFullPathName().toStdString());
+
+        mDirectories.assign(1, root);
+        mNumberOfBusyThreads = 0;
+
+        // Every thread collects what it found on its own, they only meet on
+        // the directory queue
+        const int numberOfThreads = juce::jmax(1, mOptions.numberOfThreads);
+        std::vector<FoundFiles> found((size_t)numberOfThreads);
+        std::vector<std::thread> threads;
+
+        for (int t = 0; t < numberOfThreads; t++)
+        {
+            threads.emplace_back([this, &onFile, previous, &files = found[(size_t)t]]
+            {
+                runThread(onFile, previous, files);
+            });
+        }
+        for (auto& thread : threads) thread.join();
+
+        // A cancel that came after the last listing counts too, it cannot
+        // be told apart from one that cut the walk short
+        snapshot.mComplete = !mShouldCancel;
+
+        size_t numberOfFiles = 0;
+        for (const auto& files : found) numberOfFiles += files.size();
+        snapshot.mEntries.reserve(numberOfFiles);
+
+        for (auto& files : found)
+        {
+            for (auto& [path, entry] : files)
+            {
+                snapshot.mEntries.emplace(std::move(path), entry);
+            }
+        }
+
+        MY_LOG_INFO("Scanned {}: {} files{}",
+                    root.getFullPathName().toStdString(), numberOfFiles,
+                    snapshot.mComplete ? "" : ", cancelled");
+        return snapshot;
+    }
+
+    void DirectoryScanner::runThread(const FileCallback& onFile,
+                                     const ScanSnapshot* previous,
+                                     FoundFiles& found)
+    {
+        for (;;)
+        {
+            juce::File directory;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mCondition.wait(lock, [this]
+                {
+                    return !mDirectories.empty() || mNumberOfBusyThreads == 0;
+                });
+
+                // Nothing queued and nobody left who could queue more
+                if (mDirectories.empty() || mShouldCancel)
+                {
+                    mCondition.notify_all();
+                    return;
+                }
+
+                directory = std::move(mDirectories.front());
+                mDirectories.pop_front();
+                mNumberOfBusyThreads++;
+            }
+
+            listDirectory(directory, onFile, previous, found);
+
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mNumberOfBusyThreads--;
+                if (mNumberOfBusyThreads == 0 && mDirectories.empty())
+                {
+                    mCondition.notify_all();
+                }
+            }
+        }
+    }
+
+    void DirectoryScanner::listDirectory(const juce::File& directory,
+                                         const FileCallback& onFile,
+                                         const ScanSnapshot* previous,
+                                         FoundFiles& found)
+    {
+        int whatToLookFor = juce::File::findFilesAndDirectories;
+        if (mOptions.ignoreHiddenFiles) whatToLookFor |= juce::File::ignoreHiddenFiles;
+
+        std::vector<juce::File> subdirectories;
+
+        // Not recursive: subdirectories go back to the queue, so that any
+        // idle thread can pick them up
+        for (const auto& entry : juce::RangedDirectoryIterator(directory,
+                                                               false,
+                                                               "*",
+                                                               whatToLookFor))
+        {
+            if (mShouldCancel) break;
+
+            const auto file = entry.getFile();
+
+            if (entry.isDirectory())
+            {
+                // Links could lead in circles
+                if (!file.isSymbolicLink()) subdirectories.push_back(file);
+                continue;
+            }
+
+            if (!file.hasFileExtension(mOptions.extensions)) continue;
+
+            const ScanSnapshot::Entry info { entry.getFileSize(),
+                                             entry.getModificationTime().toMilliseconds() };
+            found.emplace_back(file.getFullPathName().toStdString(), info);
+
+            const auto before = previous != nullptr ? previous->find(file)
+                                                    : std::nullopt;
+            if (!before.has_value() || !(*before == info))
+            {
+                if (onFile) onFile(file);
+            }
+        }
+
+        if (subdirectories.empty()) return;
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for (auto& subdirectory : subdirectories)
+            {
+                mDirectories.push_back(std::move(subdirectory));
+            }
+        }
+        mCondition.notify_all();
+    }
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+/*  Finds the audio files under a folder. Directories are listed by several
+    threads at once, which is what makes the difference on network shares
+    where every listing is a round trip, and every file is handed to the
+    caller as soon as it is found instead of after the whole walk.
+
+    A scan returns a snapshot of what it saw (size and modification time per
+    file). Given the snapshot of an earlier scan, only files that are new or
+    changed since are handed on, which makes repeated runs incremental.
+*/
+
+#include <juce_core/juce_core.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <condition_variable>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace norm
+{
+
+class ScanSnapshot
+{
+public:
+    struct Entry
+    {
+        juce::int64 size = 0;
+        juce::int64 modificationTimeMs = 0;
+
+        bool operator==(const Entry& other) const = default;
+    };
+
+public:
+    bool load(const juce::File& file);
+    // Replaces the file in one go, a crash never leaves half a snapshot.
+    // Refuses an incomplete snapshot.
+    bool save(const juce::File& file) const;
+
+    void add(const juce::File& file, const Entry& entry);
+    std::optional<Entry> find(const juce::File& file) const;
+    size_t size() const { return mEntries.size(); }
+    // False if the scan was cancelled or could not list the root. Files
+    // that are still there are missing then, so the snapshot must not be
+    // the baseline of a later scan.
+    bool isComplete() const { return mComplete; }
+
+    // Files in this snapshot that are missing from the newer one
+    juce::Array<juce::File> getRemoved(const ScanSnapshot& newer) const;
+
+private:
+    friend class DirectoryScanner;
+    std::unordered_map<std::string, Entry> mEntries;
+    bool mComplete = true;
+};
+
+class DirectoryScanner
+{
+public:
+    struct Options
+    {
+        // Semicolon separated, as juce::File::hasFileExtension takes them
+        juce::String extensions = "wav;wave;aif;aiff;flac;ogg;mp3";
+        // Listing is I/O bound, so more threads than cores is fine
+        int numberOfThreads = 8;
+        bool ignoreHiddenFiles = true;
+    };
+
+    // Called from the scanner threads, must be thread safe
+    using FileCallback = std::function<void(const juce::File&)>;
+
+public:
+    explicit DirectoryScanner(Options options = {});
+    ~DirectoryScanner();
+
+    // Blocks until the whole tree is listed or cancel() is called. Hands
+    // every matching file to onFile, or with a previous snapshot only those
+    // that are new or changed. Returns the snapshot of this scan, marked
+    // incomplete if it was cancelled.
+    ScanSnapshot scan(const juce::File& root,
+                      const FileCallback& onFile,
+                      const ScanSnapshot* previous = nullptr);
+    // Ends the scan running now, or the next one if it comes first. Every
+    // later scan returns at once too, until rearm().
+    void cancel() { mShouldCancel = true; }
+    void rearm() { mShouldCancel = false; }
+
+private:
+    using FoundFiles = std::vector<std::pair<std::string, ScanSnapshot::Entry>>;
+
+    void runThread(const FileCallback& onFile,
+                   const ScanSnapshot* previous,
+                   FoundFiles& found);
+    void listDirectory(const juce::File& directory,
+                       const FileCallback& onFile,
+                       const ScanSnapshot* previous,
+                       FoundFiles& found);
+
+    const Options mOptions;
+    std::atomic<bool> mShouldCancel { false };
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<juce::File> mDirectories;
+    // Directories being listed right now, they may still add more
+    int mNumberOfBusyThreads = 0;
+};
+
+} // namespace norm
@@ -1,5 +1,8 @@
 #include "FileHandler.h"
+#include "Mp3GainWriter.h"
+#include "TagWriter.h"
 #include "util/Logger.h"
+#include "util/Trace.h"
 
 namespace norm
 {
@@ -10,10 +13,32 @@ namespace norm
     }
     FileHandler::~FileHandler() {}
 
-    bool FileHandler::openFile(juce::File file)
+    bool FileHandler::openFile(juce::File file, bool keepAudioInMemory)
     {
+        NORM_TRACE_SCOPE("FileHandler::openFile");
+
+        mHasFileOpen = false;
+        mKeepAudioInMemory = keepAudioInMemory;
+
         mFile = file;
-        mAudioReader.reset(mAudioFormatManager.createReaderFor(mFile));
+        mAudioReader.reset();
+
+        if (mPrefetchedFile != juce::File() && mPrefetchedFile != mFile)
+        {
+            mPrefetchedFile = juce::File();
+            mPrefetchedData.reset();
+        }
+
+        if (mPrefetchedFile == mFile)
+        {
+            // The reader owns the stream, the stream only points at the data
+            mAudioReader.reset(mAudioFormatManager.createReaderFor(
+                std::make_unique<juce::MemoryInputStream>(mPrefetchedData, false)));
+        }
+        else
+        {
+            mAudioReader.reset(mAudioFormatManager.createReaderFor(mFile));
+        }
         EXPECT_OR_RETURN (
             mAudioReader != nullptr,
             false, 
@@ -22,95 +47,309 @@ namespace norm
         
         mFileAttributes.length = mAudioReader->lengthInSamples;
         mFileAttributes.numberOfChannels = mAudioReader->numChannels;
-        mBuffer.setSize((int)mFileAttributes.numberOfChannels, 
-                        (int)mFileAttributes.length);
+        mFileAttributes.channelLayout = mAudioReader->getChannelLayout();
+        if (mKeepAudioInMemory)
+        {
+            mSamples.setSize((int)mFileAttributes.numberOfChannels,
+                             mFileAttributes.length,
+                             SampleStore::getFormatFor(mAudioReader->bitsPerSample,
+                                                       mAudioReader->usesFloatingPointData));
+        }
+        else
+        {
+            mSamples.clear();
+        }
         mPlayhead = 0;
+        mLinearGain = 1.f;
         mFileAttributes.sampleRate = mAudioReader->sampleRate;
         mSamplesPerBlock = (int)std::floor(mFileAttributes.sampleRate / 10.0);
 
         mFileAttributes.metadata = mAudioReader->metadataValues;
-        juce::String loudnessMetadata = 
-            mFileAttributes.metadata.getValue(LoudnessTag, "Unset");
-        if (loudnessMetadata == "Unset") 
-        { 
-            mHasLoudnessMetadata = false;
-        }
-        else
+        mTaggedRecord = GainModel::readTags(mFileAttributes.metadata);
+        mRecord.reset();
+
+        // Only WAV metadata comes through the readers, other formats keep
+        // the record in tags of their own
+        if (!mTaggedRecord.has_value() && TagWriter::canWrite(mFile))
         {
-            mHasLoudnessMetadata = true;
-            mLoudness = loudnessMetadata.getFloatValue();
+            std::unique_ptr<juce::InputStream> stream;
+            if (mPrefetchedFile == mFile)
+                stream = std::make_unique<juce::MemoryInputStream>(mPrefetchedData, false);
+            else
+                stream = mFile.createInputStream();
+
+            if (stream != nullptr)
+            {
+                mTaggedRecord = GainModel::fromString(
+                    TagWriter::readFields(*stream)[GainModel::RecordField]);
+            }
         }
 
         mHasFileOpen = true;
         return true;
     }
+    void FileHandler::setPrefetchedData(const juce::File& file, juce::MemoryBlock data)
+    {
+        // Not while a reader may still point into the old data
+        if (mHasFileOpen && mFile == mPrefetchedFile)
+        {
+            mAudioReader.reset();
+            mHasFileOpen = false;
+        }
+
+        mPrefetchedFile = file;
+        mPrefetchedData = std::move(data);
+    }
     bool FileHandler::readNextBlock(juce::AudioBuffer<float>* buffer)
     {
+        NORM_TRACE_SCOPE("FileHandler::readNextBlock");
+
         EXPECT_OR_RETURN (mHasFileOpen,
                           false,
                           "Cannot perform read without a file open");
 
-        if (mPlayhead + mSamplesPerBlock > mFileAttributes.length) return false;
+        if (mPlayhead + mSamplesPerBlock > mFileAttributes.length)
+        {
+            // Too short to measure, but written back with the rest. The
+            // store is not cleared, so it has to be filled to the end.
+            const int remaining = (int)(mFileAttributes.length - mPlayhead);
+            if (mKeepAudioInMemory && remaining > 0)
+            {
+                mAudioReader->read (buffer, 0, remaining, mPlayhead, true, true);
+                mSamples.write(*buffer, mPlayhead, remaining);
+                mPlayhead += remaining;
+            }
+            return false;
+        }
 
         mAudioReader->read (buffer,
                             0,
                             mSamplesPerBlock,
-                            (int)mPlayhead,
+                            mPlayhead,
                             true,
                             true);
 
-        for (unsigned int ch = 0; ch < mFileAttributes.numberOfChannels; ch++)
+        if (mKeepAudioInMemory)
         {
-            mBuffer.copyFrom ((int)ch, 
-                              (int)mPlayhead, 
-                              buffer->getReadPointer((int)ch), 
-                              mSamplesPerBlock);
+            mSamples.write(*buffer, mPlayhead, mSamplesPerBlock);
         }
 
         mPlayhead += mSamplesPerBlock;
         return true;
     }
+    bool FileHandler::seekToBlock(juce::int64 blockIndex)
+    {
+        EXPECT_OR_RETURN (mHasFileOpen,
+                          false,
+                          "Cannot seek without a file open");
+
+        // The in-memory copy is written back as a whole, it cannot have holes
+        EXPECT_OR_RETURN (!mKeepAudioInMemory,
+                          false,
+                          "Seeking is only possible for files opened for analysis only");
+
+        const juce::int64 position = blockIndex * mSamplesPerBlock;
+        EXPECT_OR_RETURN (blockIndex >= 0 && position <= mFileAttributes.length,
+                          false,
+                          "Block {} is out of range", blockIndex);
+
+        // PCM readers position by frame, so this is a plain seek, no decoding
+        mPlayhead = position;
+        return true;
+    }
     void FileHandler::applyGainDecibel(float gain)
     {
-        EXPECT_OR_RETURN (mHasLoudnessMetadata, 
-                          void(), 
-                          "Calculate Loudness before applying gain");
-
-        float linear_gain = juce::Decibels::decibelsToGain(gain);
-        mBuffer.applyGain(linear_gain);
-        mLoudness *= gain;
-        mFileAttributes.metadata.set(LoudnessTag, juce::String(mLoudness));
+        mLinearGain *= juce::Decibels::decibelsToGain(gain);
+
+        if (mRecord.has_value())
+        {
+            mRecord->appliedGain += gain;
+            GainModel::writeTags(mFileAttributes.metadata, *mRecord);
+        }
     }
-    void FileHandler::setLoundessMetadata(float loudness)
+    void FileHandler::setLoudnessRecord(const LoudnessRecord& record)
     {
-        mLoudness = loudness;
-        mFileAttributes.metadata.set(LoudnessTag, juce::String(mLoudness));
-        mHasLoudnessMetadata = true;
+        mRecord = record;
+        const float taggedGain = mTaggedRecord.has_value() ? mTaggedRecord->getSampleGain() : 0.f;
+        mLinearGain = juce::Decibels::decibelsToGain(record.appliedGain - taggedGain);
+        GainModel::writeTags(mFileAttributes.metadata, record);
     }
-    void FileHandler::writeFile()
+    bool FileHandler::writeFile()
     {
-        EXPECT_OR_RETURN (mHasLoudnessMetadata && mHasFileOpen,
-                          void(),
+        return writeFile(mFile);
+    }
+    bool FileHandler::writeFile(const juce::File& target)
+    {
+        NORM_TRACE_SCOPE("FileHandler::writeFile");
+
+        EXPECT_OR_RETURN (mRecord.has_value() && mHasFileOpen,
+                          false,
                           "No file open, or file not analyzed");
 
-        std::unique_ptr<juce::AudioFormat> format;
-        format.reset(mAudioFormatManager.findFormatForFileExtension(
-            mFile.getFileExtension()));
+        EXPECT_OR_RETURN (mKeepAudioInMemory,
+                          false,
+                          "File was opened for analysis only");
+
+        const auto path = target.getFullPathName().toStdString();
 
-        juce::FileOutputStream outputStream(mFile);
+        EXPECT_OR_RETURN (target.getParentDirectory().createDirectory(),
+                          false,
+                          "Unable to create the folder for {}", path);
 
-        auto writer = format->createWriterFor(&outputStream,
-                                              mFileAttributes.sampleRate,
-                                              mFileAttributes.numberOfChannels,
-                                              (int)mAudioReader->bitsPerSample,
-                                              mFileAttributes.metadata,
-                                              0);
+        // There is no MP3 encoder, and no need for one
+        if (Mp3GainWriter::isMp3File(mFile) && Mp3GainWriter::isMp3File(target))
+        {
+            return writeMp3(target);
+        }
 
-        writer->writeFromAudioSampleBuffer (mBuffer,
-                                            0, 
-                                            (int)mFileAttributes.length);
+        // Owned by the format manager
+        auto format = mAudioFormatManager.findFormatForFileExtension(
+            target.getFileExtension());
+        EXPECT_OR_RETURN (format != nullptr,
+                          false,
+                          "No audio format found for writing {}", path);
 
+        // Written next to the target and swapped in when complete, so a
+        // failure half way through leaves the target untouched
+        juce::TemporaryFile temporaryFile(target);
+        std::unique_ptr<juce::OutputStream> outputStream =
+            temporaryFile.getFile().createOutputStream();
+        EXPECT_OR_RETURN (outputStream != nullptr,
+                          false,
+                          "Unable to open a temporary file next to {}", path);
+
+        std::unique_ptr<juce::AudioFormatWriter> writer(
+            format->createWriterFor(outputStream.get(),
+                                    mFileAttributes.sampleRate,
+                                    mFileAttributes.numberOfChannels,
+                                    (int)mAudioReader->bitsPerSample,
+                                    mFileAttributes.metadata,
+                                    0));
+        EXPECT_OR_RETURN (writer != nullptr,
+                          false,
+                          "Format {} cannot write {}",
+                          format->getFormatName().toStdString(), path);
+
+        // The writer owns the stream from here on
+        outputStream.release();
+
+        const bool written = mWriteStage.write(*writer,
+                                               mSamples,
+                                               0,
+                                               (int)mFileAttributes.length,
+                                               mLinearGain);
+        writer.reset();
+
+        EXPECT_OR_RETURN (written, false, "Writing audio to {} failed", path);
+
+        // The writers of these formats leave our metadata out
+        if (TagWriter::canWrite(target)
+            && !TagWriter::writeFields(temporaryFile.getFile(), GainModel::makeGainFields(*mRecord, 0.f)))
+        {
+            MY_LOG_WARNING("The loudness record could not be tagged into {}", path);
+        }
+
+        closeFile(target);
+
+        EXPECT_OR_RETURN (temporaryFile.overwriteTargetFileWithTemporary(),
+                          false,
+                          "Unable to replace {}", path);
+        return true;
+    }
+    bool FileHandler::writeMp3(const juce::File& target)
+    {
+        const auto path = target.getFullPathName().toStdString();
+
+        juce::MemoryBlock data;
+        if (mPrefetchedFile == mFile)
+        {
+            data = mPrefetchedData;
+        }
+        else
+        {
+            EXPECT_OR_RETURN (mFile.loadFileAsData(data),
+                              false,
+                              "Unable to read {}", mFile.getFullPathName().toStdString());
+        }
+
+        const Mp3GainWriter mp3(std::move(data));
+        EXPECT_OR_RETURN (mp3.isValid(),
+                          false,
+                          "{} has no MPEG layer III frames", mFile.getFullPathName().toStdString());
+
+        // Only what the samples do not carry yet
+        const float taggedGain = mTaggedRecord.has_value() ? mTaggedRecord->getSampleGain() : 0.f;
+        const float gain = mRecord->appliedGain - taggedGain;
+        const auto range = mp3.getStepRange();
+        int steps = juce::jlimit(range.getStart(), range.getEnd(),
+                                 juce::roundToInt(gain / Mp3GainWriter::stepDB));
+
+        // Nothing can limit the bitstream, the gain stops below the ceiling
+        const float peak = mSamples.getMagnitude();
+        const auto& limiter = mWriteStage.getLimiter();
+        if (limiter.has_value() && peak > 0.f)
+        {
+            const float peakDB = juce::Decibels::gainToDecibels(peak);
+            while (steps > range.getStart()
+                   && peakDB + (float)steps * Mp3GainWriter::stepDB > limiter->ceilingDB)
+            {
+                steps--;
+            }
+        }
+
+        const float sampleGain = (float)steps * Mp3GainWriter::stepDB;
+        const float residual = gain - sampleGain;
+
+        auto record = *mRecord;
+        if (mSignalResidualGain)
+        {
+            record.signalledGain = residual;
+        }
+        else
+        {
+            record.appliedGain = taggedGain + sampleGain;
+            record.signalledGain = 0.f;
+        }
+        const auto fields = GainModel::makeGainFields(
+            record, peak * juce::Decibels::decibelsToGain(sampleGain));
+
+        if (!mp3.canWriteTag())
+        {
+            MY_LOG_WARNING("The ID3v2 tag of {} cannot be rewritten, the gain is not recorded",
+                           path);
+        }
+        MY_LOG_INFO("{}: {} steps of global_gain, {} dB left to the player",
+                    path, steps, mSignalResidualGain ? residual : 0.f);
+
+        closeFile(target);
+        if (!mp3.write(target, steps, fields)) return false;
+
+        mRecord = record;
+        return true;
+    }
+    bool FileHandler::writeTags(const juce::File& target, const LoudnessRecord& record, float peak)
+    {
+        return writeTags(target, record, GainModel::makeGainFields(record, peak));
+    }
+    bool FileHandler::writeTags(const juce::File& target, const LoudnessRecord& record, const juce::StringPairArray& fields)
+    {
+        NORM_TRACE_SCOPE("FileHandler::writeTags");
+
+        closeFile(target);
+        if (!TagWriter::writeFields(target, fields)) return false;
+
+        mRecord = record;
+        return true;
+    }
+    void FileHandler::closeFile(const juce::File& target)
+    {
+        mAudioReader.reset();
         mHasFileOpen = false;
+        if (target == mPrefetchedFile)
+        {
+            mPrefetchedFile = juce::File();
+            mPrefetchedData.reset();
+        }
     }
 
 }
\ No newline at end of file
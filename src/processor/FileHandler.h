@@ -6,7 +6,11 @@
     no calculations whatsoever.
 */
 
+#include "GainModel.h"
+#include "SampleStore.h"
+#include "WriteStage.h"
 #include <memory>
+#include <optional>
 #include <juce_core/juce_core.h>
 #include <juce_audio_basics/juce_audio_basics.h>
 #include <juce_audio_formats/juce_audio_formats.h>
@@ -16,44 +20,90 @@ namespace norm
 
 class FileHandler
 {
-public:
-    inline static const char LoudnessTag[] = "LKFS";
-
 public:
     FileHandler();
     ~FileHandler();
 
-    bool openFile(juce::File file);
+    // Without keepAudioInMemory the file can only be analysed, not written
+    bool openFile(juce::File file, bool keepAudioInMemory = true);
+    // The file's bytes, read ahead e.g. by a UringReader. Opening that file
+    // decodes from memory then, until another file is opened or the file is
+    // written.
+    void setPrefetchedData(const juce::File& file, juce::MemoryBlock data);
+    // False once no whole block is left. The samples after the last whole
+    // block still go into the in-memory copy then.
     bool readNextBlock(juce::AudioBuffer<float>* buffer);
+    // Moves the playhead to the start of the given 100ms block
+    bool seekToBlock(juce::int64 blockIndex);
+    // The gain is applied on the way to the disk, see WriteStage. Adds to
+    // the record if one is set.
     void applyGainDecibel(float gain);
-    void writeFile();
+    // Source loudness and gain for writing, also goes into the tags. Records
+    // are relative to the audio before any of our gain: a file that was
+    // opened with one only gets the difference between the two gains.
+    void setLoudnessRecord(const LoudnessRecord& record);
+    // Replaces the file on disk with the in-memory audio and metadata
+    bool writeFile();
+    // Same, into another file, e.g. in a mirror of the source tree. The
+    // folder is created if needed. MP3 files are not encoded again, their
+    // frames get the gain in 1.5 dB steps, see Mp3GainWriter.
+    bool writeFile(const juce::File& target);
+    WriteStage& getWriteStage() { return mWriteStage; }
+    // MP3 only: the gain the steps cannot express goes into a ReplayGain
+    // tag. Off, the file stays up to 0.75 dB away from its target.
+    void setSignalResidualGain(bool shouldSignal) { mSignalResidualGain = shouldSignal; }
+    // Only the tags of target change, the samples keep what they carry and
+    // the record's signalled gain is left to the player. peak is the sample
+    // peak of the file as it is. FLAC, Ogg Vorbis and MP3, see TagWriter.
+    bool writeTags(const juce::File& target, const LoudnessRecord& record, float peak);
+    // The same with fields made by the caller, e.g. album ones
+    bool writeTags(const juce::File& target, const LoudnessRecord& record, const juce::StringPairArray& fields);
 
-    bool hasLoudnessMetadata() { return mHasLoudnessMetadata; }
-    void setLoundessMetadata(float loudness);
+    bool hasLoudnessRecord() const { return mRecord.has_value(); }
+    // What the tags said when the file was opened, from the header alone
+    const std::optional<LoudnessRecord>& getTaggedRecord() const { return mTaggedRecord; }
     unsigned int getNumberOfChannels() { return mFileAttributes.numberOfChannels; }
     double getSampleRate() { return mFileAttributes.sampleRate; }
+    juce::int64 getLengthInSamples() { return mFileAttributes.length; }
+    int getSamplesPerBlock() { return mSamplesPerBlock; }
+    juce::int64 getNumberOfBlocks() { return mSamplesPerBlock > 0 ? mFileAttributes.length / mSamplesPerBlock : 0; }
+    // From the file's metadata if it has any, the default for the channel
+    // count otherwise
+    juce::AudioChannelSet getChannelLayout() { return mFileAttributes.channelLayout; }
 
 private:
+    bool writeMp3(const juce::File& target);
+    // Lets go of the source before the target may replace it
+    void closeFile(const juce::File& target);
+
     juce::AudioFormatManager mAudioFormatManager;
     std::unique_ptr<juce::AudioFormatReader> mAudioReader;
 
     juce::File mFile;
-    juce::AudioBuffer<float> mBuffer;
+    juce::File mPrefetchedFile;
+    juce::MemoryBlock mPrefetchedData;
+    // In the file's own sample format, at most half the size of floats
+    SampleStore mSamples;
     juce::int64 mPlayhead;
+    float mLinearGain = 1.f;
+    WriteStage mWriteStage;
 
     struct {
         juce::StringPairArray metadata;
         unsigned int numberOfChannels = 0;
+        juce::AudioChannelSet channelLayout;
         juce::int64 length = 0;
         double sampleRate = 0;
         int qualityOptionIndex = 0;
     } mFileAttributes;
 
-    bool mHasLoudnessMetadata = false;
-    float mLoudness = 0;
+    std::optional<LoudnessRecord> mTaggedRecord;
+    std::optional<LoudnessRecord> mRecord;
     int mSamplesPerBlock = 0;
 
     bool mHasFileOpen = false;
+    bool mKeepAudioInMemory = true;
+    bool mSignalResidualGain = true;
 };
 
 } // namespace norm
\ No newline at end of file
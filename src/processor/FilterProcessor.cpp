@@ -1,106 +1,339 @@
 #include "FilterProcessor.h"
 #include <juce_core/juce_core.h>
-#include <complex>
 
 namespace norm
 {
+    namespace
+    {
+        // The coefficients a kernel actually reads. HP_B is always {1, -2, 1}.
+        struct Biquads
+        {
+            float hsB0, hsB1, hsB2, hsA0, hsA1;
+            float hpA0, hpA1;
+        };
+
+        constexpr Biquads toBiquads(const KWCoefficients& c)
+        {
+            return { c.HS_B[0], c.HS_B[1], c.HS_B[2], c.HS_A[0], c.HS_A[1],
+                     c.HP_A[0], c.HP_A[1] };
+        }
+
+        inline float highShelf(float u, float* m, const Biquads& k)
+        {
+            const float y = k.hsB0 * u + k.hsB1 * m[0] + k.hsB2 * m[1] -
+                            k.hsA0 * m[2] - k.hsA1 * m[3];
+            m[1] = m[0];
+            m[0] = u;
+            m[3] = m[2];
+            m[2] = y;
+            return y;
+        }
+        inline float highPass(float u, float* m, const Biquads& k)
+        {
+            const float y = 1.f * u + -2.f * m[0] + 1.f * m[1] -
+                            k.hpA0 * m[2] - k.hpA1 * m[3];
+            m[1] = m[0];
+            m[0] = u;
+            m[3] = m[2];
+            m[2] = y;
+            return y;
+        }
+
+        inline void filterChannel(float* data, KWState& state, int size,
+                                   const Biquads& k)
+        {
+            // work on a local copy so the compiler can keep it in registers
+            KWState m = state;
+            for (int s = 0; s < size; s++)
+            {
+                data[s] = highPass(highShelf(data[s], m.Mhs, k), m.Mhp, k);
+            }
+            state = m;
+        }
+
+        // Filters one channel without writing the result anywhere and
+        // returns the energy (sum of squares) of the filtered signal.
+        inline float filterChannelEnergy(const float* data, KWState& state,
+                                         int size, const Biquads& k)
+        {
+            KWState m = state;
+            float energy = 0.f;
+            for (int s = 0; s < size; s++)
+            {
+                const float y = highPass(highShelf(data[s], m.Mhs, k), m.Mhp, k);
+                energy += y * y;
+            }
+            state = m;
+            return energy;
+        }
+
+        // Channel count known at compile time: walk the block sample by sample
+        // and the channels in the inner, fully unrolled loop.
+        template<int N>
+        inline float filterFixedLayoutEnergy(const float* const* channels,
+                                             KWState* states,
+                                             const float* weights,
+                                             int size,
+                                             const Biquads& k)
+        {
+            const float* data[N];
+            KWState m[N];
+            float energy[N];
+            for (int ch = 0; ch < N; ch++)
+            {
+                data[ch] = channels[ch];
+                m[ch] = states[ch];
+                energy[ch] = 0.f;
+            }
+
+            for (int s = 0; s < size; s++)
+            {
+                for (int ch = 0; ch < N; ch++)
+                {
+                    const float y = highPass(highShelf(data[ch][s], m[ch].Mhs, k),
+                                             m[ch].Mhp, k);
+                    energy[ch] += y * y;
+                }
+            }
+
+            float weightedEnergy = 0.f;
+            for (int ch = 0; ch < N; ch++)
+            {
+                states[ch] = m[ch];
+                weightedEnergy += weights[ch] * energy[ch];
+            }
+            return weightedEnergy;
+        }
+
+        template<int N, const KWCoefficients& C>
+        float specialisedKernel(const float* const* channels,
+                                KWState* states,
+                                const KWCoefficients&,
+                                const float* weights,
+                                int,
+                                int size)
+        {
+            static constexpr Biquads k = toBiquads(C);
+            return filterFixedLayoutEnergy<N>(channels, states, weights, size, k);
+        }
+
+        float genericKernel(const float* const* channels,
+                            KWState* states,
+                            const KWCoefficients& coeffs,
+                            const float* weights,
+                            int numChannels,
+                            int size)
+        {
+            const Biquads k = toBiquads(coeffs);
+            float weightedEnergy = 0.f;
+            for (int ch = 0; ch < numChannels; ch++)
+            {
+                weightedEnergy += weights[ch] *
+                    filterChannelEnergy(channels[ch], states[ch], size, k);
+            }
+            return weightedEnergy;
+        }
+
+        // mono, stereo, 5.1 and 7.1, the latter two both with and without
+        // the LFE channel, which loudness measurement leaves out
+        template<const KWCoefficients& C>
+        KWFilterBank::Kernel findKernelForLayout(int numberOfChannels)
+        {
+            switch (numberOfChannels)
+            {
+                case 1: return &specialisedKernel<1, C>;
+                case 2: return &specialisedKernel<2, C>;
+                case 5: return &specialisedKernel<5, C>;
+                case 6: return &specialisedKernel<6, C>;
+                case 7: return &specialisedKernel<7, C>;
+                case 8: return &specialisedKernel<8, C>;
+                default: return nullptr;
+            }
+        }
+
+        KWFilterBank::Kernel findSpecialisedKernel(int rateIndex,
+                                                   int numberOfChannels)
+        {
+            using namespace kweighting;
+            switch (rateIndex)
+            {
+                case 0: return findKernelForLayout<Coeffs44100>(numberOfChannels);
+                case 1: return findKernelForLayout<Coeffs48000>(numberOfChannels);
+                case 2: return findKernelForLayout<Coeffs88200>(numberOfChannels);
+                case 3: return findKernelForLayout<Coeffs96000>(numberOfChannels);
+                case 4: return findKernelForLayout<Coeffs192000>(numberOfChannels);
+                default: return nullptr;
+            }
+        }
+    }
+
+    namespace kweighting
+    {
+        int findPrecomputedRate(double sampleRate)
+        {
+            for (size_t i = 0; i < PrecomputedRates.size(); i++)
+            {
+                // float comparison
+                if (std::fabs(PrecomputedRates[i] - sampleRate) < 1.0)
+                    return (int)i;
+            }
+            return -1;
+        }
+        KWCoefficients getCoefficients(double sampleRate)
+        {
+            jassert(sampleRate > 0);
+
+            switch (findPrecomputedRate(sampleRate))
+            {
+                case 0: return Coeffs44100;
+                case 1: return Coeffs48000;
+                case 2: return Coeffs88200;
+                case 3: return Coeffs96000;
+                case 4: return Coeffs192000;
+                default: return design(sampleRate);
+            }
+        }
+    }
+
+    //==========================================================================
+
     KWFilter::KWFilter() {}
     KWFilter::~KWFilter() {}
 
     void KWFilter::reset(double sampleRate)
     {
-        for (int i = 0; i < 4; i++)
-            {
-                Mhp[i] = 0;
-                Mhs[i] = 0;
-            }
+        mState = KWState{};
 
         // float comparison
-        const bool sampleRateActuallyChanged = 
+        const bool sampleRateActuallyChanged =
             std::fabs(fs - sampleRate) > 1.f;
         if (sampleRateActuallyChanged)
         {
             fs = sampleRate;
-            recalibrate();
+            mCoeffs = kweighting::getCoefficients(fs);
         }
     }
     void KWFilter::process(float* data, int size)
     {
         jassert(fs > 0);
 
-        for (int s = 0; s < size; s++)
+        filterChannel(data, mState, size, toBiquads(mCoeffs));
+    }
+
+    //==========================================================================
+
+    KWFilterBank::KWFilterBank() {}
+    KWFilterBank::~KWFilterBank() {}
+
+    void KWFilterBank::reset(double sampleRate, int numberOfChannels)
+    {
+        jassert(sampleRate > 0 && numberOfChannels > 0);
+
+        // float comparison
+        const bool sampleRateActuallyChanged =
+            std::fabs(fs - sampleRate) > 1.f;
+        if (sampleRateActuallyChanged)
         {
-            // high-shelf filtering ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-            float u = data[s];
-            float u1 = Mhs[0];
-            float u2 = Mhs[1];
-            float y1 = Mhs[2];
-            float y2 = Mhs[3];
-
-            data[s] =
-                HS_B[0] * u + HS_B[1] * u1 + HS_B[2] * u2 -
-                HS_A[0] * y1 - HS_A[1] * y2;
-
-            Mhs[0] = u;
-            Mhs[1] = u1;
-            Mhs[2] = data[s];
-            Mhs[3] = y1;
-
-            // high-pass filtering ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-            u = data[s];
-            u1 = Mhp[0];
-            u2 = Mhp[1];
-            y1 = Mhp[2];
-            y2 = Mhp[3];
-
-            data[s] =
-                HP_B[0] * u + HP_B[1] * u1 + HP_B[2] * u2 -
-                HP_A[0] * y1 - HP_A[1] * y2;
-
-            Mhp[0] = u;
-            Mhp[1] = u1;
-            Mhp[2] = data[s];
-            Mhp[3] = y1;
+            fs = sampleRate;
+            mCoeffs = kweighting::getCoefficients(fs);
         }
+
+        chnum = numberOfChannels;
+        mStates.assign((size_t)chnum, KWState{});
+
+        mKernel = mAllowSpecialised
+                ? findSpecialisedKernel(kweighting::findPrecomputedRate(fs), chnum)
+                : nullptr;
+        mIsSpecialised = mKernel != nullptr;
+        if (!mIsSpecialised) mKernel = &genericKernel;
     }
+    void KWFilterBank::clear()
+    {
+        for (auto& state : mStates)
+        {
+            state = KWState{};
+        }
+    }
+    float KWFilterBank::processEnergy(const float* const* channels,
+                                      const float* weights,
+                                      int size)
+    {
+        jassert(fs > 0 && mKernel != nullptr);
+
+        return mKernel(channels, mStates.data(), mCoeffs, weights, chnum, size);
+    }
+
+    //==========================================================================
+
+    KWFilterLanes::KWFilterLanes() {}
+    KWFilterLanes::~KWFilterLanes() {}
 
-    void KWFilter::recalibrate()
+    void KWFilterLanes::resetLane(int lane, double sampleRate)
     {
-        jassert(fs > 0);
+        jassert(lane >= 0 && lane < numberOfLanes && sampleRate > 0);
+
+        const auto l = (size_t)lane;
+        const auto c = kweighting::getCoefficients(sampleRate);
+        hsB0[l] = c.HS_B[0];
+        hsB1[l] = c.HS_B[1];
+        hsB2[l] = c.HS_B[2];
+        hsA0[l] = c.HS_A[0];
+        hsA1[l] = c.HS_A[1];
+        hpA0[l] = c.HP_A[0];
+        hpA1[l] = c.HP_A[1];
 
-        // high-shelf coeffs ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-        float Khs = tan(defines::pi * Fhs / (float)fs);
-        float khs2 = Khs * Khs;
-        float a0 = 1.0f + Khs / Qhs + khs2;
-
-        HS_B[0] = (Vh + Vb * Khs / Qhs + khs2) / a0;
-        HS_B[1] = 2.0f * (khs2 - Vh) / a0;
-        HS_B[2] = (Vh - Vb * Khs / Qhs + khs2) / a0;
-        HS_A[0] = 2.0f * (khs2 - 1.0f) / a0;
-        HS_A[1] = (1.0f - Khs / Qhs + khs2) / a0;
-
-        // high-pass coeffs ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-        float Khp = tan(defines::pi * Fhp / (float)fs);
-        float khp2 = Khp * Khp;
-
-        HP_B[0] = 1.f;
-        HP_B[1] = -2.f;
-        HP_B[2] = 1.f;
-        HP_A[0] = 2.f * (khp2 - 1.f) / (1.f + Khp / Qhp + khp2);
-        HP_A[1] = (1.f - Khp / Qhp + khp2) / (1.f + Khp / Qhp + khp2);
-
-        // attenuation @ 997Hz ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-        using c = std::complex<float>;
-        c j(0.f, 1.f);
-        c z = std::exp(c(997.f * 2.f * defines::pi / (float)fs) * -j);
-
-        c h =  c(HS_B[0], 0) * z * z + c(HS_B[1], 0) * z + c(HS_B[2], 0);
-        h  *= (c(HP_B[0], 0) * z * z + c(HP_B[1], 0) * z + c(HP_B[2], 0));
-        h  /= (c(1.0, 0)     * z * z + c(HS_A[0], 0) * z + c(HS_A[1], 0));
-        h  /= (c(1.0, 0)     * z * z + c(HP_A[0], 0) * z + c(HP_A[1], 0));
-
-        att = std::abs(h);
+        hsU1[l] = hsU2[l] = hsY1[l] = hsY2[l] = 0.f;
+        hpU1[l] = hpU2[l] = hpY1[l] = hpY2[l] = 0.f;
     }
-}
+    void KWFilterLanes::clearLane(int lane)
+    {
+        jassert(lane >= 0 && lane < numberOfLanes);
+
+        // All zero coefficients make silence out of anything
+        const auto l = (size_t)lane;
+        hsB0[l] = hsB1[l] = hsB2[l] = hsA0[l] = hsA1[l] = 0.f;
+        hpA0[l] = hpA1[l] = 0.f;
+        hsU1[l] = hsU2[l] = hsY1[l] = hsY2[l] = 0.f;
+        hpU1[l] = hpU2[l] = hpY1[l] = hpY2[l] = 0.f;
+    }
+    void KWFilterLanes::processEnergy(const float* interleaved,
+                                      int size,
+                                      float* energies)
+    {
+        constexpr int N = numberOfLanes;
+
+        // work on local copies so the compiler can keep them in registers
+        alignas(32) Lanes u1 = hsU1, u2 = hsU2, y1 = hsY1, y2 = hsY2;
+        alignas(32) Lanes v1 = hpU1, v2 = hpU2, z1 = hpY1, z2 = hpY2;
+        alignas(32) Lanes energy {};
+
+        for (int s = 0; s < size; s++)
+        {
+            const float* u = interleaved + (size_t)s * N;
+
+            // Same arithmetic as highShelf and highPass, lane by lane
+            for (size_t l = 0; l < (size_t)N; l++)
+            {
+                const float hs = hsB0[l] * u[l] + hsB1[l] * u1[l] + hsB2[l] * u2[l] -
+                                 hsA0[l] * y1[l] - hsA1[l] * y2[l];
+                u2[l] = u1[l];
+                u1[l] = u[l];
+                y2[l] = y1[l];
+                y1[l] = hs;
 
-#undef pi
\ No newline at end of file
+                const float hp = 1.f * hs + -2.f * v1[l] + 1.f * v2[l] -
+                                 hpA0[l] * z1[l] - hpA1[l] * z2[l];
+                v2[l] = v1[l];
+                v1[l] = hs;
+                z2[l] = z1[l];
+                z1[l] = hp;
+
+                energy[l] += hp * hp;
+            }
+        }
+
+        hsU1 = u1; hsU2 = u2; hsY1 = y1; hsY2 = y2;
+        hpU1 = v1; hpU2 = v2; hpY1 = z1; hpY2 = z2;
+        for (size_t l = 0; l < (size_t)N; l++) energies[l] += energy[l];
+    }
+}
@@ -1,11 +1,25 @@
 #pragma once
 
 /*  K-Weighted Filter for one channel. Create multiple instances to work on
-    multi-channel audio
+    multi-channel audio, or use KWFilterBank, which filters every channel of
+    a block in one go and only returns the weighted energy of the result.
+
+    KWFilterLanes turns this around for short mono and stereo files, where a
+    loop over one or two channels leaves most of a vector register empty: it
+    filters unrelated channels, e.g. of different files, side by side.
+
+    Coefficients for the common sample rates are designed at compile time.
+    For those rates KWFilterBank runs kernels where both the coefficients and
+    the channel count are template parameters, so the coefficients end up as
+    immediates and the channel loop is unrolled. Any other rate falls back to
+    coefficients designed at runtime and a generic loop.
 */
 
+#include <util/ConstexprMath.h>
+#include <array>
 #include <cmath>
 #include <numbers>
+#include <vector>
 
 // Test Fixture for unit testing
 class FilterTest;
@@ -18,6 +32,113 @@ namespace defines
     static constexpr float pi = std::numbers::pi_v<float>;
 }
 
+struct KWCoefficients
+{
+    // High-Shelf Filter
+    float HS_A[2] = {};
+    float HS_B[3] = {};
+
+    // High-Pass Filter
+    float HP_A[2] = {};
+    float HP_B[3] = {};
+
+    // Linear gain of the whole cascade @ 997Hz
+    float att = 0.f;
+};
+
+// Direct form I memory of both stages: { u[n-1], u[n-2], y[n-1], y[n-2] }
+struct KWState
+{
+    float Mhs[4] = {};
+    float Mhp[4] = {};
+};
+
+namespace kweighting
+{
+    // High-Shelf Filter Contants
+    inline constexpr double Fhs = 1681.9745;
+    inline constexpr double Qhs = 0.70717525;
+    inline constexpr double Gdb = 3.9998438;
+    inline constexpr double Vh = cmath::pow10(Gdb / 20.0);
+    inline constexpr double Vb = cmath::pow10(Gdb / 20.0 * 0.49966678);
+
+    // High-Pass Filter Constants
+    inline constexpr double Fhp = 38.13547;
+    inline constexpr double Qhp = 0.50032705;
+
+    constexpr KWCoefficients design(double fs)
+    {
+        KWCoefficients c;
+
+        // high-shelf coeffs ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+        const double Khs = cmath::tan(std::numbers::pi * Fhs / fs);
+        const double khs2 = Khs * Khs;
+        const double a0 = 1.0 + Khs / Qhs + khs2;
+
+        const double hsB0 = (Vh + Vb * Khs / Qhs + khs2) / a0;
+        const double hsB1 = 2.0 * (khs2 - Vh) / a0;
+        const double hsB2 = (Vh - Vb * Khs / Qhs + khs2) / a0;
+        const double hsA0 = 2.0 * (khs2 - 1.0) / a0;
+        const double hsA1 = (1.0 - Khs / Qhs + khs2) / a0;
+
+        // high-pass coeffs ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+        const double Khp = cmath::tan(std::numbers::pi * Fhp / fs);
+        const double khp2 = Khp * Khp;
+
+        const double hpA0 = 2.0 * (khp2 - 1.0) / (1.0 + Khp / Qhp + khp2);
+        const double hpA1 = (1.0 - Khp / Qhp + khp2) / (1.0 + Khp / Qhp + khp2);
+
+        c.HS_B[0] = (float)hsB0;
+        c.HS_B[1] = (float)hsB1;
+        c.HS_B[2] = (float)hsB2;
+        c.HS_A[0] = (float)hsA0;
+        c.HS_A[1] = (float)hsA1;
+
+        c.HP_B[0] = 1.f;
+        c.HP_B[1] = -2.f;
+        c.HP_B[2] = 1.f;
+        c.HP_A[0] = (float)hpA0;
+        c.HP_A[1] = (float)hpA1;
+
+        // attenuation @ 997Hz ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+        // |H(z)|^2 of each quadratic, evaluated at z = e^(-jw)
+        const double w = 997.0 * 2.0 * std::numbers::pi / fs;
+        const double zr = cmath::cos(w);
+        const double zi = -cmath::sin(w);
+        const double z2r = zr * zr - zi * zi;
+        const double z2i = 2.0 * zr * zi;
+
+        auto magnitudeSquared = [=](double p0, double p1, double p2)
+        {
+            const double re = p0 * z2r + p1 * zr + p2;
+            const double im = p0 * z2i + p1 * zi;
+            return re * re + im * im;
+        };
+
+        const double h2 = magnitudeSquared(hsB0, hsB1, hsB2)
+                        * magnitudeSquared(1.0, -2.0, 1.0)
+                        / magnitudeSquared(1.0, hsA0, hsA1)
+                        / magnitudeSquared(1.0, hpA0, hpA1);
+
+        c.att = (float)cmath::sqrt(h2);
+        return c;
+    }
+
+    inline constexpr std::array<double, 5> PrecomputedRates = {
+        44100.0, 48000.0, 88200.0, 96000.0, 192000.0 };
+
+    inline constexpr KWCoefficients Coeffs44100  = design(44100.0);
+    inline constexpr KWCoefficients Coeffs48000  = design(48000.0);
+    inline constexpr KWCoefficients Coeffs88200  = design(88200.0);
+    inline constexpr KWCoefficients Coeffs96000  = design(96000.0);
+    inline constexpr KWCoefficients Coeffs192000 = design(192000.0);
+
+    // Index into PrecomputedRates, or -1 if the rate has no table
+    int findPrecomputedRate(double sampleRate);
+    // Table entry when there is one, runtime design otherwise
+    KWCoefficients getCoefficients(double sampleRate);
+}
+
 class KWFilter
 {
 public:
@@ -26,35 +147,92 @@ public:
 
     void reset(double sampleRate);
     void process(float* data, int size);
-    static float getLinearAttenuation() { return att; }
+    float getLinearAttenuation() const { return mCoeffs.att; }
 
 private:
-    static void recalibrate();
+    double fs = -1.0;
+    KWCoefficients mCoeffs;
+    KWState mState;
 
-    inline static double fs = -1.0;
-    inline static float att = 0.f;
+    // Test Fixture for KWFilter Unit Test
+    friend FilterTest;
+};
 
-    // High-Shelf Filter
-    inline static float HS_A[2] = {};
-    inline static float HS_B[3] = {};
-    float Mhs[4] = {};
+// K-weights every channel of a block and sums the energy of the filtered
+// signal, each channel scaled by its weight. Picks a specialised kernel on
+// reset when sample rate and channel count allow it.
+class KWFilterBank
+{
+public:
+    using Kernel = float (*)(const float* const* channels,
+                             KWState* states,
+                             const KWCoefficients& coeffs,
+                             const float* weights,
+                             int numChannels,
+                             int size);
 
-    // High-Pass Filter
-    inline static float HP_A[2] = {};
-    inline static float HP_B[3] = {};
-    float Mhp[4] = {};
+public:
+    KWFilterBank();
+    ~KWFilterBank();
 
-    // High-Shelf Filter Contants
-    inline static const float Fhs = 1681.9745f;
-    inline static const float Qhs = 0.70717525f;
-    inline static const float Vh = pow(10.0f, 3.9998438f / 20.0f);
-    inline static float Vb = pow(10.0f, 3.9998438f / 20.0f * 0.49966678f);
+    void reset(double sampleRate, int numberOfChannels);
+    // Clears filter memory but keeps the selected kernel
+    void clear();
+    // Input is left untouched. Returns sum over channels of weight * energy.
+    float processEnergy(const float* const* channels,
+                        const float* weights,
+                        int size);
 
-    // High-Pass Filter Constants
-    inline static float Fhp = 38.13547f;
-    inline static float Qhp = 0.50032705f;
+    float getLinearAttenuation() const { return mCoeffs.att; }
+    bool isSpecialised() const { return mIsSpecialised; }
+    // Forces the generic loop even for a supported rate, for benchmarking
+    void setUseSpecialisedKernels(bool shouldUse) { mAllowSpecialised = shouldUse; }
+
+private:
+    double fs = -1.0;
+    int chnum = 0;
+    KWCoefficients mCoeffs;
+    std::vector<KWState> mStates;
+
+    Kernel mKernel = nullptr;
+    bool mIsSpecialised = false;
+    bool mAllowSpecialised = true;
+
+    friend FilterTest;
+};
+
+// K-weights numberOfLanes unrelated channels side by side and returns the
+// energy of each. Every lane has its own coefficients and memory, so lanes
+// may run at different rates. The input is interleaved by lane and the inner
+// loop runs across the lanes, which the compiler turns into vector code.
+class KWFilterLanes
+{
+public:
+    // A coefficient or state variable of every lane fills one AVX register
+    static constexpr int numberOfLanes = 8;
+
+public:
+    KWFilterLanes();
+    ~KWFilterLanes();
+
+    // Fresh memory and the coefficients for the rate
+    void resetLane(int lane, double sampleRate);
+    // The lane only outputs silence until it is reset again
+    void clearLane(int lane);
+    // Sample s of a lane is interleaved[s * numberOfLanes + lane]. Adds the
+    // energy of each lane's filtered signal to energies[lane].
+    void processEnergy(const float* interleaved, int size, float* energies);
+
+private:
+    using Lanes = std::array<float, numberOfLanes>;
+
+    // Biquads, one value per lane. HP_B is always {1, -2, 1}.
+    alignas(32) Lanes hsB0 {}, hsB1 {}, hsB2 {}, hsA0 {}, hsA1 {};
+    alignas(32) Lanes hpA0 {}, hpA1 {};
+    // KWState, one value per lane
+    alignas(32) Lanes hsU1 {}, hsU2 {}, hsY1 {}, hsY2 {};
+    alignas(32) Lanes hpU1 {}, hpU2 {}, hpY1 {}, hpY2 {};
 
-    // Test Fixture for KWFilter Unit Test
     friend FilterTest;
 };
 
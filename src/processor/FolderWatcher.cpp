@@ -0,0 +1,369 @@
+#include "FolderWatcher.h"
+#include "util/Logger.h"
+#include <vector>
+
+#if JUCE_LINUX
+ #include <cerrno>
+ #include <cstring>
+ #include <poll.h>
+ #include <sys/eventfd.h>
+ #include <sys/inotify.h>
+ #include <unistd.h>
+#endif
+
+namespace norm
+{
+    FolderWatcher::FolderWatcher(Options options)
+        : mOptions(std::move(options))
+    {
+       #if JUCE_LINUX
+        mWakeUpFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+       #endif
+    }
+    FolderWatcher::~FolderWatcher()
+    {
+       #if JUCE_LINUX
+        if (mWakeUpFd >= 0) close(mWakeUpFd);
+       #endif
+    }
+
+    bool FolderWatcher::run(const juce::File& root, const FileCallback& onFile)
+    {
+        EXPECT_OR_RETURN (root.isDirectory(),
+                          false,
+                          "Cannot watch {}, it is not a folder",
+                          root.getFullPathName().toStdString());
+
+        if (runNotified(root, onFile)) return true;
+        return runPolling(root, onFile);
+    }
+    void FolderWatcher::stop()
+    {
+        mShouldStop = true;
+        mWakeUp.signal();
+
+       #if JUCE_LINUX
+        if (mWakeUpFd >= 0)
+        {
+            const juce::uint64 one = 1;
+            juce::ignoreUnused(write(mWakeUpFd, &one, sizeof(one)));
+        }
+       #endif
+    }
+
+    bool FolderWatcher::isCandidate(const juce::File& file) const
+    {
+        return file.hasFileExtension(mOptions.extensions)
+            && !(mOptions.ignoreHiddenFiles && file.isHidden());
+    }
+    void FolderWatcher::touch(const juce::File& file, int delayMs)
+    {
+        if (!isCandidate(file)) return;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDeadlines[file.getFullPathName().toStdString()] =
+            Clock::now() + std::chrono::milliseconds(delayMs);
+    }
+    void FolderWatcher::forget(const juce::File& file)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDeadlines.erase(file.getFullPathName().toStdString());
+    }
+    void FolderWatcher::ignoreOwnWrite(const juce::File& file)
+    {
+        const ScanSnapshot::Entry entry { file.getSize(), file.getLastModificationTime().toMilliseconds() };
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mOwnWrites[file.getFullPathName().toStdString()] = entry;
+    }
+    bool FolderWatcher::isOwnWrite(const juce::File& file)
+    {
+        const ScanSnapshot::Entry entry { file.getSize(), file.getLastModificationTime().toMilliseconds() };
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        const auto it = mOwnWrites.find(file.getFullPathName().toStdString());
+        if (it == mOwnWrites.end()) return false;
+        if (it->second == entry) return true;
+
+        // Dropped again since, or changed by someone else
+        mOwnWrites.erase(it);
+        return false;
+    }
+    void FolderWatcher::touchExisting(const juce::File& directory)
+    {
+        for (const auto& entry : juce::RangedDirectoryIterator(directory,
+                                                               true,
+                                                               "*",
+                                                               juce::File::findFiles))
+        {
+            touch(entry.getFile(), mOptions.settleTimeMs);
+        }
+    }
+
+    int FolderWatcher::handOnSettled(const FileCallback& onFile)
+    {
+        std::vector<juce::File> settled;
+        int untilNext = -1;
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            const auto now = Clock::now();
+
+            for (auto it = mDeadlines.begin(); it != mDeadlines.end();)
+            {
+                if (it->second <= now)
+                {
+                    settled.emplace_back(juce::String(it->first));
+                    it = mDeadlines.erase(it);
+                    continue;
+                }
+
+                const int remaining = 1 + (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                                              it->second - now).count();
+                untilNext = untilNext < 0 ? remaining : juce::jmin(untilNext, remaining);
+                ++it;
+            }
+        }
+
+        // Gone again by now, e.g. a temporary file that was renamed
+        for (const auto& file : settled)
+        {
+            if (file.existsAsFile() && !isOwnWrite(file)) onFile(file);
+        }
+
+        return untilNext;
+    }
+
+    bool FolderWatcher::runNotified(const juce::File& root, const FileCallback& onFile)
+    {
+       #if JUCE_LINUX
+        const int fd = mWakeUpFd >= 0 ? inotify_init1(IN_NONBLOCK | IN_CLOEXEC) : -1;
+        EXPECT_OR_RETURN (fd >= 0,
+                          false,
+                          "inotify is not available ({}), polling instead",
+                          std::strerror(errno));
+
+        constexpr juce::uint32 mask = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE
+                                    | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+        std::unordered_map<int, juce::File> directories;
+
+        auto watchTree = [&](const juce::File& top)
+        {
+            juce::Array<juce::File> toWatch { top };
+            for (const auto& entry : juce::RangedDirectoryIterator(top,
+                                                                   true,
+                                                                   "*",
+                                                                   juce::File::findDirectories))
+            {
+                const auto& directory = entry.getFile();
+                if (directory.isSymbolicLink()) continue;
+                if (mOptions.ignoreHiddenFiles && entry.isHidden()) continue;
+                toWatch.add(directory);
+            }
+
+            for (const auto& directory : toWatch)
+            {
+                const int wd = inotify_add_watch(fd, directory.getFullPathName().toRawUTF8(), mask);
+                if (wd < 0)
+                {
+                    MY_LOG_WARNING("Unable to watch {}: {}",
+                                   directory.getFullPathName().toStdString(),
+                                   std::strerror(errno));
+                    continue;
+                }
+                directories[wd] = directory;
+            }
+        };
+
+        watchTree(root);
+        if (directories.empty())
+        {
+            close(fd);
+            return false;
+        }
+
+        if (mOptions.includeExisting) touchExisting(root);
+
+        MY_LOG_INFO("Watching {} and {} folders under it",
+                    root.getFullPathName().toStdString(),
+                    directories.size() - 1);
+
+        // Big enough for a burst of events with long names
+        alignas(inotify_event) char buffer[16384];
+        pollfd fds[2] = { { fd, POLLIN, 0 }, { mWakeUpFd, POLLIN, 0 } };
+
+        while (!mShouldStop)
+        {
+            const int timeoutMs = handOnSettled(onFile);
+            if (poll(fds, 2, timeoutMs) < 0 && errno != EINTR) break;
+            if ((fds[0].revents & POLLIN) == 0) continue;
+
+            for (;;)
+            {
+                const auto length = read(fd, buffer, sizeof(buffer));
+                if (length <= 0) break;
+
+                for (char* p = buffer; p < buffer + length;)
+                {
+                    const auto* event = reinterpret_cast<const inotify_event*>(p);
+                    p += sizeof(inotify_event) + event->len;
+
+                    // Events were lost, have a look at everything again
+                    if (event->mask & IN_Q_OVERFLOW)
+                    {
+                        touchExisting(root);
+                        continue;
+                    }
+
+                    const auto it = directories.find(event->wd);
+                    if (it == directories.end()) continue;
+                    if (event->mask & IN_IGNORED)
+                    {
+                        directories.erase(it);
+                        continue;
+                    }
+                    if (event->len == 0) continue;
+
+                    const auto file = it->second.getChildFile(juce::CharPointer_UTF8(event->name));
+
+                    if (event->mask & IN_ISDIR)
+                    {
+                        // Files may have landed before the watch did
+                        if ((event->mask & (IN_CREATE | IN_MOVED_TO))
+                            && !(mOptions.ignoreHiddenFiles && file.isHidden()))
+                        {
+                            watchTree(file);
+                            touchExisting(file);
+                        }
+                    }
+                    else if (event->mask & (IN_MOVED_FROM | IN_DELETE))
+                    {
+                        forget(file);
+                    }
+                    else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                    {
+                        touch(file, mOptions.closedSettleTimeMs);
+                    }
+                    else
+                    {
+                        touch(file, mOptions.settleTimeMs);
+                    }
+                }
+            }
+        }
+
+        juce::uint64 drained = 0;
+        juce::ignoreUnused(read(mWakeUpFd, &drained, sizeof(drained)));
+        close(fd);
+        return true;
+       #else
+        juce::ignoreUnused(root, onFile);
+        return false;
+       #endif
+    }
+
+    bool FolderWatcher::runPolling(const juce::File& root, const FileCallback& onFile)
+    {
+        DirectoryScanner::Options scanOptions;
+        scanOptions.extensions = mOptions.extensions;
+        scanOptions.ignoreHiddenFiles = mOptions.ignoreHiddenFiles;
+        DirectoryScanner scanner(scanOptions);
+
+        // A file changed since the last scan is touched again, so it is handed
+        // on once two scans a settle time apart agree on it
+        const int intervalMs = juce::jmax(50, mOptions.settleTimeMs / 2);
+        ScanSnapshot snapshot;
+        bool isFirstScan = true;
+
+        while (!mShouldStop)
+        {
+            const bool handOn = !isFirstScan || mOptions.includeExisting;
+            auto scanned = scanner.scan(root,
+                                        [&](const juce::File& file)
+                                        {
+                                            if (handOn) touch(file, mOptions.settleTimeMs);
+                                        },
+                                        isFirstScan ? nullptr : &snapshot);
+            // E.g. the folder is gone for a moment: the next scan compares
+            // against the last one that saw everything
+            if (scanned.isComplete())
+            {
+                snapshot = std::move(scanned);
+                isFirstScan = false;
+            }
+
+            const int untilNext = handOnSettled(onFile);
+            mWakeUp.wait(untilNext < 0 ? intervalMs : juce::jmin(intervalMs, untilNext));
+        }
+        return true;
+    }
+
+    //==========================================================================
+
+    WatchFolderService::WatchFolderService(const juce::File& root,
+                                           BatchEngine::Options batchOptions,
+                                           FolderWatcher::Options watchOptions)
+        : mRoot(root)
+        , mOutput(batchOptions.sourceDirectory, batchOptions.outputDirectory)
+        , mEngine(forWatching(std::move(batchOptions)))
+        , mWatcher(std::move(watchOptions))
+    {
+        // Every write of the engine would show up as a new drop
+        mEngine.setResultCallback([this](const BatchEngine::FileResult& result)
+        {
+            handleResult(result);
+        });
+    }
+    WatchFolderService::~WatchFolderService()
+    {
+        stop();
+    }
+
+    BatchEngine::Options WatchFolderService::forWatching(BatchEngine::Options options)
+    {
+        options.gainMode = BatchEngine::GainMode::track;
+        // A batch that never ends would keep every result forever
+        options.collectResults = false;
+        // The journal would skip a file dropped again under the same name.
+        // Files normalised before are recognised by their tags instead.
+        options.journalFile = juce::File();
+        return options;
+    }
+
+    void WatchFolderService::start()
+    {
+        if (mThread.joinable()) return;
+
+        mThread = std::thread([this]
+        {
+            mEngine.run([this](const BatchEngine::AddFile& addFile)
+            {
+                if (!mWatcher.run(mRoot, addFile))
+                {
+                    MY_LOG_ERROR("Unable to watch {}", mRoot.getFullPathName().toStdString());
+                }
+            });
+        });
+    }
+    void WatchFolderService::stop()
+    {
+        mWatcher.stop();
+        mEngine.cancel();
+        if (mThread.joinable()) mThread.join();
+    }
+    void WatchFolderService::setResultCallback(BatchEngine::ResultCallback callback)
+    {
+        mResultCallback = std::move(callback);
+    }
+    void WatchFolderService::handleResult(const BatchEngine::FileResult& result)
+    {
+        if (result.status == FileStatus::written || result.status == FileStatus::verified)
+        {
+            const auto written = mOutput.isEnabled() ? mOutput.getOutputFile(result.file)
+                                                     : result.file;
+            if (written != juce::File()) mWatcher.ignoreOwnWrite(written);
+        }
+
+        if (mResultCallback) mResultCallback(result);
+    }
+}
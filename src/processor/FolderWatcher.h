@@ -0,0 +1,120 @@
+#pragma once
+
+/*  Watches a drop folder and everything under it for new audio files. On
+    Linux the kernel tells us through inotify; elsewhere the folder is
+    rescanned with a DirectoryScanner snapshot every settle interval.
+
+    A file is only handed on once it has settled: nothing has touched it for
+    a while. Closing a file after writing it is taken as a strong hint that
+    it is complete, so the wait is short then; a file that is still being
+    written keeps pushing its deadline back.
+
+    WatchFolderService puts a watcher in front of a BatchEngine that never
+    runs out of files, so the engine's workers and their analysis engines
+    stay up between drops and a new file costs only its own processing.
+    What the engine writes under the watched folder is not taken for a new
+    drop.
+*/
+
+#include "BatchEngine.h"
+#include "DirectoryScanner.h"
+#include "OutputTree.h"
+#include <juce_core/juce_core.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace norm
+{
+
+class FolderWatcher
+{
+public:
+    struct Options
+    {
+        // Semicolon separated, as juce::File::hasFileExtension takes them
+        juce::String extensions = "wav;wave;aif;aiff;flac;ogg;mp3";
+        bool ignoreHiddenFiles = true;
+        // Files already in the folder at start are handed on as well
+        bool includeExisting = true;
+        // Quiet time after the last change before a file is handed on
+        int settleTimeMs = 2000;
+        // The same after the writer closed the file
+        int closedSettleTimeMs = 250;
+    };
+
+    using FileCallback = std::function<void(const juce::File&)>;
+
+public:
+    explicit FolderWatcher(Options options = {});
+    ~FolderWatcher();
+
+    // Blocks until stop() is called, or returns false at once if root cannot
+    // be watched. onFile is called from this thread.
+    bool run(const juce::File& root, const FileCallback& onFile);
+    // Thread safe. A stopped watcher stays stopped, even if run() has not
+    // started yet.
+    void stop();
+    // Thread safe. The file as it is now is our own output: it is not handed
+    // on again until its size or modification time changes.
+    void ignoreOwnWrite(const juce::File& file);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    bool isCandidate(const juce::File& file) const;
+    // Something happened to the file, it settles after delayMs from now
+    void touch(const juce::File& file, int delayMs);
+    void forget(const juce::File& file);
+    bool isOwnWrite(const juce::File& file);
+    // Hands on every settled file, returns the time until the next deadline
+    int handOnSettled(const FileCallback& onFile);
+    void touchExisting(const juce::File& directory);
+
+    bool runNotified(const juce::File& root, const FileCallback& onFile);
+    bool runPolling(const juce::File& root, const FileCallback& onFile);
+
+    const Options mOptions;
+    std::atomic<bool> mShouldStop { false };
+
+    std::mutex mMutex;
+    std::unordered_map<std::string, Clock::time_point> mDeadlines;
+    std::unordered_map<std::string, ScanSnapshot::Entry> mOwnWrites;
+
+    // Wake up the polling and the inotify loop on stop
+    juce::WaitableEvent mWakeUp;
+    int mWakeUpFd = -1;
+};
+
+class WatchFolderService
+{
+public:
+    // The batch always normalises track by track: an album is never
+    // complete in a folder that keeps receiving files
+    WatchFolderService(const juce::File& root,
+                       BatchEngine::Options batchOptions,
+                       FolderWatcher::Options watchOptions = {});
+    ~WatchFolderService();
+
+    void start();
+    // Waits for the file in hand to finish
+    void stop();
+    void setResultCallback(BatchEngine::ResultCallback callback);
+
+private:
+    static BatchEngine::Options forWatching(BatchEngine::Options options);
+    void handleResult(const BatchEngine::FileResult& result);
+
+    const juce::File mRoot;
+    const OutputTree mOutput;
+    BatchEngine mEngine;
+    FolderWatcher mWatcher;
+    BatchEngine::ResultCallback mResultCallback;
+    std::thread mThread;
+};
+
+} // namespace norm
@@ -0,0 +1,139 @@
+#include "GainModel.h"
+#include <cmath>
+#include <limits>
+
+namespace norm
+{
+    namespace
+    {
+        const juce::String recordPrefix = "Normalize;";
+        // Root element of an iXML chunk we start
+        const juce::String ixmlRoot = "BWFXML";
+    }
+
+    LoudnessRecord GainModel::forTrack(float sourceLoudness, float targetLoudness)
+    {
+        return { sourceLoudness, targetLoudness - sourceLoudness };
+    }
+
+    float GainModel::getAlbumLoudness(const std::vector<Track>& tracks)
+    {
+        // Loudness is a log of mean energy, so the album's is the log of the
+        // length weighted mean of the track energies
+        double energy = 0.0;
+        double length = 0.0;
+
+        for (const auto& track : tracks)
+        {
+            if (track.lengthInSamples <= 0 || !std::isfinite(track.loudness)) continue;
+
+            energy += (double)track.lengthInSamples * std::pow(10.0, track.loudness / 10.0);
+            length += (double)track.lengthInSamples;
+        }
+
+        if (length <= 0.0 || energy <= 0.0) return -std::numeric_limits<float>::infinity();
+        return (float)(10.0 * std::log10(energy / length));
+    }
+    std::vector<LoudnessRecord> GainModel::forAlbum(const std::vector<Track>& tracks,
+                                                    float targetLoudness)
+    {
+        const float albumLoudness = getAlbumLoudness(tracks);
+        const float gain = std::isfinite(albumLoudness) ? targetLoudness - albumLoudness
+                                                        : 0.f;
+
+        std::vector<LoudnessRecord> records;
+        records.reserve(tracks.size());
+        for (const auto& track : tracks) records.push_back({ track.loudness, gain });
+        return records;
+    }
+
+    void GainModel::writeTags(juce::StringPairArray& metadata, const LoudnessRecord& record)
+    {
+        metadata.set(LoudnessTag, juce::String(record.getResultLoudness(), 2));
+
+        // Our element replaces the one of an earlier run, nothing else
+        auto ixml = juce::parseXML(metadata.getValue(RecordTag, {}));
+        if (ixml == nullptr) ixml = std::make_unique<juce::XmlElement>(ixmlRoot);
+        if (auto* previous = ixml->getChildByName(RecordField))
+            ixml->removeChildElement(previous, true);
+        ixml->createNewChildElement(RecordField)->addTextElement(toString(record));
+
+        metadata.set(RecordTag, ixml->toString());
+    }
+    std::optional<LoudnessRecord> GainModel::readTags(const juce::StringPairArray& metadata)
+    {
+        if (const auto ixml = juce::parseXML(metadata.getValue(RecordTag, {})))
+        {
+            if (const auto* element = ixml->getChildByName(RecordField))
+                return fromString(element->getAllSubText());
+        }
+        return fromString(metadata.getValue(LegacyRecordTag, {}));
+    }
+    juce::String GainModel::toString(const LoudnessRecord& record)
+    {
+        auto text = recordPrefix
+                  + "source=" + juce::String(record.sourceLoudness, 2)
+                  + ";gain=" + juce::String(record.appliedGain, 2);
+        // Left out when there is none, as older versions wrote it
+        if (record.signalledGain != 0.f)
+            text << ";signalled=" << juce::String(record.signalledGain, 2);
+        return text;
+    }
+    std::optional<LoudnessRecord> GainModel::fromString(const juce::String& text)
+    {
+        if (!text.startsWith(recordPrefix)) return std::nullopt;
+
+        std::optional<float> source, gain;
+        float signalled = 0.f;
+        for (const auto& field : juce::StringArray::fromTokens(text.substring(recordPrefix.length()), ";", {}))
+        {
+            const auto key = field.upToFirstOccurrenceOf("=", false, false);
+            const auto value = field.fromFirstOccurrenceOf("=", false, false);
+            if (value.isEmpty()) continue;
+
+            if (key == "source") source = value.getFloatValue();
+            else if (key == "gain") gain = value.getFloatValue();
+            else if (key == "signalled") signalled = value.getFloatValue();
+        }
+
+        if (!source.has_value() || !gain.has_value()) return std::nullopt;
+        return LoudnessRecord { *source, *gain, signalled };
+    }
+
+    juce::StringPairArray GainModel::makeGainFields(const LoudnessRecord& record, float peak)
+    {
+        juce::StringPairArray fields;
+        fields.set(RecordField, toString(record));
+
+        // Nothing left for the player, nothing stale either
+        const bool signalled = record.signalledGain != 0.f;
+        fields.set(TrackGainField,
+                   signalled ? juce::String::formatted("%+.2f dB", record.signalledGain) : juce::String());
+        fields.set(TrackPeakField, signalled ? juce::String(peak, 6) : juce::String());
+        // Album figures no longer match once any gain changes
+        fields.set(AlbumGainField, {});
+        fields.set(AlbumPeakField, {});
+        return fields;
+    }
+    juce::StringPairArray GainModel::makeAlbumGainFields(const LoudnessRecord& record,
+                                                         float trackGain,
+                                                         float peak,
+                                                         float albumPeak)
+    {
+        juce::StringPairArray fields;
+        fields.set(RecordField, toString(record));
+        fields.set(TrackGainField, juce::String::formatted("%+.2f dB", trackGain));
+        fields.set(TrackPeakField, juce::String(peak, 6));
+        fields.set(AlbumGainField, juce::String::formatted("%+.2f dB", record.signalledGain));
+        fields.set(AlbumPeakField, juce::String(albumPeak, 6));
+        return fields;
+    }
+
+    bool GainModel::isAlreadyNormalised(const std::optional<LoudnessRecord>& record,
+                                        float targetLoudness,
+                                        float toleranceDB)
+    {
+        return record.has_value()
+            && std::abs(record->getResultLoudness() - targetLoudness) <= toleranceDB;
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+/*  Everything about the gain a file gets, in dB: the loudness it was measured
+    at, the gain applied, and the loudness it ends up at. The same record is
+    written into the file's metadata, so a later run can tell from the header
+    alone that a file is already normalised, without decoding it.
+
+    Gains are computed for a single track, or for a whole album at once, where
+    every track gets the same gain so their relative levels are preserved.
+*/
+
+#include <juce_core/juce_core.h>
+#include <optional>
+#include <vector>
+
+namespace norm
+{
+
+struct LoudnessRecord
+{
+    // Integrated loudness before any gain, LUFS
+    float sourceLoudness = 0;
+    // Gain applied on top of the source, dB
+    float appliedGain = 0;
+    // The part of appliedGain that is only in the tags for the player to
+    // apply (ReplayGain), e.g. what MP3 global_gain steps cannot express
+    float signalledGain = 0;
+
+    float getResultLoudness() const { return sourceLoudness + appliedGain; }
+    // The gain the samples themselves carry
+    float getSampleGain() const { return appliedGain - signalledGain; }
+};
+
+class GainModel
+{
+public:
+    struct Track
+    {
+        float loudness = 0;
+        juce::int64 lengthInSamples = 0;
+    };
+
+    // Legacy tag, holds only the resulting loudness
+    inline static const char LoudnessTag[] = "LKFS";
+    // The WAV iXML chunk, one of the few keys the WAV writer keeps. The
+    // record is an element of its own in it, RecordField, so whatever a
+    // recorder put there stays.
+    inline static const char RecordTag[] = "iXML";
+    // Where earlier versions kept the record, the RIFF INFO "software" field.
+    // Still read, never written.
+    inline static const char LegacyRecordTag[] = "ISFT";
+    // Formats with free form tags of their own (Vorbis comments, ID3v2 TXXX
+    // frames) keep the record under this name, next to ReplayGain fields
+    inline static const char RecordField[] = "NORMALIZE";
+    inline static const char TrackGainField[] = "REPLAYGAIN_TRACK_GAIN";
+    inline static const char TrackPeakField[] = "REPLAYGAIN_TRACK_PEAK";
+    inline static const char AlbumGainField[] = "REPLAYGAIN_ALBUM_GAIN";
+    inline static const char AlbumPeakField[] = "REPLAYGAIN_ALBUM_PEAK";
+
+public:
+    static LoudnessRecord forTrack(float sourceLoudness, float targetLoudness);
+
+    // Loudness of the tracks played back to back, from their per track
+    // loudness weighted by length. Silent or empty tracks do not count.
+    // Only an approximation, merged GatingHistograms give the exact figure.
+    static float getAlbumLoudness(const std::vector<Track>& tracks);
+    // One gain for every track, bringing the album as a whole to the target
+    static std::vector<LoudnessRecord> forAlbum(const std::vector<Track>& tracks,
+                                                float targetLoudness);
+
+    static void writeTags(juce::StringPairArray& metadata, const LoudnessRecord& record);
+    // Nothing if the file was never normalised by us
+    static std::optional<LoudnessRecord> readTags(const juce::StringPairArray& metadata);
+    // The record as it goes into RecordField, for formats with tags of their own
+    static juce::String toString(const LoudnessRecord& record);
+    static std::optional<LoudnessRecord> fromString(const juce::String& text);
+    // The record and the ReplayGain fields for its signalled gain, peak being
+    // the sample peak of the file as it is. Album fields are emptied, an
+    // empty value stands for a field to remove.
+    static juce::StringPairArray makeGainFields(const LoudnessRecord& record, float peak);
+    // For album mode, where the record's signalled gain is the album's: it
+    // goes into the album fields with the album's peak, trackGain, the gain
+    // the file would get on its own, into the track fields.
+    static juce::StringPairArray makeAlbumGainFields(const LoudnessRecord& record,
+                                                     float trackGain,
+                                                     float peak,
+                                                     float albumPeak);
+
+    static bool isAlreadyNormalised(const std::optional<LoudnessRecord>& record,
+                                    float targetLoudness,
+                                    float toleranceDB);
+};
+
+} // namespace norm
@@ -0,0 +1,194 @@
+#include "GatingHistogram.h"
+#include <cmath>
+#include <limits>
+
+namespace norm
+{
+    int GatingHistogram::getBin(double blockEnergy)
+    {
+        const double level = 10.0 * std::log10(blockEnergy);
+        const int bin = (int)std::floor((level - absoluteGateDB) * binsPerDB);
+        return juce::jlimit(0, numberOfBins - 1, bin);
+    }
+
+    void GatingHistogram::add(float blockEnergy)
+    {
+        if (!(blockEnergy > 0.f)) return;
+
+        if (mCounts.empty())
+        {
+            mCounts.assign((size_t)numberOfBins, 0);
+            mEnergies.assign((size_t)numberOfBins, 0.0);
+        }
+
+        const int bin = getBin(blockEnergy);
+        mCounts[(size_t)bin]++;
+        mEnergies[(size_t)bin] += blockEnergy;
+        mNumberOfBlocks++;
+    }
+    void GatingHistogram::merge(const GatingHistogram& other)
+    {
+        if (other.isEmpty()) return;
+        if (isEmpty())
+        {
+            *this = other;
+            return;
+        }
+
+        for (size_t bin = 0; bin < (size_t)numberOfBins; bin++)
+        {
+            mCounts[bin] += other.mCounts[bin];
+            mEnergies[bin] += other.mEnergies[bin];
+        }
+        mNumberOfBlocks += other.mNumberOfBlocks;
+    }
+    void GatingHistogram::applyGain(float gainDB)
+    {
+        if (isEmpty() || gainDB == 0.f) return;
+
+        const double factor = std::pow(10.0, gainDB / 10.0);
+        const double gateEnergy = std::pow(10.0, absoluteGateDB / 10.0);
+
+        GatingHistogram scaled;
+        scaled.mCounts.assign((size_t)numberOfBins, 0);
+        scaled.mEnergies.assign((size_t)numberOfBins, 0.0);
+
+        // A bin moves as a whole, by where its mean lands
+        for (size_t bin = 0; bin < (size_t)numberOfBins; bin++)
+        {
+            if (mCounts[bin] == 0) continue;
+
+            const double energy = mEnergies[bin] * factor;
+            if (energy / mCounts[bin] <= gateEnergy) continue;
+
+            const int target = getBin(energy / mCounts[bin]);
+            scaled.mCounts[(size_t)target] += mCounts[bin];
+            scaled.mEnergies[(size_t)target] += energy;
+            scaled.mNumberOfBlocks += mCounts[bin];
+        }
+
+        if (scaled.isEmpty()) clear();
+        else                  *this = std::move(scaled);
+    }
+    void GatingHistogram::clear()
+    {
+        mCounts.clear();
+        mEnergies.clear();
+        mNumberOfBlocks = 0;
+    }
+
+    float GatingHistogram::getIntegratedLoudness() const
+    {
+        if (isEmpty()) return -std::numeric_limits<float>::infinity();
+
+        double energySum = 0;
+        for (const auto energy : mEnergies) energySum += energy;
+
+        // Same gate as LKFS::integrate
+        const float averageDB = 10.f * (float)std::log10(energySum / (double)mNumberOfBlocks);
+        const float relativeGate = juce::jmax(averageDB, absoluteGateDB) - 10.f;
+        const double relativeGateLin = std::pow(10.0, relativeGate / 10.0);
+
+        // Bins above the gate have their mean above it too, so the mean
+        // decides for the one bin the gate falls into
+        double gatedSum = 0;
+        juce::int64 gatedCount = 0;
+        for (size_t bin = 0; bin < (size_t)numberOfBins; bin++)
+        {
+            if (mCounts[bin] == 0) continue;
+            if (mEnergies[bin] / mCounts[bin] <= relativeGateLin) continue;
+
+            gatedSum += mEnergies[bin];
+            gatedCount += mCounts[bin];
+        }
+
+        if (gatedCount == 0) return -std::numeric_limits<float>::infinity();
+        return 10.f * (float)std::log10(gatedSum / (double)gatedCount);
+    }
+
+    float GatingHistogram::getLoudnessRange() const
+    {
+        if (isEmpty()) return 0.f;
+
+        double energySum = 0;
+        for (const auto energy : mEnergies) energySum += energy;
+
+        // Relative gate 20 LU below the mean, decided by bin mean as above
+        const double relativeGateLin = energySum / (double)mNumberOfBlocks * 0.01;
+
+        juce::int64 gatedCount = 0;
+        for (size_t bin = 0; bin < (size_t)numberOfBins; bin++)
+        {
+            if (mCounts[bin] > 0 && mEnergies[bin] / mCounts[bin] > relativeGateLin)
+                gatedCount += mCounts[bin];
+        }
+        if (gatedCount == 0) return 0.f;
+
+        // Level of the bin holding the value at a percentile of what passed
+        auto getPercentile = [&](double percentile)
+        {
+            const auto index = (juce::int64)std::llround(percentile * (double)(gatedCount - 1));
+            juce::int64 seen = 0;
+            for (size_t bin = 0; bin < (size_t)numberOfBins; bin++)
+            {
+                if (mCounts[bin] == 0 || mEnergies[bin] / mCounts[bin] <= relativeGateLin) continue;
+
+                seen += mCounts[bin];
+                if (seen > index) return 10.f * (float)std::log10(mEnergies[bin] / mCounts[bin]);
+            }
+            return 0.f;
+        };
+
+        return getPercentile(0.95) - getPercentile(0.1);
+    }
+
+    void GatingHistogram::writeToStream(juce::OutputStream& stream) const
+    {
+        int binsInUse = 0;
+        for (const auto count : mCounts) binsInUse += count > 0 ? 1 : 0;
+
+        stream.writeInt(binsInUse);
+        for (size_t bin = 0; bin < mCounts.size(); bin++)
+        {
+            if (mCounts[bin] == 0) continue;
+            stream.writeShort((short)bin);
+            stream.writeInt((int)mCounts[bin]);
+            stream.writeDouble(mEnergies[bin]);
+        }
+    }
+    bool GatingHistogram::readFromStream(juce::InputStream& stream)
+    {
+        clear();
+
+        // Bin index, count and energy sum
+        constexpr int bytesPerBin = 2 + 4 + 8;
+
+        const int binsInUse = stream.readInt();
+        if (binsInUse < 0 || binsInUse > numberOfBins) return false;
+        if (binsInUse == 0) return true;
+
+        const auto remaining = stream.getNumBytesRemaining();
+        if (remaining >= 0 && remaining < (juce::int64)binsInUse * bytesPerBin) return false;
+
+        mCounts.assign((size_t)numberOfBins, 0);
+        mEnergies.assign((size_t)numberOfBins, 0.0);
+
+        for (int i = 0; i < binsInUse; i++)
+        {
+            const int bin = stream.readShort();
+            const auto count = (juce::uint32)stream.readInt();
+            const double energy = stream.readDouble();
+
+            if (bin < 0 || bin >= numberOfBins)
+            {
+                clear();
+                return false;
+            }
+
+            mCounts[(size_t)bin] += count;
+            mEnergies[(size_t)bin] += energy;
+            mNumberOfBlocks += count;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+/*  The state BS.1770 gating needs, in a form that can be merged: the 400ms
+    block energies that passed the absolute gate, binned by level. Each bin
+    keeps the count and the exact energy sum of its blocks, so the only error
+    against gating the blocks themselves comes from the single bin the
+    relative gate falls into, a fraction of its 0.1 dB width.
+
+    Histograms of several files merged together give the loudness of those
+    files played back to back, e.g. an album, without decoding anything again.
+*/
+
+#include <juce_core/juce_core.h>
+#include <vector>
+
+namespace norm
+{
+
+class GatingHistogram
+{
+public:
+    // Linear block energy, already past the absolute gate
+    void add(float blockEnergy);
+    void merge(const GatingHistogram& other);
+    // Scales every block, e.g. to undo a gain applied earlier. Blocks that
+    // end up below the absolute gate are dropped.
+    void applyGain(float gainDB);
+    void clear();
+
+    bool isEmpty() const { return mNumberOfBlocks == 0; }
+    juce::int64 getNumberOfBlocks() const { return mNumberOfBlocks; }
+    // Relative gate applied over every block, -inf if there are none
+    float getIntegratedLoudness() const;
+    // For a histogram of 3s short-term energies instead of 400ms blocks:
+    // the EBU Tech 3342 loudness range in LU, 0 if there are none
+    float getLoudnessRange() const;
+
+    // Only the bins in use, a few hundred bytes for a typical track
+    void writeToStream(juce::OutputStream& stream) const;
+    bool readFromStream(juce::InputStream& stream);
+
+    static constexpr float absoluteGateDB = -70.f;
+    static constexpr float maximumDB = 10.f;
+    static constexpr int binsPerDB = 10;
+    static constexpr int numberOfBins = (int)((maximumDB - absoluteGateDB) * binsPerDB);
+
+private:
+    static int getBin(double blockEnergy);
+
+    // Allocated with the first block, empty histograms are cheap to copy
+    std::vector<juce::uint32> mCounts;
+    std::vector<double> mEnergies;
+    juce::int64 mNumberOfBlocks = 0;
+};
+
+} // namespace norm
@@ -1,5 +1,6 @@
 #include "LKFSProcessor.h"
 #include <util/Logger.h>
+#include <util/Trace.h>
 #include <juce_core/juce_core.h>
 #include <juce_audio_basics/juce_audio_basics.h>
 
@@ -8,24 +9,37 @@ namespace norm
 
 LKFS::LKFS() 
     : mState(State::invalid)
-    , mCircularBuffer(4)
+    , mCircularBuffer(mBlocksPerWindow)
+    , mShortTermBuffer(mBlocksPerShortTermWindow)
 {}
 LKFS::~LKFS() {}
 
-void LKFS::reset(double sampleRate, int numberOfChannels)
+void LKFS::reset(double sampleRate,
+                 int numberOfChannels,
+                 const juce::AudioChannelSet& layout)
 {
     setNumberOfChannels(numberOfChannels);
+    setChannelLayout(layout);
     setSampleRate(sampleRate);
 
     mSamplePeak = 0;
+    mMomentaryLoudness = -std::numeric_limits<float>::infinity();
+    mShortTermLoudness = -std::numeric_limits<float>::infinity();
 
     mBlockEnergyValues.clear();
+    mShortTermHistogram.clear();
+    mHistogram.clear();
     mCircularBuffer.reset();
+    mShortTermBuffer.reset();
+    mBlocksSinceDiscontinuity = 0;
+    mWarmUpBlocks = 0;
 
     mState = State::ready;
 }
 void LKFS::processNext100ms(const juce::AudioBuffer<float>& buffer)
 {
+    NORM_TRACE_SCOPE("LKFS::processNext100ms");
+
     EXPECT_OR_RETURN (mState != State::invalid,
                       void(), 
                       "You need to reset the LKFS Processor before use.");
@@ -36,85 +50,151 @@ void LKFS::processNext100ms(const juce::AudioBuffer<float>& buffer)
                      std::exception{},
                      "Wrong buffer size fed into LKFS unit");
 
+    EXPECT_OR_THROW (buffer.getNumChannels() == chnum,
+                     std::exception{},
+                     "LKFS unit expects {} channels, got {}",
+                     chnum, buffer.getNumChannels());
+
     //==========================================================================
 
-    juce::AudioBuffer<float> workBuffer = buffer;
+    float localMax = buffer.getMagnitude(0, mExpectedBufferSize);
+
+    // Excluded channels (LFE) are not even filtered
+    for (size_t i = 0; i < mActiveChannels.size(); i++)
+    {
+        mActiveChannelData[i] = buffer.getReadPointer(mActiveChannels[i]);
+    }
+
+    float blockEnergy = mFilterBank.processEnergy(mActiveChannelData.data(),
+                                                  mChannelWeights.data(),
+                                                  mExpectedBufferSize);
+
+    processNext100msEnergy(blockEnergy, localMax);
+}
+void LKFS::processNext100msEnergy(float blockEnergy, float blockPeak)
+{
+    EXPECT_OR_RETURN (mState != State::invalid,
+                      void(),
+                      "You need to reset the LKFS Processor before use.");
 
-    float localMax = workBuffer.getMagnitude(0, mExpectedBufferSize);
-    mSamplePeak = juce::jmax(mSamplePeak, localMax);
+    mSamplePeak = juce::jmax(mSamplePeak, blockPeak);
+
+    mCircularBuffer.push(blockEnergy);
+    if (mShortTermEnabled) mShortTermBuffer.push(blockEnergy);
+    mBlocksSinceDiscontinuity++;
+
+    float FilterEffetOnEnergy = mLinearAttenuation * mLinearAttenuation;
 
-    float blockEnergy = 0;
-    for (int ch = 0; ch < workBuffer.getNumChannels(); ch++)
+    // According to ITU-R BS.1770, the first window measured should be one
+    // completely filled with data. In case of 75% overlap, that window is the
+    // 4th one. After a discontinuity, the warm-up blocks must also have left
+    // the window.
+    if (mBlocksSinceDiscontinuity >= mBlocksPerWindow + mWarmUpBlocks)
     {
-        auto pChannelData = workBuffer.getWritePointer(ch);
-        mFilters[(size_t)ch].process(pChannelData, mExpectedBufferSize);
+        float FrameSum = mCircularBuffer.getSum();
+        float numSamplesInFrame = (float)fs * 0.4f;
+
+        float momentaryLin = FrameSum / numSamplesInFrame / FilterEffetOnEnergy;
+        float momentaryDB = 10.f * std::log10(momentaryLin);
+        mMomentaryLoudness = momentaryDB;
 
-        for (int s = 0; s < workBuffer.getNumSamples(); s++)
+        if (momentaryDB > mAbsoluteGate)
         {
-            blockEnergy += (pChannelData[s] * pChannelData[s]);
+            mBlockEnergyValues.emplace_back(momentaryLin);
+            mHistogram.add(momentaryLin);
         }
     }
 
-    mCircularBuffer.push(blockEnergy);
-    float FrameSum = mCircularBuffer.getSum();
-    float numSamplesInFrame = (float)fs * 0.4f;
-    float FilterEffetOnEnergy = mLinearAttenuation * mLinearAttenuation;
+    // EBU Tech 3341: the same, over 3s. Tech 3342 gates these values for
+    // the loudness range.
+    if (mShortTermEnabled && mBlocksSinceDiscontinuity >= mBlocksPerShortTermWindow + mWarmUpBlocks)
+    {
+        float numSamplesInFrame = (float)fs * 3.f;
 
-    float momentaryLin = FrameSum / numSamplesInFrame / FilterEffetOnEnergy;
-    float momentaryDB = 10.f * std::log10(momentaryLin);
+        float shortTermLin = mShortTermBuffer.getSum() / numSamplesInFrame / FilterEffetOnEnergy;
+        mShortTermLoudness = 10.f * std::log10(shortTermLin);
 
-    if (momentaryDB > mAbsoluteGate)
-    {
-        mBlockEnergyValues.emplace_back(momentaryLin);
+        if (mShortTermLoudness > mAbsoluteGate)
+        {
+            mShortTermHistogram.add(shortTermLin);
+        }
     }
 
     mState = State::in_use;
 }
+void LKFS::markDiscontinuity(int warmUpBlocks)
+{
+    EXPECT_OR_RETURN (mState != State::invalid,
+                      void(),
+                      "You need to reset the LKFS Processor before use.");
+
+    mFilterBank.clear();
+    mCircularBuffer.reset();
+    mShortTermBuffer.reset();
+    mBlocksSinceDiscontinuity = 0;
+    mMomentaryLoudness = -std::numeric_limits<float>::infinity();
+    mShortTermLoudness = -std::numeric_limits<float>::infinity();
+    mWarmUpBlocks = juce::jmax(0, warmUpBlocks);
+}
 float LKFS::getIntegratedLoudness()
+{
+    NORM_TRACE_SCOPE("LKFS::getIntegratedLoudness");
+    return getGatedLoudness().integratedLoudness;
+}
+LKFS::GatedLoudness LKFS::getGatedLoudness()
 {
     bool startedUsing = mState == State::in_use;
-    bool enoughData = mBlockEnergyValues.size() > 3;
+    bool enoughData = !mBlockEnergyValues.empty();
 
     EXPECT_OR_THROW (startedUsing && enoughData,
                      std::exception{},
                      "You need to feed the processor some audio before querying loudness");
 
-    // The first 3 entries are actually invalid and should be discarded, because
-    // according to ITU-R BS.1770, the first window measured should be one
-    // completely filled with data. In case of 75% overlap, that window is the
-    // 4th one.
-    mBlockEnergyValues.erase (mBlockEnergyValues.begin(), 
-                                   mBlockEnergyValues.begin() + 2);
+    mState = State::invalid;
+
+    return integrate(mBlockEnergyValues);
+}
+LKFS::GatedLoudness LKFS::integrate(const std::vector<float>& blockEnergies)
+{
+    GatedLoudness result;
+    result.numberOfBlocks = blockEnergies.size();
+    if (blockEnergies.empty()) return result;
 
-    float blockEnergySum = 0;
-    for (const auto& blockEnergy : mBlockEnergyValues)
+    double blockEnergySum = 0;
+    for (const auto& blockEnergy : blockEnergies)
     {
         blockEnergySum += blockEnergy;
     }
-    float blockEnergyAverage = blockEnergySum / (float)mBlockEnergyValues.size();
-    float blockAverageDB = 10.0f * log10(blockEnergyAverage);
+    double blockEnergyAverage = blockEnergySum / (double)blockEnergies.size();
+    float blockAverageDB = 10.0f * (float)log10(blockEnergyAverage);
 
     float relativeGate = juce::jmax(blockAverageDB, -70.0f) - 10.f;
     float relativeGateLin = pow(10.f, relativeGate / 10.f);
-    float gatedSum = 0;
-    int gatedCount = 0;
+    double gatedSum = 0;
+    double gatedSquareSum = 0;
+    size_t gatedCount = 0;
 
-    for (const auto& blockEnergy : mBlockEnergyValues)
+    for (const auto& blockEnergy : blockEnergies)
     {
         if (blockEnergy > relativeGateLin)
         {
             gatedSum += blockEnergy;
+            gatedSquareSum += (double)blockEnergy * blockEnergy;
             gatedCount++;
         }
     }
 
-    mState = State::invalid;
+    if (gatedCount == 0) return result;
 
-    float gatedAverage = gatedSum / (float)gatedCount;
-    float integratedLoudness = 10.f * log10(gatedAverage);
-    return integratedLoudness;
+    double gatedAverage = gatedSum / (double)gatedCount;
+    result.numberOfGatedBlocks = gatedCount;
+    result.gatedEnergyMean = gatedAverage;
+    result.gatedEnergyVariance =
+        juce::jmax(0.0, gatedSquareSum / (double)gatedCount - gatedAverage * gatedAverage);
+    result.integratedLoudness = 10.f * (float)log10(gatedAverage);
+    return result;
 }
-float LKFS::getSamplePeak()
+float LKFS::getSamplePeak() const
 {
     return mSamplePeak;
 }
@@ -126,14 +206,11 @@ void LKFS::setSampleRate(double sampleRate)
                      "Sample Rate is {}", sampleRate);
 
     fs = sampleRate;
-    for (int ch = 0; ch < chnum; ch++)
-    {
-        mFilters[(size_t)ch].reset(fs);
-    }
+    mFilterBank.reset(fs, (int)mActiveChannels.size());
 
     mExpectedBufferSize = (int)(fs / 10.0);
 
-    mLinearAttenuation = KWFilter::getLinearAttenuation();
+    mLinearAttenuation = mFilterBank.getLinearAttenuation();
 }
 void LKFS::setNumberOfChannels(int numberOfChannels)
 {
@@ -141,10 +218,60 @@ void LKFS::setNumberOfChannels(int numberOfChannels)
                      std::exception{},
                      "Number of channels is {}", numberOfChannels);
 
-    if (chnum != numberOfChannels)
+    chnum = numberOfChannels;
+}
+
+void LKFS::setChannelLayout(const juce::AudioChannelSet& layout)
+{
+    mLayout = layout.size() == chnum
+            ? layout
+            : juce::AudioChannelSet::canonicalChannelSet(chnum);
+
+    // canonicalChannelSet has nothing for some counts, weigh those equally
+    if (mLayout.size() != chnum)
+    {
+        mLayout = juce::AudioChannelSet::discreteChannels(chnum);
+    }
+
+    mActiveChannels.clear();
+    mChannelWeights.clear();
+    for (int ch = 0; ch < chnum; ch++)
     {
-        chnum = numberOfChannels;
-        mFilters = std::make_unique<KWFilter[]>((size_t)chnum);
+        const float weight = getChannelWeight(mLayout.getTypeOfChannel(ch));
+        if (weight > 0.f)
+        {
+            mActiveChannels.push_back(ch);
+            mChannelWeights.push_back(weight);
+        }
+    }
+    mActiveChannelData.assign(mActiveChannels.size(), nullptr);
+
+    EXPECT_OR_THROW (!mActiveChannels.empty(),
+                     std::exception{},
+                     "Channel layout {} has no channel that counts towards loudness",
+                     mLayout.getDescription().toStdString());
+}
+
+float LKFS::getChannelWeight(juce::AudioChannelSet::ChannelType type)
+{
+    using CT = juce::AudioChannelSet::ChannelType;
+
+    // ITU-R BS.1770: channels between 60 and 120 degrees off centre get
+    // +1.5 dB, low frequency effects are left out of the measurement.
+    switch (type)
+    {
+        case CT::LFE:
+        case CT::LFE2:
+            return 0.f;
+
+        case CT::leftSurround:
+        case CT::rightSurround:
+        case CT::leftSurroundSide:
+        case CT::rightSurroundSide:
+            return 1.41f;
+
+        default:
+            return 1.f;
     }
 }
 
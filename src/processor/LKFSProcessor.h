@@ -7,8 +7,11 @@
 */
 
 #include "FilterProcessor.h"
+#include "GatingHistogram.h"
 #include <juce_audio_basics/juce_audio_basics.h>
+#include <limits>
 #include <memory>
+#include <vector>
 #include <util/CircularArray.h>
 
 namespace norm
@@ -19,32 +22,97 @@ class LKFS
 public:
     enum class State { ready, in_use, invalid };
 
+    // Result of gating a set of 400ms block energies
+    struct GatedLoudness
+    {
+        float integratedLoudness = -std::numeric_limits<float>::infinity();
+        // blocks above the absolute gate
+        size_t numberOfBlocks = 0;
+        // blocks above both gates, and the statistics of their energies
+        size_t numberOfGatedBlocks = 0;
+        double gatedEnergyMean = 0;
+        double gatedEnergyVariance = 0;
+    };
+
 public:
     LKFS();
     ~LKFS();
 
-    void reset(double sampleRate, int numberOfChannels);
+    // Without a layout (or one that does not match the channel count) the
+    // default layout for the channel count is assumed, e.g. 5.1 for 6.
+    void reset(double sampleRate,
+               int numberOfChannels,
+               const juce::AudioChannelSet& layout = {});
     void processNext100ms(const juce::AudioBuffer<float>& buffer);
+    // The same for callers that K-weight the block themselves, e.g.
+    // LaneAnalyser: the weighted energy of the filtered block, summed as
+    // KWFilterBank::processEnergy does, and the block's sample peak
+    void processNext100msEnergy(float blockEnergy, float blockPeak);
+    // The next block does not follow the previous one (e.g. the reader
+    // skipped ahead). Filters and the window start over; the first
+    // warmUpBlocks blocks only settle the filters and are never measured.
+    void markDiscontinuity(int warmUpBlocks = 1);
     // Returns integrated loudness in dB. Needs reset after this.
     float getIntegratedLoudness();
-    float getSamplePeak();
+    // Same as above, with the gating statistics. Needs reset after this.
+    GatedLoudness getGatedLoudness();
+    // Applies the relative gate to energies that passed the absolute gate
+    static GatedLoudness integrate(const std::vector<float>& blockEnergies);
+    // The same blocks in mergeable form, valid until the next reset
+    const GatingHistogram& getHistogram() const { return mHistogram; }
+    float getSamplePeak() const;
+
+    // For callers that measure while the audio keeps coming, e.g. a meter.
+    // Momentary is the last 400ms window, short-term the last 3s, both -inf
+    // until that much audio followed the reset or the last discontinuity.
+    // Short-term values are only measured when enabled, which lasts across
+    // resets; a file analysis has no use for them.
+    void setShortTermEnabled(bool shouldMeasure) { mShortTermEnabled = shouldMeasure; }
+    float getMomentaryLoudness() const { return mMomentaryLoudness; }
+    float getShortTermLoudness() const { return mShortTermLoudness; }
+    // Integrated loudness of the blocks so far, from the histogram, so any
+    // number of queries cost the same. The measurement goes on.
+    float getIntegratedLoudnessSoFar() const { return mHistogram.getIntegratedLoudness(); }
+    // EBU Tech 3342 loudness range in LU, over the short-term values taken
+    // every 100ms so far. 0 until there is one.
+    float getLoudnessRange() const { return mShortTermHistogram.getLoudnessRange(); }
+    const juce::AudioChannelSet& getChannelLayout() const { return mLayout; }
+
+    // Weight of a channel's energy in the sum, 0 means excluded
+    static float getChannelWeight(juce::AudioChannelSet::ChannelType type);
 
 private:
     void setSampleRate(double sampleRate);
     void setNumberOfChannels(int numberOfChannels);
+    void setChannelLayout(const juce::AudioChannelSet& layout);
 
     int chnum = 0;
     double fs = -1;
     float mLinearAttenuation = 0;
     const float mAbsoluteGate = -70;
+    static constexpr int mBlocksPerWindow = 4;
+    static constexpr int mBlocksPerShortTermWindow = 30;
+    int mBlocksSinceDiscontinuity = 0;
+    int mWarmUpBlocks = 0;
     int mExpectedBufferSize = 0;
     float mSamplePeak = 0;
+    float mMomentaryLoudness = -std::numeric_limits<float>::infinity();
+    float mShortTermLoudness = -std::numeric_limits<float>::infinity();
+    bool mShortTermEnabled = false;
 
     State mState;
 
     CircularArray<float> mCircularBuffer;
+    CircularArray<float> mShortTermBuffer;
     std::vector<float> mBlockEnergyValues;
-    std::unique_ptr<KWFilter[]> mFilters; 
+    GatingHistogram mHistogram;
+    // Short-term energies above the absolute gate, for the loudness range
+    GatingHistogram mShortTermHistogram;
+    juce::AudioChannelSet mLayout;
+    std::vector<int> mActiveChannels;
+    std::vector<float> mChannelWeights;
+    std::vector<const float*> mActiveChannelData;
+    KWFilterBank mFilterBank;
 };
 
 } // namespace norm
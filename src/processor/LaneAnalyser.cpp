@@ -0,0 +1,263 @@
+#include "LaneAnalyser.h"
+#include "util/Logger.h"
+#include <limits>
+#include <map>
+#include <utility>
+
+namespace norm
+{
+    LaneAnalyser::LaneAnalyser()
+    {
+        for (auto& slot : mSlots) slot = std::make_unique<Slot>();
+        for (int lane = 0; lane < numberOfLanes; lane++) mFilter.clearLane(lane);
+    }
+    LaneAnalyser::~LaneAnalyser() {}
+
+    void LaneAnalyser::run(const NextFile& next, const ResultCallback& onResult)
+    {
+        // Opened, but its channels did not fit into the free lanes yet
+        Slot* waiting = nullptr;
+        bool sourceIsDone = false;
+
+        auto hasFreeLane = [this]
+        {
+            for (const bool inUse : mLaneInUse) if (!inUse) return true;
+            return false;
+        };
+        auto findFreeSlot = [&]() -> Slot*
+        {
+            for (auto& slot : mSlots)
+                if (!slot->isActive && slot.get() != waiting) return slot.get();
+            return nullptr;
+        };
+
+        for (;;)
+        {
+            // Refill the lanes of the files that finished
+            for (;;)
+            {
+                if (waiting != nullptr)
+                {
+                    if (!assignLanes(*waiting)) break;
+                    advance(*std::exchange(waiting, nullptr), onResult);
+                    continue;
+                }
+                if (sourceIsDone || !hasFreeLane()) break;
+
+                // There is always one, a file takes at least one lane
+                Slot* slot = findFreeSlot();
+                jassert(slot != nullptr);
+
+                const auto file = next();
+                if (!file.has_value())
+                {
+                    sourceIsDone = true;
+                    break;
+                }
+
+                if (!open(*slot, *file))
+                {
+                    onResult(slot->result);
+                }
+                else if ((int)slot->channels.size() > numberOfLanes)
+                {
+                    slot->result.analysis = mSingleFileEngine.analyse(*file);
+                    slot->result.tagged = mSingleFileEngine.getFileHandler().getTaggedRecord();
+                    onResult(slot->result);
+                }
+                else
+                {
+                    waiting = slot;
+                }
+            }
+
+            // Up to the nearest block boundary of any file in the lanes
+            int size = std::numeric_limits<int>::max();
+            for (const auto& slot : mSlots)
+            {
+                if (slot->isActive)
+                    size = juce::jmin(size, slot->samplesPerBlock - slot->position);
+            }
+
+            // A waiting file always fits once every lane is free
+            if (size == std::numeric_limits<int>::max())
+            {
+                if (sourceIsDone && waiting == nullptr) return;
+                continue;
+            }
+
+            filterActiveSlots(size, onResult);
+        }
+    }
+
+    std::vector<LaneAnalyser::Result> LaneAnalyser::analyse(const juce::Array<juce::File>& files)
+    {
+        std::vector<Result> results((size_t)files.size());
+        // Where each file goes in the results, a file may be listed twice
+        std::multimap<juce::File, size_t> indices;
+        for (int i = 0; i < files.size(); i++) indices.emplace(files[i], (size_t)i);
+
+        int next = 0;
+        run([&]() -> std::optional<juce::File>
+            {
+                if (next >= files.size()) return std::nullopt;
+                return files[next++];
+            },
+            [&](const Result& result)
+            {
+                const auto it = indices.find(result.file);
+                jassert(it != indices.end());
+                results[it->second] = result;
+                indices.erase(it);
+            });
+
+        return results;
+    }
+
+    bool LaneAnalyser::open(Slot& slot, const juce::File& file)
+    {
+        slot.result = Result {};
+        slot.result.file = file;
+        slot.channels.clear();
+        slot.weights.clear();
+        slot.position = 0;
+
+        try
+        {
+            if (!slot.fileHandler.openFile(file, false)) return false;
+            slot.result.tagged = slot.fileHandler.getTaggedRecord();
+
+            const int numberOfChannels = (int)slot.fileHandler.getNumberOfChannels();
+            slot.samplesPerBlock = slot.fileHandler.getSamplesPerBlock();
+
+            EXPECT_OR_RETURN (numberOfChannels > 0 && slot.samplesPerBlock > 0,
+                              false,
+                              "File {} has no audio to analyse",
+                              file.getFullPathName().toStdString());
+
+            slot.lkfs.reset(slot.fileHandler.getSampleRate(),
+                            numberOfChannels,
+                            slot.fileHandler.getChannelLayout());
+
+            // The channels LKFS measures, with the weights it would use
+            const auto& layout = slot.lkfs.getChannelLayout();
+            for (int ch = 0; ch < numberOfChannels; ch++)
+            {
+                const float weight = LKFS::getChannelWeight(layout.getTypeOfChannel(ch));
+                if (weight > 0.f)
+                {
+                    slot.channels.push_back(ch);
+                    slot.weights.push_back(weight);
+                }
+            }
+
+            slot.buffer.setSize(numberOfChannels, slot.samplesPerBlock, false, false, true);
+            return true;
+        }
+        catch (const std::exception&)
+        {
+            MY_LOG_WARNING("Analysis of {} failed", file.getFullPathName().toStdString());
+        }
+        return false;
+    }
+
+    bool LaneAnalyser::assignLanes(Slot& slot)
+    {
+        int freeLanes = 0;
+        for (const bool inUse : mLaneInUse) freeLanes += inUse ? 0 : 1;
+        if (freeLanes < (int)slot.channels.size()) return false;
+
+        slot.lanes.clear();
+        for (size_t i = 0; i < slot.channels.size(); i++)
+        {
+            int lane = 0;
+            while (mLaneInUse[(size_t)lane]) lane++;
+
+            mLaneInUse[(size_t)lane] = true;
+            mLaneEnergies[(size_t)lane] = 0.f;
+            mFilter.resetLane(lane, slot.fileHandler.getSampleRate());
+            slot.lanes.push_back(lane);
+        }
+
+        slot.isActive = true;
+        return true;
+    }
+
+    void LaneAnalyser::advance(Slot& slot, const ResultCallback& onResult)
+    {
+        slot.position = 0;
+        if (!slot.fileHandler.readNextBlock(&slot.buffer)) finish(slot, onResult);
+    }
+
+    void LaneAnalyser::finish(Slot& slot, const ResultCallback& onResult)
+    {
+        auto& analysis = slot.result.analysis;
+
+        try
+        {
+            analysis.samplePeak = slot.lkfs.getSamplePeak();
+            analysis.integratedLoudness = slot.lkfs.getIntegratedLoudness();
+            analysis.histogram = slot.lkfs.getHistogram();
+            analysis.lengthInSamples = slot.fileHandler.getLengthInSamples();
+            analysis.ok = true;
+        }
+        catch (const std::exception&)
+        {
+            MY_LOG_WARNING("Analysis of {} failed",
+                           slot.result.file.getFullPathName().toStdString());
+        }
+
+        for (const int lane : slot.lanes)
+        {
+            mFilter.clearLane(lane);
+            mLaneInUse[(size_t)lane] = false;
+        }
+        slot.lanes.clear();
+        slot.isActive = false;
+
+        onResult(slot.result);
+    }
+
+    void LaneAnalyser::filterActiveSlots(int size, const ResultCallback& onResult)
+    {
+        // Idle lanes filter whatever was left there into silence
+        const size_t needed = (size_t)size * numberOfLanes;
+        if (mInterleaved.size() < needed) mInterleaved.resize(needed);
+
+        for (const auto& slot : mSlots)
+        {
+            if (!slot->isActive) continue;
+
+            for (size_t i = 0; i < slot->lanes.size(); i++)
+            {
+                const float* source = slot->buffer.getReadPointer(slot->channels[i], slot->position);
+                float* destination = mInterleaved.data() + slot->lanes[i];
+                for (int s = 0; s < size; s++) destination[(size_t)s * numberOfLanes] = source[s];
+            }
+        }
+
+        mFilter.processEnergy(mInterleaved.data(), size, mLaneEnergies.data());
+
+        for (const auto& slot : mSlots)
+        {
+            if (!slot->isActive) continue;
+
+            slot->position += size;
+            if (slot->position < slot->samplesPerBlock) continue;
+
+            // Summed like KWFilterBank::processEnergy does
+            float blockEnergy = 0.f;
+            for (size_t i = 0; i < slot->lanes.size(); i++)
+            {
+                auto& energy = mLaneEnergies[(size_t)slot->lanes[i]];
+                blockEnergy += slot->weights[i] * energy;
+                energy = 0.f;
+            }
+
+            slot->lkfs.processNext100msEnergy(blockEnergy,
+                                              slot->buffer.getMagnitude(0, slot->samplesPerBlock));
+            slot->result.analysis.blocksRead++;
+            advance(*slot, onResult);
+        }
+    }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+/*  Full analysis of many files at once, for libraries of short mono and
+    stereo files (dialogue, effects) where filtering one file at a time
+    leaves most of every vector register unused. The measured channels of up
+    to KWFilterLanes::numberOfLanes files share one K-weighting pass, each
+    channel in a lane of its own; every file keeps its own LKFS for gating.
+
+    A lane is given the next file as soon as its file is done, so the lanes
+    stay busy across files of different lengths. Files of different sample
+    rates can share a pass, but then the lanes only advance to the nearest
+    block boundary of any of them at a time. A file with more measured
+    channels than there are lanes is analysed on its own.
+
+    Results match AnalysisEngine::analyse for the same file within float
+    rounding. They are not bit-identical once a block spans several passes,
+    which happens when rates are mixed: its energy is then summed in pieces.
+*/
+
+#include "AnalysisEngine.h"
+#include "FileHandler.h"
+#include "FilterProcessor.h"
+#include "LKFSProcessor.h"
+#include <juce_core/juce_core.h>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <array>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace norm
+{
+
+class LaneAnalyser
+{
+public:
+    struct Result
+    {
+        juce::File file;
+        AnalysisEngine::Result analysis;
+        // What the tags said, see FileHandler::getTaggedRecord
+        std::optional<LoudnessRecord> tagged;
+    };
+
+    // The next file to analyse, nothing once there are no more
+    using NextFile = std::function<std::optional<juce::File>()>;
+    // Called as each file is done, in the order they finish
+    using ResultCallback = std::function<void(const Result&)>;
+
+public:
+    LaneAnalyser();
+    ~LaneAnalyser();
+
+    // Blocks until next has run out and every file it gave is done
+    void run(const NextFile& next, const ResultCallback& onResult);
+    // Same for a list, the results are in the order of the list
+    std::vector<Result> analyse(const juce::Array<juce::File>& files);
+
+private:
+    struct Slot
+    {
+        FileHandler fileHandler;
+        LKFS lkfs;
+        juce::AudioBuffer<float> buffer;
+        Result result;
+
+        // Per measured channel: the source channel, its lane and weight
+        std::vector<int> channels;
+        std::vector<int> lanes;
+        std::vector<float> weights;
+
+        // Samples of the current block already filtered
+        int position = 0;
+        int samplesPerBlock = 0;
+        bool isActive = false;
+    };
+
+    // Opens the file in the slot. False if it cannot be analysed at all.
+    bool open(Slot& slot, const juce::File& file);
+    // Gives the slot's channels free lanes, false if there are not enough
+    bool assignLanes(Slot& slot);
+    // Reads the slot's next block, finishes the file at its end
+    void advance(Slot& slot, const ResultCallback& onResult);
+    void finish(Slot& slot, const ResultCallback& onResult);
+    // Filters size samples of every active file, all within one block
+    void filterActiveSlots(int size, const ResultCallback& onResult);
+
+    static constexpr int numberOfLanes = KWFilterLanes::numberOfLanes;
+
+    // A file takes at least one lane, and one more may be waiting for lanes
+    std::array<std::unique_ptr<Slot>, numberOfLanes + 1> mSlots;
+    std::array<bool, numberOfLanes> mLaneInUse {};
+    std::array<float, numberOfLanes> mLaneEnergies {};
+    KWFilterLanes mFilter;
+    std::vector<float> mInterleaved;
+
+    // For files with too many channels to share the lanes
+    AnalysisEngine mSingleFileEngine;
+};
+
+} // namespace norm
@@ -0,0 +1,512 @@
+#include "Mp3GainWriter.h"
+#include "util/Logger.h"
+#include <cstring>
+
+namespace norm
+{
+    namespace
+    {
+        // Side info fields are packed MSB first across byte boundaries
+        int readBits(const juce::uint8* data, int bitOffset, int numberOfBits)
+        {
+            int value = 0;
+            for (int i = bitOffset; i < bitOffset + numberOfBits; i++)
+            {
+                value = (value << 1) | ((data[i >> 3] >> (7 - (i & 7))) & 1);
+            }
+            return value;
+        }
+        void writeBits(juce::uint8* data, int bitOffset, int numberOfBits, int value)
+        {
+            for (int i = 0; i < numberOfBits; i++)
+            {
+                const int bit = bitOffset + i;
+                const auto mask = (juce::uint8)(1 << (7 - (bit & 7)));
+                if ((value >> (numberOfBits - 1 - i)) & 1) data[bit >> 3] |= mask;
+                else                                       data[bit >> 3] &= (juce::uint8)~mask;
+            }
+        }
+
+        juce::uint32 readSyncsafe(const juce::uint8* data)
+        {
+            return ((juce::uint32)(data[0] & 0x7f) << 21) | ((juce::uint32)(data[1] & 0x7f) << 14)
+                 | ((juce::uint32)(data[2] & 0x7f) << 7)  |  (juce::uint32)(data[3] & 0x7f);
+        }
+        void writeSyncsafe(juce::MemoryOutputStream& stream, juce::uint32 value)
+        {
+            for (int shift = 21; shift >= 0; shift -= 7)
+                stream.writeByte((char)((value >> shift) & 0x7f));
+        }
+
+        // ID3v2 text in one of its four encodings
+        juce::String decodeText(const juce::uint8* data, size_t size, int encoding)
+        {
+            if (encoding == 3) return juce::String::fromUTF8((const char*)data, (int)size);
+
+            juce::String text;
+            if (encoding == 0)
+            {
+                for (size_t i = 0; i < size && data[i] != 0; i++)
+                    text += juce::String::charToString((juce::juce_wchar)data[i]);
+                return text;
+            }
+
+            // UTF-16, with a byte order mark or big endian
+            bool bigEndian = encoding == 2;
+            size_t i = 0;
+            if (encoding == 1 && size >= 2)
+            {
+                bigEndian = data[0] == 0xfe && data[1] == 0xff;
+                i = 2;
+            }
+            for (; i + 1 < size; i += 2)
+            {
+                const auto unit = bigEndian ? (juce::juce_wchar)((data[i] << 8) | data[i + 1])
+                                            : (juce::juce_wchar)((data[i + 1] << 8) | data[i]);
+                if (unit == 0) break;
+                // Surrogates only occur outside of what we look for
+                if (unit < 0xd800 || unit > 0xdfff) text += juce::String::charToString(unit);
+            }
+            return text;
+        }
+        // Length of the first string, and of its terminator
+        std::pair<size_t, size_t> findTerminator(const juce::uint8* data, size_t size, int encoding)
+        {
+            const bool wide = encoding == 1 || encoding == 2;
+            for (size_t i = 0; i + (wide ? 1 : 0) < size; i += wide ? 2 : 1)
+            {
+                if (data[i] == 0 && (!wide || data[i + 1] == 0)) return { i, wide ? 2 : 1 };
+            }
+            return { size, 0 };
+        }
+
+        void writeLatin1(juce::MemoryOutputStream& stream, const juce::String& text)
+        {
+            for (auto c : text) stream.writeByte(c < 256 ? (char)c : '?');
+        }
+
+        bool startsWith(const juce::uint8* data, size_t size, size_t offset, const char* text)
+        {
+            const size_t length = std::strlen(text);
+            return offset + length <= size && std::memcmp(data + offset, text, length) == 0;
+        }
+        // Tags and junk after the last frame
+        bool isTrailer(const juce::uint8* data, size_t size, size_t offset)
+        {
+            return startsWith(data, size, offset, "TAG")
+                || startsWith(data, size, offset, "APETAGEX")
+                || startsWith(data, size, offset, "LYRICS");
+        }
+
+        // Layer III bitrates in kbit/s, MPEG 1 and MPEG 2 / 2.5
+        constexpr int bitrates[2][15] = {
+            { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+            { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }
+        };
+        constexpr int sampleRates[3] = { 44100, 48000, 32000 };
+
+        constexpr size_t maxTagLength = 64 * 1024 * 1024;
+        // Left after the frames of a tag that had to grow, for the next time
+        constexpr size_t newTagPadding = 2048;
+    }
+
+    Mp3GainWriter::Mp3GainWriter(juce::MemoryBlock data)
+        : mData(std::move(data))
+    {
+        const auto* bytes = static_cast<const juce::uint8*>(mData.getData());
+        const size_t size = mData.getSize();
+
+        mTag = parseTag(bytes, size);
+
+        // Until the first frame, and after anything that was not one, a
+        // header only counts if the next frame follows it
+        bool inSync = false;
+        size_t offset = mTag.length;
+        while (offset + 4 <= size)
+        {
+            if (!mFrames.empty() && isTrailer(bytes, size, offset)) break;
+
+            int length = 0;
+            auto frame = parseHeader(bytes, size, offset, &length);
+            if (frame.has_value() && !inSync)
+            {
+                const size_t next = offset + (size_t)length;
+                int nextLength = 0;
+                if (next != size && !isTrailer(bytes, size, next)
+                    && !parseHeader(bytes, size, next, &nextLength).has_value())
+                {
+                    frame.reset();
+                }
+            }
+            // A frame cut short is left as it is, decoders drop it anyway
+            if (!frame.has_value() || offset + (size_t)length > size)
+            {
+                inSync = false;
+                offset++;
+                continue;
+            }
+
+            inSync = true;
+            frame->offset = offset;
+            if (!isInfoFrame(bytes, size, *frame))
+            {
+                const auto* sideInfo = bytes + offset + frame->sideInfoOffset;
+                for (const int bit : getGlobalGainOffsets(*frame))
+                {
+                    // Granules without coded data do not care about their gain
+                    if (readBits(sideInfo, bit - 21, 12) == 0) continue;
+
+                    const int globalGain = readBits(sideInfo, bit, 8);
+                    mMinimumGlobalGain = juce::jmin(mMinimumGlobalGain, globalGain);
+                    mMaximumGlobalGain = juce::jmax(mMaximumGlobalGain, globalGain);
+                }
+                mFrames.push_back(*frame);
+            }
+            offset += (size_t)length;
+        }
+
+        mIsValid = !mFrames.empty();
+    }
+
+    juce::Range<int> Mp3GainWriter::getStepRange() const
+    {
+        // Nothing but silence, no gain changes anything
+        if (mMinimumGlobalGain > mMaximumGlobalGain) return {};
+        return { -mMinimumGlobalGain, 255 - mMaximumGlobalGain };
+    }
+
+    bool Mp3GainWriter::write(const juce::File& target,
+                              int steps,
+                              const juce::StringPairArray& fields) const
+    {
+        const auto path = target.getFullPathName().toStdString();
+        const auto range = getStepRange();
+
+        EXPECT_OR_RETURN (mIsValid, false, "No MPEG layer III frames to write to {}", path);
+        EXPECT_OR_RETURN (steps >= range.getStart() && steps <= range.getEnd(),
+                          false,
+                          "{} steps of global_gain are out of range for {}", steps, path);
+
+        const auto* bytes = static_cast<const juce::uint8*>(mData.getData());
+        const juce::MemoryBlock tag = mTag.isEditable ? buildTag(mTag, fields, 0)
+                                                      : juce::MemoryBlock(bytes, mTag.length);
+
+        // Everything after the tag, frames patched in place
+        juce::MemoryBlock audio(bytes + mTag.length, mData.getSize() - mTag.length);
+        auto* output = static_cast<juce::uint8*>(audio.getData());
+        if (steps != 0)
+        {
+            for (const auto& frame : mFrames)
+            {
+                auto* data = output + (frame.offset - mTag.length);
+                auto* sideInfo = data + frame.sideInfoOffset;
+
+                for (const int bit : getGlobalGainOffsets(frame))
+                {
+                    if (readBits(sideInfo, bit - 21, 12) == 0) continue;
+                    writeBits(sideInfo, bit, 8, readBits(sideInfo, bit, 8) + steps);
+                }
+
+                if (frame.hasCrc)
+                {
+                    const auto crc = computeCrc(data, frame);
+                    data[4] = (juce::uint8)(crc >> 8);
+                    data[5] = (juce::uint8)(crc & 0xff);
+                }
+            }
+        }
+
+        // Written next to the target and swapped in when complete
+        juce::TemporaryFile temporaryFile(target);
+        {
+            std::unique_ptr<juce::FileOutputStream> stream =
+                temporaryFile.getFile().createOutputStream();
+            EXPECT_OR_RETURN (stream != nullptr,
+                              false,
+                              "Unable to open a temporary file next to {}", path);
+
+            const bool written = stream->write(tag.getData(), tag.getSize())
+                              && stream->write(audio.getData(), audio.getSize());
+            stream->flush();
+            EXPECT_OR_RETURN (written && stream->getStatus().wasOk(),
+                              false,
+                              "Writing {} failed", path);
+        }
+
+        EXPECT_OR_RETURN (temporaryFile.overwriteTargetFileWithTemporary(),
+                          false,
+                          "Unable to replace {}", path);
+        return true;
+    }
+
+    juce::StringPairArray Mp3GainWriter::readFields(juce::InputStream& stream)
+    {
+        const auto tag = readTag(stream);
+        if (!tag.has_value()) return {};
+        return parseTag(static_cast<const juce::uint8*>(tag->getData()), tag->getSize()).fields;
+    }
+
+    bool Mp3GainWriter::writeFields(const juce::File& file, const juce::StringPairArray& fields)
+    {
+        const auto path = file.getFullPathName().toStdString();
+
+        std::unique_ptr<juce::FileInputStream> input = file.createInputStream();
+        EXPECT_OR_RETURN (input != nullptr, false, "Unable to read {}", path);
+
+        const auto data = readTag(*input);
+        Tag tag;
+        if (data.has_value())
+        {
+            tag = parseTag(static_cast<const juce::uint8*>(data->getData()), data->getSize());
+            EXPECT_OR_RETURN (tag.isEditable, false, "The ID3v2 tag of {} cannot be rewritten", path);
+        }
+
+        // Padding takes up what the frames leave of the old tag, so the tag
+        // keeps its size if it can
+        auto rebuilt = buildTag(tag, fields, 0);
+        if (tag.length > 0 && rebuilt.getSize() <= tag.length)
+            rebuilt = buildTag(tag, fields, tag.length - rebuilt.getSize());
+        else
+            rebuilt = buildTag(tag, fields, newTagPadding);
+
+        // Never in place: a write that fails half way would leave a broken
+        // tag in front of frames that may already carry the new gain. The
+        // frames are copied behind it into a file next to this one.
+        EXPECT_OR_RETURN (input->setPosition((juce::int64)tag.length),
+                          false,
+                          "Unable to read {}", path);
+
+        juce::TemporaryFile temporaryFile(file);
+        {
+            std::unique_ptr<juce::FileOutputStream> output =
+                temporaryFile.getFile().createOutputStream();
+            EXPECT_OR_RETURN (output != nullptr,
+                              false,
+                              "Unable to open a temporary file next to {}", path);
+
+            const bool written = output->write(rebuilt.getData(), rebuilt.getSize())
+                              && output->writeFromInputStream(*input, -1) >= 0;
+            output->flush();
+            EXPECT_OR_RETURN (written && output->getStatus().wasOk(),
+                              false,
+                              "Writing {} failed", path);
+        }
+        input.reset();
+
+        EXPECT_OR_RETURN (temporaryFile.overwriteTargetFileWithTemporary(),
+                          false,
+                          "Unable to replace {}", path);
+        return true;
+    }
+
+    std::optional<juce::MemoryBlock> Mp3GainWriter::readTag(juce::InputStream& stream)
+    {
+        juce::uint8 header[10];
+        if (stream.read(header, 10) != 10 || !startsWith(header, 10, 0, "ID3")) return std::nullopt;
+
+        size_t length = 10 + readSyncsafe(header + 6);
+        if ((header[5] & 0x10) != 0) length += 10;
+        // Cover art can be large, but not this large
+        if (length > maxTagLength) return std::nullopt;
+
+        juce::MemoryBlock tag(length);
+        std::memcpy(tag.getData(), header, 10);
+        const auto bodyRead = stream.read(static_cast<char*>(tag.getData()) + 10, (int)(length - 10));
+        if (bodyRead < 0) return std::nullopt;
+
+        tag.setSize(10 + (size_t)bodyRead);
+        return tag;
+    }
+
+    Mp3GainWriter::Tag Mp3GainWriter::parseTag(const juce::uint8* data, size_t size)
+    {
+        Tag tag;
+        if (size < 10 || !startsWith(data, size, 0, "ID3")) return tag;
+
+        const int flags = data[5];
+        const size_t end = juce::jmin(size, 10 + (size_t)readSyncsafe(data + 6));
+        tag.version = data[3];
+        tag.length = juce::jmin(size, end + ((flags & 0x10) != 0 ? 10 : 0));
+
+        // Unsynchronisation and extended headers would have to be undone and
+        // redone, such tags are kept as they are
+        if (tag.version < 3 || tag.version > 4 || (flags & 0xc0) != 0)
+        {
+            tag.isEditable = false;
+            return tag;
+        }
+
+        size_t position = 10;
+        while (position + 10 <= end && data[position] != 0)
+        {
+            const auto* frame = data + position;
+            const size_t frameSize = tag.version == 4
+                                   ? readSyncsafe(frame + 4)
+                                   : ((size_t)frame[4] << 24) | ((size_t)frame[5] << 16)
+                                   | ((size_t)frame[6] << 8) | (size_t)frame[7];
+            if (position + 10 + frameSize > end)
+            {
+                // Frames after a broken one would be lost
+                tag.isEditable = false;
+                return tag;
+            }
+
+            // Compressed, encrypted or grouped frames are not looked into
+            const bool isPlain = tag.version == 4 ? (frame[9] & 0x4f) == 0
+                                                  : (frame[9] & 0xe0) == 0;
+            TagFrame kept { juce::MemoryBlock(frame, 10 + frameSize), {} };
+
+            if (isPlain && frameSize > 1 && std::memcmp(frame, "TXXX", 4) == 0)
+            {
+                const auto* body = frame + 10;
+                const int encoding = body[0];
+                const auto [descriptionLength, terminator] =
+                    findTerminator(body + 1, frameSize - 1, encoding);
+                const size_t valueStart = 1 + descriptionLength + terminator;
+
+                kept.description = decodeText(body + 1, descriptionLength, encoding);
+                const auto value = valueStart < frameSize
+                                 ? decodeText(body + valueStart, frameSize - valueStart, encoding)
+                                 : juce::String();
+                tag.fields.set(kept.description, value);
+            }
+
+            tag.frames.push_back(std::move(kept));
+            position += 10 + frameSize;
+        }
+
+        return tag;
+    }
+
+    juce::MemoryBlock Mp3GainWriter::buildTag(const Tag& tag,
+                                              const juce::StringPairArray& fields,
+                                              size_t padding)
+    {
+        const int version = tag.length > 0 ? tag.version : 3;
+
+        juce::MemoryOutputStream frames;
+        for (const auto& frame : tag.frames)
+        {
+            if (frame.description.isNotEmpty() && fields.containsKey(frame.description)) continue;
+            frames.write(frame.data.getData(), frame.data.getSize());
+        }
+
+        for (const auto& key : fields.getAllKeys())
+        {
+            const auto value = fields[key];
+            if (value.isEmpty()) continue;
+
+            juce::MemoryOutputStream body;
+            body.writeByte(0);
+            writeLatin1(body, key);
+            body.writeByte(0);
+            writeLatin1(body, value);
+
+            frames.write("TXXX", 4);
+            if (version == 4) writeSyncsafe(frames, (juce::uint32)body.getDataSize());
+            else              frames.writeIntBigEndian((int)body.getDataSize());
+            frames.writeShort(0);
+            frames.write(body.getData(), body.getDataSize());
+        }
+
+        juce::MemoryOutputStream output;
+        output.write("ID3", 3);
+        output.writeByte((char)version);
+        output.writeByte(0);
+        output.writeByte(0);
+        writeSyncsafe(output, (juce::uint32)(frames.getDataSize() + padding));
+        output.write(frames.getData(), frames.getDataSize());
+        output.writeRepeatedByte(0, padding);
+        return output.getMemoryBlock();
+    }
+
+    std::optional<Mp3GainWriter::Frame> Mp3GainWriter::parseHeader(const juce::uint8* data,
+                                                                   size_t size,
+                                                                   size_t offset,
+                                                                   int* frameLength)
+    {
+        if (offset + 4 > size) return std::nullopt;
+        const auto* header = data + offset;
+        if (header[0] != 0xff || (header[1] & 0xe0) != 0xe0) return std::nullopt;
+
+        // 3 = MPEG 1, 2 = MPEG 2, 0 = MPEG 2.5; layer 1 stands for layer III
+        const int version = (header[1] >> 3) & 3;
+        const int layer = (header[1] >> 1) & 3;
+        const int bitrateIndex = header[2] >> 4;
+        const int sampleRateIndex = (header[2] >> 2) & 3;
+        if (version == 1 || layer != 1 || bitrateIndex == 0 || bitrateIndex == 15
+            || sampleRateIndex == 3)
+        {
+            return std::nullopt;
+        }
+
+        Frame frame;
+        frame.isMpeg1 = version == 3;
+        frame.hasCrc = (header[1] & 1) == 0;
+        frame.numberOfChannels = ((header[3] >> 6) & 3) == 3 ? 1 : 2;
+        frame.sideInfoOffset = frame.hasCrc ? 6 : 4;
+        frame.sideInfoLength = frame.isMpeg1 ? (frame.numberOfChannels == 1 ? 17 : 32)
+                                             : (frame.numberOfChannels == 1 ? 9 : 17);
+
+        const int sampleRate = sampleRates[sampleRateIndex] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+        const int bitrate = bitrates[frame.isMpeg1 ? 0 : 1][bitrateIndex] * 1000;
+        const int padding = (header[2] >> 1) & 1;
+        *frameLength = (frame.isMpeg1 ? 144 : 72) * bitrate / sampleRate + padding;
+
+        if (*frameLength < frame.sideInfoOffset + frame.sideInfoLength) return std::nullopt;
+        return frame;
+    }
+
+    bool Mp3GainWriter::isInfoFrame(const juce::uint8* data, size_t size, const Frame& frame)
+    {
+        const size_t afterSideInfo = frame.offset + (size_t)(frame.sideInfoOffset + frame.sideInfoLength);
+        return startsWith(data, size, afterSideInfo, "Xing")
+            || startsWith(data, size, afterSideInfo, "Info")
+            || startsWith(data, size, frame.offset + 36, "VBRI");
+    }
+
+    std::vector<int> Mp3GainWriter::getGlobalGainOffsets(const Frame& frame)
+    {
+        // part2_3_length (12 bits) and big_values (9) come first in every
+        // granule, then global_gain
+        std::vector<int> offsets;
+        const int channels = frame.numberOfChannels;
+        if (frame.isMpeg1)
+        {
+            // main_data_begin, private bits, scfsi; then 59 bits per granule
+            const int start = 9 + (channels == 1 ? 5 : 3) + 4 * channels;
+            for (int granule = 0; granule < 2; granule++)
+                for (int channel = 0; channel < channels; channel++)
+                    offsets.push_back(start + (granule * channels + channel) * 59 + 21);
+        }
+        else
+        {
+            // One granule of 63 bits per channel
+            const int start = 8 + (channels == 1 ? 1 : 2);
+            for (int channel = 0; channel < channels; channel++)
+                offsets.push_back(start + channel * 63 + 21);
+        }
+        return offsets;
+    }
+
+    juce::uint16 Mp3GainWriter::computeCrc(const juce::uint8* frame, const Frame& info)
+    {
+        // CRC-16, polynomial 0x8005, over the last two header bytes and the
+        // side info
+        juce::uint32 crc = 0xffff;
+        auto add = [&crc](juce::uint8 byte)
+        {
+            for (int bit = 7; bit >= 0; bit--)
+            {
+                const bool top = (((crc >> 15) ^ (juce::uint32)(byte >> bit)) & 1) != 0;
+                crc = (crc << 1) & 0xffff;
+                if (top) crc ^= 0x8005;
+            }
+        };
+
+        add(frame[2]);
+        add(frame[3]);
+        for (int i = 0; i < info.sideInfoLength; i++) add(frame[info.sideInfoOffset + i]);
+        return (juce::uint16)crc;
+    }
+}
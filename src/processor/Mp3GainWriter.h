@@ -0,0 +1,111 @@
+#pragma once
+
+/*  Gain for MP3 files without decoding and encoding them again. Every
+    granule of a layer III frame has a global_gain field in its side info;
+    one step up or down scales the decoded granule by 2^(1/4), 1.5 dB. Moving
+    every granule by the same number of steps changes the loudness of the
+    whole file losslessly, and only touches a byte or two per frame.
+
+    What 1.5 dB steps cannot express, up to 0.75 dB, can be left for the
+    player: it goes into a ReplayGain track gain tag, with the peak after
+    the gain. The loudness record of GainModel goes into a TXXX frame of the
+    ID3v2 tag, so a later run can read it from the header.
+
+    Anything between frames that is not a layer III frame is copied as it
+    is. A tag this cannot rewrite (ID3v2.2, unsynchronised or with an
+    extended header) is kept as it is, without the new fields. Frame CRCs
+    are recomputed, the Xing/LAME header frame is left alone.
+*/
+
+#include "GainModel.h"
+#include <juce_core/juce_core.h>
+#include <optional>
+#include <vector>
+
+namespace norm
+{
+
+class Mp3GainWriter
+{
+public:
+    // One step of global_gain, 20 log10(2^(1/4))
+    static constexpr float stepDB = 1.50515f;
+
+public:
+    // Parses the ID3v2 tag and the frames of a whole file
+    explicit Mp3GainWriter(juce::MemoryBlock data);
+
+    // Whether there is at least one layer III frame
+    bool isValid() const { return mIsValid; }
+    int getNumberOfFrames() const { return (int)mFrames.size(); }
+    // The steps every granule can move by, so none leaves 0 to 255. Both
+    // ends are allowed.
+    juce::Range<int> getStepRange() const;
+    // Whether the fields of write can go into the tag
+    bool canWriteTag() const { return mTag.isEditable; }
+
+    // Writes the file with every granule moved by steps into target,
+    // through a temporary file next to it. fields replace the TXXX frames
+    // of the same description, an empty value removes one.
+    bool write(const juce::File& target, int steps, const juce::StringPairArray& fields) const;
+
+    // The TXXX frames of the ID3v2 tag at the start of stream
+    static juce::StringPairArray readFields(juce::InputStream& stream);
+    // Only the tag of file changes, the frames stay as they are. The file is
+    // written again through a temporary file next to it, the tag keeping
+    // its size if the new fields fit into the old one with its padding.
+    static bool writeFields(const juce::File& file, const juce::StringPairArray& fields);
+    static bool isMp3File(const juce::File& file) { return file.hasFileExtension("mp3"); }
+
+private:
+    struct Frame
+    {
+        size_t offset = 0;
+        bool isMpeg1 = true;
+        bool hasCrc = false;
+        int numberOfChannels = 2;
+        // Side info, from the start of the frame
+        int sideInfoOffset = 4;
+        int sideInfoLength = 32;
+    };
+
+    struct TagFrame
+    {
+        juce::MemoryBlock data;
+        // Of a TXXX frame, empty for every other
+        juce::String description;
+    };
+
+    struct Tag
+    {
+        // Of the whole tag, 0 if there is none
+        size_t length = 0;
+        int version = 3;
+        bool isEditable = true;
+        // Copied over as they are, unless fields replace them
+        std::vector<TagFrame> frames;
+        juce::StringPairArray fields;
+    };
+
+    static Tag parseTag(const juce::uint8* data, size_t size);
+    static std::optional<Frame> parseHeader(const juce::uint8* data, size_t size, size_t offset,
+                                            int* frameLength);
+    // Xing, Info or VBRI: a header frame without audio
+    static bool isInfoFrame(const juce::uint8* data, size_t size, const Frame& frame);
+    // Bit offsets of the global_gain fields in the side info
+    static std::vector<int> getGlobalGainOffsets(const Frame& frame);
+    static juce::uint16 computeCrc(const juce::uint8* frame, const Frame& info);
+    // With padding zero bytes after the frames
+    static juce::MemoryBlock buildTag(const Tag& tag, const juce::StringPairArray& fields,
+                                      size_t padding);
+    static std::optional<juce::MemoryBlock> readTag(juce::InputStream& stream);
+
+    const juce::MemoryBlock mData;
+    Tag mTag;
+    std::vector<Frame> mFrames;
+    bool mIsValid = false;
+    int mMinimumGlobalGain = 255;
+    int mMaximumGlobalGain = 0;
+};
+
+} // namespace norm
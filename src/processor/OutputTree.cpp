@@ -0,0 +1,120 @@
+#include "OutputTree.h"
+#include "util/Logger.h"
+
+#if JUCE_LINUX || JUCE_MAC
+ #include <fcntl.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+#endif
+#if JUCE_LINUX
+ #include <linux/fs.h>
+ #include <sys/ioctl.h>
+#elif JUCE_MAC
+ #include <sys/clonefile.h>
+#endif
+
+namespace norm
+{
+    OutputTree::OutputTree(const juce::File& sourceRoot, const juce::File& outputRoot)
+        : mSourceRoot(sourceRoot)
+        , mOutputRoot(outputRoot)
+    {
+    }
+
+    juce::File OutputTree::getOutputFile(const juce::File& source) const
+    {
+        if (!isEnabled() || !source.isAChildOf(mSourceRoot)) return {};
+        // An output root inside the source root would otherwise mirror
+        // its own files on the next scan
+        if (source.isAChildOf(mOutputRoot)) return {};
+
+        return mOutputRoot.getChildFile(source.getRelativePathFrom(mSourceRoot));
+    }
+
+    std::optional<OutputTree::CloneMethod> OutputTree::clone(const juce::File& source,
+                                                             const juce::File& target,
+                                                             bool allowHardlink)
+    {
+        const auto path = target.getFullPathName().toStdString();
+
+        EXPECT_OR_RETURN (target.getParentDirectory().createDirectory(),
+                          std::nullopt,
+                          "Unable to create the folder for {}", path);
+
+        // Every method creates the temporary file itself
+        juce::TemporaryFile temporaryFile(target);
+        const auto& temporary = temporaryFile.getFile();
+
+        std::optional<CloneMethod> method;
+        if (reflink(source, temporary))
+            method = CloneMethod::reflink;
+        else if (allowHardlink && hardlink(source, temporary))
+            method = CloneMethod::hardlink;
+        else if (source.copyFileTo(temporary))
+            method = CloneMethod::copy;
+
+        EXPECT_OR_RETURN (method.has_value(),
+                          std::nullopt,
+                          "Unable to clone {} to {}",
+                          source.getFullPathName().toStdString(),
+                          path);
+        EXPECT_OR_RETURN (temporaryFile.overwriteTargetFileWithTemporary(),
+                          std::nullopt,
+                          "Unable to replace {}", path);
+        return method;
+    }
+    const char* OutputTree::toString(CloneMethod method)
+    {
+        switch (method)
+        {
+            case CloneMethod::reflink:  return "reflink";
+            case CloneMethod::hardlink: return "hardlink";
+            case CloneMethod::copy:     return "copy";
+        }
+        return "";
+    }
+
+    bool OutputTree::reflink(const juce::File& source, const juce::File& target)
+    {
+       #if JUCE_LINUX
+        const int in = open(source.getFullPathName().toRawUTF8(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) return false;
+
+        struct stat status {};
+        const mode_t mode = fstat(in, &status) == 0 ? (status.st_mode & 0777) : 0644;
+        const int out = open(target.getFullPathName().toRawUTF8(),
+                             O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                             mode);
+        if (out < 0)
+        {
+            close(in);
+            return false;
+        }
+
+        // Fails with EOPNOTSUPP or EXDEV where blocks cannot be shared
+        const bool cloned = ioctl(out, FICLONE, in) == 0;
+        close(out);
+        close(in);
+
+        if (!cloned) unlink(target.getFullPathName().toRawUTF8());
+        return cloned;
+       #elif JUCE_MAC
+        return clonefile(source.getFullPathName().toRawUTF8(),
+                         target.getFullPathName().toRawUTF8(),
+                         0) == 0;
+       #else
+        juce::ignoreUnused(source, target);
+        return false;
+       #endif
+    }
+    bool OutputTree::hardlink(const juce::File& source, const juce::File& target)
+    {
+       #if JUCE_LINUX || JUCE_MAC
+        return link(source.getFullPathName().toRawUTF8(),
+                    target.getFullPathName().toRawUTF8()) == 0;
+       #else
+        juce::ignoreUnused(source, target);
+        return false;
+       #endif
+    }
+}
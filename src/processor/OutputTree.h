@@ -0,0 +1,53 @@
+#pragma once
+
+/*  A mirror of the source tree in another folder, for libraries whose
+    originals must stay as they are. Files that need gain are written into
+    the mirror; files that do not are cloned there as cheaply as the file
+    system allows:
+
+    - reflink: the clone shares the original's data blocks copy-on-write,
+      no data is copied (btrfs, XFS, bcachefs on Linux, APFS on macOS)
+    - hardlink: the clone is the original under a second name
+    - copy: the bytes are copied, when neither of the above works
+
+    A hardlink is a second name for the same inode: a tool that edits the
+    mirrored file in place edits the original as well. Tools that write a new
+    file and rename it over the old one, as this one does, are safe.
+*/
+
+#include <juce_core/juce_core.h>
+#include <optional>
+
+namespace norm
+{
+
+class OutputTree
+{
+public:
+    enum class CloneMethod { reflink, hardlink, copy };
+
+public:
+    // Nothing is mirrored with an empty output root
+    OutputTree(const juce::File& sourceRoot, const juce::File& outputRoot);
+
+    bool isEnabled() const { return mOutputRoot != juce::File(); }
+    // Same path relative to the output root as source has to the source
+    // root. Empty for files outside the source root.
+    juce::File getOutputFile(const juce::File& source) const;
+
+    // Puts an unchanged copy of source at target, replacing what is there
+    // in one step. Nothing if all methods failed.
+    static std::optional<CloneMethod> clone(const juce::File& source,
+                                            const juce::File& target,
+                                            bool allowHardlink);
+    static const char* toString(CloneMethod method);
+
+private:
+    static bool reflink(const juce::File& source, const juce::File& target);
+    static bool hardlink(const juce::File& source, const juce::File& target);
+
+    const juce::File mSourceRoot;
+    const juce::File mOutputRoot;
+};
+
+} // namespace norm
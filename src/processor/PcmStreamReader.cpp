@@ -0,0 +1,246 @@
+#include "PcmStreamReader.h"
+#include "util/Logger.h"
+#include <cstdio>
+#include <cstring>
+
+#if JUCE_WINDOWS
+ #include <fcntl.h>
+ #include <io.h>
+#endif
+
+namespace norm
+{
+    namespace
+    {
+        constexpr juce::uint16 wavePcm = 1;
+        constexpr juce::uint16 waveFloat = 3;
+        constexpr juce::uint16 waveExtensible = 0xfffe;
+        // The largest chunk in a header that is read rather than skipped
+        constexpr juce::uint32 maxFormatChunkSize = 64;
+
+        bool isChunk(const char* id, const char* name)
+        {
+            return std::memcmp(id, name, 4) == 0;
+        }
+    }
+
+    std::optional<PcmStreamReader::SampleFormat> PcmStreamReader::parseSampleFormat(const juce::String& name)
+    {
+        if (name == "u8")    return SampleFormat::uint8;
+        if (name == "s16le") return SampleFormat::int16;
+        if (name == "s24le") return SampleFormat::int24;
+        if (name == "s32le") return SampleFormat::int32;
+        if (name == "f32le") return SampleFormat::float32;
+        return std::nullopt;
+    }
+    int PcmStreamReader::getBytesPerSample(SampleFormat format)
+    {
+        switch (format)
+        {
+            case SampleFormat::uint8:   return 1;
+            case SampleFormat::int16:   return 2;
+            case SampleFormat::int24:   return 3;
+            case SampleFormat::int32:   return 4;
+            case SampleFormat::float32: return 4;
+        }
+        return 0;
+    }
+
+    std::unique_ptr<PcmStreamReader> PcmStreamReader::createForWav(juce::InputStream& stream)
+    {
+        char riff[12];
+        EXPECT_OR_RETURN (readFully(stream, riff, 12) == 12
+                          && (isChunk(riff, "RIFF") || isChunk(riff, "RF64"))
+                          && isChunk(riff + 8, "WAVE"),
+                          nullptr,
+                          "The stream does not start with a WAV header");
+
+        std::optional<Format> format;
+        // From the ds64 chunk of an RF64 stream
+        juce::int64 rf64DataSize = -1;
+
+        for (;;)
+        {
+            char header[8];
+            EXPECT_OR_RETURN (readFully(stream, header, 8) == 8,
+                              nullptr,
+                              "The WAV stream ended before its data chunk");
+            const juce::uint32 size = juce::ByteOrder::littleEndianInt(header + 4);
+
+            if (isChunk(header, "data"))
+            {
+                EXPECT_OR_RETURN (format.has_value(),
+                                  nullptr,
+                                  "The WAV stream has no format before its data");
+
+                // Streams written to a pipe could not fill in their size
+                juce::int64 dataSize = size;
+                if (size == 0xffffffffu) dataSize = rf64DataSize;
+                else if (size == 0)      dataSize = -1;
+                return std::make_unique<PcmStreamReader>(stream, *format, dataSize);
+            }
+
+            if (isChunk(header, "fmt ") || isChunk(header, "ds64"))
+            {
+                EXPECT_OR_RETURN (size >= 16 && size <= maxFormatChunkSize,
+                                  nullptr,
+                                  "Unexpected WAV header chunk of {} bytes", size);
+
+                juce::uint8 chunk[maxFormatChunkSize + 1];
+                EXPECT_OR_RETURN (readFully(stream, chunk, (int)(size + (size & 1))) == (int)(size + (size & 1)),
+                                  nullptr,
+                                  "The WAV stream ended in its header");
+
+                if (isChunk(header, "ds64"))
+                {
+                    rf64DataSize = (juce::int64)juce::ByteOrder::littleEndianInt64(chunk + 8);
+                    continue;
+                }
+
+                juce::uint16 tag = juce::ByteOrder::littleEndianShort(chunk);
+                const int numberOfChannels = juce::ByteOrder::littleEndianShort(chunk + 2);
+                const double sampleRate = juce::ByteOrder::littleEndianInt(chunk + 4);
+                const int blockAlign = juce::ByteOrder::littleEndianShort(chunk + 12);
+                const int bitsPerSample = juce::ByteOrder::littleEndianShort(chunk + 14);
+                // The real tag is the start of the sub-format GUID
+                if (tag == waveExtensible && size >= 26) tag = juce::ByteOrder::littleEndianShort(chunk + 24);
+
+                Format parsed { sampleRate, numberOfChannels, SampleFormat::int16 };
+                if (tag == waveFloat && bitsPerSample == 32)   parsed.sampleFormat = SampleFormat::float32;
+                else if (tag == wavePcm && bitsPerSample == 8)  parsed.sampleFormat = SampleFormat::uint8;
+                else if (tag == wavePcm && bitsPerSample == 16) parsed.sampleFormat = SampleFormat::int16;
+                else if (tag == wavePcm && bitsPerSample == 24) parsed.sampleFormat = SampleFormat::int24;
+                else if (tag == wavePcm && bitsPerSample == 32) parsed.sampleFormat = SampleFormat::int32;
+                else
+                {
+                    MY_LOG_WARNING("WAV format {} with {} bits is not supported on streams", tag, bitsPerSample);
+                    return nullptr;
+                }
+
+                EXPECT_OR_RETURN (numberOfChannels >= 1 && numberOfChannels <= maxNumberOfChannels
+                                  && sampleRate >= 1 && sampleRate <= maxSampleRate,
+                                  nullptr,
+                                  "WAV streams of {} channels at {} Hz are not supported",
+                                  numberOfChannels, sampleRate);
+                EXPECT_OR_RETURN (blockAlign == numberOfChannels * getBytesPerSample(parsed.sampleFormat),
+                                  nullptr,
+                                  "WAV frames of {} bytes for {} channels of {} bits are not supported",
+                                  blockAlign, numberOfChannels, bitsPerSample);
+                format = parsed;
+                continue;
+            }
+
+            // LIST, fact and the like, padded to an even size. Skipping
+            // reads through them, the stream cannot seek.
+            stream.skipNextBytes((juce::int64)size + (size & 1));
+        }
+    }
+
+    PcmStreamReader::PcmStreamReader(juce::InputStream& stream,
+                                     const Format& format,
+                                     juce::int64 dataSize)
+        : mStream(stream),
+          mFormat(format),
+          mRemaining(dataSize)
+    {
+    }
+    PcmStreamReader::~PcmStreamReader() {}
+
+    bool PcmStreamReader::isValid() const
+    {
+        return mFormat.sampleRate > 0 && mFormat.sampleRate <= maxSampleRate
+            && mFormat.numberOfChannels > 0 && mFormat.numberOfChannels <= maxNumberOfChannels;
+    }
+
+    int PcmStreamReader::read(juce::AudioBuffer<float>& buffer, int numSamples)
+    {
+        const int numberOfChannels = mFormat.numberOfChannels;
+        const int bytesPerSample = getBytesPerSample(mFormat.sampleFormat);
+        const int frameSize = numberOfChannels * bytesPerSample;
+        jassert (buffer.getNumChannels() >= numberOfChannels && buffer.getNumSamples() >= numSamples);
+
+        juce::int64 wanted = (juce::int64)numSamples * frameSize;
+        if (mRemaining >= 0) wanted = juce::jmin(wanted, mRemaining - mRemaining % frameSize);
+        if (wanted <= 0) return 0;
+
+        if (mBytesSize < (int)wanted)
+        {
+            mBytes.malloc(wanted);
+            mBytesSize = (int)wanted;
+        }
+        const int frames = readFully(mStream, mBytes.get(), (int)wanted) / frameSize;
+        if (mRemaining >= 0) mRemaining -= (juce::int64)frames * frameSize;
+
+        for (int ch = 0; ch < numberOfChannels; ch++)
+        {
+            float* dest = buffer.getWritePointer(ch);
+            const char* source = mBytes.get() + ch * bytesPerSample;
+
+            switch (mFormat.sampleFormat)
+            {
+                case SampleFormat::uint8:
+                    for (int i = 0; i < frames; i++)
+                        dest[i] = (float)((int)(juce::uint8)source[i * frameSize] - 128) * (1.f / 128.f);
+                    break;
+                case SampleFormat::int16:
+                    for (int i = 0; i < frames; i++)
+                        dest[i] = (float)(juce::int16)juce::ByteOrder::littleEndianShort(source + i * frameSize)
+                                * (1.f / 32768.f);
+                    break;
+                case SampleFormat::int24:
+                    for (int i = 0; i < frames; i++)
+                        dest[i] = (float)juce::ByteOrder::littleEndian24Bit(source + i * frameSize)
+                                * (1.f / 8388608.f);
+                    break;
+                case SampleFormat::int32:
+                    for (int i = 0; i < frames; i++)
+                        dest[i] = (float)(int)juce::ByteOrder::littleEndianInt(source + i * frameSize)
+                                * (1.f / 2147483648.f);
+                    break;
+                case SampleFormat::float32:
+                    for (int i = 0; i < frames; i++)
+                    {
+                        const juce::uint32 bits = juce::ByteOrder::littleEndianInt(source + i * frameSize);
+                        std::memcpy(dest + i, &bits, sizeof(float));
+                    }
+                    break;
+            }
+        }
+
+        mSamplesRead += frames;
+        return frames;
+    }
+
+    int PcmStreamReader::readFully(juce::InputStream& stream, void* dest, int size)
+    {
+        // Pipes hand out what they have, not what was asked for
+        int total = 0;
+        while (total < size)
+        {
+            const int read = stream.read(static_cast<char*>(dest) + total, size - total);
+            if (read <= 0) break;
+            total += read;
+        }
+        return total;
+    }
+
+    //==========================================================================
+
+    StandardInputStream::StandardInputStream()
+    {
+       #if JUCE_WINDOWS
+        // Text mode would eat carriage returns in the samples
+        _setmode(_fileno(stdin), _O_BINARY);
+       #endif
+    }
+    bool StandardInputStream::isExhausted()
+    {
+        return std::feof(stdin) != 0 || std::ferror(stdin) != 0;
+    }
+    int StandardInputStream::read(void* destBuffer, int maxBytesToRead)
+    {
+        const int read = (int)std::fread(destBuffer, 1, (size_t)juce::jmax(0, maxBytesToRead), stdin);
+        mPosition += read;
+        return read;
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+/*  Audio from a stream that can only be read forward, e.g. a pipe from
+    ffmpeg on stdin. Either a WAV (or RF64) header comes first, or the
+    stream is raw interleaved little-endian PCM in a format given by the
+    caller. Nothing is ever seeked, and only one block of bytes is held at a
+    time. The analysis itself keeps the energy of every 400ms window above
+    the absolute gate, so memory grows by a few bytes per 100ms of audio,
+    about 140 kB an hour.
+
+    A WAV header written to a pipe cannot know its data size: a size of 0 or
+    0xffffffff reads to the end of the stream. Any other size is trusted,
+    and what follows the data chunk is left unread.
+*/
+
+#include <juce_core/juce_core.h>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <memory>
+#include <optional>
+
+namespace norm
+{
+
+class PcmStreamReader
+{
+public:
+    enum class SampleFormat { uint8, int16, int24, int32, float32 };
+
+    struct Format
+    {
+        double sampleRate = 0;
+        int numberOfChannels = 0;
+        SampleFormat sampleFormat = SampleFormat::int16;
+    };
+
+    // Beyond these a header is broken or hostile, the buffers it would size
+    // are not allocated. The channel limit is the C interface's.
+    static constexpr int maxNumberOfChannels = 64;
+    static constexpr double maxSampleRate = 768000.0;
+
+    // ffmpeg's names: u8, s16le, s24le, s32le, f32le
+    static std::optional<SampleFormat> parseSampleFormat(const juce::String& name);
+    static int getBytesPerSample(SampleFormat format);
+
+    // Reads the header off the stream, nothing if it is not PCM or float WAV
+    static std::unique_ptr<PcmStreamReader> createForWav(juce::InputStream& stream);
+
+public:
+    // Raw PCM from the stream's current position on. The stream must
+    // outlive the reader.
+    PcmStreamReader(juce::InputStream& stream,
+                    const Format& format,
+                    juce::int64 dataSize = -1);
+    ~PcmStreamReader();
+
+    const Format& getFormat() const { return mFormat; }
+    // Whether the format is within the limits above
+    bool isValid() const;
+
+    // Fills the first numSamples of every channel of buffer, which needs
+    // at least as many channels as the stream. Returns how many samples were
+    // read, fewer only at the end of the stream.
+    int read(juce::AudioBuffer<float>& buffer, int numSamples);
+    juce::int64 getSamplesRead() const { return mSamplesRead; }
+
+private:
+    // Blocks until size bytes came or the stream ended
+    static int readFully(juce::InputStream& stream, void* dest, int size);
+
+    juce::InputStream& mStream;
+    const Format mFormat;
+    // Bytes of audio left, negative for up to the end of the stream
+    juce::int64 mRemaining;
+    juce::HeapBlock<char> mBytes;
+    int mBytesSize = 0;
+    juce::int64 mSamplesRead = 0;
+};
+
+// stdin as a juce::InputStream, binary, without seeking
+class StandardInputStream : public juce::InputStream
+{
+public:
+    StandardInputStream();
+
+    juce::int64 getTotalLength() override { return -1; }
+    bool isExhausted() override;
+    int read(void* destBuffer, int maxBytesToRead) override;
+    juce::int64 getPosition() override { return mPosition; }
+    bool setPosition(juce::int64 newPosition) override { return newPosition == mPosition; }
+
+private:
+    juce::int64 mPosition = 0;
+};
+
+} // namespace norm
@@ -0,0 +1,171 @@
+#include "SampleStore.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace norm
+{
+    namespace
+    {
+        constexpr float int16Scale = 32768.f;
+        constexpr float int24Scale = 8388608.f;
+
+        // Round half away from zero, as WriteStage does
+        inline int quantise(float value, float scale)
+        {
+            const float y = std::min(std::max(value * scale, -scale), scale - 1.f);
+            return (int)(y + (y >= 0.f ? 0.5f : -0.5f));
+        }
+    }
+
+    SampleStore::Format SampleStore::getFormatFor(unsigned int bitsPerSample, bool usesFloatingPointData)
+    {
+        if (usesFloatingPointData || bitsPerSample > 24) return Format::float32;
+        return bitsPerSample > 16 ? Format::int24 : Format::int16;
+    }
+    int SampleStore::getBytesPerSample(Format format)
+    {
+        switch (format)
+        {
+            case Format::int16:   return 2;
+            case Format::int24:   return 3;
+            case Format::float32: return 4;
+        }
+        return 4;
+    }
+
+    void SampleStore::setSize(int numberOfChannels, juce::int64 numSamples, Format format)
+    {
+        mNumberOfChannels = juce::jmax(0, numberOfChannels);
+        mNumberOfSamples = juce::jmax((juce::int64)0, numSamples);
+        mFormat = format;
+        mChannelStride = (size_t)mNumberOfSamples * (size_t)getBytesPerSample(format);
+
+        // Not cleared: untouched pages cost no memory
+        mData.free();
+        if (getSizeInBytes() > 0) mData.malloc(getSizeInBytes());
+    }
+
+    void SampleStore::write(const juce::AudioBuffer<float>& block, juce::int64 startSample, int numSamples)
+    {
+        jassert (startSample >= 0 && startSample + numSamples <= mNumberOfSamples);
+
+        const int numberOfChannels = juce::jmin(mNumberOfChannels, block.getNumChannels());
+        for (int ch = 0; ch < numberOfChannels; ch++)
+        {
+            pack(block.getReadPointer(ch), getPointer(ch, startSample), numSamples, mFormat);
+        }
+    }
+    void SampleStore::read(int channel, juce::int64 startSample, int numSamples, float* dest) const
+    {
+        jassert (channel < mNumberOfChannels);
+        jassert (startSample >= 0 && startSample + numSamples <= mNumberOfSamples);
+
+        unpack(getPointer(channel, startSample), dest, numSamples, mFormat);
+    }
+
+    float SampleStore::getMagnitude() const
+    {
+        const auto numSamples = (size_t)mNumberOfSamples;
+        float magnitude = 0.f;
+
+        for (int ch = 0; ch < mNumberOfChannels; ch++)
+        {
+            const char* data = getPointer(ch, 0);
+            switch (mFormat)
+            {
+                case Format::int16:
+                {
+                    const auto* samples = reinterpret_cast<const juce::int16*>(data);
+                    int largest = 0;
+                    for (size_t i = 0; i < numSamples; i++) largest = std::max(largest, std::abs((int)samples[i]));
+                    magnitude = std::max(magnitude, (float)largest / int16Scale);
+                    break;
+                }
+                case Format::int24:
+                {
+                    const auto* bytes = reinterpret_cast<const juce::uint8*>(data);
+                    int largest = 0;
+                    for (size_t i = 0; i < numSamples; i++)
+                    {
+                        const auto* sample = bytes + 3 * i;
+                        const int value = (int)((juce::uint32)(sample[0] | (sample[1] << 8) | (sample[2] << 16)) << 8) >> 8;
+                        largest = std::max(largest, std::abs(value));
+                    }
+                    magnitude = std::max(magnitude, (float)largest / int24Scale);
+                    break;
+                }
+                case Format::float32:
+                {
+                    const auto range = juce::FloatVectorOperations::findMinAndMax(
+                        reinterpret_cast<const float*>(data), (int)numSamples);
+                    magnitude = std::max(magnitude, std::max(-range.getStart(), range.getEnd()));
+                    break;
+                }
+            }
+        }
+        return magnitude;
+    }
+
+    void SampleStore::pack(const float* source, void* dest, int numSamples, Format format)
+    {
+        switch (format)
+        {
+            case Format::int16:
+            {
+                auto* samples = static_cast<juce::int16*>(dest);
+                for (int i = 0; i < numSamples; i++)
+                    samples[i] = (juce::int16)quantise(source[i], int16Scale);
+                break;
+            }
+            case Format::int24:
+            {
+                auto* bytes = static_cast<juce::uint8*>(dest);
+                for (int i = 0; i < numSamples; i++)
+                {
+                    const auto value = (juce::uint32)quantise(source[i], int24Scale);
+                    bytes[3 * i]     = (juce::uint8)value;
+                    bytes[3 * i + 1] = (juce::uint8)(value >> 8);
+                    bytes[3 * i + 2] = (juce::uint8)(value >> 16);
+                }
+                break;
+            }
+            case Format::float32:
+                juce::FloatVectorOperations::copy(static_cast<float*>(dest), source, numSamples);
+                break;
+        }
+    }
+    void SampleStore::unpack(const void* source, float* dest, int numSamples, Format format)
+    {
+        switch (format)
+        {
+            case Format::int16:
+            {
+                const auto* samples = static_cast<const juce::int16*>(source);
+                for (int i = 0; i < numSamples; i++)
+                    dest[i] = (float)samples[i] * (1.f / int16Scale);
+                break;
+            }
+            case Format::int24:
+            {
+                const auto* bytes = static_cast<const juce::uint8*>(source);
+                for (int i = 0; i < numSamples; i++)
+                {
+                    const auto* sample = bytes + 3 * i;
+                    // Shifted up and back down to extend the sign
+                    const int value = (int)((juce::uint32)(sample[0] | (sample[1] << 8) | (sample[2] << 16)) << 8) >> 8;
+                    dest[i] = (float)value * (1.f / int24Scale);
+                }
+                break;
+            }
+            case Format::float32:
+                juce::FloatVectorOperations::copy(dest, static_cast<const float*>(source), numSamples);
+                break;
+        }
+    }
+
+    char* SampleStore::getPointer(int channel, juce::int64 sample) const
+    {
+        return mData.get() + (size_t)channel * mChannelStride
+                           + (size_t)sample * (size_t)getBytesPerSample(mFormat);
+    }
+}
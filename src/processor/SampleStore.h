@@ -0,0 +1,66 @@
+#pragma once
+
+/*  Audio held in memory in the sample format of its file: a 16 bit file
+    takes 2 bytes a sample and a 24 bit one 3, packed, instead of the 4 of a
+    float buffer. Blocks go in and come out as floats, converted on the way,
+    so nothing else has to know about the packing.
+
+    Floats from a reader are exact multiples of the file's LSB, so packing
+    them back into integers of that width loses nothing. Files of 8 bits are
+    kept as 16, those of 32 bit integers, like floating point files, as
+    floats: the same precision the float buffer had.
+*/
+
+#include <juce_core/juce_core.h>
+#include <juce_audio_basics/juce_audio_basics.h>
+
+namespace norm
+{
+
+class SampleStore
+{
+public:
+    enum class Format { int16, int24, float32 };
+
+    // The narrowest format that holds the samples of a reader exactly
+    static Format getFormatFor(unsigned int bitsPerSample, bool usesFloatingPointData);
+    static int getBytesPerSample(Format format);
+
+public:
+    SampleStore() {}
+    ~SampleStore() {}
+
+    // Contents are undefined until written. Pages are only committed as
+    // blocks are written.
+    void setSize(int numberOfChannels, juce::int64 numSamples, Format format);
+    void clear() { setSize(0, 0, Format::float32); }
+
+    int getNumChannels() const { return mNumberOfChannels; }
+    juce::int64 getNumSamples() const { return mNumberOfSamples; }
+    Format getFormat() const { return mFormat; }
+    size_t getSizeInBytes() const { return mChannelStride * (size_t)mNumberOfChannels; }
+
+    // Packs numSamples of every channel of block, from its start, into the
+    // store at startSample
+    void write(const juce::AudioBuffer<float>& block, juce::int64 startSample, int numSamples);
+    // Unpacks numSamples of one channel from startSample on into dest
+    void read(int channel, juce::int64 startSample, int numSamples, float* dest) const;
+
+    // Largest absolute sample of all channels
+    float getMagnitude() const;
+
+    // The conversions on their own, for one run of samples
+    static void pack(const float* source, void* dest, int numSamples, Format format);
+    static void unpack(const void* source, float* dest, int numSamples, Format format);
+
+private:
+    char* getPointer(int channel, juce::int64 sample) const;
+
+    juce::HeapBlock<char> mData;
+    int mNumberOfChannels = 0;
+    juce::int64 mNumberOfSamples = 0;
+    Format mFormat = Format::float32;
+    size_t mChannelStride = 0;
+};
+
+} // namespace norm
@@ -0,0 +1,619 @@
+#include "TagWriter.h"
+#include "Mp3GainWriter.h"
+#include "util/Logger.h"
+#include <array>
+#include <cstring>
+
+namespace norm
+{
+    namespace
+    {
+        // For comments that had no vendor string to keep
+        const char vendorString[] = "Normalize";
+        // Left after the metadata of a FLAC file that had to grow, as the
+        // reference encoder does
+        constexpr size_t newFlacPadding = 8192;
+        constexpr size_t maxFlacBlockLength = (1 << 24) - 1;
+
+        enum FlacBlockType { streamInfo = 0, padding = 1, vorbisComment = 4 };
+
+        juce::uint32 readBigEndian24(const juce::uint8* data)
+        {
+            return ((juce::uint32)data[0] << 16) | ((juce::uint32)data[1] << 8) | (juce::uint32)data[2];
+        }
+        void writeFlacBlockHeader(juce::OutputStream& stream, int type, bool isLast, size_t length)
+        {
+            stream.writeByte((char)((isLast ? 0x80 : 0) | type));
+            stream.writeByte((char)((length >> 16) & 0xff));
+            stream.writeByte((char)((length >> 8) & 0xff));
+            stream.writeByte((char)(length & 0xff));
+        }
+
+        // Vorbis header packets start with their type and "vorbis"
+        bool isVorbisPacket(const juce::MemoryBlock& packet, int type)
+        {
+            return packet.getSize() >= 7
+                && packet[0] == (char)type
+                && std::memcmp(packet.begin() + 1, "vorbis", 6) == 0;
+        }
+
+        // Polynomial 0x04c11db7, not reflected, starting from 0
+        juce::uint32 computeOggCrc(const juce::uint8* data, size_t size)
+        {
+            static const auto table = []
+            {
+                std::array<juce::uint32, 256> entries {};
+                for (juce::uint32 i = 0; i < 256; i++)
+                {
+                    juce::uint32 remainder = i << 24;
+                    for (int bit = 0; bit < 8; bit++)
+                        remainder = (remainder & 0x80000000) != 0 ? (remainder << 1) ^ 0x04c11db7
+                                                                  : remainder << 1;
+                    entries[i] = remainder;
+                }
+                return entries;
+            }();
+
+            juce::uint32 crc = 0;
+            for (size_t i = 0; i < size; i++)
+                crc = (crc << 8) ^ table[((crc >> 24) ^ data[i]) & 0xff];
+            return crc;
+        }
+    }
+
+    bool TagWriter::canWrite(const juce::File& file)
+    {
+        return file.hasFileExtension("flac;ogg;oga;mp3");
+    }
+
+    juce::StringPairArray TagWriter::readFields(juce::InputStream& stream)
+    {
+        const auto start = stream.getPosition();
+        char magic[4] = {};
+        if (stream.read(magic, 4) != 4) return {};
+
+        if (std::memcmp(magic, "fLaC", 4) == 0) return readFlacFields(stream);
+
+        if (!stream.setPosition(start)) return {};
+        if (std::memcmp(magic, "OggS", 4) == 0) return readOggFields(stream);
+        if (std::memcmp(magic, "ID3", 3) == 0) return Mp3GainWriter::readFields(stream);
+        return {};
+    }
+
+    bool TagWriter::writeFields(const juce::File& file, const juce::StringPairArray& fields)
+    {
+        const auto path = file.getFullPathName().toStdString();
+
+        char magic[4] = {};
+        {
+            std::unique_ptr<juce::FileInputStream> input = file.createInputStream();
+            EXPECT_OR_RETURN (input != nullptr, false, "Unable to read {}", path);
+            input->read(magic, 4);
+        }
+
+        if (std::memcmp(magic, "fLaC", 4) == 0) return writeFlacFields(file, fields);
+        if (std::memcmp(magic, "OggS", 4) == 0) return writeOggFields(file, fields);
+        if (Mp3GainWriter::isMp3File(file))     return Mp3GainWriter::writeFields(file, fields);
+
+        MY_LOG_WARNING("{} has no tags that can be written", path);
+        return false;
+    }
+
+    //==========================================================================
+
+    std::optional<TagWriter::Comments> TagWriter::parseComments(const juce::uint8* data, size_t size)
+    {
+        size_t position = 0;
+        auto readLength = [&]() -> std::optional<juce::uint32>
+        {
+            if (position + 4 > size) return std::nullopt;
+            const auto length = juce::ByteOrder::littleEndianInt(data + position);
+            position += 4;
+            return length;
+        };
+        auto readString = [&]() -> std::optional<juce::String>
+        {
+            const auto length = readLength();
+            if (!length.has_value() || *length > size - position) return std::nullopt;
+            const auto text = juce::String::fromUTF8((const char*)data + position, (int)*length);
+            position += *length;
+            return text;
+        };
+
+        Comments comments;
+        const auto vendor = readString();
+        const auto count = readLength();
+        if (!vendor.has_value() || !count.has_value()) return std::nullopt;
+
+        comments.vendor = *vendor;
+        for (juce::uint32 i = 0; i < *count; i++)
+        {
+            const auto entry = readString();
+            if (!entry.has_value()) return std::nullopt;
+            comments.entries.add(*entry);
+        }
+        return comments;
+    }
+
+    juce::MemoryBlock TagWriter::buildComments(const Comments& comments)
+    {
+        juce::MemoryOutputStream stream;
+        auto writeString = [&stream](const juce::String& text)
+        {
+            stream.writeInt((int)text.getNumBytesAsUTF8());
+            stream.write(text.toRawUTF8(), text.getNumBytesAsUTF8());
+        };
+
+        writeString(comments.vendor);
+        stream.writeInt(comments.entries.size());
+        for (const auto& entry : comments.entries) writeString(entry);
+        return stream.getMemoryBlock();
+    }
+
+    void TagWriter::applyFields(Comments& comments, const juce::StringPairArray& fields)
+    {
+        for (const auto& key : fields.getAllKeys())
+        {
+            for (int i = comments.entries.size(); --i >= 0;)
+            {
+                if (comments.entries[i].upToFirstOccurrenceOf("=", false, false).equalsIgnoreCase(key))
+                    comments.entries.remove(i);
+            }
+
+            const auto value = fields[key];
+            if (value.isNotEmpty()) comments.entries.add(key.toUpperCase() + "=" + value);
+        }
+    }
+
+    juce::StringPairArray TagWriter::toFields(const Comments& comments)
+    {
+        juce::StringPairArray fields;
+        for (const auto& entry : comments.entries)
+        {
+            if (!entry.containsChar('=')) continue;
+            fields.set(entry.upToFirstOccurrenceOf("=", false, false),
+                       entry.fromFirstOccurrenceOf("=", false, false));
+        }
+        return fields;
+    }
+
+    //==========================================================================
+
+    juce::StringPairArray TagWriter::readFlacFields(juce::InputStream& stream)
+    {
+        for (;;)
+        {
+            juce::uint8 header[4];
+            if (stream.read(header, 4) != 4) return {};
+
+            const int type = header[0] & 0x7f;
+            const auto length = readBigEndian24(header + 1);
+            if (type == vorbisComment)
+            {
+                juce::MemoryBlock body(length);
+                if (stream.read(body.getData(), (int)length) != (int)length) return {};
+
+                const auto comments = parseComments(static_cast<const juce::uint8*>(body.getData()),
+                                                    body.getSize());
+                return comments.has_value() ? toFields(*comments) : juce::StringPairArray();
+            }
+
+            if ((header[0] & 0x80) != 0 || !stream.setPosition(stream.getPosition() + length))
+                return {};
+        }
+    }
+
+    bool TagWriter::writeFlacFields(const juce::File& file, const juce::StringPairArray& fields)
+    {
+        const auto path = file.getFullPathName().toStdString();
+
+        std::unique_ptr<juce::FileInputStream> input = file.createInputStream();
+        EXPECT_OR_RETURN (input != nullptr, false, "Unable to read {}", path);
+
+        struct Block
+        {
+            int type = 0;
+            juce::MemoryBlock data;
+        };
+
+        // Every metadata block, and all of them as they are in the file
+        std::vector<Block> blocks;
+        juce::MemoryOutputStream original;
+
+        char magic[4] = {};
+        EXPECT_OR_RETURN (input->read(magic, 4) == 4 && std::memcmp(magic, "fLaC", 4) == 0,
+                          false,
+                          "{} is not a FLAC file", path);
+        for (bool isLast = false; !isLast;)
+        {
+            juce::uint8 header[4];
+            EXPECT_OR_RETURN (input->read(header, 4) == 4,
+                              false,
+                              "The metadata of {} is cut short", path);
+
+            isLast = (header[0] & 0x80) != 0;
+            const auto length = readBigEndian24(header + 1);
+            Block block { header[0] & 0x7f, juce::MemoryBlock(length) };
+            EXPECT_OR_RETURN (input->read(block.data.getData(), (int)length) == (int)length,
+                              false,
+                              "The metadata of {} is cut short", path);
+
+            original.write(header, 4);
+            original << block.data;
+            blocks.push_back(std::move(block));
+        }
+        EXPECT_OR_RETURN (blocks.front().type == streamInfo,
+                          false,
+                          "{} does not start with a STREAMINFO block", path);
+
+        // The comments stay where they were, or go right after STREAMINFO.
+        // Padding is put back at the end, however much is left.
+        Comments comments { vendorString, {} };
+        std::vector<Block> rebuilt;
+        size_t commentIndex = 1;
+        for (auto& block : blocks)
+        {
+            if (block.type == padding) continue;
+            if (block.type == vorbisComment)
+            {
+                if (const auto parsed = parseComments(static_cast<const juce::uint8*>(block.data.getData()),
+                                                      block.data.getSize()))
+                {
+                    comments = *parsed;
+                }
+                commentIndex = rebuilt.size();
+                continue;
+            }
+            rebuilt.push_back(std::move(block));
+        }
+
+        applyFields(comments, fields);
+        Block commentBlock { vorbisComment, buildComments(comments) };
+        EXPECT_OR_RETURN (commentBlock.data.getSize() <= maxFlacBlockLength,
+                          false,
+                          "The comments of {} do not fit into a metadata block", path);
+        rebuilt.insert(rebuilt.begin() + (std::ptrdiff_t)commentIndex, std::move(commentBlock));
+
+        size_t needed = 0;
+        for (const auto& block : rebuilt) needed += 4 + block.data.getSize();
+
+        auto serialise = [&rebuilt](std::optional<size_t> paddingLength)
+        {
+            juce::MemoryOutputStream stream;
+            for (size_t i = 0; i < rebuilt.size(); i++)
+            {
+                const bool isLast = !paddingLength.has_value() && i + 1 == rebuilt.size();
+                writeFlacBlockHeader(stream, rebuilt[i].type, isLast, rebuilt[i].data.getSize());
+                stream << rebuilt[i].data;
+            }
+            if (paddingLength.has_value())
+            {
+                writeFlacBlockHeader(stream, padding, true, *paddingLength);
+                stream.writeRepeatedByte(0, *paddingLength);
+            }
+            return stream.getMemoryBlock();
+        };
+
+        // A padding block needs room for its header at least
+        const size_t available = original.getDataSize();
+        if (needed == available || needed + 4 <= available)
+        {
+            const auto metadata = needed == available
+                                ? serialise(std::nullopt)
+                                : serialise(available - needed - 4);
+            input.reset();
+            return patchFile(file, 4, original.getMemoryBlock(), metadata);
+        }
+
+        // The audio has to move, through a file next to it
+        const auto metadata = serialise(newFlacPadding);
+        juce::TemporaryFile temporaryFile(file);
+        {
+            std::unique_ptr<juce::FileOutputStream> output =
+                temporaryFile.getFile().createOutputStream();
+            EXPECT_OR_RETURN (output != nullptr,
+                              false,
+                              "Unable to open a temporary file next to {}", path);
+
+            const bool written = output->write("fLaC", 4)
+                              && output->write(metadata.getData(), metadata.getSize())
+                              && output->writeFromInputStream(*input, -1) >= 0;
+            output->flush();
+            EXPECT_OR_RETURN (written && output->getStatus().wasOk(),
+                              false,
+                              "Writing {} failed", path);
+        }
+        input.reset();
+
+        EXPECT_OR_RETURN (temporaryFile.overwriteTargetFileWithTemporary(),
+                          false,
+                          "Unable to replace {}", path);
+        MY_LOG_INFO("{} had too little padding for its tags, it was written again", path);
+        return true;
+    }
+
+    //==========================================================================
+
+    std::optional<TagWriter::OggPage> TagWriter::readOggPage(juce::InputStream& stream)
+    {
+        juce::uint8 header[27];
+        if (stream.read(header, 27) != 27 || std::memcmp(header, "OggS", 4) != 0 || header[4] != 0)
+            return std::nullopt;
+
+        OggPage page;
+        page.headerType = header[5];
+        page.granulePosition = (juce::int64)juce::ByteOrder::littleEndianInt64(header + 6);
+        page.serialNumber = juce::ByteOrder::littleEndianInt(header + 14);
+        page.sequenceNumber = juce::ByteOrder::littleEndianInt(header + 18);
+
+        page.segments.resize(header[26]);
+        if (stream.read(page.segments.data(), (int)page.segments.size()) != (int)page.segments.size())
+            return std::nullopt;
+
+        size_t bodySize = 0;
+        for (const auto lacing : page.segments) bodySize += lacing;
+        page.body.setSize(bodySize);
+        if (stream.read(page.body.getData(), (int)bodySize) != (int)bodySize) return std::nullopt;
+
+        return page;
+    }
+
+    juce::MemoryBlock TagWriter::buildOggPage(const OggPage& page)
+    {
+        juce::MemoryOutputStream stream;
+        stream.write("OggS", 4);
+        stream.writeByte(0);
+        stream.writeByte((char)page.headerType);
+        stream.writeInt64(page.granulePosition);
+        stream.writeInt((int)page.serialNumber);
+        stream.writeInt((int)page.sequenceNumber);
+        // The checksum covers the page with its own field zeroed
+        stream.writeInt(0);
+        stream.writeByte((char)page.segments.size());
+        stream.write(page.segments.data(), page.segments.size());
+        stream << page.body;
+
+        auto data = stream.getMemoryBlock();
+        auto* bytes = static_cast<juce::uint8*>(data.getData());
+        const auto crc = computeOggCrc(bytes, data.getSize());
+        for (int i = 0; i < 4; i++) bytes[22 + i] = (juce::uint8)(crc >> (8 * i));
+        return data;
+    }
+
+    std::vector<TagWriter::OggPage> TagWriter::paginate(const std::vector<juce::MemoryBlock>& packets,
+                                                        juce::uint32 serialNumber,
+                                                        juce::uint32 firstSequenceNumber)
+    {
+        std::vector<OggPage> pages;
+        OggPage page;
+        bool isContinued = false;
+        bool endsPacket = false;
+
+        auto finishPage = [&]
+        {
+            page.headerType = isContinued ? 1 : 0;
+            // Pages on which no packet ends have no position
+            page.granulePosition = endsPacket ? 0 : -1;
+            page.serialNumber = serialNumber;
+            page.sequenceNumber = firstSequenceNumber + (juce::uint32)pages.size();
+            pages.push_back(std::move(page));
+            page = OggPage();
+            endsPacket = false;
+        };
+
+        for (const auto& packet : packets)
+        {
+            size_t position = 0;
+            for (bool isDone = false; !isDone;)
+            {
+                // A packet ends with the first segment shorter than 255
+                const size_t lacing = juce::jmin((size_t)255, packet.getSize() - position);
+                page.segments.push_back((juce::uint8)lacing);
+                page.body.append(packet.begin() + position, lacing);
+                position += lacing;
+
+                isDone = lacing < 255;
+                endsPacket = endsPacket || isDone;
+                if (page.segments.size() == 255)
+                {
+                    finishPage();
+                    isContinued = !isDone;
+                }
+            }
+        }
+        if (!page.segments.empty()) finishPage();
+
+        return pages;
+    }
+
+    juce::StringPairArray TagWriter::readOggFields(juce::InputStream& stream)
+    {
+        std::optional<juce::uint32> serialNumber;
+        juce::MemoryBlock packet;
+        int packetIndex = 0;
+
+        while (const auto page = readOggPage(stream))
+        {
+            // Pages of other streams multiplexed into the file
+            if (!serialNumber.has_value()) serialNumber = page->serialNumber;
+            if (page->serialNumber != *serialNumber) continue;
+
+            size_t position = 0;
+            for (const auto lacing : page->segments)
+            {
+                packet.append(page->body.begin() + position, lacing);
+                position += lacing;
+                if (lacing == 255) continue;
+
+                if (packetIndex == 0 && !isVorbisPacket(packet, 1)) return {};
+                if (packetIndex == 1)
+                {
+                    if (!isVorbisPacket(packet, 3)) return {};
+                    const auto comments = parseComments(
+                        static_cast<const juce::uint8*>(packet.getData()) + 7, packet.getSize() - 7);
+                    return comments.has_value() ? toFields(*comments) : juce::StringPairArray();
+                }
+                packetIndex++;
+                packet.reset();
+            }
+        }
+        return {};
+    }
+
+    bool TagWriter::writeOggFields(const juce::File& file, const juce::StringPairArray& fields)
+    {
+        const auto path = file.getFullPathName().toStdString();
+
+        std::unique_ptr<juce::FileInputStream> input = file.createInputStream();
+        EXPECT_OR_RETURN (input != nullptr, false, "Unable to read {}", path);
+
+        // The identification header is alone on the first page, the comment
+        // and setup headers come next and end a page before any audio
+        const auto first = readOggPage(*input);
+        EXPECT_OR_RETURN (first.has_value()
+                          && (first->headerType & 2) != 0
+                          && first->segments.size() == 1
+                          && isVorbisPacket(first->body, 1),
+                          false,
+                          "{} is not an Ogg Vorbis file", path);
+
+        const auto serialNumber = first->serialNumber;
+        const auto headerStart = input->getPosition();
+        std::vector<juce::MemoryBlock> packets;
+        juce::MemoryBlock packet;
+        juce::uint32 numberOfPages = 0;
+        while (packets.size() < 2)
+        {
+            const auto page = readOggPage(*input);
+            EXPECT_OR_RETURN (page.has_value(), false, "The headers of {} are cut short", path);
+            EXPECT_OR_RETURN (page->serialNumber == serialNumber,
+                              false,
+                              "{} holds more than one stream, its tags are not written", path);
+
+            size_t position = 0;
+            for (const auto lacing : page->segments)
+            {
+                packet.append(page->body.begin() + position, lacing);
+                position += lacing;
+                if (lacing < 255)
+                {
+                    packets.push_back(std::move(packet));
+                    packet = juce::MemoryBlock();
+                }
+            }
+            numberOfPages++;
+        }
+        const auto headerEnd = input->getPosition();
+
+        EXPECT_OR_RETURN (packets.size() == 2 && packet.isEmpty(),
+                          false,
+                          "The headers of {} do not end on a page", path);
+        EXPECT_OR_RETURN (isVorbisPacket(packets[0], 3) && isVorbisPacket(packets[1], 5),
+                          false,
+                          "{} has no Vorbis comment and setup headers", path);
+
+        auto comments = parseComments(static_cast<const juce::uint8*>(packets[0].getData()) + 7,
+                                      packets[0].getSize() - 7);
+        EXPECT_OR_RETURN (comments.has_value(), false, "The comments of {} are broken", path);
+
+        applyFields(*comments, fields);
+        juce::MemoryOutputStream commentPacket;
+        commentPacket.writeByte(3);
+        commentPacket.write("vorbis", 6);
+        commentPacket << buildComments(*comments);
+        // Framing bit
+        commentPacket.writeByte(1);
+        packets[0] = commentPacket.getMemoryBlock();
+
+        const auto pages = paginate(packets, serialNumber, 1);
+        juce::MemoryOutputStream headers;
+        for (const auto& page : pages) headers << buildOggPage(page);
+
+        // Nothing after the headers moves, nor needs numbering again
+        if (pages.size() == numberOfPages
+            && (juce::int64)headers.getDataSize() == headerEnd - headerStart)
+        {
+            juce::MemoryBlock original((size_t)(headerEnd - headerStart));
+            EXPECT_OR_RETURN (input->setPosition(headerStart)
+                              && input->read(original.getData(), (int)original.getSize())
+                                 == (int)original.getSize(),
+                              false,
+                              "Unable to read {}", path);
+            input.reset();
+            return patchFile(file, headerStart, original, headers.getMemoryBlock());
+        }
+
+        // Sequence numbers wrap around, so does the difference
+        const juce::uint32 shift = (juce::uint32)pages.size() - numberOfPages;
+
+        juce::TemporaryFile temporaryFile(file);
+        {
+            std::unique_ptr<juce::FileOutputStream> output =
+                temporaryFile.getFile().createOutputStream();
+            EXPECT_OR_RETURN (output != nullptr,
+                              false,
+                              "Unable to open a temporary file next to {}", path);
+
+            bool written = input->setPosition(0)
+                        && output->writeFromInputStream(*input, headerStart) == headerStart
+                        && output->write(headers.getData(), headers.getDataSize())
+                        && input->setPosition(headerEnd);
+
+            // Pages of this stream are numbered on, anything else is copied
+            // as it is, including whatever follows a page that is broken
+            while (written && shift != 0)
+            {
+                const auto position = input->getPosition();
+                auto page = readOggPage(*input);
+                if (!page.has_value())
+                {
+                    written = input->setPosition(position);
+                    break;
+                }
+                if (page->serialNumber == serialNumber) page->sequenceNumber += shift;
+
+                const auto data = buildOggPage(*page);
+                written = output->write(data.getData(), data.getSize());
+            }
+            written = written && output->writeFromInputStream(*input, -1) >= 0;
+
+            output->flush();
+            EXPECT_OR_RETURN (written && output->getStatus().wasOk(),
+                              false,
+                              "Writing {} failed", path);
+        }
+        input.reset();
+
+        EXPECT_OR_RETURN (temporaryFile.overwriteTargetFileWithTemporary(),
+                          false,
+                          "Unable to replace {}", path);
+        return true;
+    }
+
+    //==========================================================================
+
+    bool TagWriter::patchFile(const juce::File& file,
+                              juce::int64 offset,
+                              const juce::MemoryBlock& original,
+                              const juce::MemoryBlock& data)
+    {
+        jassert (original.getSize() == data.getSize());
+        const auto path = file.getFullPathName().toStdString();
+
+        size_t first = 0;
+        size_t end = data.getSize();
+        while (first < end && original[first] == data[first]) first++;
+        while (end > first && original[end - 1] == data[end - 1]) end--;
+        if (first == end) return true;
+
+        juce::FileOutputStream output(file);
+        EXPECT_OR_RETURN (output.openedOk() && output.setPosition(offset + (juce::int64)first),
+                          false,
+                          "Unable to open {} for writing", path);
+
+        output.write(data.begin() + first, end - first);
+        output.flush();
+        EXPECT_OR_RETURN (output.getStatus().wasOk(), false, "Writing {} failed", path);
+        return true;
+    }
+}
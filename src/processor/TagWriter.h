@@ -0,0 +1,85 @@
+#pragma once
+
+/*  Gain for players instead of in the samples: only the tags of a file are
+    rewritten, its audio frames are never decoded nor touched. Players that
+    honour ReplayGain then apply the gain on playback, and a library costs
+    kilobytes of writes per file instead of a full encode.
+
+    FLAC keeps its Vorbis comments in a metadata block. The block is
+    rewritten in place, with the padding block after it taking up the
+    difference; only when there is not enough padding does the file move,
+    behind new padding for the next time. Ogg Vorbis keeps them in the
+    second header packet: the header pages are rewritten in place if they
+    come out at the same size, otherwise the pages after them are copied
+    with their sequence numbers moved. MP3 files get ID3v2 TXXX frames, see
+    Mp3GainWriter.
+
+    Opus would take R128_* gains instead of ReplayGain, but nothing here
+    decodes Opus to measure it, so it is not covered.
+*/
+
+#include <juce_core/juce_core.h>
+#include <optional>
+#include <vector>
+
+namespace norm
+{
+
+class TagWriter
+{
+public:
+    // FLAC, Ogg Vorbis and MP3, by extension
+    static bool canWrite(const juce::File& file);
+
+    // The fields of whichever tag stream starts with, e.g. Vorbis comments
+    static juce::StringPairArray readFields(juce::InputStream& stream);
+    // Replaces the fields of the same name, case ignored, and adds the rest.
+    // An empty value removes a field.
+    static bool writeFields(const juce::File& file, const juce::StringPairArray& fields);
+
+private:
+    struct Comments
+    {
+        juce::String vendor;
+        // "NAME=value", as they are in the file
+        juce::StringArray entries;
+    };
+
+    struct OggPage
+    {
+        int headerType = 0;
+        juce::int64 granulePosition = 0;
+        juce::uint32 serialNumber = 0;
+        juce::uint32 sequenceNumber = 0;
+        std::vector<juce::uint8> segments;
+        juce::MemoryBlock body;
+
+        size_t getSize() const { return 27 + segments.size() + body.getSize(); }
+    };
+
+    static std::optional<Comments> parseComments(const juce::uint8* data, size_t size);
+    static juce::MemoryBlock buildComments(const Comments& comments);
+    static void applyFields(Comments& comments, const juce::StringPairArray& fields);
+    static juce::StringPairArray toFields(const Comments& comments);
+
+    static juce::StringPairArray readFlacFields(juce::InputStream& stream);
+    static bool writeFlacFields(const juce::File& file, const juce::StringPairArray& fields);
+
+    static std::optional<OggPage> readOggPage(juce::InputStream& stream);
+    static juce::MemoryBlock buildOggPage(const OggPage& page);
+    // Pages for packets that start and end on page boundaries
+    static std::vector<OggPage> paginate(const std::vector<juce::MemoryBlock>& packets,
+                                         juce::uint32 serialNumber,
+                                         juce::uint32 firstSequenceNumber);
+    static juce::StringPairArray readOggFields(juce::InputStream& stream);
+    static bool writeOggFields(const juce::File& file, const juce::StringPairArray& fields);
+
+    // Writes data over file from offset on, only the bytes that differ
+    // from original
+    static bool patchFile(const juce::File& file,
+                          juce::int64 offset,
+                          const juce::MemoryBlock& original,
+                          const juce::MemoryBlock& data);
+};
+
+} // namespace norm
@@ -0,0 +1,211 @@
+#include "TruePeakLimiter.h"
+#include <algorithm>
+#include <cmath>
+
+namespace norm
+{
+    namespace
+    {
+        constexpr int HistorySize = truepeak::TapsPerPhase - 1;
+
+        // Highest of |x| and the interpolated values in every interval whose
+        // filter window ends in the block. history holds HistorySize samples
+        // before the block, then the block itself.
+        void accumulatePeaks(const float* history,
+                             float* peak,
+                             float* interpolated,
+                             int numSamples)
+        {
+            for (int i = 0; i < numSamples; i++)
+            {
+                peak[i] = std::max(peak[i],
+                                   std::abs(history[i + truepeak::FilterDelay - 1]));
+            }
+
+            for (const auto& phase : truepeak::Interpolators)
+            {
+                std::fill(interpolated, interpolated + numSamples, 0.f);
+
+                // Tap by tap over the whole block keeps the inner loop
+                // contiguous, so it vectorises
+                for (int j = 0; j < truepeak::TapsPerPhase; j++)
+                {
+                    const float c = phase[(size_t)j];
+                    for (int i = 0; i < numSamples; i++)
+                        interpolated[i] += c * history[i + j];
+                }
+
+                for (int i = 0; i < numSamples; i++)
+                    peak[i] = std::max(peak[i], std::abs(interpolated[i]));
+            }
+        }
+    }
+
+    TruePeakLimiter::TruePeakLimiter() {}
+    TruePeakLimiter::~TruePeakLimiter() {}
+
+    void TruePeakLimiter::prepare(double sampleRate,
+                                  int numberOfChannels,
+                                  int maxBlockSize,
+                                  const Options& options)
+    {
+        mNumberOfChannels = juce::jmax(1, numberOfChannels);
+        mMaxBlockSize = juce::jmax(1, maxBlockSize);
+        mLookAhead = juce::jmax(1, (int)std::lround(options.lookAheadMs * sampleRate / 1000.0));
+        mCeiling = juce::Decibels::decibelsToGain(options.ceilingDB);
+
+        const double releaseSamples = juce::jmax(1.0, options.releaseMs * sampleRate / 1000.0);
+        mReleaseCoefficient = (float)(1.0 - std::exp(-1.0 / releaseSamples));
+
+        mHistory.resize((size_t)mNumberOfChannels);
+        for (auto& history : mHistory)
+            history.resize((size_t)(HistorySize + mMaxBlockSize));
+
+        mDelay.resize((size_t)mNumberOfChannels);
+        for (auto& delay : mDelay)
+            delay.resize((size_t)(getLatencyInSamples() + mMaxBlockSize));
+
+        mPeak.resize((size_t)mMaxBlockSize);
+        mInterpolated.resize((size_t)mMaxBlockSize);
+        mGain.resize((size_t)mMaxBlockSize);
+
+        // The hold covers one sample more than the look-ahead, so that both
+        // ends of an interval between two samples get the reduced gain
+        mMinPositions.resize((size_t)mLookAhead + 2);
+        mMinValues.resize((size_t)mLookAhead + 2);
+        mAverageRing.resize((size_t)mLookAhead);
+
+        reset();
+    }
+    void TruePeakLimiter::reset()
+    {
+        for (auto& history : mHistory) std::fill(history.begin(), history.end(), 0.f);
+        for (auto& delay : mDelay) std::fill(delay.begin(), delay.end(), 0.f);
+
+        mMinFront = 0;
+        mMinSize = 0;
+        mPosition = 0;
+        mReleased = 1.f;
+        mMinGain = 1.f;
+
+        std::fill(mAverageRing.begin(), mAverageRing.end(), 1.f);
+        mAverageIndex = 0;
+        mAverageSum = (double)mLookAhead;
+    }
+
+    void TruePeakLimiter::process(float* const* channels, int numSamples)
+    {
+        const int latency = getLatencyInSamples();
+
+        for (int offset = 0; offset < numSamples; offset += mMaxBlockSize)
+        {
+            const int size = juce::jmin(mMaxBlockSize, numSamples - offset);
+
+            detectPeaks(channels, offset, size);
+            computeGain(size);
+
+            for (int ch = 0; ch < mNumberOfChannels; ch++)
+            {
+                float* samples = channels[ch] + offset;
+                float* delay = mDelay[(size_t)ch].data();
+
+                std::copy(samples, samples + size, delay + latency);
+                for (int i = 0; i < size; i++)
+                    samples[i] = delay[i] * mGain[(size_t)i];
+                std::copy(delay + size, delay + size + latency, delay);
+            }
+        }
+    }
+
+    void TruePeakLimiter::detectPeaks(const float* const* channels,
+                                      int offset,
+                                      int numSamples)
+    {
+        std::fill(mPeak.begin(), mPeak.begin() + numSamples, 0.f);
+
+        for (int ch = 0; ch < mNumberOfChannels; ch++)
+        {
+            float* history = mHistory[(size_t)ch].data();
+            std::copy(channels[ch] + offset,
+                      channels[ch] + offset + numSamples,
+                      history + HistorySize);
+
+            accumulatePeaks(history, mPeak.data(), mInterpolated.data(), numSamples);
+
+            std::copy(history + numSamples, history + numSamples + HistorySize, history);
+        }
+    }
+
+    void TruePeakLimiter::computeGain(int numSamples)
+    {
+        for (int i = 0; i < numSamples; i++)
+            mGain[(size_t)i] = std::min(1.f, mCeiling / std::max(mPeak[(size_t)i], 1e-9f));
+
+        const int capacity = (int)mMinValues.size();
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            const float required = mGain[(size_t)i];
+            const juce::int64 position = mPosition++;
+
+            // Running minimum over the hold window
+            while (mMinSize > 0)
+            {
+                const int back = (mMinFront + mMinSize - 1) % capacity;
+                if (mMinValues[(size_t)back] < required) break;
+                mMinSize--;
+            }
+            const int slot = (mMinFront + mMinSize) % capacity;
+            mMinPositions[(size_t)slot] = position;
+            mMinValues[(size_t)slot] = required;
+            mMinSize++;
+
+            while (mMinPositions[(size_t)mMinFront] <= position - capacity)
+            {
+                mMinFront = (mMinFront + 1) % capacity;
+                mMinSize--;
+            }
+            const float held = mMinValues[(size_t)mMinFront];
+
+            // Instant attack, the moving average below does the smoothing
+            mReleased = held < mReleased ? held
+                                         : mReleased + (held - mReleased) * mReleaseCoefficient;
+
+            mAverageSum += (double)(mReleased - mAverageRing[(size_t)mAverageIndex]);
+            mAverageRing[(size_t)mAverageIndex] = mReleased;
+            mAverageIndex = (mAverageIndex + 1) % mLookAhead;
+
+            // Divided in double, so that no limiting is exactly a gain of 1
+            const float gain = (float)(mAverageSum / mLookAhead);
+            mGain[(size_t)i] = gain;
+            mMinGain = std::min(mMinGain, gain);
+        }
+    }
+
+    float TruePeakLimiter::getMaxGainReductionDB() const
+    {
+        return -juce::Decibels::gainToDecibels(mMinGain, -200.f);
+    }
+
+    float TruePeakLimiter::measureTruePeak(const float* const* channels,
+                                           int numberOfChannels,
+                                           int numSamples)
+    {
+        if (numSamples <= 0) return 0.f;
+
+        // Silence around the signal, so the filters see every interval
+        const int padded = numSamples + truepeak::FilterDelay;
+        std::vector<float> history((size_t)(HistorySize + padded), 0.f);
+        std::vector<float> peak((size_t)padded, 0.f);
+        std::vector<float> interpolated((size_t)padded);
+
+        for (int ch = 0; ch < numberOfChannels; ch++)
+        {
+            std::fill(history.begin(), history.end(), 0.f);
+            std::copy(channels[ch], channels[ch] + numSamples, history.begin() + HistorySize);
+            accumulatePeaks(history.data(), peak.data(), interpolated.data(), padded);
+        }
+
+        return *std::max_element(peak.begin(), peak.end());
+    }
+}
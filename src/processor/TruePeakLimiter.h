@@ -0,0 +1,145 @@
+#pragma once
+
+/*  Look-ahead true-peak limiter for the write stage, so that a positive gain
+    can be applied without going over a delivery ceiling such as -1 dBTP, in
+    the same pass that writes the file.
+
+    Peaks are detected on a 4x oversampled signal, like the true-peak meter
+    of ITU-R BS.1770: three interpolating filters estimate the signal at a
+    quarter, half and three quarters between every two samples. The gain
+    needed to keep each peak under the ceiling is held for the look-ahead
+    time, released with a one pole filter, then smoothed with a moving
+    average as long as the look-ahead, so the gain reaches its target just as
+    the peak comes out of the delay line. All channels share one gain.
+
+    Block based and allocation free after prepare(). The filters and the
+    delay are plain loops over contiguous buffers, which the compiler
+    vectorises, only the gain curve itself is computed sample by sample.
+*/
+
+#include "util/ConstexprMath.h"
+#include <juce_core/juce_core.h>
+#include <array>
+#include <vector>
+
+namespace norm
+{
+
+namespace truepeak
+{
+    inline constexpr int Phases = 4;
+    inline constexpr int TapsPerPhase = 12;
+    // Samples between the newest input and the interval the filters estimate
+    inline constexpr int FilterDelay = TapsPerPhase / 2;
+
+    using Coefficients = std::array<std::array<float, TapsPerPhase>, Phases - 1>;
+
+    // Windowed sinc for the fractional positions 1/4, 2/4 and 3/4, each
+    // phase normalised to unity gain at DC
+    constexpr Coefficients design()
+    {
+        constexpr double pi = std::numbers::pi;
+        constexpr double halfWidth = TapsPerPhase / 2;
+
+        Coefficients coefficients {};
+        for (int p = 1; p < Phases; p++)
+        {
+            const double fraction = (double)p / Phases;
+            double taps[TapsPerPhase] {};
+            double sum = 0.0;
+
+            for (int j = 0; j < TapsPerPhase; j++)
+            {
+                // distance from tap j to the interpolated position
+                const double d = (halfWidth - 1.0) + fraction - j;
+                const double sinc = cmath::sin(pi * d) / (pi * d);
+                const double window = 0.5 + 0.5 * cmath::cos(pi * d / halfWidth);
+                taps[j] = sinc * window;
+                sum += taps[j];
+            }
+            for (int j = 0; j < TapsPerPhase; j++)
+            {
+                coefficients[(size_t)p - 1][(size_t)j] = (float)(taps[j] / sum);
+            }
+        }
+        return coefficients;
+    }
+
+    inline constexpr Coefficients Interpolators = design();
+}
+
+class TruePeakLimiter
+{
+public:
+    struct Options
+    {
+        float ceilingDB = -1.f;
+        float lookAheadMs = 2.f;
+        float releaseMs = 100.f;
+
+        bool operator==(const Options&) const = default;
+    };
+
+public:
+    TruePeakLimiter();
+    ~TruePeakLimiter();
+
+    // Allocates only where a buffer has to grow, the same sample rate,
+    // channels and block size again only cost a reset
+    void prepare(double sampleRate,
+                 int numberOfChannels,
+                 int maxBlockSize,
+                 const Options& options);
+    // Clears the state for the next file, no allocation
+    void reset();
+
+    // In place. The output is delayed by getLatencyInSamples().
+    void process(float* const* channels, int numSamples);
+
+    int getLatencyInSamples() const { return mLookAhead + truepeak::FilterDelay; }
+    // Deepest gain reduction since the last reset, as a positive number
+    float getMaxGainReductionDB() const;
+
+    // Highest interpolated peak of a whole signal, linear
+    static float measureTruePeak(const float* const* channels,
+                                 int numberOfChannels,
+                                 int numSamples);
+
+private:
+    void detectPeaks(const float* const* channels, int offset, int numSamples);
+    void computeGain(int numSamples);
+
+    int mNumberOfChannels = 0;
+    int mMaxBlockSize = 0;
+    int mLookAhead = 0;
+    float mCeiling = 1.f;
+    float mReleaseCoefficient = 0.f;
+
+    // Per channel: filter history followed by the current block, and the
+    // delay line followed by the current block
+    std::vector<std::vector<float>> mHistory;
+    std::vector<std::vector<float>> mDelay;
+
+    // Per block, shared by all channels
+    std::vector<float> mPeak;
+    std::vector<float> mInterpolated;
+    std::vector<float> mGain;
+
+    // Running minimum over the look-ahead, as a monotonic queue of
+    // (position, value) in a ring buffer
+    std::vector<juce::int64> mMinPositions;
+    std::vector<float> mMinValues;
+    int mMinFront = 0;
+    int mMinSize = 0;
+    juce::int64 mPosition = 0;
+
+    float mReleased = 1.f;
+    float mMinGain = 1.f;
+
+    // Moving average over the look-ahead
+    std::vector<float> mAverageRing;
+    int mAverageIndex = 0;
+    double mAverageSum = 0.0;
+};
+
+} // namespace norm
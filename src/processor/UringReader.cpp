@@ -0,0 +1,475 @@
+#include "UringReader.h"
+#include "util/Logger.h"
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+
+#if JUCE_LINUX && __has_include(<linux/io_uring.h>)
+ #define NORM_HAS_IO_URING 1
+ #include <cerrno>
+ #include <fcntl.h>
+ #include <linux/io_uring.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <sys/syscall.h>
+ #include <sys/uio.h>
+ #include <unistd.h>
+#else
+ #define NORM_HAS_IO_URING 0
+#endif
+
+namespace norm
+{
+    namespace
+    {
+        // EAGAIN or EBUSY in a row, about a second, before the ring is given up
+        constexpr int maxTransientFailures = 1000;
+        // MemoryBlock takes int offsets, so no file above this is read
+        constexpr juce::int64 maxReadableFileSize = std::numeric_limits<int>::max();
+    }
+
+    // The submission and completion queues shared with the kernel, set up
+    // with the raw system calls so there is no dependency on liburing
+    struct UringReader::Ring
+    {
+       #if NORM_HAS_IO_URING
+        static std::unique_ptr<Ring> create(unsigned entries)
+        {
+            io_uring_params params {};
+            const int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+            if (fd < 0) return nullptr;
+
+            auto ring = std::make_unique<Ring>();
+            ring->fd = fd;
+
+            // Both queues in one mapping and the opcodes we need, 5.6 and up
+            if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0) return nullptr;
+            if (!ring->supports({ IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+                                  IORING_OP_READ_FIXED, IORING_OP_CLOSE }))
+            {
+                return nullptr;
+            }
+
+            ring->ringSize = juce::jmax(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+            ring->ringMemory = mmap(nullptr, ring->ringSize, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (ring->ringMemory == MAP_FAILED)
+            {
+                ring->ringMemory = nullptr;
+                return nullptr;
+            }
+
+            ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            void* sqes = mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED) return nullptr;
+            ring->sqes = static_cast<io_uring_sqe*>(sqes);
+
+            auto* base = static_cast<char*>(ring->ringMemory);
+            ring->sqHead  = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+            ring->sqTail  = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+            ring->sqMask  = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+            ring->sqArray = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+            ring->sqEntries = params.sq_entries;
+            ring->cqHead  = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+            ring->cqTail  = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+            ring->cqMask  = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+            ring->cqes    = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+            return ring;
+        }
+        ~Ring()
+        {
+            if (sqes != nullptr) munmap(sqes, sqesSize);
+            if (ringMemory != nullptr) munmap(ringMemory, ringSize);
+            if (fd >= 0) close(fd);
+        }
+
+        bool supports(std::initializer_list<int> opcodes)
+        {
+            constexpr unsigned numberOfOps = 256;
+            std::vector<char> memory(sizeof(io_uring_probe) + numberOfOps * sizeof(io_uring_probe_op));
+            auto* probe = reinterpret_cast<io_uring_probe*>(memory.data());
+
+            if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, numberOfOps) < 0)
+                return false;
+
+            for (const int opcode : opcodes)
+            {
+                if (opcode > probe->last_op) return false;
+                if ((probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) == 0) return false;
+            }
+            return true;
+        }
+        bool registerBuffers(const std::vector<iovec>& buffers)
+        {
+            return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS,
+                           buffers.data(), (unsigned)buffers.size()) == 0;
+        }
+
+        // Never more operations in flight than entries, so there is room
+        void queue(const io_uring_sqe& sqe)
+        {
+            const unsigned tail = *sqTail;
+            jassert(tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) < sqEntries);
+
+            const unsigned index = tail & sqMask;
+            sqes[index] = sqe;
+            sqArray[index] = index;
+            __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+            toSubmit++;
+        }
+        // Submits what is queued and waits for at least one completion.
+        // Returns 0 or the errno of the failure.
+        int submitAndWait()
+        {
+            for (;;)
+            {
+                const auto submitted = syscall(__NR_io_uring_enter, fd, toSubmit, 1u,
+                                               IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (submitted >= 0)
+                {
+                    toSubmit -= (unsigned)submitted;
+                    return 0;
+                }
+                if (errno != EINTR) return errno;
+            }
+        }
+        template<typename Callback>
+        void forEachCompletion(Callback&& callback)
+        {
+            unsigned head = *cqHead;
+            const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++)
+            {
+                const auto& cqe = cqes[head & cqMask];
+                callback(cqe.user_data, cqe.res);
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+
+        int fd = -1;
+        void* ringMemory = nullptr;
+        size_t ringSize = 0;
+        io_uring_sqe* sqes = nullptr;
+        size_t sqesSize = 0;
+
+        unsigned* sqHead = nullptr;
+        unsigned* sqTail = nullptr;
+        unsigned* sqArray = nullptr;
+        unsigned sqMask = 0;
+        unsigned sqEntries = 0;
+        unsigned* cqHead = nullptr;
+        unsigned* cqTail = nullptr;
+        unsigned cqMask = 0;
+        io_uring_cqe* cqes = nullptr;
+        unsigned toSubmit = 0;
+       #endif
+    };
+
+    // One file on its way through open, size query, reads and close. At
+    // most one operation of a request is in flight at a time.
+    struct UringReader::Request
+    {
+        enum class Step { idle, opening, sizing, reading, closing };
+
+        Step step = Step::idle;
+        int index = 0;
+        juce::File file;
+        // Read by the kernel while the open is in flight
+        std::string path;
+        int fd = -1;
+       #if NORM_HAS_IO_URING
+        struct statx status {};
+       #endif
+        juce::int64 size = 0;
+        juce::int64 offset = 0;
+        juce::MemoryBlock data;
+        bool ok = false;
+    };
+
+    UringReader::UringReader(Options options)
+        : mOptions(std::move(options))
+    {
+       #if NORM_HAS_IO_URING
+        const int queueDepth = juce::jmax(1, mOptions.queueDepth);
+        mRing = Ring::create((unsigned)queueDepth);
+        if (mRing == nullptr)
+        {
+            MY_LOG_INFO("io_uring is not available, reading through streams");
+            return;
+        }
+
+        const auto chunkSize = (size_t)juce::jmax(4096, mOptions.chunkSize);
+        mBuffers.resize((size_t)queueDepth * chunkSize);
+
+        std::vector<iovec> buffers;
+        for (int i = 0; i < queueDepth; i++)
+        {
+            auto request = std::make_unique<Request>();
+            request->index = i;
+            mRequests.push_back(std::move(request));
+            buffers.push_back({ mBuffers.data() + (size_t)i * chunkSize, chunkSize });
+        }
+
+        // Over the locked memory limit, e.g.: plain reads into the same buffers
+        mBuffersRegistered = mRing->registerBuffers(buffers);
+       #endif
+    }
+    UringReader::~UringReader() {}
+
+    void UringReader::run(const NextFile& next, const FileCallback& onFile)
+    {
+       #if NORM_HAS_IO_URING
+        if (!isAvailable()) return;
+
+        bool sourceIsDone = false;
+        int transientFailures = 0;
+        for (;;)
+        {
+            int inFlight = 0;
+            for (const auto& request : mRequests)
+                inFlight += request->step != Request::Step::idle ? 1 : 0;
+
+            // Only wait for new files when there is nothing else to wait for
+            for (const auto& request : mRequests)
+            {
+                if (sourceIsDone) break;
+                if (request->step != Request::Step::idle) continue;
+
+                const auto file = next(inFlight == 0);
+                if (!file.has_value())
+                {
+                    sourceIsDone = inFlight == 0;
+                    break;
+                }
+                start(*request, *file);
+                inFlight++;
+            }
+
+            if (inFlight == 0)
+            {
+                if (sourceIsDone) return;
+                continue;
+            }
+
+            const int error = mRing->submitAndWait();
+            if (error == 0)
+            {
+                transientFailures = 0;
+            }
+            else if ((error == EAGAIN || error == EBUSY) && ++transientFailures < maxTransientFailures)
+            {
+                // Out of kernel resources for now, the completions below free some
+                juce::Thread::sleep(1);
+            }
+            else
+            {
+                MY_LOG_ERROR("io_uring_enter failed: {}, reading through streams from here on",
+                             std::strerror(error));
+                abandon(onFile);
+                return;
+            }
+            mRing->forEachCompletion([&](juce::uint64 index, int result)
+            {
+                advance(*mRequests[(size_t)index], result, onFile);
+            });
+        }
+       #else
+        juce::ignoreUnused(next, onFile);
+       #endif
+    }
+
+    std::vector<UringReader::Completed> UringReader::read(const juce::Array<juce::File>& files)
+    {
+        std::vector<Completed> results((size_t)files.size());
+        // Where each file goes in the results, a file may be listed twice
+        std::multimap<juce::File, size_t> indices;
+        for (int i = 0; i < files.size(); i++)
+        {
+            indices.emplace(files[i], (size_t)i);
+            results[(size_t)i].file = files[i];
+        }
+
+        int next = 0;
+        run([&](bool) -> std::optional<juce::File>
+            {
+                if (next >= files.size()) return std::nullopt;
+                return files[next++];
+            },
+            [&](Completed&& completed)
+            {
+                const auto it = indices.find(completed.file);
+                jassert(it != indices.end());
+                results[it->second] = std::move(completed);
+                indices.erase(it);
+            });
+
+        return results;
+    }
+
+    void UringReader::start(Request& request, const juce::File& file)
+    {
+       #if NORM_HAS_IO_URING
+        request.file = file;
+        request.path = file.getFullPathName().toStdString();
+        request.fd = -1;
+        request.size = 0;
+        request.offset = 0;
+        request.ok = false;
+
+        io_uring_sqe sqe {};
+        sqe.opcode = IORING_OP_OPENAT;
+        sqe.fd = AT_FDCWD;
+        sqe.addr = (juce::uint64)(uintptr_t)request.path.c_str();
+        sqe.open_flags = O_RDONLY | O_CLOEXEC;
+        sqe.user_data = (juce::uint64)request.index;
+        request.step = Request::Step::opening;
+        mRing->queue(sqe);
+       #else
+        juce::ignoreUnused(request, file);
+       #endif
+    }
+
+    void UringReader::queueRead(Request& request)
+    {
+       #if NORM_HAS_IO_URING
+        const auto chunkSize = (juce::int64)juce::jmax(4096, mOptions.chunkSize);
+        char* buffer = mBuffers.data() + (size_t)request.index * (size_t)chunkSize;
+
+        io_uring_sqe sqe {};
+        sqe.opcode = mBuffersRegistered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe.fd = request.fd;
+        sqe.addr = (juce::uint64)(uintptr_t)buffer;
+        sqe.len = (juce::uint32)juce::jmin(chunkSize, request.size - request.offset);
+        sqe.off = (juce::uint64)request.offset;
+        if (mBuffersRegistered) sqe.buf_index = (juce::uint16)request.index;
+        sqe.user_data = (juce::uint64)request.index;
+        request.step = Request::Step::reading;
+        mRing->queue(sqe);
+       #else
+        juce::ignoreUnused(request);
+       #endif
+    }
+
+    void UringReader::advance(Request& request, int result, const FileCallback& onFile)
+    {
+       #if NORM_HAS_IO_URING
+        auto queueClose = [&](bool ok)
+        {
+            io_uring_sqe sqe {};
+            sqe.opcode = IORING_OP_CLOSE;
+            sqe.fd = request.fd;
+            sqe.user_data = (juce::uint64)request.index;
+            request.ok = ok;
+            request.step = Request::Step::closing;
+            mRing->queue(sqe);
+            // The kernel closes it from here on, abandon must not close it
+            // again, the number may belong to another file by then
+            request.fd = -1;
+        };
+
+        switch (request.step)
+        {
+            case Request::Step::opening:
+            {
+                if (result < 0)
+                {
+                    complete(request, false, onFile);
+                    return;
+                }
+                request.fd = result;
+
+                io_uring_sqe sqe {};
+                sqe.opcode = IORING_OP_STATX;
+                sqe.fd = request.fd;
+                sqe.addr = (juce::uint64)(uintptr_t)"";
+                sqe.len = STATX_SIZE;
+                sqe.off = (juce::uint64)(uintptr_t)&request.status;
+                sqe.statx_flags = AT_EMPTY_PATH;
+                sqe.user_data = (juce::uint64)request.index;
+                request.step = Request::Step::sizing;
+                mRing->queue(sqe);
+                return;
+            }
+            case Request::Step::sizing:
+            {
+                if (result < 0) return queueClose(false);
+
+                request.size = (juce::int64)request.status.stx_size;
+                if (request.size > juce::jmin(mOptions.maxFileSize, maxReadableFileSize))
+                    return queueClose(false);
+                if (request.size == 0) return queueClose(true);
+
+                request.data.setSize((size_t)request.size);
+                queueRead(request);
+                return;
+            }
+            case Request::Step::reading:
+            {
+                if (result < 0) return queueClose(false);
+                // Shorter than it was a moment ago
+                if (result == 0)
+                {
+                    request.data.setSize((size_t)request.offset);
+                    return queueClose(true);
+                }
+
+                const auto chunkSize = (size_t)juce::jmax(4096, mOptions.chunkSize);
+                request.data.copyFrom(mBuffers.data() + (size_t)request.index * chunkSize,
+                                      (int)request.offset,
+                                      (size_t)result);
+                request.offset += result;
+
+                if (request.offset >= request.size) return queueClose(true);
+                queueRead(request);
+                return;
+            }
+            case Request::Step::closing:
+                complete(request, request.ok, onFile);
+                return;
+
+            case Request::Step::idle:
+                jassertfalse;
+                return;
+        }
+       #else
+        juce::ignoreUnused(request, result, onFile);
+       #endif
+    }
+
+    void UringReader::abandon(const FileCallback& onFile)
+    {
+       #if NORM_HAS_IO_URING
+        // Closing the ring cancels what is in flight. Buffers and paths stay
+        // with the reader, so the kernel never sees them go away.
+        mRing.reset();
+
+        for (const auto& request : mRequests)
+        {
+            if (request->step == Request::Step::idle) continue;
+
+            if (request->fd >= 0) close(request->fd);
+            complete(*request, false, onFile);
+        }
+       #else
+        juce::ignoreUnused(onFile);
+       #endif
+    }
+
+    void UringReader::complete(Request& request, bool ok, const FileCallback& onFile)
+    {
+        Completed completed;
+        completed.file = request.file;
+        completed.ok = ok;
+        if (ok) completed.data = std::move(request.data);
+
+        request.step = Request::Step::idle;
+        request.fd = -1;
+        request.data.reset();
+
+        onFile(std::move(completed));
+    }
+}
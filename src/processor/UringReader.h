@@ -0,0 +1,89 @@
+#pragma once
+
+/*  Reads whole files into memory through io_uring, for batches of many small
+    files where reading through a stream per worker costs a blocking system
+    call for every open, read and close. Here the opens, size queries, reads
+    and closes of up to queueDepth files are queued together, and one call
+    to the kernel submits a batch and collects what has completed.
+
+    Reads go into buffers registered with the kernel once, so it does not
+    have to map them on every read. The decoders get the file from memory
+    afterwards (see FileHandler::setPrefetchedData).
+
+    Linux only, from kernel 5.6. isAvailable() is false elsewhere, on older
+    kernels and where io_uring is disabled, e.g. in many containers; callers
+    read through streams then.
+*/
+
+#include <juce_core/juce_core.h>
+#include <functional>
+#include <optional>
+#include <vector>
+
+namespace norm
+{
+
+class UringReader
+{
+public:
+    struct Options
+    {
+        // Files in flight at once
+        int queueDepth = 32;
+        // Read size, one registered buffer of this size per file in flight
+        int chunkSize = 256 * 1024;
+        // Larger files are not read, they are better streamed. Files over
+        // 2 GiB are never read, whatever this says.
+        juce::int64 maxFileSize = 64 * 1024 * 1024;
+    };
+
+    struct Completed
+    {
+        juce::File file;
+        juce::MemoryBlock data;
+        // False if the file could not be read or was too large. It can still
+        // be read through a stream.
+        bool ok = false;
+    };
+
+    // The next file to read. Without mayWait only a file that is at hand,
+    // with it the call may block; nothing then means there are no more.
+    using NextFile = std::function<std::optional<juce::File>(bool mayWait)>;
+    // Called on the reading thread as each file completes
+    using FileCallback = std::function<void(Completed&& completed)>;
+
+public:
+    explicit UringReader(Options options = {});
+    ~UringReader();
+
+    bool isAvailable() const { return mRing != nullptr; }
+    const Options& getOptions() const { return mOptions; }
+
+    // Blocks until next has run out and every file it gave is done. Does
+    // nothing if io_uring is not available. If the ring itself fails, the
+    // files in flight complete as not read and run returns without asking
+    // next for more; isAvailable() is false from then on.
+    void run(const NextFile& next, const FileCallback& onFile);
+    // Same for a list, the results are in the order of the list
+    std::vector<Completed> read(const juce::Array<juce::File>& files);
+
+private:
+    struct Ring;
+    struct Request;
+
+    void start(Request& request, const juce::File& file);
+    // Moves a request on after one of its operations completed
+    void advance(Request& request, int result, const FileCallback& onFile);
+    void queueRead(Request& request);
+    void complete(Request& request, bool ok, const FileCallback& onFile);
+    // Closes the ring after a failure, every file in flight fails
+    void abandon(const FileCallback& onFile);
+
+    const Options mOptions;
+    std::unique_ptr<Ring> mRing;
+    std::vector<std::unique_ptr<Request>> mRequests;
+    std::vector<char> mBuffers;
+    bool mBuffersRegistered = false;
+};
+
+} // namespace norm
@@ -0,0 +1,278 @@
+#include "WorkerProcess.h"
+#include "util/Logger.h"
+
+namespace norm
+{
+    namespace worker
+    {
+        juce::MemoryBlock encode(const Job& job)
+        {
+            juce::MemoryOutputStream stream;
+            stream.writeString(job.file.getFullPathName());
+            stream.writeInt((int)job.options.mode);
+            stream.writeFloat(job.options.targetLoudness);
+            stream.writeFloat(job.options.taggedToleranceDB);
+            stream.writeBool(job.previous.has_value());
+            if (job.previous.has_value())
+            {
+                stream.writeInt((int)job.previous->status);
+                stream.writeFloat(job.previous->loudness);
+                stream.writeFloat(job.previous->gain);
+            }
+            const auto& limiter = job.options.limiter;
+            stream.writeBool(limiter.has_value());
+            if (limiter.has_value())
+            {
+                stream.writeFloat(limiter->ceilingDB);
+                stream.writeFloat(limiter->lookAheadMs);
+                stream.writeFloat(limiter->releaseMs);
+            }
+            stream.writeBool(job.albumGain.has_value());
+            if (job.albumGain.has_value())
+            {
+                stream.writeFloat(job.albumGain->gain);
+                stream.writeFloat(job.albumGain->peak);
+            }
+            stream.writeString(job.options.sourceDirectory.getFullPathName());
+            stream.writeString(job.options.outputDirectory.getFullPathName());
+            stream.writeFloat(job.options.cloneToleranceDB);
+            stream.writeBool(job.options.allowHardlinks);
+            stream.writeBool(job.options.signalResidualGain);
+            stream.writeBool(job.options.tagsOnly);
+            return stream.getMemoryBlock();
+        }
+        std::optional<Job> decodeJob(const juce::MemoryBlock& message)
+        {
+            juce::MemoryInputStream stream(message, false);
+
+            Job job;
+            const auto path = stream.readString();
+            if (!juce::File::isAbsolutePath(path)) return std::nullopt;
+
+            job.file = juce::File(path);
+            job.options.mode = (BatchEngine::Mode)stream.readInt();
+            job.options.targetLoudness = stream.readFloat();
+            job.options.taggedToleranceDB = stream.readFloat();
+            if (stream.readBool())
+            {
+                BatchJournal::Entry previous;
+                previous.status = (FileStatus)stream.readInt();
+                previous.loudness = stream.readFloat();
+                previous.gain = stream.readFloat();
+                job.previous = previous;
+            }
+            if (stream.readBool())
+            {
+                TruePeakLimiter::Options limiter;
+                limiter.ceilingDB = stream.readFloat();
+                limiter.lookAheadMs = stream.readFloat();
+                limiter.releaseMs = stream.readFloat();
+                job.options.limiter = limiter;
+            }
+            if (stream.readBool())
+            {
+                BatchEngine::AlbumGain albumGain;
+                albumGain.gain = stream.readFloat();
+                albumGain.peak = stream.readFloat();
+                job.albumGain = albumGain;
+            }
+
+            const auto sourceDirectory = stream.readString();
+            const auto outputDirectory = stream.readString();
+            if (outputDirectory.isNotEmpty())
+            {
+                if (!juce::File::isAbsolutePath(sourceDirectory)
+                    || !juce::File::isAbsolutePath(outputDirectory))
+                {
+                    return std::nullopt;
+                }
+                job.options.sourceDirectory = juce::File(sourceDirectory);
+                job.options.outputDirectory = juce::File(outputDirectory);
+            }
+            job.options.cloneToleranceDB = stream.readFloat();
+            job.options.allowHardlinks = stream.readBool();
+            job.options.signalResidualGain = stream.readBool();
+            job.options.tagsOnly = stream.readBool();
+            return job;
+        }
+        juce::MemoryBlock encode(const Report& report)
+        {
+            juce::MemoryOutputStream stream;
+            stream.writeString(report.result.file.getFullPathName());
+            stream.writeInt((int)report.result.status);
+            stream.writeFloat(report.result.loudness);
+            stream.writeFloat(report.result.gain);
+            stream.writeFloat(report.result.samplePeak);
+            stream.writeBool(report.isFinal);
+            report.result.histogram.writeToStream(stream);
+            return stream.getMemoryBlock();
+        }
+        std::optional<Report> decodeReport(const juce::MemoryBlock& message)
+        {
+            juce::MemoryInputStream stream(message, false);
+
+            Report report;
+            const auto path = stream.readString();
+            if (!juce::File::isAbsolutePath(path)) return std::nullopt;
+
+            report.result.file = juce::File(path);
+            report.result.status = (FileStatus)stream.readInt();
+            report.result.loudness = stream.readFloat();
+            report.result.gain = stream.readFloat();
+            report.result.samplePeak = stream.readFloat();
+            report.isFinal = stream.readBool();
+            if (!report.result.histogram.readFromStream(stream)) return std::nullopt;
+            return report;
+        }
+    }
+
+    //==========================================================================
+
+    WorkerProcess::WorkerProcess() {}
+    WorkerProcess::~WorkerProcess()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mShouldExit = true;
+        }
+        mCondition.notify_all();
+        if (mThread.joinable()) mThread.join();
+    }
+
+    void WorkerProcess::handleMessageFromCoordinator(const juce::MemoryBlock& message)
+    {
+        auto job = worker::decodeJob(message);
+        EXPECT_OR_RETURN (job.has_value(), void(), "Malformed job message");
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mJobs.push_back(std::move(*job));
+
+            // only started once there is work, the object is also created
+            // when the application is not in worker mode at all
+            if (!mThread.joinable()) mThread = std::thread([this] { run(); });
+        }
+        mCondition.notify_one();
+    }
+    void WorkerProcess::handleConnectionLost()
+    {
+        // Nobody is waiting for results any more
+        juce::JUCEApplicationBase::quit();
+    }
+
+    void WorkerProcess::run()
+    {
+        for (;;)
+        {
+            worker::Job job;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mCondition.wait(lock, [this] { return mShouldExit || !mJobs.empty(); });
+                if (mShouldExit) return;
+
+                job = std::move(mJobs.front());
+                mJobs.pop_front();
+            }
+
+            mEngine.setLimiter(job.options.limiter);
+            mEngine.getFileHandler().setSignalResidualGain(job.options.signalResidualGain);
+            const auto result = BatchEngine::processFile(
+                mEngine,
+                job.file,
+                job.options,
+                job.previous,
+                job.albumGain,
+                [this](const BatchEngine::FileResult& state)
+                {
+                    sendMessageToCoordinator(worker::encode(worker::Report { state, false }));
+                });
+            sendMessageToCoordinator(worker::encode(worker::Report { result, true }));
+        }
+    }
+
+    //==========================================================================
+
+    WorkerConnection::WorkerConnection() {}
+    WorkerConnection::~WorkerConnection()
+    {
+        killWorkerProcess();
+    }
+
+    bool WorkerConnection::launch(const juce::File& executable, int timeoutMs)
+    {
+        // No output streams: nobody would drain the pipes
+        mIsAlive = launchWorkerProcess(executable,
+                                       worker::CommandLineId,
+                                       timeoutMs,
+                                       0);
+        return mIsAlive;
+    }
+
+    std::optional<BatchEngine::FileResult> WorkerConnection::process(
+        const worker::Job& job,
+        int timeoutMs,
+        const BatchEngine::StateCallback& onStateChange)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mResult.reset();
+        mOnStateChange = onStateChange;
+
+        if (!mIsAlive || !sendMessageToWorker(worker::encode(job)))
+        {
+            mIsAlive = false;
+            return std::nullopt;
+        }
+
+        auto answered = [this] { return mResult.has_value() || !mIsAlive; };
+        if (timeoutMs > 0)
+        {
+            if (!mCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), answered))
+            {
+                MY_LOG_WARNING("Worker timed out on {}",
+                               job.file.getFullPathName().toStdString());
+                mIsAlive = false;
+                lock.unlock();
+                killWorkerProcess();
+                return std::nullopt;
+            }
+        }
+        else
+        {
+            mCondition.wait(lock, answered);
+        }
+
+        if (!mResult.has_value()) return std::nullopt;
+        return std::move(mResult);
+    }
+
+    void WorkerConnection::handleMessageFromWorker(const juce::MemoryBlock& message)
+    {
+        auto report = worker::decodeReport(message);
+        EXPECT_OR_RETURN (report.has_value(), void(), "Malformed result message");
+
+        if (!report->isFinal)
+        {
+            BatchEngine::StateCallback onStateChange;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                onStateChange = mOnStateChange;
+            }
+            if (onStateChange) onStateChange(report->result);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mResult = std::move(report->result);
+        }
+        mCondition.notify_all();
+    }
+    void WorkerConnection::handleConnectionLost()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mIsAlive = false;
+        }
+        mCondition.notify_all();
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+/*  Process isolation for the batch engine. The supervisor launches copies of
+    the application executable in worker mode and hands each of them one file
+    at a time over a pipe. Only the path travels, workers open and write the
+    files themselves, so the pipe traffic per file is a few bytes, plus the
+    gating histogram of every file analysed.
+
+    If a worker crashes or hangs, the supervisor side notices the lost
+    connection, marks the file that worker was on as quarantined and starts a
+    fresh worker.
+*/
+
+#include "BatchEngine.h"
+#include <juce_events/juce_events.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace norm
+{
+
+namespace worker
+{
+    // Tells the application to start in worker mode, see Main.cpp
+    inline constexpr char CommandLineId[] = "normalize-batch-worker";
+
+    struct Job
+    {
+        juce::File file;
+        // Only the fields processFile reads are sent: mode, target, the
+        // tolerances, limiter, mirror directories and how gain is written.
+        // The rest keep their defaults in the worker, gainMode among them,
+        // an album's gain comes as albumGain.
+        BatchEngine::Options options;
+        std::optional<BatchJournal::Entry> previous;
+        std::optional<BatchEngine::AlbumGain> albumGain;
+    };
+
+    // The worker reports every state of a file, the last one is final
+    struct Report
+    {
+        BatchEngine::FileResult result;
+        bool isFinal = true;
+    };
+
+    juce::MemoryBlock encode(const Job& job);
+    std::optional<Job> decodeJob(const juce::MemoryBlock& message);
+    juce::MemoryBlock encode(const Report& report);
+    std::optional<Report> decodeReport(const juce::MemoryBlock& message);
+}
+
+// Lives in the worker process. Jobs are processed on a thread of their own,
+// the connection's thread has to stay free to answer pings.
+class WorkerProcess : public juce::ChildProcessWorker
+{
+public:
+    WorkerProcess();
+    ~WorkerProcess() override;
+
+    void handleMessageFromCoordinator(const juce::MemoryBlock& message) override;
+    void handleConnectionLost() override;
+
+private:
+    void run();
+
+    AnalysisEngine mEngine;
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<worker::Job> mJobs;
+    bool mShouldExit = false;
+
+    std::thread mThread;
+};
+
+// Supervisor side of a single worker process
+class WorkerConnection : public juce::ChildProcessCoordinator
+{
+public:
+    WorkerConnection();
+    ~WorkerConnection() override;
+
+    bool launch(const juce::File& executable, int timeoutMs);
+    bool isAlive() const { return mIsAlive; }
+
+    // Blocks until the worker answers. Returns nothing if the worker died or
+    // exceeded timeoutMs (0 = no limit), in which case it has been killed.
+    // Intermediate states go to onStateChange, on the connection's thread.
+    std::optional<BatchEngine::FileResult> process(
+        const worker::Job& job,
+        int timeoutMs,
+        const BatchEngine::StateCallback& onStateChange);
+
+    void handleMessageFromWorker(const juce::MemoryBlock& message) override;
+    void handleConnectionLost() override;
+
+private:
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::optional<BatchEngine::FileResult> mResult;
+    BatchEngine::StateCallback mOnStateChange;
+    std::atomic<bool> mIsAlive { false };
+};
+
+} // namespace norm
@@ -0,0 +1,296 @@
+#include "WriteStage.h"
+#include "util/Logger.h"
+#include <algorithm>
+#include <cmath>
+
+namespace norm
+{
+    WriteStage::DitherSource::DitherSource(juce::uint32 seed)
+    {
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            // xorshift must not start at 0, and the lanes must differ
+            mState[lane] = (seed ^ (0x85ebca6bu * (juce::uint32)(lane + 1))) | 1u;
+        }
+    }
+    void WriteStage::DitherSource::fill(float* dest, int numSamples)
+    {
+        // Both uniform variables come from one draw, the upper and lower
+        // halves. 16 bits of resolution are plenty for noise of 1 LSB.
+        constexpr float toLSB = 1.f / 65536.f;
+
+        int i = 0;
+        for (; i + lanes <= numSamples; i += lanes)
+        {
+            for (int lane = 0; lane < lanes; lane++)
+            {
+                juce::uint32 s = mState[lane];
+                s ^= s << 13;
+                s ^= s >> 17;
+                s ^= s << 5;
+                mState[lane] = s;
+
+                dest[i + lane] = ((float)(s >> 16) - (float)(s & 0xffffu)) * toLSB;
+            }
+        }
+
+        for (int lane = 0; i < numSamples; i++, lane++)
+        {
+            juce::uint32 s = mState[lane];
+            s ^= s << 13;
+            s ^= s >> 17;
+            s ^= s << 5;
+            mState[lane] = s;
+
+            dest[i] = ((float)(s >> 16) - (float)(s & 0xffffu)) * toLSB;
+        }
+    }
+
+    //==========================================================================
+
+    WriteStage::WriteStage() {}
+    WriteStage::~WriteStage() {}
+
+    void WriteStage::prepare(int numberOfChannels)
+    {
+        if ((int)mBlocks.size() >= numberOfChannels) return;
+
+        mBlocks.resize((size_t)numberOfChannels);
+        for (auto& block : mBlocks) block.resize(blockSize);
+        mPointers.resize((size_t)numberOfChannels + 1);
+        mSources.resize((size_t)numberOfChannels);
+        mUnpacked.resize((size_t)numberOfChannels);
+        for (auto& block : mUnpacked) block.resize(blockSize);
+        mDitherBlock.resize(blockSize);
+    }
+
+    void WriteStage::setLimiter(std::optional<TruePeakLimiter::Options> options)
+    {
+        if (options == mLimiterOptions) return;
+
+        mLimiterOptions = options;
+        // Prepared again with the new options on the next write
+        mLimiterOptionsChanged = true;
+    }
+    float WriteStage::getMaxGainReductionDB() const
+    {
+        return mLimiterUsed ? mLimiter.getMaxGainReductionDB() : 0.f;
+    }
+
+    void WriteStage::prepareLimiter(double sampleRate, int numberOfChannels)
+    {
+        // Files of the same kind in a row only need a reset
+        if (!mLimiterOptionsChanged
+            && sampleRate == mLimiterSampleRate
+            && numberOfChannels == mLimiterChannels)
+        {
+            mLimiter.reset();
+            return;
+        }
+
+        mLimiter.prepare(sampleRate, numberOfChannels, blockSize, *mLimiterOptions);
+        mLimiterOptionsChanged = false;
+        mLimiterSampleRate = sampleRate;
+        mLimiterChannels = numberOfChannels;
+
+        mScratch.resize((size_t)numberOfChannels);
+        for (auto& block : mScratch) block.resize(blockSize);
+        mScratchPointers.resize((size_t)numberOfChannels);
+        for (int ch = 0; ch < numberOfChannels; ch++)
+            mScratchPointers[(size_t)ch] = mScratch[(size_t)ch].data();
+    }
+
+    bool WriteStage::write(juce::AudioFormatWriter& writer,
+                           const juce::AudioBuffer<float>& buffer,
+                           int startSample,
+                           int numSamples,
+                           float linearGain)
+    {
+        const int numberOfChannels = juce::jmin(buffer.getNumChannels(),
+                                                writer.getNumChannels());
+        return writeFrom(writer, numberOfChannels, numSamples, linearGain,
+                         [&buffer, startSample](int channel, int offset, int, float*)
+                         {
+                             return buffer.getReadPointer(channel, startSample + offset);
+                         });
+    }
+    bool WriteStage::write(juce::AudioFormatWriter& writer,
+                           const SampleStore& samples,
+                           int startSample,
+                           int numSamples,
+                           float linearGain)
+    {
+        const int numberOfChannels = juce::jmin(samples.getNumChannels(),
+                                                writer.getNumChannels());
+        return writeFrom(writer, numberOfChannels, numSamples, linearGain,
+                         [&samples, startSample](int channel, int offset, int size, float* scratch)
+                         {
+                             samples.read(channel, startSample + offset, size, scratch);
+                             return (const float*)scratch;
+                         });
+    }
+
+    bool WriteStage::writeFrom(juce::AudioFormatWriter& writer,
+                               int numberOfChannels,
+                               int numSamples,
+                               float linearGain,
+                               const Fetch& fetch)
+    {
+        EXPECT_OR_RETURN (numberOfChannels > 0,
+                          false,
+                          "Nothing to write");
+
+        prepare(numberOfChannels);
+
+        mLimiterUsed = mLimiterOptions.has_value();
+        if (mLimiterUsed)
+        {
+            return writeLimited(writer, numberOfChannels, numSamples, linearGain, fetch);
+        }
+
+        for (int offset = 0; offset < numSamples; offset += blockSize)
+        {
+            const int size = juce::jmin(blockSize, numSamples - offset);
+
+            for (int ch = 0; ch < numberOfChannels; ch++)
+            {
+                mSources[(size_t)ch] = fetch(ch, offset, size, mUnpacked[(size_t)ch].data());
+            }
+
+            if (!writeBlock(writer, numberOfChannels, size, linearGain)) return false;
+        }
+
+        return true;
+    }
+
+    bool WriteStage::writeLimited(juce::AudioFormatWriter& writer,
+                                  int numberOfChannels,
+                                  int numSamples,
+                                  float linearGain,
+                                  const Fetch& fetch)
+    {
+        prepareLimiter(writer.getSampleRate(), numberOfChannels);
+
+        const int latency = mLimiter.getLatencyInSamples();
+        int toSkip = latency;
+
+        // The input followed by latency samples of silence to flush the delay
+        for (int offset = 0; offset < numSamples + latency; offset += blockSize)
+        {
+            const int size = juce::jmin(blockSize, numSamples + latency - offset);
+            const int fromInput = juce::jlimit(0, size, numSamples - offset);
+
+            for (int ch = 0; ch < numberOfChannels; ch++)
+            {
+                float* scratch = mScratchPointers[(size_t)ch];
+                if (fromInput > 0)
+                {
+                    // Unpacked samples land in scratch and are gained in place
+                    applyGain(fetch(ch, offset, fromInput, scratch),
+                              scratch,
+                              fromInput,
+                              linearGain);
+                }
+                std::fill(scratch + fromInput, scratch + size, 0.f);
+            }
+
+            mLimiter.process(mScratchPointers.data(), size);
+
+            // The first latency samples out are from before the file started
+            const int skip = juce::jmin(toSkip, size);
+            toSkip -= skip;
+            if (skip == size) continue;
+
+            for (int ch = 0; ch < numberOfChannels; ch++)
+            {
+                mSources[(size_t)ch] = mScratchPointers[(size_t)ch] + skip;
+            }
+
+            if (!writeBlock(writer, numberOfChannels, size - skip, 1.f)) return false;
+        }
+
+        return true;
+    }
+
+    bool WriteStage::writeBlock(juce::AudioFormatWriter& writer,
+                                int numberOfChannels,
+                                int numSamples,
+                                float linearGain)
+    {
+        const bool isFloat = writer.isFloatingPoint();
+        const int bitsPerSample = writer.getBitsPerSample();
+        // A float carries 24 bits, below that dither would be noise on noise
+        const bool dither = mDitherEnabled && !isFloat && bitsPerSample <= 24;
+
+        for (int ch = 0; ch < numberOfChannels; ch++)
+        {
+            const float* source = mSources[(size_t)ch];
+            int* dest = mBlocks[(size_t)ch].data();
+
+            if (isFloat)
+            {
+                // Float writers take their samples through the int pointers
+                applyGain(source, reinterpret_cast<float*>(dest), numSamples, linearGain);
+            }
+            else
+            {
+                if (dither) mDither.fill(mDitherBlock.data(), numSamples);
+                convertToInt(source,
+                             dest,
+                             dither ? mDitherBlock.data() : nullptr,
+                             numSamples,
+                             linearGain,
+                             bitsPerSample);
+            }
+
+            mPointers[(size_t)ch] = dest;
+        }
+        mPointers[(size_t)numberOfChannels] = nullptr;
+
+        return writer.write(mPointers.data(), numSamples);
+    }
+
+    void WriteStage::convertToInt(const float* source,
+                                  int* dest,
+                                  const float* dither,
+                                  int numSamples,
+                                  float linearGain,
+                                  int bitsPerSample)
+    {
+        bitsPerSample = juce::jlimit(8, 32, bitsPerSample);
+
+        const double fullScale = std::ldexp(1.0, bitsPerSample - 1);
+        const float scale = (float)(linearGain * fullScale);
+        const float minValue = (float)-fullScale;
+        // 2^31 - 1 is not a float, the largest one below it is 2^31 - 128
+        const float maxValue = bitsPerSample >= 32 ? 2147483520.f
+                                                   : (float)(fullScale - 1.0);
+        const int shift = 32 - bitsPerSample;
+
+        // Round half away from zero, the select compiles to a blend
+        auto quantise = [&](float y)
+        {
+            y = std::min(std::max(y, minValue), maxValue);
+            y += y >= 0.f ? 0.5f : -0.5f;
+            return (int)((juce::uint32)(int)y << shift);
+        };
+
+        if (dither != nullptr)
+        {
+            for (int i = 0; i < numSamples; i++)
+                dest[i] = quantise(source[i] * scale + dither[i]);
+        }
+        else
+        {
+            for (int i = 0; i < numSamples; i++)
+                dest[i] = quantise(source[i] * scale);
+        }
+    }
+    void WriteStage::applyGain(const float* source,
+                               float* dest,
+                               int numSamples,
+                               float linearGain)
+    {
+        juce::FloatVectorOperations::multiply(dest, source, linearGain, numSamples);
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+/*  Last step before the disk: gain, TPDF dither, clipping and the conversion
+    to integer samples in one pass over each block, instead of a gain pass
+    over the whole buffer followed by the writer's own undithered, truncating
+    conversion.
+
+    The kernel is written as plain loops without branches or calls so that the
+    compiler vectorises it. Output is what juce::AudioFormatWriter::write
+    takes: 32-bit integers, left-justified, already quantised to the file's
+    bit depth, so the writer only has to pack bytes.
+
+    Optionally a true-peak limiter runs between the gain and the conversion,
+    still block by block in the same pass. Its latency is compensated here:
+    the first output samples are dropped and the tail is flushed with
+    silence, so the file keeps its length and alignment.
+*/
+
+#include "SampleStore.h"
+#include "TruePeakLimiter.h"
+#include <juce_core/juce_core.h>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <functional>
+#include <optional>
+#include <vector>
+
+namespace norm
+{
+
+class WriteStage
+{
+public:
+    // Random source for the dither. Several independent xorshift generators
+    // side by side, so that filling a block vectorises as well.
+    class DitherSource
+    {
+    public:
+        explicit DitherSource(juce::uint32 seed = 0x9e3779b9u);
+        // Triangular distribution on (-1, 1), in LSB
+        void fill(float* dest, int numSamples);
+
+        static constexpr int lanes = 8;
+
+    private:
+        juce::uint32 mState[lanes];
+    };
+
+public:
+    WriteStage();
+    ~WriteStage();
+
+    // No dither is only useful for tests and bit exact round trips
+    void setDitherEnabled(bool shouldDither) { mDitherEnabled = shouldDither; }
+    // Nothing disables the limiter. The same options again keep the limiter
+    // as it is prepared, so this can be called for every file.
+    void setLimiter(std::optional<TruePeakLimiter::Options> options);
+    bool hasLimiter() const { return mLimiterOptions.has_value(); }
+    const std::optional<TruePeakLimiter::Options>& getLimiter() const { return mLimiterOptions; }
+    // Of the last write, 0 without a limiter
+    float getMaxGainReductionDB() const;
+
+    // Streams numSamples of buffer into the writer, with the gain applied.
+    // Allocates only the first time, or when the writer needs more channels.
+    bool write(juce::AudioFormatWriter& writer,
+               const juce::AudioBuffer<float>& buffer,
+               int startSample,
+               int numSamples,
+               float linearGain);
+    // The same from packed samples, unpacked a block at a time
+    bool write(juce::AudioFormatWriter& writer,
+               const SampleStore& samples,
+               int startSample,
+               int numSamples,
+               float linearGain);
+
+    // The fused kernel: dest = clip(round(source * gain * 2^(bits-1) + dither))
+    // left-justified to 32 bits. dither may be nullptr.
+    static void convertToInt(const float* source,
+                             int* dest,
+                             const float* dither,
+                             int numSamples,
+                             float linearGain,
+                             int bitsPerSample);
+    // For floating point files: gain only, there is nothing to quantise
+    static void applyGain(const float* source,
+                          float* dest,
+                          int numSamples,
+                          float linearGain);
+
+    static constexpr int blockSize = 4096;
+
+private:
+    // Float samples of a channel from offset on, either in place or put
+    // into scratch, which holds blockSize
+    using Fetch = std::function<const float*(int channel, int offset, int numSamples, float* scratch)>;
+
+    void prepare(int numberOfChannels);
+    void prepareLimiter(double sampleRate, int numberOfChannels);
+    bool writeFrom(juce::AudioFormatWriter& writer,
+                   int numberOfChannels,
+                   int numSamples,
+                   float linearGain,
+                   const Fetch& fetch);
+    // Converts numSamples from mSources with the gain and writes them
+    bool writeBlock(juce::AudioFormatWriter& writer,
+                    int numberOfChannels,
+                    int numSamples,
+                    float linearGain);
+    bool writeLimited(juce::AudioFormatWriter& writer,
+                      int numberOfChannels,
+                      int numSamples,
+                      float linearGain,
+                      const Fetch& fetch);
+
+    DitherSource mDither;
+    bool mDitherEnabled = true;
+
+    // One block per channel. Integer data, or floats for float files: the
+    // writer takes both through the same int pointers.
+    std::vector<std::vector<int>> mBlocks;
+    std::vector<const int*> mPointers;
+    std::vector<const float*> mSources;
+    // Where packed samples are unpacked to
+    std::vector<std::vector<float>> mUnpacked;
+    std::vector<float> mDitherBlock;
+
+    std::optional<TruePeakLimiter::Options> mLimiterOptions;
+    TruePeakLimiter mLimiter;
+    bool mLimiterUsed = false;
+    bool mLimiterOptionsChanged = false;
+    double mLimiterSampleRate = 0;
+    int mLimiterChannels = 0;
+    // Gained float blocks the limiter works on in place
+    std::vector<std::vector<float>> mScratch;
+    std::vector<float*> mScratchPointers;
+};
+
+} // namespace norm
@@ -0,0 +1,90 @@
+#pragma once
+
+/*  Minimal constexpr replacements for the <cmath> functions needed to design
+    filters at compile time. Evaluated in double precision with plain series
+    expansions, which is plenty for the small arguments filter design uses.
+    Not meant for the audio path.
+*/
+
+#include <numbers>
+
+namespace norm::cmath
+{
+
+constexpr double abs(double x)
+{
+    return x < 0.0 ? -x : x;
+}
+
+constexpr double sqrt(double x)
+{
+    if (x <= 0.0) return 0.0;
+
+    double guess = x > 1.0 ? x : 1.0;
+    for (int i = 0; i < 64; i++)
+    {
+        const double next = 0.5 * (guess + x / guess);
+        if (next == guess) break;
+        guess = next;
+    }
+    return guess;
+}
+
+constexpr double exp(double x)
+{
+    // exp(x) = exp(x / 2^k)^(2^k), keeps the series argument below 0.5
+    int halvings = 0;
+    while (abs(x) > 0.5)
+    {
+        x *= 0.5;
+        halvings++;
+    }
+
+    double term = 1.0;
+    double sum = 1.0;
+    for (int n = 1; n < 30; n++)
+    {
+        term *= x / n;
+        sum += term;
+    }
+
+    for (int i = 0; i < halvings; i++)
+    {
+        sum *= sum;
+    }
+    return sum;
+}
+
+// 10^x, the only kind of power filter design needs (decibels)
+constexpr double pow10(double x)
+{
+    return exp(x * std::numbers::ln10);
+}
+
+constexpr double sin(double x)
+{
+    constexpr double twoPi = 2.0 * std::numbers::pi;
+    while (x >  std::numbers::pi) x -= twoPi;
+    while (x < -std::numbers::pi) x += twoPi;
+
+    double term = x;
+    double sum = x;
+    for (int n = 1; n < 20; n++)
+    {
+        term *= -x * x / ((2 * n) * (2 * n + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double cos(double x)
+{
+    return sin(x + std::numbers::pi / 2.0);
+}
+
+constexpr double tan(double x)
+{
+    return sin(x) / cos(x);
+}
+
+} // namespace norm::cmath
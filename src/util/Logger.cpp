@@ -1,5 +1,141 @@
-/*  Should be a singleton class, that handles logging, maybe based on a macro
-    or something. Maybe based on Build type (debug logs somewhere, release does not)
+/*  Singleton that owns the log queue and the background thread writing it out.
+    Producers only ever format and push; the thread drains the queue in bulk
+    and flushes the sink once per batch instead of once per line.
 */
 
-#include "Logger.h"
\ No newline at end of file
+#include "Logger.h"
+#include <chrono>
+#include <iostream>
+
+namespace norm
+{
+    namespace
+    {
+        constexpr size_t QueueCapacity = 4096;
+        constexpr auto IdleWait = std::chrono::milliseconds(2);
+
+        const char* levelToString(Logger::Level level)
+        {
+            switch (level)
+            {
+                case Logger::Level::error:   return "ERROR";
+                case Logger::Level::warning: return "WARNING";
+                case Logger::Level::info:    return "INFO";
+            }
+            return "";
+        }
+    }
+
+    Logger& Logger::getInstance()
+    {
+        static Logger instance;
+        return instance;
+    }
+
+    Logger::Logger()
+        : mQueue(QueueCapacity)
+        , mStartTicks(juce::Time::getHighResolutionTicks())
+        , mStartTimeMs(juce::Time::currentTimeMillis())
+    {
+        mThread = std::thread([this] { run(); });
+    }
+    Logger::~Logger()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mWaitMutex);
+            mShouldExit = true;
+        }
+        mWakeUp.notify_all();
+        mFlushed.notify_all();
+        if (mThread.joinable()) mThread.join();
+    }
+
+    void Logger::push(Message&& message)
+    {
+        message.threadId = std::this_thread::get_id();
+        message.ticks = juce::Time::getHighResolutionTicks();
+
+        if (mQueue.tryPush(std::move(message)))
+        {
+            mPushed.fetch_add(1, std::memory_order_release);
+        }
+        else
+        {
+            mDropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    void Logger::flush()
+    {
+        if (std::this_thread::get_id() == mThread.get_id()) return;
+
+        const auto target = mPushed.load(std::memory_order_acquire);
+
+        std::unique_lock<std::mutex> lock(mWaitMutex);
+        mWakeUp.notify_one();
+        mFlushed.wait(lock, [&]
+        {
+            return mWritten.load(std::memory_order_acquire) >= target || mShouldExit.load();
+        });
+    }
+
+    void Logger::setSink(Sink sink)
+    {
+        std::lock_guard<std::mutex> lock(mSinkMutex);
+        mSink = std::move(sink);
+    }
+    void Logger::resetSink()
+    {
+        setSink(nullptr);
+    }
+
+    void Logger::run()
+    {
+        while (!mShouldExit.load())
+        {
+            if (!drain())
+            {
+                std::unique_lock<std::mutex> lock(mWaitMutex);
+                if (!mShouldExit.load()) mWakeUp.wait_for(lock, IdleWait);
+            }
+        }
+
+        // Whatever made it into the queue before shutdown still gets written
+        drain();
+    }
+    bool Logger::drain()
+    {
+        std::lock_guard<std::mutex> lock(mSinkMutex);
+
+        const double msPerTick = 1000.0 / (double)juce::Time::getHighResolutionTicksPerSecond();
+
+        bool wroteSomething = false;
+        while (auto message = mQueue.tryPop())
+        {
+            message->timeMs = mStartTimeMs
+                            + (juce::int64)((double)(message->ticks - mStartTicks) * msPerTick);
+
+            if (mSink) mSink(*message);
+            else       writeToStandardError(*message);
+
+            mWritten.fetch_add(1, std::memory_order_release);
+            wroteSomething = true;
+        }
+
+        if (wroteSomething)
+        {
+            if (!mSink) std::cerr.flush();
+
+            // Taken so a flush() about to wait cannot miss the notification
+            { std::lock_guard<std::mutex> lock(mWaitMutex); }
+            mFlushed.notify_all();
+        }
+        return wroteSomething;
+    }
+    void Logger::writeToStandardError(const Message& message)
+    {
+        std::cerr << juce::Time(message.timeMs).toISO8601(true)
+                  << " [" << levelToString(message.level) << "]"
+                  << " [" << message.threadId << "] "
+                  << message.getText() << '\n';
+    }
+}
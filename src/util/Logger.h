@@ -1,23 +1,265 @@
 /*  Macro definitions used for logging. The macros should be kept the same
     throughout the lifetime of the project, but the implementation could
     be changed anytime, could even be made configurable by some other defs
+
+    Messages are formatted with std::format syntax ("Sample rate is {}") on the
+    calling thread, straight into a fixed size message, then handed to the
+    Logger singleton through a lock-free queue. A log call allocates nothing
+    and only reads a tick counter for the time; turning that into a date,
+    and writing to the actual sink, happens on a background thread, so a log
+    call never waits on stderr.
+
+    Define NORM_LOG_LEVEL to one of the NORM_LOG_LEVEL_* values to choose which
+    macros are compiled in at all. Debug builds keep everything, release builds
+    drop info messages.
 */
 
 #pragma once
 
 #include <juce_core/juce_core.h>
-#include <iostream>
+#include <util/MPSCQueue.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <version>
+
+#if defined(__cpp_lib_format)
+ #include <format>
+#endif
+
+#define NORM_LOG_LEVEL_NONE    0
+#define NORM_LOG_LEVEL_ERROR   1
+#define NORM_LOG_LEVEL_WARNING 2
+#define NORM_LOG_LEVEL_INFO    3
+
+#ifndef NORM_LOG_LEVEL
+ #if JUCE_DEBUG
+  #define NORM_LOG_LEVEL NORM_LOG_LEVEL_INFO
+ #else
+  #define NORM_LOG_LEVEL NORM_LOG_LEVEL_WARNING
+ #endif
+#endif
+
+namespace norm
+{
+
+class Logger
+{
+public:
+    enum class Level { error = NORM_LOG_LEVEL_ERROR,
+                       warning = NORM_LOG_LEVEL_WARNING,
+                       info = NORM_LOG_LEVEL_INFO };
+
+    struct Message
+    {
+        // Longer messages are cut short
+        static constexpr size_t maxLength = 480;
+
+        Level level = Level::info;
+        std::thread::id threadId;
+        // juce::Time::getHighResolutionTicks() when logged
+        juce::int64 ticks = 0;
+        // Filled in from ticks on the background thread, for the sink
+        juce::int64 timeMs = 0;
+        size_t length = 0;
+        char text[maxLength];
+
+        std::string_view getText() const { return { text, length }; }
+    };
+
+    using Sink = std::function<void(const Message&)>;
+
+public:
+    static Logger& getInstance();
+
+    // Non-blocking. Drops the message (and counts it) if the queue is full.
+    template<typename... Args>
+    void log(Level level, std::string_view fmt, const Args&... args)
+    {
+        Message message;
+        message.level = level;
+        message.length = formatTo(message.text, Message::maxLength, fmt, args...);
+        push(std::move(message));
+    }
+    // Blocks until everything logged before this call reached the sink
+    void flush();
+
+    // Replaces the default stderr sink. Called on the background thread.
+    void setSink(Sink sink);
+    void resetSink();
+    juce::uint64 getNumberOfDroppedMessages() const { return mDropped.load(); }
+
+    // Formats MSG with std::format semantics, falling back to plain "{}"
+    // substitution when the standard library does not provide <format>.
+    template<typename... Args>
+    static std::string format(std::string_view fmt, const Args&... args)
+    {
+       #if defined(__cpp_lib_format)
+        try
+        {
+            return std::vformat(fmt, std::make_format_args(args...));
+        }
+        catch (const std::format_error&)
+        {
+            return std::string(fmt);
+        }
+       #else
+        std::ostringstream stream;
+        size_t position = 0;
+        (appendNextArgument(stream, fmt, position, args), ...);
+        stream << fmt.substr(position);
+        return stream.str();
+       #endif
+    }
+    // The same into dest, up to capacity characters. Returns the length.
+    template<typename... Args>
+    static size_t formatTo(char* dest, size_t capacity, std::string_view fmt, const Args&... args)
+    {
+       #if defined(__cpp_lib_format)
+        size_t length = 0;
+        try
+        {
+            std::vformat_to(BoundedWriter { dest, capacity, &length }, fmt, std::make_format_args(args...));
+            return length;
+        }
+        catch (const std::format_error&)
+        {
+            length = 0;
+            std::copy_n(fmt.begin(), std::min(fmt.size(), capacity), BoundedWriter { dest, capacity, &length });
+            return length;
+        }
+       #else
+        const auto text = format(fmt, args...);
+        const size_t length = std::min(text.size(), capacity);
+        std::copy_n(text.begin(), length, dest);
+        return length;
+       #endif
+    }
+
+    ~Logger();
+
+private:
+    Logger();
+
+    // Writes to a fixed buffer and drops what does not fit
+    struct BoundedWriter
+    {
+        using iterator_category = std::output_iterator_tag;
+        using value_type = void;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = void;
+
+        char* dest;
+        size_t capacity;
+        size_t* length;
+
+        BoundedWriter& operator*() { return *this; }
+        BoundedWriter& operator++() { return *this; }
+        BoundedWriter operator++(int) { return *this; }
+        BoundedWriter& operator=(char c)
+        {
+            if (*length < capacity) dest[(*length)++] = c;
+            return *this;
+        }
+    };
+
+    template<typename Arg>
+    static void appendNextArgument(std::ostringstream& stream,
+                                   std::string_view fmt,
+                                   size_t& position,
+                                   const Arg& arg)
+    {
+        const size_t open = fmt.find('{', position);
+        const size_t close = open == std::string_view::npos
+                           ? std::string_view::npos
+                           : fmt.find('}', open);
+        if (close == std::string_view::npos) return;
+
+        stream << fmt.substr(position, open - position) << arg;
+        position = close + 1;
+    }
+
+    void push(Message&& message);
+    void run();
+    bool drain();
+    static void writeToStandardError(const Message& message);
+
+    MPSCQueue<Message> mQueue;
+    std::atomic<juce::uint64> mDropped { 0 };
+    std::atomic<juce::uint64> mPushed { 0 };
+    std::atomic<juce::uint64> mWritten { 0 };
+    std::atomic<bool> mShouldExit { false };
+
+    // Ticks are made into wall clock times from this pair
+    const juce::int64 mStartTicks;
+    const juce::int64 mStartTimeMs;
+
+    // Wakes the background thread early, and flush() once it has written
+    std::mutex mWaitMutex;
+    std::condition_variable mWakeUp;
+    std::condition_variable mFlushed;
+
+    std::mutex mSinkMutex;
+    Sink mSink;
+
+    std::thread mThread;
+};
+
+// Binds the message to its arguments, so the macros below do not need
+// __VA_OPT__ to deal with an empty argument list.
+struct LogFormat
+{
+    Logger::Level level;
+    std::string_view fmt;
+
+    template<typename... Args>
+    void operator()(const Args&... args) const
+    {
+        Logger::getInstance().log(level, fmt, args...);
+    }
+};
+
+} // namespace norm
 
 #define ENFORCE_SEMICOLON(statement) do { statement } while (0)
 
+#define NORM_LOG_AT(LEVEL, MSG, ...)                                            \
+    norm::LogFormat{LEVEL, MSG}(__VA_ARGS__)
+
+#define NORM_LOG_DISCARD(MSG, ...)                                              \
+    if constexpr (false) { norm::LogFormat{norm::Logger::Level::info, MSG}(__VA_ARGS__); }
+
+#if NORM_LOG_LEVEL >= NORM_LOG_LEVEL_ERROR
 // Should be used when something could directly or indirectly cause a crash
-#define MY_LOG_ERROR(MSG, ...) ENFORCE_SEMICOLON(juce::ignoreUnused(__VA_ARGS__); std::cerr << MSG << std::endl; jasserfalse;)
+ #define MY_LOG_ERROR(MSG, ...) ENFORCE_SEMICOLON(                              \
+    NORM_LOG_AT(norm::Logger::Level::error, MSG, __VA_ARGS__);                  \
+    norm::Logger::getInstance().flush();                                        \
+    jassertfalse;)
+#else
+ #define MY_LOG_ERROR(MSG, ...) ENFORCE_SEMICOLON(NORM_LOG_DISCARD(MSG, __VA_ARGS__) jassertfalse;)
+#endif
 
+#if NORM_LOG_LEVEL >= NORM_LOG_LEVEL_WARNING
 // Should be used when something isn't neccessarily an error, but could indicate that something went wrong
-#define MY_LOG_WARNING(MSG, ...) ENFORCE_SEMICOLON(juce::ignoreUnused(__VA_ARGS__); std::cerr << MSG << std::endl;)
+ #define MY_LOG_WARNING(MSG, ...) ENFORCE_SEMICOLON(NORM_LOG_AT(norm::Logger::Level::warning, MSG, __VA_ARGS__);)
+#else
+ #define MY_LOG_WARNING(MSG, ...) ENFORCE_SEMICOLON(NORM_LOG_DISCARD(MSG, __VA_ARGS__))
+#endif
 
+#if NORM_LOG_LEVEL >= NORM_LOG_LEVEL_INFO
 // Should be used to log info that does not indicate any problems, but might be useful for diagnostics
-#define MY_LOG_INFO(MSG, ...) ENFORCE_SEMICOLON(juce::ignoreUnused(__VA_ARGS__); std::cerr << MSG << std::endl;)
+ #define MY_LOG_INFO(MSG, ...) ENFORCE_SEMICOLON(NORM_LOG_AT(norm::Logger::Level::info, MSG, __VA_ARGS__);)
+#else
+ #define MY_LOG_INFO(MSG, ...) ENFORCE_SEMICOLON(NORM_LOG_DISCARD(MSG, __VA_ARGS__))
+#endif
 
 
 // Expect condition and return if false. Log msg provided in __VA_ARGS__
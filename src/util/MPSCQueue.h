@@ -0,0 +1,107 @@
+#pragma once
+
+/*  Bounded, lock-free multi-producer single-consumer queue. Producers never
+    block: if the queue is full, tryPush fails and the caller decides what to
+    drop. Based on Dmitry Vyukov's bounded queue, where every slot carries a
+    sequence number telling whose turn it is to touch it.
+*/
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+#include <utility>
+
+namespace norm
+{
+
+template<typename T>
+class MPSCQueue
+{
+public:
+    // Capacity is rounded up to the next power of two
+    explicit MPSCQueue(size_t capacity)
+        : mCapacity(roundUpToPowerOfTwo(capacity))
+        , mMask(mCapacity - 1)
+        , mSlots(std::make_unique<Slot[]>(mCapacity))
+    {
+        for (size_t i = 0; i < mCapacity; i++)
+        {
+            mSlots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+    ~MPSCQueue() {}
+
+    // Safe to call from any number of threads
+    bool tryPush(T&& element)
+    {
+        size_t position = mHead.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot& slot = mSlots[position & mMask];
+            const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            const auto diff = (ptrdiff_t)sequence - (ptrdiff_t)position;
+
+            if (diff == 0)
+            {
+                if (mHead.compare_exchange_weak(position, position + 1,
+                                                std::memory_order_relaxed))
+                {
+                    slot.value = std::move(element);
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = mHead.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    // Must only be called from the single consumer thread
+    std::optional<T> tryPop()
+    {
+        Slot& slot = mSlots[mTail & mMask];
+        const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+
+        if ((ptrdiff_t)sequence - (ptrdiff_t)(mTail + 1) < 0) return std::nullopt;
+
+        std::optional<T> element(std::move(slot.value));
+        slot.sequence.store(mTail + mCapacity, std::memory_order_release);
+        mTail++;
+        return element;
+    }
+    size_t getCapacity() const { return mCapacity; }
+
+private:
+    static size_t roundUpToPowerOfTwo(size_t value)
+    {
+        size_t result = 2;
+        while (result < value) result <<= 1;
+        return result;
+    }
+
+    struct Slot
+    {
+        std::atomic<size_t> sequence { 0 };
+        T value {};
+    };
+
+    static constexpr size_t CacheLine = 64;
+
+    const size_t mCapacity;
+    const size_t mMask;
+    std::unique_ptr<Slot[]> mSlots;
+
+    alignas(CacheLine) std::atomic<size_t> mHead { 0 };
+    alignas(CacheLine) size_t mTail = 0;
+};
+
+} // namespace norm
@@ -0,0 +1,158 @@
+/*  The rings are plain vectors with a count: a thread only ever writes its
+    own, the mutex is only taken to hand a ring to a new thread, to give it
+    back, and to export.
+*/
+
+#include "Trace.h"
+#include "Logger.h"
+#include <algorithm>
+#include <chrono>
+
+namespace norm
+{
+    namespace
+    {
+        juce::int64 steadyNanoseconds()
+        {
+            return (juce::int64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        juce::String escape(const char* text)
+        {
+            return juce::String(text).replace("\\", "\\\\").replace("\"", "\\\"");
+        }
+    }
+
+    Tracer& Tracer::getInstance()
+    {
+        static Tracer instance;
+        return instance;
+    }
+
+    Tracer::Tracer()
+        : mOrigin(steadyNanoseconds())
+    {
+    }
+    Tracer::~Tracer() {}
+
+    juce::int64 Tracer::now() const
+    {
+        return steadyNanoseconds() - mOrigin;
+    }
+
+    void Tracer::record(const char* name, juce::int64 start, juce::int64 duration)
+    {
+        auto& buffer = getThreadBuffer();
+        buffer.events[buffer.written % eventsPerThread] = { name, start, duration };
+        buffer.written++;
+    }
+
+    Tracer::ThreadBuffer& Tracer::getThreadBuffer()
+    {
+        // Gives the buffer back when the thread ends
+        struct Holder
+        {
+            ThreadBuffer* buffer = nullptr;
+            ~Holder()
+            {
+                if (buffer != nullptr) Tracer::getInstance().releaseThreadBuffer(buffer);
+            }
+        };
+        thread_local Holder holder;
+
+        if (holder.buffer != nullptr) return *holder.buffer;
+
+        std::lock_guard<std::mutex> lock(mBuffersMutex);
+        for (auto& buffer : mBuffers)
+        {
+            if (!buffer->inUse)
+            {
+                holder.buffer = buffer.get();
+                break;
+            }
+        }
+        if (holder.buffer == nullptr)
+        {
+            mBuffers.push_back(std::make_unique<ThreadBuffer>());
+            mBuffers.back()->events.resize(eventsPerThread);
+            holder.buffer = mBuffers.back().get();
+        }
+        holder.buffer->inUse = true;
+        return *holder.buffer;
+    }
+    void Tracer::releaseThreadBuffer(ThreadBuffer* buffer)
+    {
+        std::lock_guard<std::mutex> lock(mBuffersMutex);
+        buffer->inUse = false;
+    }
+
+    std::vector<std::vector<Tracer::Event>> Tracer::getEvents() const
+    {
+        std::lock_guard<std::mutex> lock(mBuffersMutex);
+
+        std::vector<std::vector<Event>> events;
+        for (const auto& buffer : mBuffers)
+        {
+            const size_t count = std::min(buffer->written, eventsPerThread);
+            const size_t first = buffer->written - count;
+
+            auto& thread = events.emplace_back();
+            thread.reserve(count);
+            for (size_t i = first; i < buffer->written; i++)
+                thread.push_back(buffer->events[i % eventsPerThread]);
+        }
+        return events;
+    }
+
+    bool Tracer::writeChromeTrace(const juce::File& file) const
+    {
+        juce::FileOutputStream stream(file);
+        EXPECT_OR_RETURN (stream.openedOk(),
+                          false,
+                          "Unable to write a trace to {}", file.getFullPathName().toStdString());
+        stream.setPosition(0);
+        stream.truncate();
+
+        // Times are in microseconds, with the nanoseconds as decimals
+        auto toMicroseconds = [](juce::int64 nanoseconds)
+        {
+            return juce::String(nanoseconds / 1000) + "."
+                 + juce::String(nanoseconds % 1000).paddedLeft('0', 3);
+        };
+
+        const auto events = getEvents();
+        stream << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        for (size_t thread = 0; thread < events.size(); thread++)
+        {
+            const juce::String threadId((int)thread + 1);
+
+            stream << (first ? "\n" : ",\n")
+                   << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << threadId
+                   << ",\"args\":{\"name\":\"thread " << threadId << "\"}}";
+            first = false;
+
+            for (const auto& event : events[thread])
+            {
+                stream << ",\n{\"name\":\"" << escape(event.name)
+                       << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << threadId
+                       << ",\"ts\":" << toMicroseconds(event.start)
+                       << ",\"dur\":" << toMicroseconds(event.duration) << "}";
+            }
+        }
+        stream << "\n]}\n";
+        stream.flush();
+
+        EXPECT_OR_RETURN (stream.getStatus().wasOk(),
+                          false,
+                          "Writing the trace to {} failed", file.getFullPathName().toStdString());
+        return true;
+    }
+
+    void Tracer::clear()
+    {
+        std::lock_guard<std::mutex> lock(mBuffersMutex);
+        for (auto& buffer : mBuffers) buffer->written = 0;
+    }
+}
@@ -0,0 +1,133 @@
+/*  Scoped tracing zones for finding out where a batch spends its time, per
+    thread, exported as a Chrome trace that Perfetto (ui.perfetto.dev) or
+    chrome://tracing open.
+
+        NORM_TRACE_SCOPE("FileHandler::openFile");
+
+    records one complete event from that line to the end of the scope. Each
+    thread writes into a ring buffer of its own, so recording takes no lock
+    and allocates nothing after the thread's first event: two clock reads
+    and three stores. When the ring is full the oldest events go.
+
+    The macros are compiled in with NORM_TRACE defined to 1 (the NORM_TRACE
+    CMake option) and expand to nothing otherwise. Compiled in, nothing is
+    recorded until tracing is enabled at runtime, a zone then costs one
+    relaxed load.
+
+    The Tracer itself is always built, so tests and tools can use it
+    directly.
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifndef NORM_TRACE
+ #define NORM_TRACE 0
+#endif
+
+namespace norm
+{
+
+class Tracer
+{
+public:
+    struct Event
+    {
+        // A string literal, only the pointer is kept
+        const char* name = nullptr;
+        // Nanoseconds since the tracer was created
+        juce::int64 start = 0;
+        juce::int64 duration = 0;
+    };
+
+    // Events each thread keeps before overwriting its oldest
+    static constexpr size_t eventsPerThread = 1 << 16;
+
+public:
+    static Tracer& getInstance();
+
+    void setEnabled(bool shouldTrace) { mEnabled.store(shouldTrace, std::memory_order_relaxed); }
+    bool isEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+
+    // Nanoseconds since the tracer was created, on a monotonic clock
+    juce::int64 now() const;
+    // Into the calling thread's ring
+    void record(const char* name, juce::int64 start, juce::int64 duration);
+
+    // Not while traced threads are running, e.g. after a batch: the rings
+    // are read without synchronising with their writers.
+    // Every thread's events, oldest first, indexed like the threads
+    std::vector<std::vector<Event>> getEvents() const;
+    // A JSON object with a "traceEvents" array of complete ("X") events,
+    // one track per thread
+    bool writeChromeTrace(const juce::File& file) const;
+    void clear();
+
+    ~Tracer();
+
+private:
+    Tracer();
+
+    struct ThreadBuffer
+    {
+        std::vector<Event> events;
+        // Total written, the ring position is this modulo its size
+        size_t written = 0;
+        // Only one living thread writes to a buffer. A thread that ends
+        // leaves its buffer, with its events, to the next new thread.
+        bool inUse = false;
+    };
+
+    // Registers the calling thread the first time it records
+    ThreadBuffer& getThreadBuffer();
+    void releaseThreadBuffer(ThreadBuffer* buffer);
+
+    std::atomic<bool> mEnabled { false };
+    const juce::int64 mOrigin;
+
+    mutable std::mutex mBuffersMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> mBuffers;
+};
+
+// A zone, see NORM_TRACE_SCOPE
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name)
+        : mName(name),
+          mStart(Tracer::getInstance().isEnabled() ? Tracer::getInstance().now() : -1)
+    {
+    }
+    ~TraceScope()
+    {
+        if (mStart < 0) return;
+
+        auto& tracer = Tracer::getInstance();
+        tracer.record(mName, mStart, tracer.now() - mStart);
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* mName;
+    const juce::int64 mStart;
+};
+
+} // namespace norm
+
+#define NORM_TRACE_CONCAT_INNER(A, B) A##B
+#define NORM_TRACE_CONCAT(A, B) NORM_TRACE_CONCAT_INNER(A, B)
+
+#if NORM_TRACE
+// Times the rest of the enclosing scope. NAME must be a string literal.
+ #define NORM_TRACE_SCOPE(NAME)                                                 \
+    const norm::TraceScope NORM_TRACE_CONCAT(normTraceScope, __LINE__) (NAME)
+#else
+ #define NORM_TRACE_SCOPE(NAME) do {} while (0)
+#endif
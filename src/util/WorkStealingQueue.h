@@ -0,0 +1,141 @@
+#pragma once
+
+/*  Tasks for a fixed set of workers, each with a queue of its own. A worker
+    takes from its own queue and steals from the others once that is empty,
+    so workers mostly touch their own lock and none sits idle while another
+    has work waiting.
+
+    Every task comes with a cost, e.g. its length in samples. Queues are kept
+    costliest first, and a thief takes the costliest task it can find: the
+    long jobs of a batch start early instead of stretching its end. Within a
+    queue, tasks of equal cost keep the order they were pushed in.
+*/
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace norm
+{
+
+template<typename T>
+class WorkStealingQueue
+{
+public:
+    explicit WorkStealingQueue(int numberOfWorkers)
+        : mNumberOfQueues(numberOfWorkers > 1 ? (size_t)numberOfWorkers : 1)
+        , mQueues(std::make_unique<Queue[]>(mNumberOfQueues))
+    {
+    }
+    WorkStealingQueue(const WorkStealingQueue&) = delete;
+    WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+    ~WorkStealingQueue() {}
+
+    // Onto the queue with the least cost waiting in it. Safe to call from any
+    // number of threads.
+    void push(T&& task, double cost)
+    {
+        // Ties go round, so tasks without a cost are still spread out
+        const size_t first = mNextQueue.fetch_add(1, std::memory_order_relaxed);
+        size_t target = first % mNumberOfQueues;
+        for (size_t i = 1; i < mNumberOfQueues; i++)
+        {
+            const size_t index = (first + i) % mNumberOfQueues;
+            if (mQueues[index].waitingCost.load(std::memory_order_relaxed)
+                < mQueues[target].waitingCost.load(std::memory_order_relaxed))
+            {
+                target = index;
+            }
+        }
+
+        auto& queue = mQueues[target];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            // Counted before it can be taken, the size never drops below 0
+            mSize.fetch_add(1, std::memory_order_release);
+            queue.tasks.emplace(cost, std::move(task));
+            queue.waitingCost.store(queue.waitingCost.load(std::memory_order_relaxed) + cost,
+                                    std::memory_order_relaxed);
+        }
+    }
+    // The worker's own costliest task, or else the costliest one waiting for
+    // another worker. Nothing only if every queue is empty.
+    std::optional<T> tryPop(int worker)
+    {
+        const size_t own = (size_t)worker % mNumberOfQueues;
+        if (auto task = takeFront(mQueues[own])) return task;
+
+        while (mSize.load(std::memory_order_acquire) > 0)
+        {
+            Queue* victim = nullptr;
+            double victimCost = 0;
+            for (size_t i = 1; i < mNumberOfQueues; i++)
+            {
+                auto& queue = mQueues[(own + i) % mNumberOfQueues];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.tasks.empty()) continue;
+
+                const double cost = queue.tasks.begin()->first;
+                if (victim == nullptr || cost > victimCost)
+                {
+                    victim = &queue;
+                    victimCost = cost;
+                }
+            }
+
+            // Another thread may have been quicker, then look again
+            if (victim == nullptr) victim = &mQueues[own];
+            if (auto task = takeFront(*victim)) return task;
+        }
+        return std::nullopt;
+    }
+    // Tasks waiting in all queues together
+    size_t size() const { return mSize.load(std::memory_order_acquire); }
+    bool isEmpty() const { return size() == 0; }
+    void clear()
+    {
+        for (size_t i = 0; i < mNumberOfQueues; i++)
+        {
+            auto& queue = mQueues[i];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            mSize.fetch_sub(queue.tasks.size(), std::memory_order_relaxed);
+            queue.tasks.clear();
+            queue.waitingCost.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        // Costliest first, tasks of equal cost in the order they came
+        std::multimap<double, T, std::greater<double>> tasks;
+        std::atomic<double> waitingCost { 0 };
+    };
+
+    std::optional<T> takeFront(Queue& queue)
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) return std::nullopt;
+
+        const auto front = queue.tasks.begin();
+        std::optional<T> task(std::move(front->second));
+        queue.waitingCost.store(queue.waitingCost.load(std::memory_order_relaxed) - front->first,
+                                std::memory_order_relaxed);
+        queue.tasks.erase(front);
+        mSize.fetch_sub(1, std::memory_order_release);
+        return task;
+    }
+
+    const size_t mNumberOfQueues;
+    std::unique_ptr<Queue[]> mQueues;
+    std::atomic<size_t> mSize { 0 };
+    std::atomic<size_t> mNextQueue { 0 };
+};
+
+} // namespace norm
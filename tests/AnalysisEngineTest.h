@@ -0,0 +1,153 @@
+/*  Tests for the analysis engine: the full read - analyse loop must agree with
+    the reference values, a preview of a steady signal must agree with the
+    full analysis, and that of a changing signal must come within its error
+    estimate.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/AnalysisEngine.h>
+#include <processor/FilterProcessor.h>
+#include <cmath>
+
+class AnalysisEngineTest : public testing::Test
+{
+protected:
+    norm::AnalysisEngine mEngine;
+    const float eps = 0.05f;
+
+    juce::File getTestFile(juce::String fileName)
+    {
+        juce::File file = juce::File(TEST_AUDIO_DIR).getChildFile(fileName);
+        EXPECT_TRUE(file.existsAsFile());
+        return file;
+    }
+};
+
+//==============================================================================
+
+TEST_F(AnalysisEngineTest, FullAnalysis)
+{
+    const auto result = mEngine.analyse(getTestFile("HomeMade_997Hz_20LKFS.wav"));
+    const float target = -20.f + 20.f * log10(sqrt(2.f));
+
+    ASSERT_TRUE(result.ok);
+    EXPECT_FALSE(result.isPreview);
+    EXPECT_NEAR(result.integratedLoudness, target, eps);
+    EXPECT_FLOAT_EQ(result.errorEstimate, 0.f);
+}
+
+TEST_F(AnalysisEngineTest, RangesMergeIntoFullAnalysis)
+{
+    const auto file = getTestFile("1770-2_Comp_RelGateTest.wav");
+    const auto full = mEngine.analyse(file);
+    ASSERT_TRUE(full.ok);
+
+    const juce::int64 blocksInFile = mEngine.getFileHandler().getNumberOfBlocks();
+    const juce::int64 rangeLength = blocksInFile / 3;
+    ASSERT_GE(rangeLength, 4);
+
+    norm::GatingHistogram merged;
+    float peak = 0;
+    for (juce::int64 first = 0; first < blocksInFile; first += rangeLength)
+    {
+        const auto range = mEngine.analyseBlocks(file, first,
+                                                 juce::jmin(rangeLength, blocksInFile - first));
+        ASSERT_TRUE(range.ok);
+        merged.merge(range.histogram);
+        peak = juce::jmax(peak, range.samplePeak);
+    }
+
+    EXPECT_EQ(merged.getNumberOfBlocks(), full.histogram.getNumberOfBlocks());
+    EXPECT_NEAR(merged.getIntegratedLoudness(), full.histogram.getIntegratedLoudness(), 0.001f);
+    EXPECT_FLOAT_EQ(peak, full.samplePeak);
+}
+
+TEST_F(AnalysisEngineTest, PreviewOfSteadySignal)
+{
+    const auto file = getTestFile("HomeMade_997Hz_20LKFS.wav");
+    const auto full = mEngine.analyse(file);
+
+    norm::AnalysisEngine::PreviewOptions options;
+    options.strideSeconds = 1.0;
+    const auto preview = mEngine.preview(file, options);
+
+    ASSERT_TRUE(preview.ok);
+    EXPECT_TRUE(preview.isPreview);
+    EXPECT_LT(preview.blocksRead, full.blocksRead);
+    EXPECT_NEAR(preview.integratedLoudness, full.integratedLoudness, eps);
+    EXPECT_LT(preview.errorEstimate, eps);
+}
+
+TEST_F(AnalysisEngineTest, PreviewOfChangingSignal)
+{
+    // 2 minutes of a 997Hz sine, 3.7s sections alternating 10 dB apart, so
+    // the probes land in both and in the steps between them
+    const double sampleRate = 48000;
+    const int numSamples = (int)sampleRate * 120;
+    const int samplesPerSection = (int)(sampleRate * 3.7);
+
+    juce::AudioBuffer<float> buffer(1, numSamples);
+    for (int i = 0; i < numSamples; i++)
+    {
+        const float amplitude = (i / samplesPerSection) % 2 == 0 ? 0.5f : 0.5f / std::sqrt(10.f);
+        buffer.setSample(0, i, amplitude * std::sin(2.f * norm::defines::pi * 997.f * (float)i / (float)sampleRate));
+    }
+
+    juce::TemporaryFile file(".wav");
+    {
+        juce::WavAudioFormat format;
+        std::unique_ptr<juce::OutputStream> stream = file.getFile().createOutputStream();
+        std::unique_ptr<juce::AudioFormatWriter> writer(
+            format.createWriterFor(stream.get(), sampleRate, 1, 24, {}, 0));
+        ASSERT_NE(writer, nullptr);
+
+        // Owned by the writer now
+        stream.release();
+        writer->writeFromAudioSampleBuffer(buffer, 0, numSamples);
+    }
+
+    const auto full = mEngine.analyse(file.getFile());
+    ASSERT_TRUE(full.ok);
+
+    norm::AnalysisEngine::PreviewOptions options;
+    options.strideSeconds = 2.0;
+    const auto preview = mEngine.preview(file.getFile(), options);
+
+    ASSERT_TRUE(preview.ok);
+    EXPECT_LT(preview.blocksRead, full.blocksRead / 2);
+    EXPECT_GT(preview.errorEstimate, eps);
+    EXPECT_TRUE(std::isfinite(preview.errorEstimate));
+    EXPECT_LE(std::fabs(preview.integratedLoudness - full.integratedLoudness),
+              preview.errorEstimate);
+
+    // Within the estimate of the target the preview cannot decide, well
+    // outside it it can
+    EXPECT_TRUE(norm::AnalysisEngine::needsFullAnalysis(preview, full.integratedLoudness, 0.1f));
+    EXPECT_TRUE(norm::AnalysisEngine::needsFullAnalysis(
+        preview, preview.integratedLoudness - 0.9f * preview.errorEstimate, 0.f));
+    EXPECT_FALSE(norm::AnalysisEngine::needsFullAnalysis(
+        preview, preview.integratedLoudness - preview.errorEstimate - 1.f, 0.1f));
+}
+
+TEST_F(AnalysisEngineTest, MissingFile)
+{
+    const auto result = mEngine.analyse(juce::File(TEST_AUDIO_DIR).getChildFile("nope.wav"));
+    EXPECT_FALSE(result.ok);
+}
+
+TEST_F(AnalysisEngineTest, NeedsFullAnalysis)
+{
+    norm::AnalysisEngine::Result preview;
+    preview.ok = true;
+    preview.isPreview = true;
+    preview.integratedLoudness = -20.f;
+    preview.errorEstimate = 0.5f;
+
+    EXPECT_TRUE(norm::AnalysisEngine::needsFullAnalysis(preview, -20.8f, 0.5f));
+    EXPECT_FALSE(norm::AnalysisEngine::needsFullAnalysis(preview, -23.f, 0.5f));
+
+    preview.ok = false;
+    EXPECT_TRUE(norm::AnalysisEngine::needsFullAnalysis(preview, -23.f, 0.5f));
+}
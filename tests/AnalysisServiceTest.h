@@ -0,0 +1,197 @@
+/*  Tests for the analysis service: the protocol round trips, a client gets
+    the same loudness through the socket, for files and for samples in
+    shared memory, as from an engine of its own, and a client that does not
+    read its responses is held up instead of queueing without end.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/AnalysisService.h>
+#include <cstring>
+
+#if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+ #include <sys/socket.h>
+ #include <sys/time.h>
+ #include <sys/un.h>
+ #include <unistd.h>
+#endif
+
+class AnalysisServiceTest : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        if (!norm::AnalysisService::isAvailable()) GTEST_SKIP() << "No Unix domain sockets";
+
+        mDirectory = juce::File::createTempFile("service");
+        ASSERT_TRUE(mDirectory.createDirectory());
+        mSocket = mDirectory.getChildFile("analysis.sock");
+    }
+    void TearDown() override
+    {
+        mDirectory.deleteRecursively();
+    }
+
+    static juce::File getTestFile()
+    {
+        return juce::File(TEST_AUDIO_DIR).getChildFile("HomeMade_997Hz_20LKFS.wav");
+    }
+
+    juce::File mDirectory;
+    juce::File mSocket;
+};
+
+//==============================================================================
+
+TEST_F(AnalysisServiceTest, ProtocolRoundTrips)
+{
+    norm::service::Request request;
+    request.id = 42;
+    request.kind = norm::service::Kind::analyseSamples;
+    request.file = getTestFile();
+    request.format.sampleRate = 44100;
+    request.format.numberOfChannels = 6;
+    request.format.sampleFormat = norm::PcmStreamReader::SampleFormat::float32;
+    request.offset = 4096;
+    request.size = 1 << 20;
+
+    const auto requests = norm::service::decodeRequests(norm::service::encode({ request, request }));
+    ASSERT_TRUE(requests.has_value());
+    ASSERT_EQ(requests->size(), 2u);
+    EXPECT_EQ((*requests)[1].id, 42);
+    EXPECT_EQ((*requests)[1].kind, norm::service::Kind::analyseSamples);
+    EXPECT_EQ((*requests)[1].file, getTestFile());
+    EXPECT_EQ((*requests)[1].format.numberOfChannels, 6);
+    EXPECT_EQ((*requests)[1].size, 1 << 20);
+
+    // Cut short, or a relative path
+    auto message = norm::service::encode({ request });
+    message.setSize(message.getSize() - 3);
+    EXPECT_FALSE(norm::service::decodeRequests(message).has_value());
+    request.file = juce::File();
+    EXPECT_FALSE(norm::service::decodeRequests(norm::service::encode({ request })).has_value());
+
+    norm::service::Response response;
+    response.id = 7;
+    response.ok = true;
+    response.status = norm::FileStatus::verified;
+    response.loudness = -23.5f;
+    const auto decoded = norm::service::decodeResponse(norm::service::encode(response));
+    ASSERT_TRUE(decoded.has_value());
+    EXPECT_EQ(decoded->id, 7);
+    EXPECT_EQ(decoded->status, norm::FileStatus::verified);
+    EXPECT_FLOAT_EQ(decoded->loudness, -23.5f);
+}
+
+TEST_F(AnalysisServiceTest, AnswersFilesAndSharedSamples)
+{
+    norm::AnalysisEngine engine;
+    const auto expected = engine.analyse(getTestFile());
+    ASSERT_TRUE(expected.ok);
+
+    // The test file's samples behind a page and a half of something else
+    juce::MemoryBlock wav;
+    ASSERT_TRUE(getTestFile().loadFileAsData(wav));
+    const juce::int64 offset = 6144;
+    const auto samples = mDirectory.getChildFile("samples.pcm");
+    {
+        juce::MemoryOutputStream stream;
+        stream << juce::MemoryBlock((size_t)offset, true);
+        stream.write(static_cast<const char*>(wav.getData()) + 44, wav.getSize() - 44);
+        ASSERT_TRUE(samples.replaceWithData(stream.getData(), stream.getDataSize()));
+    }
+
+    norm::AnalysisService::Options options;
+    options.numberOfWorkers = 2;
+    norm::AnalysisService service(options);
+    ASSERT_TRUE(service.start(mSocket));
+
+    norm::AnalysisClient client;
+    ASSERT_TRUE(client.connect(mSocket));
+
+    std::vector<norm::service::Request> requests(3);
+    requests[0].file = getTestFile();
+    requests[1].kind = norm::service::Kind::analyseSamples;
+    requests[1].file = samples;
+    requests[1].format = { 48000, 2, norm::PcmStreamReader::SampleFormat::int16 };
+    requests[1].offset = offset;
+    requests[1].size = (juce::int64)wav.getSize() - 44;
+    requests[2].file = mDirectory.getChildFile("missing.wav");
+
+    const auto responses = client.submit(requests);
+    ASSERT_TRUE(responses.has_value());
+    ASSERT_EQ(responses->size(), 3u);
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        EXPECT_TRUE((*responses)[i].ok) << i;
+        EXPECT_FLOAT_EQ((*responses)[i].loudness, expected.integratedLoudness) << i;
+        EXPECT_FLOAT_EQ((*responses)[i].samplePeak, expected.samplePeak) << i;
+    }
+    EXPECT_FALSE((*responses)[2].ok);
+    EXPECT_EQ((*responses)[2].status, norm::FileStatus::failed);
+
+    // The connection stays up for the next batch, and a second client
+    norm::AnalysisClient other;
+    ASSERT_TRUE(other.connect(mSocket));
+    EXPECT_TRUE(other.submit({ requests[1] }).has_value());
+    EXPECT_TRUE(client.submit({ requests[0] }).has_value());
+
+    service.stop();
+    EXPECT_FALSE(mSocket.exists());
+}
+
+#if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+TEST_F(AnalysisServiceTest, ClientThatDoesNotReadIsHeldUp)
+{
+    norm::AnalysisService::Options options;
+    options.numberOfWorkers = 1;
+    options.maxOutstandingRequests = 16;
+    options.sendTimeoutMs = 200;
+    norm::AnalysisService service(options);
+    ASSERT_TRUE(service.start(mSocket));
+
+    // Sends batch after batch and never reads
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_GE(fd, 0);
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, mSocket.getFullPathName().toRawUTF8());
+    ASSERT_EQ(::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)), 0);
+    const timeval timeout { 0, 500 * 1000 };
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::vector<norm::service::Request> batch((size_t)norm::service::maxRequestsPerBatch);
+    for (auto& request : batch) request.file = mDirectory.getChildFile("missing.wav");
+    juce::MemoryOutputStream frame;
+    const auto body = norm::service::encode(batch);
+    frame.writeInt((int)body.getSize());
+    frame << body;
+
+   #ifdef MSG_NOSIGNAL
+    constexpr int flags = MSG_NOSIGNAL;
+   #else
+    constexpr int flags = 0;
+    const int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+   #endif
+
+    // The service stops reading, so the socket fills up and a send times
+    // out, or fails once the service has dropped the connection
+    bool heldUp = false;
+    for (int sent = 0; sent < 1000 && !heldUp; sent++)
+        heldUp = ::send(fd, frame.getData(), frame.getDataSize(), flags) != (ssize_t)frame.getDataSize();
+    EXPECT_TRUE(heldUp);
+
+    // Other clients are still served
+    norm::AnalysisClient client;
+    ASSERT_TRUE(client.connect(mSocket));
+    const auto responses = client.submit({ batch[0] });
+    ASSERT_TRUE(responses.has_value());
+    EXPECT_EQ((*responses)[0].status, norm::FileStatus::failed);
+
+    service.stop();
+    ::close(fd);
+}
+#endif
@@ -0,0 +1,214 @@
+/*  Tests for the batch engine in threaded mode and its resume journal. Process
+    isolation needs the application executable and is not covered here.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/BatchEngine.h>
+
+class BatchEngineTest : public testing::Test
+{
+protected:
+    juce::TemporaryFile mJournalFile { ".journal" };
+    juce::TemporaryFile mNotAudio { ".wav" };
+
+    juce::Array<juce::File> getFiles()
+    {
+        const juce::File dir(TEST_AUDIO_DIR);
+        mNotAudio.getFile().replaceWithText("definitely not a RIFF header");
+
+        return { dir.getChildFile("HomeMade_997Hz_20LKFS.wav"),
+                 dir.getChildFile("1770-2_Comp_AbsGateTest.wav"),
+                 dir.getChildFile("1770-2_Comp_RelGateTest.wav"),
+                 mNotAudio.getFile() };
+    }
+
+    norm::BatchEngine::Options getOptions()
+    {
+        norm::BatchEngine::Options options;
+        options.mode = norm::BatchEngine::Mode::analyse;
+        options.numberOfWorkers = 3;
+        options.journalFile = mJournalFile.getFile();
+        return options;
+    }
+};
+
+//==============================================================================
+
+TEST_F(BatchEngineTest, AnalysesEveryFile)
+{
+    norm::BatchEngine engine(getOptions());
+    const auto results = engine.run(getFiles());
+
+    ASSERT_EQ(results.size(), 4u);
+    for (const auto& result : results)
+    {
+        const bool shouldFail = result.file == mNotAudio.getFile();
+        EXPECT_EQ(result.status, shouldFail ? norm::FileStatus::failed
+                                            : norm::FileStatus::analysed);
+    }
+}
+
+TEST_F(BatchEngineTest, ResumesFromJournal)
+{
+    {
+        norm::BatchEngine engine(getOptions());
+        engine.run(getFiles());
+    }
+
+    norm::BatchEngine engine(getOptions());
+    EXPECT_TRUE(engine.run(getFiles()).empty());
+
+    norm::BatchJournal journal;
+    ASSERT_TRUE(journal.open(mJournalFile.getFile()));
+    const auto entry = journal.find(getFiles()[0]);
+    ASSERT_TRUE(entry.has_value());
+    EXPECT_EQ(entry->status, norm::FileStatus::analysed);
+    EXPECT_NEAR(entry->loudness, -20.f + 20.f * log10(sqrt(2.f)), 0.05f);
+}
+
+TEST_F(BatchEngineTest, SplitFilesMatchWholeFiles)
+{
+    auto options = getOptions();
+    options.journalFile = juce::File();
+    options.segmentSeconds = 0;
+    const auto whole = norm::BatchEngine(options).run(getFiles());
+
+    // Every test file is several seconds long
+    options.segmentSeconds = 1.0;
+    const auto split = norm::BatchEngine(options).run(getFiles());
+
+    ASSERT_EQ(split.size(), whole.size());
+    for (const auto& result : split)
+    {
+        const auto expected = std::find_if(whole.begin(), whole.end(),
+                                           [&](const auto& w) { return w.file == result.file; });
+        ASSERT_NE(expected, whole.end());
+        EXPECT_EQ(result.status, expected->status);
+        // Merged histograms gate to within a fraction of a bin
+        EXPECT_NEAR(result.loudness, expected->loudness, 0.05f);
+        EXPECT_EQ(result.histogram.getNumberOfBlocks(), expected->histogram.getNumberOfBlocks());
+    }
+}
+
+TEST_F(BatchEngineTest, AnalysedIsNotCompleteForNormalise)
+{
+    using norm::BatchEngine;
+    using norm::FileStatus;
+
+    EXPECT_TRUE(BatchEngine::isComplete(FileStatus::analysed, BatchEngine::Mode::analyse));
+    EXPECT_FALSE(BatchEngine::isComplete(FileStatus::analysed, BatchEngine::Mode::normalise));
+    EXPECT_TRUE(BatchEngine::isComplete(FileStatus::verified, BatchEngine::Mode::normalise));
+    EXPECT_TRUE(BatchEngine::isComplete(FileStatus::quarantined, BatchEngine::Mode::normalise));
+}
+
+TEST_F(BatchEngineTest, RecognisesFileWrittenBeforeCrash)
+{
+    // As if a previous run planned -6dB from -14, wrote the file and died
+    // before journaling it: the file measures at the planned -20 now
+    juce::TemporaryFile copy(".wav");
+    ASSERT_TRUE(juce::File(TEST_AUDIO_DIR).getChildFile("HomeMade_997Hz_20LKFS.wav")
+                    .copyFileTo(copy.getFile()));
+
+    norm::AnalysisEngine analysis;
+    const float measured = analysis.analyse(copy.getFile()).integratedLoudness;
+    const norm::BatchJournal::Entry previous { norm::FileStatus::analysed,
+                                               measured + 6.f,
+                                               -6.f };
+
+    norm::BatchEngine::Options options;
+    options.mode = norm::BatchEngine::Mode::normalise;
+    options.targetLoudness = -23.f;
+
+    std::vector<norm::FileStatus> states;
+    const auto result = norm::BatchEngine::processFile(
+        analysis,
+        copy.getFile(),
+        options,
+        previous,
+        std::nullopt,
+        [&](const norm::BatchEngine::FileResult& state) { states.push_back(state.status); });
+
+    EXPECT_EQ(result.status, norm::FileStatus::verified);
+    EXPECT_FLOAT_EQ(result.gain, -6.f);
+    ASSERT_EQ(states.size(), 1u);
+    EXPECT_EQ(states[0], norm::FileStatus::written);
+    // No gain was applied a second time
+    EXPECT_NEAR(analysis.analyse(copy.getFile()).integratedLoudness, measured, 0.01f);
+}
+
+TEST_F(BatchEngineTest, JournalIgnoresTornLines)
+{
+    mJournalFile.getFile().replaceWithText(
+        "analysed\t-14\t-9\t/some/file.wav\n"
+        "verified\t-14\t-9\t/some/file.wav\n"
+        "quarantined\t0\t0\t/some/crash.wav\n"
+        "writ");
+
+    {
+        norm::BatchJournal journal;
+        ASSERT_TRUE(journal.open(mJournalFile.getFile()));
+        EXPECT_EQ(journal.find(juce::File("/some/file.wav"))->status,
+                  norm::FileStatus::verified);
+        EXPECT_EQ(journal.find(juce::File("/some/crash.wav"))->status,
+                  norm::FileStatus::quarantined);
+        EXPECT_FALSE(journal.find(juce::File("/some/other.wav")).has_value());
+
+        journal.record(juce::File("/some/other.wav"),
+                       { norm::FileStatus::analysed, -20.f, -3.f });
+        journal.commit();
+    }
+
+    // The record after the torn line must not have been glued to it
+    norm::BatchJournal journal;
+    ASSERT_TRUE(journal.open(mJournalFile.getFile()));
+    const auto entry = journal.find(juce::File("/some/other.wav"));
+    ASSERT_TRUE(entry.has_value());
+    EXPECT_EQ(entry->status, norm::FileStatus::analysed);
+    EXPECT_FLOAT_EQ(entry->gain, -3.f);
+}
+
+TEST_F(BatchEngineTest, AlbumKeepsRelativeLevels)
+{
+    // Two tracks of different loudness in one directory
+    const auto album = juce::File::createTempFile("album");
+    ASSERT_TRUE(album.createDirectory());
+    const juce::File dir(TEST_AUDIO_DIR);
+    const juce::Array<juce::File> tracks { album.getChildFile("a.wav"), album.getChildFile("b.wav") };
+    ASSERT_TRUE(dir.getChildFile("HomeMade_997Hz_20LKFS.wav").copyFileTo(tracks[0]));
+    ASSERT_TRUE(dir.getChildFile("1770-2_Comp_RelGateTest.wav").copyFileTo(tracks[1]));
+
+    norm::AnalysisEngine analysis;
+    const float a = analysis.analyse(tracks[0]).integratedLoudness;
+    const float b = analysis.analyse(tracks[1]).integratedLoudness;
+
+    auto options = getOptions();
+    options.mode = norm::BatchEngine::Mode::normalise;
+    options.gainMode = norm::BatchEngine::GainMode::album;
+    options.journalFile = juce::File();
+
+    {
+        norm::BatchEngine engine(options);
+        const auto results = engine.run(tracks);
+        ASSERT_EQ(results.size(), 2u);
+        EXPECT_EQ(results[0].status, norm::FileStatus::verified);
+        EXPECT_EQ(results[1].status, norm::FileStatus::verified);
+        EXPECT_FLOAT_EQ(results[0].gain, results[1].gain);
+    }
+
+    const float aAfter = analysis.analyse(tracks[0]).integratedLoudness;
+    const float bAfter = analysis.analyse(tracks[1]).integratedLoudness;
+    EXPECT_NEAR(aAfter - bAfter, a - b, 0.05f);
+
+    // Running again finds both tagged at the album gain and leaves them alone
+    {
+        norm::BatchEngine engine(options);
+        const auto results = engine.run(tracks);
+        ASSERT_EQ(results.size(), 2u);
+        EXPECT_NEAR(results[0].gain, results[1].gain, 0.01f);
+    }
+    EXPECT_NEAR(analysis.analyse(tracks[0]).integratedLoudness, aAfter, 0.01f);
+
+    album.deleteRecursively();
+}
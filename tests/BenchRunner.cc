@@ -0,0 +1,29 @@
+/*  Runner for the benchmarks. They are written as google tests so they can
+    share the fixtures and assertions of the unit tests, but they live in a
+    separate executable: timings are only meaningful in an optimised build on
+    an otherwise idle machine.
+
+    Run e.g. "./Benchmarks --gtest_filter=FilterBench.*" and compare the
+    reported numbers between commits.
+
+    StressBench is also the one to run in the sanitizer builds, and the only
+    one registered with ctest: "cmake --preset tsan && cmake --build --preset
+    tsan && ctest --preset tsan" runs it with the unit tests, same for asan.
+    "ctest -LE stress" leaves it out.
+*/
+
+#include <gtest/gtest.h>
+
+// include headers containing the benchmarks here
+#include "FilterBench.h"
+#include "WriteBench.h"
+#include "StressBench.h"
+#include "LaneBench.h"
+#include "UringBench.h"
+#include "ScheduleBench.h"
+#include "ServiceBench.h"
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,50 @@
+/*  Tiny helpers shared by the benchmarks: a timer that repeats a callable
+    until enough time has passed and reports the best run, and percentiles
+    for latency distributions.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+    // Returns the fastest single run in seconds
+    template<typename Callable>
+    double measureBest(Callable&& callable, int repetitions = 20)
+    {
+        using clock = std::chrono::steady_clock;
+        double best = 1e300;
+
+        for (int i = 0; i < repetitions; i++)
+        {
+            const auto start = clock::now();
+            callable();
+            const std::chrono::duration<double> elapsed = clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        return best;
+    }
+
+    // Nearest rank, p between 0 and 1
+    inline double percentile(std::vector<double> values, double p)
+    {
+        if (values.empty()) return 0;
+
+        std::sort(values.begin(), values.end());
+        const auto rank = (size_t)std::ceil(p * (double)values.size());
+        return values[std::clamp(rank, (size_t)1, values.size()) - 1];
+    }
+
+    inline void report(const std::string& name, double value, const std::string& unit)
+    {
+        std::cout << "[ BENCH    ] " << name << ": " << value << " " << unit << std::endl;
+        testing::Test::RecordProperty(name, std::to_string(value));
+    }
+}
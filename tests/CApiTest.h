@@ -0,0 +1,157 @@
+/*  Tests for the C interface: samples pushed in any layout, format and piece
+    size measure what AnalysisEngine measures for the same file, the meters
+    follow a level change, and bad arguments are refused rather than thrown.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <api/Normalize.h>
+#include <processor/AnalysisEngine.h>
+#include <processor/FilterProcessor.h>
+#include <cmath>
+#include <limits>
+
+class CApiTest : public testing::Test
+{
+protected:
+    void TearDown() override
+    {
+        norm_analyzer_destroy(mAnalyzer);
+    }
+
+    static juce::File getTestFile()
+    {
+        return juce::File(TEST_AUDIO_DIR).getChildFile("HomeMade_997Hz_20LKFS.wav");
+    }
+
+    // The interleaved 16 bit stereo samples after the 44 byte header
+    static std::vector<int16_t> loadTestSamples()
+    {
+        juce::MemoryBlock wav;
+        EXPECT_TRUE(getTestFile().loadFileAsData(wav));
+        std::vector<int16_t> samples((wav.getSize() - 44) / sizeof(int16_t));
+        std::memcpy(samples.data(), static_cast<const char*>(wav.getData()) + 44, samples.size() * sizeof(int16_t));
+        return samples;
+    }
+
+    // Pieces of changing sizes, so blocks end anywhere within them
+    template <typename PushPiece>
+    static void pushInPieces(size_t frames, PushPiece&& pushPiece)
+    {
+        size_t piece = 1234;
+        for (size_t position = 0; position < frames; position += piece)
+        {
+            piece = piece * 7 % 5000 + 1;
+            ASSERT_EQ(pushPiece(position, std::min(piece, frames - position)), NORM_OK);
+        }
+    }
+
+    static double query(norm_analyzer* analyzer, int (*get)(const norm_analyzer*, double*))
+    {
+        double value = 0;
+        EXPECT_EQ(get(analyzer, &value), NORM_OK);
+        return value;
+    }
+
+    norm_analyzer* mAnalyzer = nullptr;
+};
+
+//==============================================================================
+
+TEST_F(CApiTest, MatchesEngineInEveryLayout)
+{
+    norm::AnalysisEngine engine;
+    const auto expected = engine.analyse(getTestFile());
+    ASSERT_TRUE(expected.ok);
+
+    const auto interleaved = loadTestSamples();
+    const size_t frames = interleaved.size() / 2;
+
+    std::vector<float> left(frames), right(frames);
+    for (size_t s = 0; s < frames; s++)
+    {
+        left[s] = (float)interleaved[2 * s] / 32768.f;
+        right[s] = (float)interleaved[2 * s + 1] / 32768.f;
+    }
+
+    mAnalyzer = norm_analyzer_create(48000, 2);
+    ASSERT_NE(mAnalyzer, nullptr);
+
+    pushInPieces(frames, [&](size_t position, size_t n)
+    {
+        return norm_analyzer_push_interleaved(mAnalyzer, interleaved.data() + 2 * position, NORM_SAMPLE_INT16, n);
+    });
+    const double integrated = query(mAnalyzer, norm_analyzer_get_integrated);
+    EXPECT_NEAR(integrated, expected.integratedLoudness, 0.001);
+    EXPECT_FLOAT_EQ((float)query(mAnalyzer, norm_analyzer_get_sample_peak), expected.samplePeak);
+
+    // The same samples as planar float, read in place
+    ASSERT_EQ(norm_analyzer_reset(mAnalyzer), NORM_OK);
+    pushInPieces(frames, [&](size_t position, size_t n)
+    {
+        const void* channels[] = { left.data() + position, right.data() + position };
+        return norm_analyzer_push_planar(mAnalyzer, channels, NORM_SAMPLE_FLOAT32, n);
+    });
+    EXPECT_NEAR(query(mAnalyzer, norm_analyzer_get_integrated), integrated, 0.001);
+    EXPECT_FLOAT_EQ((float)query(mAnalyzer, norm_analyzer_get_sample_peak), expected.samplePeak);
+
+    // A steady tone: every meter reads the same and the range is nothing
+    EXPECT_NEAR(query(mAnalyzer, norm_analyzer_get_momentary), integrated, 0.01);
+    EXPECT_NEAR(query(mAnalyzer, norm_analyzer_get_short_term), integrated, 0.01);
+    EXPECT_NEAR(query(mAnalyzer, norm_analyzer_get_loudness_range), 0.0, 0.01);
+}
+
+TEST_F(CApiTest, MetersFollowALevelChange)
+{
+    // 20s of a 997Hz sine, then 20s of it 10 dB lower
+    const double sampleRate = 48000;
+    std::vector<float> samples((size_t)sampleRate * 40);
+    for (size_t s = 0; s < samples.size(); s++)
+    {
+        const float amplitude = s < samples.size() / 2 ? 0.5f : 0.5f / std::sqrt(10.f);
+        samples[s] = amplitude * std::sin(2.f * norm::defines::pi * 997.f * (float)s / (float)sampleRate);
+    }
+
+    mAnalyzer = norm_analyzer_create(sampleRate, 1);
+    ASSERT_NE(mAnalyzer, nullptr);
+    EXPECT_EQ(query(mAnalyzer, norm_analyzer_get_momentary), -std::numeric_limits<double>::infinity());
+    EXPECT_EQ(query(mAnalyzer, norm_analyzer_get_integrated), -std::numeric_limits<double>::infinity());
+
+    // The first half, then the meters again after the second
+    const void* channel[] = { samples.data() };
+    ASSERT_EQ(norm_analyzer_push_planar(mAnalyzer, channel, NORM_SAMPLE_FLOAT32, samples.size() / 2), NORM_OK);
+    const double loud = query(mAnalyzer, norm_analyzer_get_short_term);
+    EXPECT_NEAR(query(mAnalyzer, norm_analyzer_get_integrated), loud, 0.01);
+
+    channel[0] = samples.data() + samples.size() / 2;
+    ASSERT_EQ(norm_analyzer_push_planar(mAnalyzer, channel, NORM_SAMPLE_FLOAT32, samples.size() / 2), NORM_OK);
+    EXPECT_NEAR(query(mAnalyzer, norm_analyzer_get_momentary), loud - 10.0, 0.01);
+    EXPECT_NEAR(query(mAnalyzer, norm_analyzer_get_short_term), loud - 10.0, 0.01);
+    EXPECT_NEAR(query(mAnalyzer, norm_analyzer_get_loudness_range), 10.0, 0.05);
+    EXPECT_NEAR(query(mAnalyzer, norm_analyzer_get_sample_peak), 0.5, 0.001);
+}
+
+TEST_F(CApiTest, BadArgumentsAreRefused)
+{
+    EXPECT_EQ(norm_get_api_version(), NORM_API_VERSION);
+
+    EXPECT_EQ(norm_analyzer_create(0, 2), nullptr);
+    EXPECT_EQ(norm_analyzer_create(48000, 0), nullptr);
+    EXPECT_EQ(norm_analyzer_create(48000, 1000), nullptr);
+    norm_analyzer_destroy(nullptr);
+
+    mAnalyzer = norm_analyzer_create(44100, 2);
+    ASSERT_NE(mAnalyzer, nullptr);
+
+    const float samples[2] = {};
+    const void* oneChannel[] = { samples, nullptr };
+    double value = 0;
+    EXPECT_EQ(norm_analyzer_push_planar(mAnalyzer, nullptr, NORM_SAMPLE_FLOAT32, 1), NORM_ERROR_INVALID_ARGUMENT);
+    EXPECT_EQ(norm_analyzer_push_planar(mAnalyzer, oneChannel, NORM_SAMPLE_FLOAT32, 1), NORM_ERROR_INVALID_ARGUMENT);
+    EXPECT_EQ(norm_analyzer_push_interleaved(mAnalyzer, samples, (norm_sample_format)7, 1), NORM_ERROR_INVALID_ARGUMENT);
+    EXPECT_EQ(norm_analyzer_push_interleaved(mAnalyzer, nullptr, NORM_SAMPLE_FLOAT32, 0), NORM_OK);
+    EXPECT_EQ(norm_analyzer_get_integrated(mAnalyzer, nullptr), NORM_ERROR_INVALID_ARGUMENT);
+    EXPECT_EQ(norm_analyzer_get_integrated(nullptr, &value), NORM_ERROR_INVALID_ARGUMENT);
+    EXPECT_EQ(norm_analyzer_reset(nullptr), NORM_ERROR_INVALID_ARGUMENT);
+}
@@ -0,0 +1,142 @@
+/*  Tests for the parallel directory scanner and its incremental snapshots,
+    on a small tree built in a temporary folder.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/DirectoryScanner.h>
+#include <processor/BatchEngine.h>
+#include <mutex>
+#include <set>
+
+class DirectoryScannerTest : public testing::Test
+{
+protected:
+    juce::TemporaryFile mRoot;
+    juce::File mRootDir;
+
+    void SetUp() override
+    {
+        mRootDir = mRoot.getFile();
+        ASSERT_TRUE(mRootDir.createDirectory());
+
+        // 3 levels, 4 audio files per folder plus one that is not audio
+        for (int a = 0; a < 3; a++)
+        {
+            for (int b = 0; b < 3; b++)
+            {
+                const auto dir = mRootDir.getChildFile("a" + juce::String(a))
+                                         .getChildFile("b" + juce::String(b));
+                ASSERT_TRUE(dir.createDirectory());
+
+                for (int f = 0; f < 4; f++)
+                {
+                    dir.getChildFile("file" + juce::String(f) + ".wav").replaceWithText("x");
+                }
+                dir.getChildFile("notes.txt").replaceWithText("x");
+            }
+        }
+    }
+    void TearDown() override
+    {
+        mRootDir.deleteRecursively();
+    }
+
+    std::set<juce::String> scan(const norm::ScanSnapshot* previous,
+                                norm::ScanSnapshot* snapshot = nullptr)
+    {
+        std::mutex mutex;
+        std::set<juce::String> found;
+
+        norm::DirectoryScanner scanner;
+        auto result = scanner.scan(mRootDir,
+                                   [&](const juce::File& file)
+                                   {
+                                       std::lock_guard<std::mutex> lock(mutex);
+                                       EXPECT_TRUE(found.insert(file.getFullPathName()).second);
+                                   },
+                                   previous);
+
+        if (snapshot != nullptr) *snapshot = std::move(result);
+        return found;
+    }
+};
+
+//==============================================================================
+
+TEST_F(DirectoryScannerTest, FindsEveryAudioFileOnce)
+{
+    norm::ScanSnapshot snapshot;
+    const auto found = scan(nullptr, &snapshot);
+
+    EXPECT_EQ(found.size(), 36u);
+    EXPECT_EQ(snapshot.size(), 36u);
+    for (const auto& path : found) EXPECT_TRUE(path.endsWith(".wav"));
+}
+
+TEST_F(DirectoryScannerTest, IncrementalReportsOnlyChanges)
+{
+    norm::ScanSnapshot first;
+    scan(nullptr, &first);
+
+    const auto snapshotFile = mRootDir.getChildFile("scan.snapshot");
+    ASSERT_TRUE(first.save(snapshotFile));
+    norm::ScanSnapshot loaded;
+    ASSERT_TRUE(loaded.load(snapshotFile));
+    EXPECT_EQ(loaded.size(), first.size());
+
+    const auto changed = mRootDir.getChildFile("a1/b2/file0.wav");
+    changed.replaceWithText("longer than before");
+    const auto added = mRootDir.getChildFile("a2/new.wav");
+    added.replaceWithText("x");
+    const auto removed = mRootDir.getChildFile("a0/b0/file3.wav");
+    removed.deleteFile();
+
+    norm::ScanSnapshot second;
+    const auto found = scan(&loaded, &second);
+
+    EXPECT_EQ(found, (std::set<juce::String> { changed.getFullPathName(),
+                                               added.getFullPathName() }));
+    EXPECT_EQ(loaded.getRemoved(second), juce::Array<juce::File> { removed });
+}
+
+TEST_F(DirectoryScannerTest, StreamsIntoBatch)
+{
+    // Not audio, so every file fails, but each must reach the batch once
+    norm::BatchEngine::Options options;
+    options.numberOfWorkers = 2;
+    norm::BatchEngine engine(options);
+
+    norm::DirectoryScanner scanner;
+    const auto results = engine.run([&](const norm::BatchEngine::AddFile& addFile)
+    {
+        scanner.scan(mRootDir, addFile);
+    });
+
+    EXPECT_EQ(results.size(), 36u);
+}
+
+TEST_F(DirectoryScannerTest, CancelBeforeScanIsKept)
+{
+    std::atomic<int> found { 0 };
+    auto onFile = [&](const juce::File&) { found++; };
+
+    // E.g. from another thread, just before the scan got going
+    norm::DirectoryScanner scanner;
+    scanner.cancel();
+    const auto cancelled = scanner.scan(mRootDir, onFile);
+    EXPECT_EQ(cancelled.size(), 0u);
+    EXPECT_EQ(found, 0);
+
+    // Not a baseline for the next scan
+    EXPECT_FALSE(cancelled.isComplete());
+    juce::TemporaryFile file(".snapshot");
+    EXPECT_FALSE(cancelled.save(file.getFile()));
+
+    scanner.rearm();
+    const auto complete = scanner.scan(mRootDir, onFile);
+    EXPECT_EQ(complete.size(), 36u);
+    EXPECT_TRUE(complete.isComplete());
+    EXPECT_EQ(found, 36);
+}
@@ -0,0 +1,82 @@
+/*  Tests for the data behind the file list: updates find their row by path,
+    sorting only reorders the display rows, and files added during a sort
+    are not lost.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <gui/FileList.h>
+
+class FileListTest : public testing::Test
+{
+protected:
+    norm::FileListData mData;
+
+    void SetUp() override
+    {
+        mData.apply({ juce::File("/music/b.wav"), norm::FileListData::State::analysed, -14.f, -9.f });
+        mData.apply({ juce::File("/music/a.wav"), norm::FileListData::State::verified, -30.f, 7.f });
+        mData.add(juce::File("/music/c10.wav"));
+        mData.add(juce::File("/music/c9.wav"));
+    }
+};
+
+//==============================================================================
+
+TEST_F(FileListTest, UpdatesFindTheirRow)
+{
+    ASSERT_EQ(mData.size(), 4);
+
+    EXPECT_EQ(mData.apply({ juce::File("/music/b.wav"),
+                            norm::FileListData::State::verified, -14.f, -9.f }), 0);
+    EXPECT_EQ(mData.size(), 4);
+    EXPECT_EQ(mData.getState(0), norm::FileListData::State::verified);
+    EXPECT_EQ(mData.getState(2), norm::FileListData::State::pending);
+}
+
+TEST_F(FileListTest, SortingMovesRowsOnly)
+{
+    mData.sortBy(norm::FileListData::Column::name, true);
+    EXPECT_EQ(mData.getName(0), "a.wav");
+    EXPECT_EQ(mData.getName(1), "b.wav");
+    // Natural order, 9 before 10
+    EXPECT_EQ(mData.getName(2), "c9.wav");
+    EXPECT_EQ(mData.getName(3), "c10.wav");
+
+    mData.sortBy(norm::FileListData::Column::loudness, false);
+    EXPECT_EQ(mData.getName(0), "b.wav");
+    EXPECT_FLOAT_EQ(mData.getGain(0), -9.f);
+
+    // Updates after a sort still land on the right file
+    mData.apply({ juce::File("/music/a.wav"), norm::FileListData::State::failed, 0.f, 0.f });
+    for (int row = 0; row < mData.size(); row++)
+    {
+        if (mData.getName(row) == "a.wav")
+            EXPECT_EQ(mData.getState(row), norm::FileListData::State::failed);
+    }
+}
+
+TEST_F(FileListTest, FilesAddedWhileSortingGoLast)
+{
+    // As the list does it: the sort runs elsewhere on copies
+    const auto sorter = mData.makeSorter(norm::FileListData::Column::name, false);
+    mData.add(juce::File("/music/0.wav"));
+    EXPECT_EQ(mData.getName(4), "0.wav");
+
+    mData.setOrder(sorter());
+    ASSERT_EQ(mData.size(), 5);
+    EXPECT_EQ(mData.getName(0), "c10.wav");
+    EXPECT_EQ(mData.getName(3), "a.wav");
+    EXPECT_EQ(mData.getName(4), "0.wav");
+}
+
+TEST_F(FileListTest, ExcludedFilesAreLeftOut)
+{
+    mData.setExcluded(1, true);
+    EXPECT_TRUE(mData.isExcluded(1));
+
+    const auto included = mData.getIncludedFiles();
+    EXPECT_EQ(included.size(), 3);
+    EXPECT_FALSE(included.contains(juce::File("/music/a.wav")));
+}
@@ -0,0 +1,69 @@
+/*  K-weighting throughput, specialised kernels against the generic loop,
+    for every sample rate and channel layout that has a specialisation.
+*/
+
+#pragma once
+
+#include "BenchUtil.h"
+#include <processor/FilterProcessor.h>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+class FilterBench : public testing::TestWithParam<std::tuple<double, int>>
+{
+protected:
+    // Frames (samples of every channel) per second the filter bank gets through
+    double run(bool specialised)
+    {
+        const auto [sampleRate, numberOfChannels] = GetParam();
+        const int blockSize = (int)(sampleRate / 10.0);
+        const int blocks = 100; // 10 seconds of audio
+
+        std::vector<std::vector<float>> audio((size_t)numberOfChannels);
+        std::vector<const float*> pointers;
+        const std::vector<float> weights((size_t)numberOfChannels, 1.f);
+        for (auto& channel : audio)
+        {
+            channel.resize((size_t)blockSize);
+            for (auto& sample : channel)
+                sample = (float)std::rand() / (float)RAND_MAX * 2.f - 1.f;
+            pointers.push_back(channel.data());
+        }
+
+        norm::KWFilterBank bank;
+        bank.setUseSpecialisedKernels(specialised);
+        bank.reset(sampleRate, numberOfChannels);
+        EXPECT_EQ(bank.isSpecialised(), specialised);
+
+        float energy = 0.f;
+        const double seconds = bench::measureBest([&]
+        {
+            for (int b = 0; b < blocks; b++)
+                energy += bank.processEnergy(pointers.data(), weights.data(), blockSize);
+        }, 10);
+        EXPECT_GT(energy, 0.f); // keeps the result observable
+
+        return (double)blockSize * blocks / seconds;
+    }
+};
+
+TEST_P(FilterBench, SpecialisedAgainstGeneric)
+{
+    const auto [sampleRate, numberOfChannels] = GetParam();
+    const std::string name = std::to_string((int)sampleRate) + "Hz_"
+                           + std::to_string(numberOfChannels) + "ch";
+
+    const double generic = run(false);
+    const double specialised = run(true);
+
+    bench::report(name + "_generic", generic / 1e6, "Mframes/s");
+    bench::report(name + "_specialised", specialised / 1e6, "Mframes/s");
+    bench::report(name + "_speedup", specialised / generic, "x");
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Layouts,
+    FilterBench,
+    testing::Combine(testing::Values(44100.0, 48000.0, 96000.0, 192000.0),
+                     testing::Values(1, 2, 5, 6, 7, 8)));
@@ -2,6 +2,7 @@
 
 #include <gtest/gtest.h>
 #include <processor/FilterProcessor.h>
+#include <vector>
 
 class FilterTest : public testing::Test
 {
@@ -13,19 +14,19 @@ protected:
     {
         mFilter.reset(fs);
 
-        EXPECT_FLOAT_EQ(mFilter.HS_A[0], HS_A[0]);
-        EXPECT_FLOAT_EQ(mFilter.HS_A[1], HS_A[1]);
+        EXPECT_FLOAT_EQ(mFilter.mCoeffs.HS_A[0], HS_A[0]);
+        EXPECT_FLOAT_EQ(mFilter.mCoeffs.HS_A[1], HS_A[1]);
 
-        EXPECT_FLOAT_EQ(mFilter.HS_B[0], HS_B[0]);
-        EXPECT_FLOAT_EQ(mFilter.HS_B[1], HS_B[1]);
-        EXPECT_FLOAT_EQ(mFilter.HS_B[2], HS_B[2]);
+        EXPECT_FLOAT_EQ(mFilter.mCoeffs.HS_B[0], HS_B[0]);
+        EXPECT_FLOAT_EQ(mFilter.mCoeffs.HS_B[1], HS_B[1]);
+        EXPECT_FLOAT_EQ(mFilter.mCoeffs.HS_B[2], HS_B[2]);
 
-        EXPECT_FLOAT_EQ(mFilter.HP_A[0], HP_A[0]);
-        EXPECT_FLOAT_EQ(mFilter.HP_A[1], HP_A[1]);
+        EXPECT_FLOAT_EQ(mFilter.mCoeffs.HP_A[0], HP_A[0]);
+        EXPECT_FLOAT_EQ(mFilter.mCoeffs.HP_A[1], HP_A[1]);
         
-        EXPECT_FLOAT_EQ(mFilter.HP_B[0], HP_B[0]);
-        EXPECT_FLOAT_EQ(mFilter.HP_B[1], HP_B[1]);
-        EXPECT_FLOAT_EQ(mFilter.HP_B[2], HP_B[2]);
+        EXPECT_FLOAT_EQ(mFilter.mCoeffs.HP_B[0], HP_B[0]);
+        EXPECT_FLOAT_EQ(mFilter.mCoeffs.HP_B[1], HP_B[1]);
+        EXPECT_FLOAT_EQ(mFilter.mCoeffs.HP_B[2], HP_B[2]);
     }
 
     void attTest()
@@ -38,6 +39,146 @@ protected:
         EXPECT_LT(filterAttDB, att + eps);
     }
 
+    // Feeds the same noise through the specialised and the generic kernel
+    void kernelMatchTest(double sampleRate, int numberOfChannels)
+    {
+        const int size = (int)(sampleRate / 10.0);
+        std::vector<std::vector<float>> audio((size_t)numberOfChannels);
+        std::vector<const float*> pointers;
+        std::vector<float> weights;
+        for (auto& channel : audio)
+        {
+            channel.resize((size_t)size);
+            for (auto& sample : channel)
+                sample = (float)std::rand() / (float)RAND_MAX * 2.f - 1.f;
+            pointers.push_back(channel.data());
+            weights.push_back(1.f + (float)weights.size() * 0.1f);
+        }
+
+        norm::KWFilterBank fast;
+        fast.reset(sampleRate, numberOfChannels);
+        norm::KWFilterBank slow;
+        slow.setUseSpecialisedKernels(false);
+        slow.reset(sampleRate, numberOfChannels);
+
+        EXPECT_TRUE(fast.isSpecialised());
+        EXPECT_FALSE(slow.isSpecialised());
+
+        // two blocks, so carrying state across calls is covered as well
+        for (int block = 0; block < 2; block++)
+        {
+            const float fastEnergy =
+                fast.processEnergy(pointers.data(), weights.data(), size);
+            const float slowEnergy =
+                slow.processEnergy(pointers.data(), weights.data(), size);
+            EXPECT_FLOAT_EQ(fastEnergy, slowEnergy);
+        }
+    }
+
+    // Energy from the bank equals filtering with a single KWFilter
+    void bankMatchesFilterTest()
+    {
+        const int size = (int)(fs / 10.f);
+        std::vector<float> audio((size_t)size);
+        for (auto& sample : audio)
+            sample = (float)std::rand() / (float)RAND_MAX * 2.f - 1.f;
+
+        const float* pointer = audio.data();
+        const float weight = 1.41f;
+        norm::KWFilterBank bank;
+        bank.reset(fs, 1);
+        const float bankEnergy = bank.processEnergy(&pointer, &weight, size);
+
+        mFilter.reset(fs);
+        mFilter.process(audio.data(), size);
+        float filterEnergy = 0.f;
+        for (float sample : audio) filterEnergy += sample * sample;
+
+        EXPECT_FLOAT_EQ(bankEnergy, weight * filterEnergy);
+    }
+
+    // Every lane filters like a one channel bank at its own rate, and a
+    // cleared lane stays silent whatever it is fed. A block that comes in
+    // pieces matches within float rounding.
+    void lanesMatchBankTest()
+    {
+        constexpr int lanes = norm::KWFilterLanes::numberOfLanes;
+        const double rates[] = { 44100.0, 48000.0, 22050.0, 96000.0, 37800.0, 192000.0, 8000.0 };
+        const int size = 4410;
+
+        std::vector<float> interleaved((size_t)size * lanes);
+        for (auto& sample : interleaved)
+            sample = (float)std::rand() / (float)RAND_MAX * 2.f - 1.f;
+
+        norm::KWFilterLanes filter;
+        std::vector<norm::KWFilterBank> banks((size_t)lanes);
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            const double rate = rates[(size_t)lane % std::size(rates)];
+            filter.resetLane(lane, rate);
+            banks[(size_t)lane].reset(rate, 1);
+        }
+        filter.clearLane(lanes - 1);
+
+        // two blocks, so carrying state across calls is covered as well
+        for (int block = 0; block < 2; block++)
+        {
+            float energies[lanes] = {};
+            filter.processEnergy(interleaved.data(), size, energies);
+
+            for (int lane = 0; lane < lanes - 1; lane++)
+            {
+                std::vector<float> channel((size_t)size);
+                for (int s = 0; s < size; s++)
+                    channel[(size_t)s] = interleaved[(size_t)(s * lanes + lane)];
+
+                const float* pointer = channel.data();
+                const float weight = 1.f;
+                EXPECT_FLOAT_EQ(energies[lane],
+                                banks[(size_t)lane].processEnergy(&pointer, &weight, size));
+            }
+            EXPECT_EQ(energies[lanes - 1], 0.f);
+        }
+
+        // A block filtered in pieces, as when lanes of different rates
+        // advance to each other's block boundaries: the energy is summed in
+        // another order, so it matches within float rounding only
+        const int pieces[] = { 1000, 7, 3403 };
+        float energies[lanes] = {};
+        int done = 0;
+        for (const int piece : pieces)
+        {
+            filter.processEnergy(interleaved.data() + (size_t)done * lanes, piece, energies);
+            done += piece;
+        }
+        ASSERT_EQ(done, size);
+
+        for (int lane = 0; lane < lanes - 1; lane++)
+        {
+            std::vector<float> channel((size_t)size);
+            for (int s = 0; s < size; s++)
+                channel[(size_t)s] = interleaved[(size_t)(s * lanes + lane)];
+
+            const float* pointer = channel.data();
+            const float weight = 1.f;
+            const float expected = banks[(size_t)lane].processEnergy(&pointer, &weight, size);
+            EXPECT_NEAR(energies[lane], expected, 1e-4f * expected);
+        }
+    }
+
+    void fallbackTest()
+    {
+        norm::KWFilterBank bank;
+        bank.reset(22050.0, 2);
+        EXPECT_FALSE(bank.isSpecialised());
+
+        bank.reset(fs, 3);
+        EXPECT_FALSE(bank.isSpecialised());
+
+        bank.reset(fs, 2);
+        EXPECT_TRUE(bank.isSpecialised());
+    }
+
 private:
     const float fs = 48000.f;
 
@@ -64,3 +205,41 @@ TEST_F(FilterTest, AttenuationTest)
 {
     attTest();
 }
+
+TEST(ConstexprMathTest, MatchesCmath)
+{
+    for (double x : { -2.5, -0.3, 0.0, 0.0012, 0.12, 0.7, 1.4 })
+    {
+        EXPECT_NEAR(norm::cmath::sin(x), std::sin(x), 1e-12);
+        EXPECT_NEAR(norm::cmath::cos(x), std::cos(x), 1e-12);
+        EXPECT_NEAR(norm::cmath::tan(x), std::tan(x), 1e-12);
+        EXPECT_NEAR(norm::cmath::exp(x), std::exp(x), 1e-12);
+    }
+    EXPECT_NEAR(norm::cmath::pow10(0.2), std::pow(10.0, 0.2), 1e-12);
+    EXPECT_NEAR(norm::cmath::sqrt(0.691), std::sqrt(0.691), 1e-12);
+}
+
+TEST_F(FilterTest, SpecialisedKernelsMatchGeneric)
+{
+    kernelMatchTest(44100.0, 1);
+    kernelMatchTest(48000.0, 2);
+    kernelMatchTest(88200.0, 5);
+    kernelMatchTest(96000.0, 6);
+    kernelMatchTest(48000.0, 7);
+    kernelMatchTest(192000.0, 8);
+}
+
+TEST_F(FilterTest, BankMatchesSingleFilter)
+{
+    bankMatchesFilterTest();
+}
+
+TEST_F(FilterTest, FallbackForUnsupportedFormats)
+{
+    fallbackTest();
+}
+
+TEST_F(FilterTest, LanesMatchFilterBank)
+{
+    lanesMatchBankTest();
+}
@@ -0,0 +1,159 @@
+/*  Tests for the drop folder watcher: files are handed on once, only after
+    they are complete, folders created while watching are watched too, and
+    our own writes do not come back as drops.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/FolderWatcher.h>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class FolderWatcherTest : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        mRoot = juce::File::createTempFile("watch");
+        ASSERT_TRUE(mRoot.createDirectory());
+    }
+    void TearDown() override
+    {
+        stop();
+        mRoot.deleteRecursively();
+    }
+
+    void start(norm::FolderWatcher::Options options)
+    {
+        mWatcher = std::make_unique<norm::FolderWatcher>(options);
+        mThread = std::thread([this]
+        {
+            mWatcher->run(mRoot, [this](const juce::File& file)
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mHandedOn.push_back(file);
+            });
+        });
+        // Let the watches be set up before anything happens in the folder
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    void stop()
+    {
+        if (mWatcher != nullptr) mWatcher->stop();
+        if (mThread.joinable()) mThread.join();
+    }
+
+    std::vector<juce::File> waitForFiles(size_t count, int timeoutMs = 5000)
+    {
+        const auto deadline = std::chrono::steady_clock::now()
+                            + std::chrono::milliseconds(timeoutMs);
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (mHandedOn.size() >= count) break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mHandedOn;
+    }
+
+    static norm::FolderWatcher::Options getOptions()
+    {
+        norm::FolderWatcher::Options options;
+        options.includeExisting = false;
+        options.settleTimeMs = 300;
+        options.closedSettleTimeMs = 50;
+        return options;
+    }
+
+    juce::File mRoot;
+    std::unique_ptr<norm::FolderWatcher> mWatcher;
+    std::thread mThread;
+    std::mutex mMutex;
+    std::vector<juce::File> mHandedOn;
+};
+
+//==============================================================================
+
+TEST_F(FolderWatcherTest, HandsOnCompleteFilesOnce)
+{
+    start(getOptions());
+
+    const auto file = mRoot.getChildFile("drop.wav");
+    {
+        juce::FileOutputStream stream(file);
+        ASSERT_TRUE(stream.openedOk());
+        for (int i = 0; i < 5; i++)
+        {
+            stream.writeRepeatedByte(0, 1024);
+            stream.flush();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+
+        // Still open, so not settled yet
+        EXPECT_TRUE(waitForFiles(1, 0).empty());
+    }
+
+    mRoot.getChildFile("notes.txt").replaceWithText("not audio");
+    mRoot.getChildFile(".hidden.wav").replaceWithText("hidden");
+
+    const auto handedOn = waitForFiles(1);
+    ASSERT_EQ(handedOn.size(), 1u);
+    EXPECT_EQ(handedOn[0], file);
+
+    // Nothing else comes after the settle time either
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    EXPECT_EQ(waitForFiles(2, 0).size(), 1u);
+}
+
+TEST_F(FolderWatcherTest, WatchesNewFolders)
+{
+    start(getOptions());
+
+    const auto folder = mRoot.getChildFile("album");
+    ASSERT_TRUE(folder.createDirectory());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    folder.getChildFile("track.flac").replaceWithText("audio");
+
+    const auto handedOn = waitForFiles(1);
+    ASSERT_EQ(handedOn.size(), 1u);
+    EXPECT_EQ(handedOn[0], folder.getChildFile("track.flac"));
+}
+
+TEST_F(FolderWatcherTest, IncludesExistingFiles)
+{
+    mRoot.getChildFile("old.wav").replaceWithText("audio");
+
+    auto options = getOptions();
+    options.includeExisting = true;
+    start(options);
+
+    const auto handedOn = waitForFiles(1);
+    ASSERT_EQ(handedOn.size(), 1u);
+    EXPECT_EQ(handedOn[0], mRoot.getChildFile("old.wav"));
+}
+
+TEST_F(FolderWatcherTest, IgnoresOwnWrites)
+{
+    start(getOptions());
+
+    const auto file = mRoot.getChildFile("drop.wav");
+    file.replaceWithText("audio");
+    ASSERT_EQ(waitForFiles(1).size(), 1u);
+
+    // Written back in place, as the batch does it
+    file.replaceWithText("normalised audio");
+    mWatcher->ignoreOwnWrite(file);
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    EXPECT_EQ(waitForFiles(2, 0).size(), 1u);
+
+    // Dropped again with new contents
+    file.replaceWithText("other audio, longer");
+    EXPECT_EQ(waitForFiles(2).size(), 2u);
+}
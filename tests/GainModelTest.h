@@ -0,0 +1,138 @@
+/*  Tests for the gain model: track and album gains, the ReplayGain fields,
+    and the loudness record surviving a round trip through the metadata.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/GainModel.h>
+#include <cmath>
+#include <limits>
+
+TEST(GainModelTest, TrackGainReachesTarget)
+{
+    const auto record = norm::GainModel::forTrack(-17.5f, -23.f);
+    EXPECT_FLOAT_EQ(record.sourceLoudness, -17.5f);
+    EXPECT_FLOAT_EQ(record.appliedGain, -5.5f);
+    EXPECT_FLOAT_EQ(record.getResultLoudness(), -23.f);
+}
+
+TEST(GainModelTest, AlbumOfEqualTracks)
+{
+    const std::vector<norm::GainModel::Track> tracks { { -20.f, 48000 }, { -20.f, 96000 } };
+    EXPECT_NEAR(norm::GainModel::getAlbumLoudness(tracks), -20.f, 1e-4f);
+
+    // Silent and empty tracks do not pull the album down
+    const std::vector<norm::GainModel::Track> withSilence {
+        { -20.f, 48000 },
+        { -std::numeric_limits<float>::infinity(), 48000 },
+        { -10.f, 0 }
+    };
+    EXPECT_NEAR(norm::GainModel::getAlbumLoudness(withSilence), -20.f, 1e-4f);
+}
+
+TEST(GainModelTest, AlbumKeepsRelativeLevels)
+{
+    // Two tracks of the same length, 10 dB apart: the album is 10log((10 + 1) / 2)
+    // above the quieter one
+    const std::vector<norm::GainModel::Track> tracks { { -30.f, 48000 }, { -20.f, 48000 } };
+    const float album = norm::GainModel::getAlbumLoudness(tracks);
+    EXPECT_NEAR(album, -30.f + 10.f * std::log10(5.5f), 1e-3f);
+
+    const auto records = norm::GainModel::forAlbum(tracks, -23.f);
+    ASSERT_EQ(records.size(), 2u);
+    EXPECT_FLOAT_EQ(records[0].appliedGain, records[1].appliedGain);
+    EXPECT_NEAR(records[1].getResultLoudness() - records[0].getResultLoudness(), 10.f, 1e-4f);
+    EXPECT_NEAR(records[0].appliedGain, -23.f - album, 1e-4f);
+}
+
+TEST(GainModelTest, TagsRoundTrip)
+{
+    juce::StringPairArray metadata;
+    EXPECT_FALSE(norm::GainModel::readTags(metadata).has_value());
+
+    norm::GainModel::writeTags(metadata, { -17.25f, -5.75f });
+    EXPECT_EQ(metadata.getValue(norm::GainModel::LoudnessTag, {}), "-23.00");
+
+    const auto record = norm::GainModel::readTags(metadata);
+    ASSERT_TRUE(record.has_value());
+    EXPECT_FLOAT_EQ(record->sourceLoudness, -17.25f);
+    EXPECT_FLOAT_EQ(record->appliedGain, -5.75f);
+
+    // Someone else's software tag is not a record
+    juce::StringPairArray other;
+    other.set(norm::GainModel::LegacyRecordTag, "Lavf58.76.100");
+    EXPECT_FALSE(norm::GainModel::readTags(other).has_value());
+}
+
+TEST(GainModelTest, TagsLeaveOtherFieldsAlone)
+{
+    // A software tag and the iXML of a field recorder
+    juce::StringPairArray metadata;
+    metadata.set(norm::GainModel::LegacyRecordTag, "Lavf58.76.100");
+    metadata.set(norm::GainModel::RecordTag, "<BWFXML><SCENE>12A</SCENE></BWFXML>");
+
+    norm::GainModel::writeTags(metadata, { -17.25f, -5.75f });
+    norm::GainModel::writeTags(metadata, { -17.25f, -6.f });
+    EXPECT_EQ(metadata.getValue(norm::GainModel::LegacyRecordTag, {}), "Lavf58.76.100");
+
+    const auto ixml = juce::parseXML(metadata.getValue(norm::GainModel::RecordTag, {}));
+    ASSERT_NE(ixml, nullptr);
+    EXPECT_EQ(ixml->getChildElementAllSubText("SCENE", {}), "12A");
+    EXPECT_EQ(ixml->getNumChildElements(), 2);
+
+    const auto record = norm::GainModel::readTags(metadata);
+    ASSERT_TRUE(record.has_value());
+    EXPECT_FLOAT_EQ(record->appliedGain, -6.f);
+
+    // Files of earlier versions kept the record in the software tag
+    juce::StringPairArray legacy;
+    legacy.set(norm::GainModel::LegacyRecordTag, norm::GainModel::toString({ -17.25f, -5.75f }));
+    ASSERT_TRUE(norm::GainModel::readTags(legacy).has_value());
+}
+
+TEST(GainModelTest, SignalledGainRoundTrip)
+{
+    // Part of the gain left to the player, as for MP3
+    const norm::LoudnessRecord record { -17.25f, -6.75f, -0.73f };
+    EXPECT_FLOAT_EQ(record.getSampleGain(), -6.02f);
+
+    const auto parsed = norm::GainModel::fromString(norm::GainModel::toString(record));
+    ASSERT_TRUE(parsed.has_value());
+    EXPECT_FLOAT_EQ(parsed->appliedGain, -6.75f);
+    EXPECT_FLOAT_EQ(parsed->signalledGain, -0.73f);
+
+    // Records without it read as all in the samples
+    const auto plain = norm::GainModel::fromString(norm::GainModel::toString({ -17.25f, -5.75f }));
+    ASSERT_TRUE(plain.has_value());
+    EXPECT_FLOAT_EQ(plain->signalledGain, 0.f);
+    EXPECT_FLOAT_EQ(plain->getSampleGain(), -5.75f);
+}
+
+TEST(GainModelTest, AlreadyNormalisedWithinTolerance)
+{
+    const std::optional<norm::LoudnessRecord> record = norm::LoudnessRecord { -20.f, -3.05f };
+
+    EXPECT_TRUE(norm::GainModel::isAlreadyNormalised(record, -23.f, 0.1f));
+    EXPECT_FALSE(norm::GainModel::isAlreadyNormalised(record, -23.f, 0.01f));
+    EXPECT_FALSE(norm::GainModel::isAlreadyNormalised(record, -16.f, 0.1f));
+    EXPECT_FALSE(norm::GainModel::isAlreadyNormalised(std::nullopt, -23.f, 0.1f));
+}
+
+TEST(GainModelTest, AlbumFieldsKeepTheTrackGain)
+{
+    // The album's gain is signalled, the track's own gain stays in its fields
+    const norm::LoudnessRecord record { -20.f, -1.5f, -1.5f };
+    const auto fields = norm::GainModel::makeAlbumGainFields(record, -3.f, 0.5f, 0.75f);
+
+    EXPECT_EQ(fields[norm::GainModel::TrackGainField], "-3.00 dB");
+    EXPECT_EQ(fields[norm::GainModel::TrackPeakField], juce::String(0.5f, 6));
+    EXPECT_EQ(fields[norm::GainModel::AlbumGainField], "-1.50 dB");
+    EXPECT_EQ(fields[norm::GainModel::AlbumPeakField], juce::String(0.75f, 6));
+    EXPECT_EQ(norm::GainModel::fromString(fields[norm::GainModel::RecordField])->appliedGain, -1.5f);
+
+    // Outside album mode the album fields are cleared
+    const auto track = norm::GainModel::makeGainFields(record, 0.5f);
+    EXPECT_TRUE(track.containsKey(norm::GainModel::AlbumGainField));
+    EXPECT_TRUE(track[norm::GainModel::AlbumGainField].isEmpty());
+}
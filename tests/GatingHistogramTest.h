@@ -0,0 +1,121 @@
+/*  Tests for the mergeable gating state: it must gate like the block list it
+    replaces, and merging must equal gating the blocks of several files at once.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/GatingHistogram.h>
+#include <processor/LKFSProcessor.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace
+{
+    // Block energies spread over levels from -65 to 0 dB, like a dynamic track
+    std::vector<float> makeBlockEnergies(int count, juce::int64 seed, float offsetDB)
+    {
+        juce::Random random(seed);
+        std::vector<float> energies;
+        for (int i = 0; i < count; i++)
+        {
+            const float level = -65.f + 65.f * random.nextFloat() + offsetDB;
+            if (level > norm::GatingHistogram::absoluteGateDB)
+                energies.push_back(std::pow(10.f, level / 10.f));
+        }
+        return energies;
+    }
+
+    norm::GatingHistogram makeHistogram(const std::vector<float>& energies)
+    {
+        norm::GatingHistogram histogram;
+        for (float energy : energies) histogram.add(energy);
+        return histogram;
+    }
+}
+
+TEST(GatingHistogramTest, GatesLikeBlockList)
+{
+    const auto energies = makeBlockEnergies(3000, 1, 0.f);
+    const auto histogram = makeHistogram(energies);
+
+    EXPECT_EQ(histogram.getNumberOfBlocks(), (juce::int64)energies.size());
+    EXPECT_NEAR(histogram.getIntegratedLoudness(),
+                norm::LKFS::integrate(energies).integratedLoudness,
+                0.02f);
+}
+
+TEST(GatingHistogramTest, MergeEqualsConcatenation)
+{
+    const auto loud = makeBlockEnergies(2000, 2, 0.f);
+    const auto quiet = makeBlockEnergies(1000, 3, -15.f);
+
+    auto album = makeHistogram(loud);
+    album.merge(makeHistogram(quiet));
+
+    std::vector<float> concatenated = loud;
+    concatenated.insert(concatenated.end(), quiet.begin(), quiet.end());
+
+    EXPECT_EQ(album.getNumberOfBlocks(), (juce::int64)concatenated.size());
+    EXPECT_NEAR(album.getIntegratedLoudness(),
+                norm::LKFS::integrate(concatenated).integratedLoudness,
+                0.02f);
+}
+
+TEST(GatingHistogramTest, GainShiftsLoudness)
+{
+    auto histogram = makeHistogram(makeBlockEnergies(2000, 4, 0.f));
+    const float before = histogram.getIntegratedLoudness();
+
+    // Upwards, so no block crosses the absolute gate
+    histogram.applyGain(6.f);
+    EXPECT_NEAR(histogram.getIntegratedLoudness(), before + 6.f, 0.02f);
+
+    // Everything below the absolute gate after the gain is gone
+    histogram.applyGain(-80.f);
+    EXPECT_TRUE(histogram.isEmpty());
+    EXPECT_TRUE(std::isinf(histogram.getIntegratedLoudness()));
+}
+
+TEST(GatingHistogramTest, LoudnessRangeLikeSortedList)
+{
+    // EBU Tech 3342 on the values themselves
+    const auto energies = makeBlockEnergies(5000, 5, 0.f);
+    double energySum = 0;
+    for (float energy : energies) energySum += energy;
+
+    std::vector<float> gated;
+    for (float energy : energies)
+    {
+        if (energy > energySum / (double)energies.size() * 0.01) gated.push_back(energy);
+    }
+    std::sort(gated.begin(), gated.end());
+    auto getPercentile = [&](double percentile)
+    {
+        return 10.f * std::log10(gated[(size_t)std::llround(percentile * (double)(gated.size() - 1))]);
+    };
+
+    EXPECT_NEAR(makeHistogram(energies).getLoudnessRange(),
+                getPercentile(0.95) - getPercentile(0.1),
+                0.2f);
+    EXPECT_EQ(norm::GatingHistogram().getLoudnessRange(), 0.f);
+}
+
+TEST(GatingHistogramTest, StreamRoundTrip)
+{
+    const auto histogram = makeHistogram(makeBlockEnergies(500, 5, 0.f));
+
+    juce::MemoryOutputStream output;
+    histogram.writeToStream(output);
+
+    juce::MemoryInputStream input(output.getData(), output.getDataSize(), false);
+    norm::GatingHistogram copy;
+    ASSERT_TRUE(copy.readFromStream(input));
+    EXPECT_EQ(copy.getNumberOfBlocks(), histogram.getNumberOfBlocks());
+    EXPECT_FLOAT_EQ(copy.getIntegratedLoudness(), histogram.getIntegratedLoudness());
+
+    // Cut short in the middle of a bin
+    juce::MemoryInputStream truncated(output.getData(), output.getDataSize() - 5, false);
+    EXPECT_FALSE(copy.readFromStream(truncated));
+}
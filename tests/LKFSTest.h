@@ -25,7 +25,9 @@ protected:
         int numberOfChannels = (int)(mFileHandler.getNumberOfChannels());
         int samplesPerBlock = (int)(sampleRate * 0.1);
 
-        mLKFSProcessor.reset((float)sampleRate, numberOfChannels);
+        mLKFSProcessor.reset(sampleRate,
+                             numberOfChannels,
+                             mFileHandler.getChannelLayout());
         juce::AudioBuffer<float> buffer(numberOfChannels, samplesPerBlock);
 
         while (mFileHandler.readNextBlock(&buffer))
@@ -35,10 +37,68 @@ protected:
 
         return mLKFSProcessor.getIntegratedLoudness();
     }
+
+    // Two seconds of a 997Hz sine at 48kHz in a single channel of the layout
+    float measureSineInChannel(const juce::AudioChannelSet& layout, int channel)
+    {
+        const double sampleRate = 48000.0;
+        const int numberOfChannels = layout.size();
+        const int samplesPerBlock = (int)(sampleRate * 0.1);
+
+        mLKFSProcessor.reset(sampleRate, numberOfChannels, layout);
+        juce::AudioBuffer<float> buffer(numberOfChannels, samplesPerBlock);
+        buffer.clear();
+
+        int phase = 0;
+        for (int block = 0; block < 20; block++)
+        {
+            auto data = buffer.getWritePointer(channel);
+            for (int s = 0; s < samplesPerBlock; s++, phase++)
+            {
+                data[s] = 0.5f * std::sin(2.f * norm::defines::pi * 997.f
+                                          * (float)phase / (float)sampleRate);
+            }
+            mLKFSProcessor.processNext100ms(buffer);
+        }
+
+        return mLKFSProcessor.getIntegratedLoudness();
+    }
 };
 
 //==============================================================================
 
+TEST_F(LKFSTest, SurroundChannelsWeighted)
+{
+    const auto layout = juce::AudioChannelSet::create5point1();
+    const float front = measureSineInChannel(layout, 0);
+    const float centre = measureSineInChannel(layout, 2);
+    const float surround = measureSineInChannel(layout, 4);
+
+    EXPECT_NEAR(centre, front, eps);
+    EXPECT_NEAR(surround - front, 10.f * log10(1.41f), eps);
+}
+
+TEST_F(LKFSTest, LFEExcluded)
+{
+    const auto layout = juce::AudioChannelSet::create5point1();
+    EXPECT_FLOAT_EQ(norm::LKFS::getChannelWeight(
+        juce::AudioChannelSet::ChannelType::LFE), 0.f);
+
+    // nothing but LFE never passes the absolute gate
+    EXPECT_ANY_THROW(measureSineInChannel(layout, 3));
+}
+
+TEST_F(LKFSTest, DefaultLayoutFromChannelCount)
+{
+    mLKFSProcessor.reset(48000.0, 6);
+    EXPECT_EQ(mLKFSProcessor.getChannelLayout(),
+              juce::AudioChannelSet::create5point1());
+
+    mLKFSProcessor.reset(48000.0, 2, juce::AudioChannelSet::mono());
+    EXPECT_EQ(mLKFSProcessor.getChannelLayout(),
+              juce::AudioChannelSet::stereo());
+}
+
 TEST_F(LKFSTest, HomeMade_997Hz_20LKFS)
 {
     const float loudness = measureAudioFile(
@@ -0,0 +1,136 @@
+/*  Tests for analysing several files in the lanes of one filter pass: every
+    file must come out as AnalysisEngine::analyse has it, whatever it shared
+    the lanes with.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/BatchEngine.h>
+#include <processor/LaneAnalyser.h>
+
+class LaneAnalyserTest : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        mDirectory = juce::File::createTempFile("lanes");
+        ASSERT_TRUE(mDirectory.createDirectory());
+
+        const juce::File dir(TEST_AUDIO_DIR);
+        mFiles = { dir.getChildFile("HomeMade_997Hz_20LKFS.wav"),
+                   dir.getChildFile("1770-2_Comp_AbsGateTest.wav"),
+                   dir.getChildFile("1770-2_Comp_RelGateTest.wav") };
+
+        // Short files of mixed rates and layouts, more than fit at once
+        juce::Random random(7);
+        const double rates[] = { 22050.0, 44100.0, 48000.0, 37800.0 };
+        for (int i = 0; i < 12; i++)
+        {
+            mFiles.add(createFile("short" + juce::String(i) + ".wav",
+                                  rates[i % 4],
+                                  1 + i % 2,
+                                  0.5 + random.nextDouble(),
+                                  random));
+        }
+        // More channels than lanes, analysed on its own
+        mFiles.add(createFile("wide.wav", 48000.0, norm::KWFilterLanes::numberOfLanes + 2, 1.0, random));
+
+        mFiles.add(mDirectory.getChildFile("missing.wav"));
+        mFiles.add(mDirectory.getChildFile("notaudio.wav"));
+        mFiles.getLast().replaceWithText("definitely not a RIFF header");
+        // Too short for a single block
+        mFiles.add(createFile("tiny.wav", 44100.0, 1, 0.05, random));
+        // Listed twice
+        mFiles.add(mFiles[4]);
+    }
+    void TearDown() override
+    {
+        mDirectory.deleteRecursively();
+    }
+
+    juce::File createFile(const juce::String& name,
+                          double sampleRate,
+                          int numberOfChannels,
+                          double seconds,
+                          juce::Random& random)
+    {
+        const auto file = mDirectory.getChildFile(name);
+        const int numSamples = (int)(seconds * sampleRate);
+        const float level = juce::Decibels::decibelsToGain(-40.f + 30.f * random.nextFloat());
+
+        juce::AudioBuffer<float> buffer(numberOfChannels, numSamples);
+        for (int ch = 0; ch < numberOfChannels; ch++)
+            for (int i = 0; i < numSamples; i++)
+                buffer.setSample(ch, i, level * (random.nextFloat() * 2.f - 1.f));
+
+        juce::WavAudioFormat format;
+        std::unique_ptr<juce::OutputStream> stream = file.createOutputStream();
+        std::unique_ptr<juce::AudioFormatWriter> writer(
+            format.createWriterFor(stream.get(), sampleRate, (unsigned int)numberOfChannels, 24, {}, 0));
+        EXPECT_NE(writer, nullptr);
+        if (writer == nullptr) return file;
+
+        // Owned by the writer now
+        stream.release();
+        writer->writeFromAudioSampleBuffer(buffer, 0, numSamples);
+        return file;
+    }
+
+    juce::File mDirectory;
+    juce::Array<juce::File> mFiles;
+};
+
+//==============================================================================
+
+TEST_F(LaneAnalyserTest, MatchesSingleFileAnalysis)
+{
+    norm::LaneAnalyser lanes;
+    const auto results = lanes.analyse(mFiles);
+    ASSERT_EQ(results.size(), (size_t)mFiles.size());
+
+    norm::AnalysisEngine engine;
+    for (int i = 0; i < mFiles.size(); i++)
+    {
+        const auto& lane = results[(size_t)i];
+        const auto single = engine.analyse(mFiles[i]);
+
+        EXPECT_EQ(lane.file, mFiles[i]);
+        ASSERT_EQ(lane.analysis.ok, single.ok) << mFiles[i].getFileName();
+        if (!single.ok) continue;
+
+        EXPECT_NEAR(lane.analysis.integratedLoudness, single.integratedLoudness, 1e-4f)
+            << mFiles[i].getFileName();
+        EXPECT_FLOAT_EQ(lane.analysis.samplePeak, single.samplePeak);
+        EXPECT_EQ(lane.analysis.blocksRead, single.blocksRead);
+        EXPECT_EQ(lane.analysis.lengthInSamples, single.lengthInSamples);
+        EXPECT_EQ(lane.analysis.histogram.getNumberOfBlocks(), single.histogram.getNumberOfBlocks());
+    }
+}
+
+TEST_F(LaneAnalyserTest, BatchSharingLanesMatches)
+{
+    norm::BatchEngine::Options options;
+    options.mode = norm::BatchEngine::Mode::analyse;
+    options.numberOfWorkers = 2;
+
+    auto byFile = [](std::vector<norm::BatchEngine::FileResult> results)
+    {
+        std::sort(results.begin(), results.end(),
+                  [](const auto& a, const auto& b) { return a.file < b.file; });
+        return results;
+    };
+
+    const auto expected = byFile(norm::BatchEngine(options).run(mFiles));
+    options.shareLanes = true;
+    const auto results = byFile(norm::BatchEngine(options).run(mFiles));
+
+    ASSERT_EQ(results.size(), expected.size());
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        EXPECT_EQ(results[i].file, expected[i].file);
+        EXPECT_EQ(results[i].status, expected[i].status) << results[i].file.getFileName();
+        EXPECT_NEAR(results[i].loudness, expected[i].loudness, 1e-4f);
+        EXPECT_NEAR(results[i].gain, expected[i].gain, 1e-4f);
+    }
+}
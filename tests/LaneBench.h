@@ -0,0 +1,75 @@
+/*  Analysis throughput on one core for a library of short mono and stereo
+    files, one AnalysisEngine file after file against a LaneAnalyser keeping
+    its lanes filled across files.
+*/
+
+#pragma once
+
+#include "BenchUtil.h"
+#include <processor/LaneAnalyser.h>
+
+class LaneBench : public testing::TestWithParam<int>
+{
+protected:
+    void SetUp() override
+    {
+        mDirectory = juce::File::createTempFile("lanebench");
+        ASSERT_TRUE(mDirectory.createDirectory());
+
+        // Dialogue lines and effects: 1 to 4 seconds at 48 kHz
+        const int numberOfChannels = GetParam();
+        juce::Random random(3);
+        for (int i = 0; i < 64; i++)
+        {
+            const int numSamples = 48000 + random.nextInt(3 * 48000);
+            juce::AudioBuffer<float> buffer(numberOfChannels, numSamples);
+            for (int ch = 0; ch < numberOfChannels; ch++)
+                for (int s = 0; s < numSamples; s++)
+                    buffer.setSample(ch, s, 0.1f * (random.nextFloat() * 2.f - 1.f));
+
+            const auto file = mDirectory.getChildFile("file" + juce::String(i) + ".wav");
+            juce::WavAudioFormat format;
+            std::unique_ptr<juce::OutputStream> stream = file.createOutputStream();
+            std::unique_ptr<juce::AudioFormatWriter> writer(
+                format.createWriterFor(stream.get(), 48000.0, (unsigned int)numberOfChannels, 16, {}, 0));
+            ASSERT_NE(writer, nullptr);
+            // Owned by the writer now
+            stream.release();
+            writer->writeFromAudioSampleBuffer(buffer, 0, numSamples);
+
+            mFiles.add(file);
+            mSamples += (juce::int64)numSamples * numberOfChannels;
+        }
+    }
+    void TearDown() override
+    {
+        mDirectory.deleteRecursively();
+    }
+
+    juce::File mDirectory;
+    juce::Array<juce::File> mFiles;
+    juce::int64 mSamples = 0;
+};
+
+TEST_P(LaneBench, LanesAgainstFileByFile)
+{
+    const std::string name = std::to_string(GetParam()) + "ch";
+
+    norm::AnalysisEngine engine;
+    const double single = bench::measureBest([&]
+    {
+        for (const auto& file : mFiles) EXPECT_TRUE(engine.analyse(file).ok);
+    }, 3);
+
+    norm::LaneAnalyser lanes;
+    const double shared = bench::measureBest([&]
+    {
+        for (const auto& result : lanes.analyse(mFiles)) EXPECT_TRUE(result.analysis.ok);
+    }, 3);
+
+    bench::report(name + "_file_by_file", (double)mSamples / single / 1e6, "Msamples/s");
+    bench::report(name + "_lanes", (double)mSamples / shared / 1e6, "Msamples/s");
+    bench::report(name + "_speedup", single / shared, "x");
+}
+
+INSTANTIATE_TEST_SUITE_P(ShortFiles, LaneBench, testing::Values(1, 2));
@@ -0,0 +1,109 @@
+/*  Tests for the logging backend: message interpolation, delivery through the
+    background thread, messages too long for their slot, and the lock-free
+    queue underneath it.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <util/Logger.h>
+#include <util/MPSCQueue.h>
+#include <thread>
+#include <vector>
+
+TEST(LoggerTest, FormatInterpolatesArguments)
+{
+    EXPECT_EQ(norm::Logger::format("Sample Rate is {}", 48000),
+              "Sample Rate is 48000");
+    EXPECT_EQ(norm::Logger::format("{} of {} channels", 2, 6),
+              "2 of 6 channels");
+    EXPECT_EQ(norm::Logger::format("No arguments"), "No arguments");
+}
+
+TEST(LoggerTest, MessagesReachSink)
+{
+    std::vector<std::string> received;
+    norm::Logger::getInstance().flush();
+    norm::Logger::getInstance().setSink(
+        [&received](const norm::Logger::Message& message)
+        {
+            received.emplace_back(message.getText());
+        });
+
+    MY_LOG_WARNING("File {} is broken", std::string("a.wav"));
+    MY_LOG_WARNING("Plain warning");
+    norm::Logger::getInstance().flush();
+    norm::Logger::getInstance().resetSink();
+
+    ASSERT_EQ(received.size(), 2u);
+    EXPECT_EQ(received[0], "File a.wav is broken");
+    EXPECT_EQ(received[1], "Plain warning");
+}
+
+TEST(LoggerTest, LongMessagesAreCutShort)
+{
+    std::vector<std::string> received;
+    juce::int64 timeMs = 0;
+    norm::Logger::getInstance().flush();
+    norm::Logger::getInstance().setSink(
+        [&](const norm::Logger::Message& message)
+        {
+            received.emplace_back(message.getText());
+            timeMs = message.timeMs;
+        });
+
+    const auto before = juce::Time::currentTimeMillis();
+    MY_LOG_WARNING("Path {}", std::string(1000, 'x'));
+    norm::Logger::getInstance().flush();
+    norm::Logger::getInstance().resetSink();
+
+    ASSERT_EQ(received.size(), 1u);
+    EXPECT_EQ(received[0].size(), norm::Logger::Message::maxLength);
+    EXPECT_EQ(received[0].substr(0, 6), "Path x");
+    // Only ticks are taken when logging, the time comes from them
+    EXPECT_NEAR((double)timeMs, (double)before, 1000.0);
+}
+
+TEST(LoggerTest, QueueRejectsWhenFull)
+{
+    norm::MPSCQueue<int> queue(4);
+
+    for (int i = 0; i < 4; i++)
+    {
+        EXPECT_TRUE(queue.tryPush(int(i)));
+    }
+    EXPECT_FALSE(queue.tryPush(4));
+
+    EXPECT_EQ(queue.tryPop().value(), 0);
+    EXPECT_TRUE(queue.tryPush(4));
+}
+
+TEST(LoggerTest, QueueKeepsEveryElementFromManyProducers)
+{
+    const int producers = 4;
+    const int perProducer = 10000;
+    norm::MPSCQueue<int> queue(1024);
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++)
+    {
+        threads.emplace_back([&]
+        {
+            for (int i = 0; i < perProducer; i++)
+            {
+                while (!queue.tryPush(1)) std::this_thread::yield();
+            }
+        });
+    }
+
+    int sum = 0;
+    while (sum < producers * perProducer)
+    {
+        if (auto element = queue.tryPop()) sum += *element;
+    }
+
+    for (auto& thread : threads) thread.join();
+
+    EXPECT_EQ(sum, producers * perProducer);
+    EXPECT_FALSE(queue.tryPop().has_value());
+}
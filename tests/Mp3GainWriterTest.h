@@ -0,0 +1,269 @@
+/*  Tests for changing the gain of MP3 files in place. The streams are made up
+    here: an ID3v2.3 tag and MPEG 1 stereo frames with known side info, no
+    real audio in them, which is all the writer looks at.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/Mp3GainWriter.h>
+#include <array>
+#include <cstring>
+
+class Mp3GainWriterTest : public testing::Test
+{
+protected:
+    // 128 kbit/s at 44.1 kHz, no padding
+    static constexpr int frameLength = 417;
+    // Side info of MPEG 1 stereo: 9 + 3 + 8 bits, then 59 bits per granule
+    // and channel, global_gain 21 bits into each
+    static constexpr int firstGranuleBit = 20;
+    static constexpr int granuleBits = 59;
+
+    void SetUp() override
+    {
+        mDirectory = juce::File::createTempFile("mp3gain");
+        ASSERT_TRUE(mDirectory.createDirectory());
+    }
+    void TearDown() override
+    {
+        mDirectory.deleteRecursively();
+    }
+
+    static int readBits(const juce::uint8* data, int bitOffset, int numberOfBits)
+    {
+        int value = 0;
+        for (int i = bitOffset; i < bitOffset + numberOfBits; i++)
+            value = (value << 1) | ((data[i >> 3] >> (7 - (i & 7))) & 1);
+        return value;
+    }
+    static void writeBits(juce::uint8* data, int bitOffset, int numberOfBits, int value)
+    {
+        for (int i = 0; i < numberOfBits; i++)
+        {
+            const int bit = bitOffset + i;
+            const auto mask = (juce::uint8)(1 << (7 - (bit & 7)));
+            if ((value >> (numberOfBits - 1 - i)) & 1) data[bit >> 3] |= mask;
+            else                                       data[bit >> 3] &= (juce::uint8)~mask;
+        }
+    }
+    // CRC-16 over the last two header bytes and the side info
+    static int computeCrc(const juce::uint8* frame, int sideInfoLength)
+    {
+        int crc = 0xffff;
+        auto add = [&crc](juce::uint8 byte)
+        {
+            for (int bit = 7; bit >= 0; bit--)
+            {
+                const bool top = ((crc >> 15) ^ (byte >> bit)) & 1;
+                crc = (crc << 1) & 0xffff;
+                if (top) crc ^= 0x8005;
+            }
+        };
+        add(frame[2]);
+        add(frame[3]);
+        for (int i = 0; i < sideInfoLength; i++) add(frame[6 + i]);
+        return crc;
+    }
+
+    // One frame per entry of gains, four granules each. A gain of -1 makes a
+    // granule without coded data, its gain stays 0.
+    static juce::MemoryBlock createFrames(const std::vector<std::array<int, 4>>& gains, bool withCrc)
+    {
+        juce::MemoryBlock data((size_t)frameLength * gains.size(), true);
+        auto* bytes = static_cast<juce::uint8*>(data.getData());
+
+        for (size_t f = 0; f < gains.size(); f++)
+        {
+            auto* frame = bytes + f * (size_t)frameLength;
+            frame[0] = 0xff;
+            frame[1] = withCrc ? 0xfa : 0xfb;
+            frame[2] = 0x90;
+            frame[3] = 0x00;
+
+            auto* sideInfo = frame + (withCrc ? 6 : 4);
+            for (int g = 0; g < 4; g++)
+            {
+                const int start = firstGranuleBit + g * granuleBits;
+                const bool silent = gains[f][(size_t)g] < 0;
+                writeBits(sideInfo, start, 12, silent ? 0 : 1000);
+                writeBits(sideInfo, start + 21, 8, silent ? 0 : gains[f][(size_t)g]);
+            }
+            // Something that is not silence where the audio would be
+            for (int i = 60; i < frameLength; i++) frame[i] = (juce::uint8)(i * 7 + f);
+
+            if (withCrc)
+            {
+                const int crc = computeCrc(frame, 32);
+                frame[4] = (juce::uint8)(crc >> 8);
+                frame[5] = (juce::uint8)(crc & 0xff);
+            }
+        }
+        return data;
+    }
+    // An ID3v2.3 tag with a title and the TXXX frames of fields
+    static juce::MemoryBlock createTag(const juce::StringPairArray& fields)
+    {
+        juce::MemoryOutputStream frames;
+        auto addFrame = [&frames](const char* id, const juce::MemoryBlock& body)
+        {
+            frames.write(id, 4);
+            frames.writeIntBigEndian((int)body.getSize());
+            frames.writeShort(0);
+            frames.write(body.getData(), body.getSize());
+        };
+
+        juce::MemoryOutputStream title;
+        title.writeByte(0);
+        title.write("Test tone", 9);
+        addFrame("TIT2", title.getMemoryBlock());
+
+        for (const auto& key : fields.getAllKeys())
+        {
+            juce::MemoryOutputStream body;
+            body.writeByte(0);
+            body.write(key.toRawUTF8(), key.getNumBytesAsUTF8());
+            body.writeByte(0);
+            body.write(fields[key].toRawUTF8(), fields[key].getNumBytesAsUTF8());
+            addFrame("TXXX", body.getMemoryBlock());
+        }
+
+        juce::MemoryOutputStream tag;
+        tag.write("ID3", 3);
+        tag.writeByte(3);
+        tag.writeByte(0);
+        tag.writeByte(0);
+        const auto size = (int)frames.getDataSize();
+        for (int shift = 21; shift >= 0; shift -= 7) tag.writeByte((char)((size >> shift) & 0x7f));
+        tag << frames.getMemoryBlock();
+        return tag.getMemoryBlock();
+    }
+
+    // The global_gain of every granule of every frame in a file of frames
+    static std::vector<int> readGains(const juce::MemoryBlock& frames, bool withCrc)
+    {
+        std::vector<int> gains;
+        const auto* bytes = static_cast<const juce::uint8*>(frames.getData());
+        for (size_t offset = 0; offset + frameLength <= frames.getSize(); offset += frameLength)
+        {
+            const auto* sideInfo = bytes + offset + (withCrc ? 6 : 4);
+            for (int g = 0; g < 4; g++)
+                gains.push_back(readBits(sideInfo, firstGranuleBit + g * granuleBits + 21, 8));
+        }
+        return gains;
+    }
+
+    juce::File mDirectory;
+};
+
+//==============================================================================
+
+TEST_F(Mp3GainWriterTest, StepRangeKeepsEveryGranuleValid)
+{
+    norm::Mp3GainWriter mp3(createFrames({ { 100, 120, 140, 160 }, { 180, 200, -1, 150 } }, false));
+    ASSERT_TRUE(mp3.isValid());
+    EXPECT_EQ(mp3.getNumberOfFrames(), 2);
+    EXPECT_EQ(mp3.getStepRange(), juce::Range<int>(-100, 55));
+
+    // Nothing but silence: there is nothing to move
+    norm::Mp3GainWriter silent(createFrames({ { -1, -1, -1, -1 } }, false));
+    ASSERT_TRUE(silent.isValid());
+    EXPECT_TRUE(silent.getStepRange().isEmpty());
+
+    // Not an MP3 at all
+    juce::MemoryBlock text(4000);
+    text.fillWith('a');
+    EXPECT_FALSE(norm::Mp3GainWriter(text).isValid());
+}
+
+TEST_F(Mp3GainWriterTest, MovesGlobalGainAndNothingElse)
+{
+    for (const bool withCrc : { false, true })
+    {
+        const auto frames = createFrames({ { 100, 120, 140, 160 }, { 180, 200, -1, 150 } }, withCrc);
+        // Junk before the first frame stays where it is
+        juce::MemoryBlock source("junk", 4);
+        source.append(frames.getData(), frames.getSize());
+
+        const auto target = mDirectory.getChildFile("moved.mp3");
+        norm::Mp3GainWriter mp3(source);
+        ASSERT_TRUE(mp3.write(target, 3, {}));
+        // Out of range, some granule would wrap around
+        EXPECT_FALSE(mp3.write(mDirectory.getChildFile("wrapped.mp3"), 56, {}));
+        EXPECT_FALSE(mDirectory.getChildFile("wrapped.mp3").exists());
+
+        juce::MemoryBlock written;
+        ASSERT_TRUE(target.loadFileAsData(written));
+        // Without fields, the new tag is only a header
+        ASSERT_EQ(written.getSize(), source.getSize() + 10);
+        EXPECT_EQ(std::memcmp(written.begin() + 10, "junk", 4), 0);
+
+        const juce::MemoryBlock result(written.begin() + 14, frames.getSize());
+        EXPECT_EQ(readGains(result, withCrc),
+                  std::vector<int>({ 103, 123, 143, 163, 183, 203, 0, 153 }));
+
+        const auto* before = static_cast<const juce::uint8*>(frames.getData());
+        const auto* after = static_cast<const juce::uint8*>(result.getData());
+        const int sideInfoEnd = (withCrc ? 6 : 4) + 32;
+        for (size_t i = 0; i < frames.getSize(); i++)
+        {
+            if ((int)(i % frameLength) < sideInfoEnd) continue;
+            ASSERT_EQ(before[i], after[i]) << "byte " << i;
+        }
+        if (withCrc)
+        {
+            for (size_t offset = 0; offset < result.getSize(); offset += frameLength)
+            {
+                const auto* frame = after + offset;
+                EXPECT_EQ((frame[4] << 8) | frame[5], computeCrc(frame, 32));
+            }
+        }
+    }
+}
+
+TEST_F(Mp3GainWriterTest, FieldsReplaceTheirFrames)
+{
+    juce::StringPairArray existing;
+    existing.set("replaygain_album_gain", "-4.00 dB");
+    existing.set("MusicBrainz Album Id", "1234");
+
+    auto source = createTag(existing);
+    const auto frames = createFrames({ { 100, 120, 140, 160 } }, false);
+    source.append(frames.getData(), frames.getSize());
+
+    {
+        juce::MemoryInputStream stream(source, false);
+        const auto fields = norm::Mp3GainWriter::readFields(stream);
+        EXPECT_EQ(fields["MusicBrainz Album Id"], "1234");
+    }
+
+    juce::StringPairArray fields;
+    fields.set(norm::GainModel::RecordField,
+               norm::GainModel::toString({ -17.25f, -6.75f, -0.73f }));
+    fields.set(norm::GainModel::TrackGainField, "-0.73 dB");
+    // Empty removes
+    fields.set(norm::GainModel::AlbumGainField, {});
+
+    norm::Mp3GainWriter mp3(source);
+    ASSERT_TRUE(mp3.canWriteTag());
+    const auto target = mDirectory.getChildFile("tagged.mp3");
+    ASSERT_TRUE(mp3.write(target, -4, fields));
+
+    std::unique_ptr<juce::InputStream> stream = target.createInputStream();
+    ASSERT_NE(stream, nullptr);
+    const auto written = norm::Mp3GainWriter::readFields(*stream);
+    EXPECT_EQ(written[norm::GainModel::RecordField], fields[norm::GainModel::RecordField]);
+    EXPECT_EQ(written[norm::GainModel::TrackGainField], "-0.73 dB");
+    EXPECT_FALSE(written.containsKey(norm::GainModel::AlbumGainField));
+    EXPECT_EQ(written["MusicBrainz Album Id"], "1234");
+
+    juce::MemoryBlock data;
+    ASSERT_TRUE(target.loadFileAsData(data));
+    EXPECT_TRUE(data.toString().contains("Test tone"));
+
+    // Written again, the frames are found after the new tag
+    norm::Mp3GainWriter again(data);
+    ASSERT_TRUE(again.isValid());
+    EXPECT_EQ(again.getNumberOfFrames(), 1);
+    EXPECT_EQ(again.getStepRange(), juce::Range<int>(-96, 99));
+}
@@ -0,0 +1,118 @@
+/*  Tests for the mirror output tree: path mapping, cloning, and a batch that
+    writes into the mirror without touching the originals.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/BatchEngine.h>
+#include <processor/OutputTree.h>
+
+class OutputTreeTest : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        mSource = juce::File::createTempFile("source");
+        mOutput = juce::File::createTempFile("output");
+        ASSERT_TRUE(mSource.createDirectory());
+    }
+    void TearDown() override
+    {
+        mSource.deleteRecursively();
+        mOutput.deleteRecursively();
+    }
+
+    static bool haveSameContent(const juce::File& a, const juce::File& b)
+    {
+        juce::MemoryBlock first, second;
+        return a.loadFileAsData(first) && b.loadFileAsData(second) && first == second;
+    }
+
+    juce::File mSource;
+    juce::File mOutput;
+};
+
+//==============================================================================
+
+TEST_F(OutputTreeTest, MirrorsRelativePaths)
+{
+    const norm::OutputTree tree(mSource, mOutput);
+    ASSERT_TRUE(tree.isEnabled());
+
+    EXPECT_EQ(tree.getOutputFile(mSource.getChildFile("album/cd1/track.wav")),
+              mOutput.getChildFile("album/cd1/track.wav"));
+    // No place in the mirror for anything else
+    EXPECT_EQ(tree.getOutputFile(mOutput.getChildFile("track.wav")), juce::File());
+
+    // Nor for the mirror itself when it lives inside the source
+    const norm::OutputTree nested(mSource, mSource.getChildFile("normalised"));
+    EXPECT_EQ(nested.getOutputFile(mSource.getChildFile("normalised/track.wav")), juce::File());
+
+    EXPECT_FALSE(norm::OutputTree(mSource, juce::File()).isEnabled());
+}
+
+TEST_F(OutputTreeTest, CloneIsIdenticalAndReplacesTarget)
+{
+    const auto source = mSource.getChildFile("track.wav");
+    ASSERT_TRUE(juce::File(TEST_AUDIO_DIR).getChildFile("HomeMade_997Hz_20LKFS.wav").copyFileTo(source));
+
+    const auto target = mOutput.getChildFile("a/b/track.wav");
+    ASSERT_TRUE(target.getParentDirectory().createDirectory());
+    ASSERT_TRUE(target.replaceWithText("stale"));
+
+    // Whichever method the file system allows
+    for (const bool allowHardlink : { false, true })
+    {
+        const auto method = norm::OutputTree::clone(source, target, allowHardlink);
+        ASSERT_TRUE(method.has_value());
+        if (!allowHardlink) EXPECT_NE(*method, norm::OutputTree::CloneMethod::hardlink);
+        EXPECT_TRUE(haveSameContent(source, target));
+    }
+
+    // No temporary files left behind
+    EXPECT_EQ(target.getParentDirectory().getNumberOfChildFiles(juce::File::findFiles), 1);
+}
+
+TEST_F(OutputTreeTest, BatchLeavesOriginalsAlone)
+{
+    const juce::File dir(TEST_AUDIO_DIR);
+    const juce::Array<juce::File> files { mSource.getChildFile("a/gated.wav"),
+                                          mSource.getChildFile("b/ontarget.wav") };
+    ASSERT_TRUE(mSource.getChildFile("a").createDirectory());
+    ASSERT_TRUE(mSource.getChildFile("b").createDirectory());
+    ASSERT_TRUE(dir.getChildFile("1770-2_Comp_RelGateTest.wav").copyFileTo(files[0]));
+    ASSERT_TRUE(dir.getChildFile("HomeMade_997Hz_20LKFS.wav").copyFileTo(files[1]));
+
+    juce::TemporaryFile original0, original1;
+    ASSERT_TRUE(files[0].copyFileTo(original0.getFile()));
+    ASSERT_TRUE(files[1].copyFileTo(original1.getFile()));
+
+    // The second file is on target already and only needs cloning
+    norm::AnalysisEngine analysis;
+    const float onTarget = analysis.analyse(files[1]).integratedLoudness;
+
+    norm::BatchEngine::Options options;
+    options.mode = norm::BatchEngine::Mode::normalise;
+    options.targetLoudness = onTarget;
+    options.numberOfWorkers = 2;
+    options.sourceDirectory = mSource;
+    options.outputDirectory = mOutput;
+
+    norm::BatchEngine engine(options);
+    const auto results = engine.run(files);
+    ASSERT_EQ(results.size(), 2u);
+    for (const auto& result : results)
+        EXPECT_EQ(result.status, norm::FileStatus::verified) << result.file.getFileName();
+
+    EXPECT_TRUE(haveSameContent(files[0], original0.getFile()));
+    EXPECT_TRUE(haveSameContent(files[1], original1.getFile()));
+
+    const auto gatedOut = mOutput.getChildFile("a/gated.wav");
+    const auto onTargetOut = mOutput.getChildFile("b/ontarget.wav");
+    ASSERT_TRUE(gatedOut.existsAsFile());
+    ASSERT_TRUE(onTargetOut.existsAsFile());
+
+    EXPECT_TRUE(haveSameContent(onTargetOut, files[1]));
+    EXPECT_NEAR(analysis.analyse(gatedOut).integratedLoudness, onTarget, 0.1f);
+}
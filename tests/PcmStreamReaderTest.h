@@ -0,0 +1,199 @@
+/*  Tests for analysing streams: a WAV file fed through a stream that cannot
+    seek, as from a pipe, must measure the same as the file itself, and so
+    must its samples as raw PCM. Headers no buffer should be sized by are
+    rejected.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/AnalysisEngine.h>
+#include <processor/PcmStreamReader.h>
+
+class PcmStreamReaderTest : public testing::Test
+{
+protected:
+    // A pipe: refuses to seek, and hands out odd sized pieces
+    class PipeStream : public juce::InputStream
+    {
+    public:
+        explicit PipeStream(const juce::MemoryBlock& data) : mSource(data, false) {}
+
+        juce::int64 getTotalLength() override { return -1; }
+        bool isExhausted() override { return mSource.isExhausted(); }
+        int read(void* dest, int size) override { return mSource.read(dest, juce::jmin(size, 1000)); }
+        juce::int64 getPosition() override { return mSource.getPosition(); }
+        bool setPosition(juce::int64 position) override
+        {
+            EXPECT_EQ(position, mSource.getPosition());
+            return position == mSource.getPosition();
+        }
+
+    private:
+        juce::MemoryInputStream mSource;
+    };
+
+    static juce::File getTestFile()
+    {
+        return juce::File(TEST_AUDIO_DIR).getChildFile("HomeMade_997Hz_20LKFS.wav");
+    }
+    static juce::MemoryBlock loadTestFile()
+    {
+        juce::MemoryBlock data;
+        EXPECT_TRUE(getTestFile().loadFileAsData(data));
+        return data;
+    }
+
+    // The samples after the 44 byte header of the test file
+    static juce::MemoryBlock getSamples(const juce::MemoryBlock& wav)
+    {
+        return juce::MemoryBlock(static_cast<const char*>(wav.getData()) + 44, wav.getSize() - 44);
+    }
+
+    norm::AnalysisEngine mEngine;
+};
+
+//==============================================================================
+
+TEST_F(PcmStreamReaderTest, WavStreamMatchesFile)
+{
+    const auto expected = mEngine.analyse(getTestFile());
+    ASSERT_TRUE(expected.ok);
+
+    const auto wav = loadTestFile();
+    PipeStream pipe(wav);
+    auto reader = norm::PcmStreamReader::createForWav(pipe);
+    ASSERT_NE(reader, nullptr);
+    EXPECT_EQ(reader->getFormat().sampleRate, 48000.0);
+    EXPECT_EQ(reader->getFormat().numberOfChannels, 2);
+    EXPECT_EQ(reader->getFormat().sampleFormat, norm::PcmStreamReader::SampleFormat::int16);
+
+    const auto result = mEngine.analyseStream(*reader);
+    ASSERT_TRUE(result.ok);
+    EXPECT_EQ(result.blocksRead, expected.blocksRead);
+    EXPECT_EQ(result.lengthInSamples, expected.lengthInSamples);
+    EXPECT_FLOAT_EQ(result.integratedLoudness, expected.integratedLoudness);
+    EXPECT_FLOAT_EQ(result.samplePeak, expected.samplePeak);
+}
+
+TEST_F(PcmStreamReaderTest, UnknownSizeReadsToTheEnd)
+{
+    const auto expected = mEngine.analyse(getTestFile());
+    ASSERT_TRUE(expected.ok);
+
+    // As ffmpeg writes it to a pipe: no sizes, and a chunk before the data
+    const auto samples = getSamples(loadTestFile());
+    juce::MemoryOutputStream wav;
+    wav.write("RIFF", 4);
+    wav.writeInt(-1);
+    wav.write("WAVE", 4);
+    wav.write("fmt ", 4);
+    wav.writeInt(16);
+    wav.writeShort(1);
+    wav.writeShort(2);
+    wav.writeInt(48000);
+    wav.writeInt(48000 * 4);
+    wav.writeShort(4);
+    wav.writeShort(16);
+    wav.write("LIST", 4);
+    wav.writeInt(3);
+    wav.write("abc\0", 4);
+    wav.write("data", 4);
+    wav.writeInt(-1);
+    wav << samples;
+
+    PipeStream pipe(wav.getMemoryBlock());
+    auto reader = norm::PcmStreamReader::createForWav(pipe);
+    ASSERT_NE(reader, nullptr);
+
+    const auto result = mEngine.analyseStream(*reader);
+    ASSERT_TRUE(result.ok);
+    EXPECT_EQ(result.lengthInSamples, expected.lengthInSamples);
+    EXPECT_FLOAT_EQ(result.integratedLoudness, expected.integratedLoudness);
+}
+
+TEST_F(PcmStreamReaderTest, RawPcmMatchesFile)
+{
+    const auto expected = mEngine.analyse(getTestFile());
+    ASSERT_TRUE(expected.ok);
+
+    PipeStream pipe(getSamples(loadTestFile()));
+    norm::PcmStreamReader::Format format;
+    format.sampleRate = 48000;
+    format.numberOfChannels = 2;
+    format.sampleFormat = *norm::PcmStreamReader::parseSampleFormat("s16le");
+    norm::PcmStreamReader reader(pipe, format);
+
+    const auto result = mEngine.analyseStream(reader);
+    ASSERT_TRUE(result.ok);
+    EXPECT_EQ(result.blocksRead, expected.blocksRead);
+    EXPECT_FLOAT_EQ(result.integratedLoudness, expected.integratedLoudness);
+}
+
+TEST_F(PcmStreamReaderTest, SampleFormatsConvert)
+{
+    // Half scale, negative half scale, in every format
+    const juce::uint8 bytes[] = {
+        0xc0, 0x40,
+        0x00, 0x40, 0x00, 0xc0,
+        0x00, 0x00, 0x40, 0x00, 0x00, 0xc0,
+        0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0xc0,
+        0x00, 0x00, 0x00, 0x3f, 0x00, 0x00, 0x00, 0xbf,
+    };
+    juce::MemoryInputStream stream(bytes, sizeof(bytes), false);
+
+    juce::AudioBuffer<float> buffer(1, 2);
+    for (const auto* name : { "u8", "s16le", "s24le", "s32le", "f32le" })
+    {
+        norm::PcmStreamReader::Format format;
+        format.sampleRate = 48000;
+        format.numberOfChannels = 1;
+        format.sampleFormat = *norm::PcmStreamReader::parseSampleFormat(name);
+        norm::PcmStreamReader reader(stream, format);
+
+        ASSERT_EQ(reader.read(buffer, 2), 2) << name;
+        EXPECT_EQ(buffer.getSample(0, 0), 0.5f) << name;
+        EXPECT_EQ(buffer.getSample(0, 1), -0.5f) << name;
+    }
+
+    EXPECT_FALSE(norm::PcmStreamReader::parseSampleFormat("s16be").has_value());
+}
+
+TEST_F(PcmStreamReaderTest, NotWavIsRejected)
+{
+    const char text[] = "This is not a WAV stream at all";
+    juce::MemoryInputStream stream(text, sizeof(text), false);
+    EXPECT_EQ(norm::PcmStreamReader::createForWav(stream), nullptr);
+}
+
+TEST_F(PcmStreamReaderTest, BrokenHeaderIsRejected)
+{
+    // The fmt chunk of the test file's 44 byte header starts at 20
+    auto createWithHeader = [this](int numberOfChannels, int blockAlign)
+    {
+        auto wav = loadTestFile();
+        auto* fmt = static_cast<juce::uint8*>(wav.getData()) + 20;
+        auto write16 = [](juce::uint8* dest, int value)
+        {
+            dest[0] = (juce::uint8)(value & 0xff);
+            dest[1] = (juce::uint8)((value >> 8) & 0xff);
+        };
+        write16(fmt + 2, numberOfChannels);
+        write16(fmt + 12, blockAlign);
+
+        PipeStream stream(wav);
+        return norm::PcmStreamReader::createForWav(stream);
+    };
+
+    EXPECT_NE(createWithHeader(2, 4), nullptr);
+    // A frame size that matches, but far too many channels to allocate for
+    EXPECT_EQ(createWithHeader(30000, 60000), nullptr);
+    EXPECT_EQ(createWithHeader(0, 0), nullptr);
+    // Frames that do not match the channels and sample size
+    EXPECT_EQ(createWithHeader(2, 6), nullptr);
+
+    // Raw PCM with an impossible format is not valid either
+    juce::MemoryInputStream raw(nullptr, 0, false);
+    EXPECT_FALSE(norm::PcmStreamReader(raw, { 48000, 1000 }).isValid());
+    EXPECT_FALSE(norm::PcmStreamReader(raw, { 1e9, 2 }).isValid());
+}
@@ -0,0 +1,184 @@
+/*  Tests for keeping audio in its file's sample format: every value a reader
+    can produce survives the packing, and the write stage gets the same
+    samples out of the store as out of a float buffer, and a file written
+    back from the store is the file that was read, to the last sample.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/FileHandler.h>
+#include <processor/SampleStore.h>
+#include <processor/WriteStage.h>
+#include <cmath>
+#include <vector>
+
+TEST(SampleStoreTest, FormatFollowsTheReader)
+{
+    using Format = norm::SampleStore::Format;
+    EXPECT_EQ(norm::SampleStore::getFormatFor(8, false), Format::int16);
+    EXPECT_EQ(norm::SampleStore::getFormatFor(16, false), Format::int16);
+    EXPECT_EQ(norm::SampleStore::getFormatFor(24, false), Format::int24);
+    EXPECT_EQ(norm::SampleStore::getFormatFor(32, false), Format::float32);
+    EXPECT_EQ(norm::SampleStore::getFormatFor(32, true), Format::float32);
+
+    norm::SampleStore store;
+    store.setSize(2, 48000, Format::int16);
+    EXPECT_EQ(store.getSizeInBytes(), 2u * 48000u * 2u);
+    store.setSize(2, 48000, Format::int24);
+    EXPECT_EQ(store.getSizeInBytes(), 2u * 48000u * 3u);
+    store.clear();
+    EXPECT_EQ(store.getSizeInBytes(), 0u);
+}
+
+TEST(SampleStoreTest, Int16RoundTripIsExact)
+{
+    // Every 16 bit value, as a reader converts it
+    std::vector<float> source(65536);
+    for (int i = 0; i < 65536; i++) source[(size_t)i] = (float)(i - 32768) / 32768.f;
+
+    std::vector<char> packed(source.size() * 2);
+    std::vector<float> result(source.size());
+    norm::SampleStore::pack(source.data(), packed.data(), 65536, norm::SampleStore::Format::int16);
+    norm::SampleStore::unpack(packed.data(), result.data(), 65536, norm::SampleStore::Format::int16);
+
+    for (size_t i = 0; i < source.size(); i++) ASSERT_EQ(result[i], source[i]);
+}
+
+TEST(SampleStoreTest, Int24RoundTripIsExact)
+{
+    std::vector<float> source;
+    for (int value = -8388608; value < 8388608; value += 4093) source.push_back((float)value / 8388608.f);
+    source.push_back(8388607.f / 8388608.f);
+    source.push_back(-1.f / 8388608.f);
+
+    const int numSamples = (int)source.size();
+    std::vector<char> packed(source.size() * 3);
+    std::vector<float> result(source.size());
+    norm::SampleStore::pack(source.data(), packed.data(), numSamples, norm::SampleStore::Format::int24);
+    norm::SampleStore::unpack(packed.data(), result.data(), numSamples, norm::SampleStore::Format::int24);
+
+    for (size_t i = 0; i < source.size(); i++) ASSERT_EQ(result[i], source[i]);
+
+    // Out of range saturates instead of wrapping
+    const float loud[] = { 1.5f, -1.5f };
+    float clipped[2];
+    norm::SampleStore::pack(loud, packed.data(), 2, norm::SampleStore::Format::int24);
+    norm::SampleStore::unpack(packed.data(), clipped, 2, norm::SampleStore::Format::int24);
+    EXPECT_EQ(clipped[0], 8388607.f / 8388608.f);
+    EXPECT_EQ(clipped[1], -1.f);
+}
+
+TEST(SampleStoreTest, BlocksGoInAndComeOut)
+{
+    const int blockSize = 4800;
+    juce::AudioBuffer<float> block(2, blockSize);
+
+    norm::SampleStore store;
+    store.setSize(2, 3 * blockSize, norm::SampleStore::Format::int16);
+    for (int index = 0; index < 3; index++)
+    {
+        for (int i = 0; i < blockSize; i++)
+        {
+            block.setSample(0, i, (float)((i + index) % 200 - 100) / 32768.f);
+            block.setSample(1, i, (float)(-index - 1) / 4.f);
+        }
+        store.write(block, (juce::int64)index * blockSize, blockSize);
+    }
+
+    std::vector<float> channel(blockSize);
+    store.read(1, blockSize, blockSize, channel.data());
+    for (float sample : channel) ASSERT_EQ(sample, -0.5f);
+    store.read(0, 2 * blockSize, blockSize, channel.data());
+    for (int i = 0; i < blockSize; i++) ASSERT_EQ(channel[(size_t)i], (float)((i + 2) % 200 - 100) / 32768.f);
+
+    EXPECT_EQ(store.getMagnitude(), 0.75f);
+}
+
+TEST(SampleStoreTest, WritesLikeAFloatBuffer)
+{
+    // 24 bit samples, so that the store packs them
+    const int numSamples = 20000;
+    juce::AudioBuffer<float> buffer(2, numSamples);
+    for (int i = 0; i < numSamples; i++)
+    {
+        buffer.setSample(0, i, std::round(4000000.f * std::sin(0.01f * (float)i)) / 8388608.f);
+        buffer.setSample(1, i, (float)(i % 1000) / 8388608.f);
+    }
+
+    norm::SampleStore store;
+    store.setSize(2, numSamples, norm::SampleStore::Format::int24);
+    store.write(buffer, 0, numSamples);
+
+    auto render = [](const auto& source)
+    {
+        juce::MemoryBlock block;
+        juce::WavAudioFormat format;
+        std::unique_ptr<juce::AudioFormatWriter> writer(
+            format.createWriterFor(new juce::MemoryOutputStream(block, false),
+                                   48000, 2, 24, {}, 0));
+        EXPECT_NE(writer, nullptr);
+
+        norm::WriteStage stage;
+        stage.setDitherEnabled(false);
+        EXPECT_TRUE(stage.write(*writer, source, 0, numSamples, 0.7f));
+        writer.reset();
+        return block;
+    };
+
+    EXPECT_TRUE(render(buffer) == render(store));
+}
+
+TEST(SampleStoreTest, PartialLastBlockIsWrittenBack)
+{
+    // 2.05s: the last 50ms are not a whole block
+    const int numSamples = 98400;
+    juce::AudioBuffer<float> buffer(2, numSamples);
+    for (int i = 0; i < numSamples; i++)
+    {
+        buffer.setSample(0, i, (float)(i % 2000 - 1000) / 32768.f);
+        buffer.setSample(1, i, (float)(1000 - i % 1500) / 32768.f);
+    }
+
+    const auto directory = juce::File::createTempFile("store");
+    ASSERT_TRUE(directory.createDirectory());
+    const auto source = directory.getChildFile("source.wav");
+    const auto target = directory.getChildFile("target.wav");
+    {
+        juce::WavAudioFormat format;
+        std::unique_ptr<juce::AudioFormatWriter> writer(
+            format.createWriterFor(source.createOutputStream().release(), 48000, 2, 16, {}, 0));
+        ASSERT_NE(writer, nullptr);
+        ASSERT_TRUE(writer->writeFromAudioSampleBuffer(buffer, 0, numSamples));
+    }
+
+    norm::FileHandler handler;
+    ASSERT_TRUE(handler.openFile(source));
+    juce::AudioBuffer<float> block(2, 4800);
+    int blocks = 0;
+    while (handler.readNextBlock(&block)) blocks++;
+    EXPECT_EQ(blocks, 20);
+
+    handler.getWriteStage().setDitherEnabled(false);
+    handler.setLoudnessRecord({ -20.f, 0.f, 0.f });
+    ASSERT_TRUE(handler.writeFile(target));
+
+    juce::AudioFormatManager manager;
+    manager.registerBasicFormats();
+    std::unique_ptr<juce::AudioFormatReader> reader(manager.createReaderFor(target));
+    ASSERT_NE(reader, nullptr);
+    ASSERT_EQ(reader->lengthInSamples, numSamples);
+
+    juce::AudioBuffer<float> result(2, numSamples);
+    ASSERT_TRUE(reader->read(&result, 0, numSamples, 0, true, true));
+    for (int ch = 0; ch < 2; ch++)
+    {
+        for (int i = 0; i < numSamples; i++)
+        {
+            ASSERT_EQ(result.getSample(ch, i), buffer.getSample(ch, i)) << ch << " " << i;
+        }
+    }
+
+    reader.reset();
+    directory.deleteRecursively();
+}
@@ -0,0 +1,74 @@
+/*  Makespan of a batch that mixes one long recording with many short clips,
+    the long one last in the list: taken in the order they come and whole,
+    against longest first with the long file split into segments.
+*/
+
+#pragma once
+
+#include "BenchUtil.h"
+#include <processor/BatchEngine.h>
+
+class ScheduleBench : public testing::Test
+{
+protected:
+    static void SetUpTestSuite()
+    {
+        sDirectory = juce::File::createTempFile("schedulebench");
+        ASSERT_TRUE(sDirectory.createDirectory());
+
+        juce::Random random(7);
+        auto writeFile = [&](const juce::String& name, int numSamples)
+        {
+            juce::AudioBuffer<float> buffer(1, numSamples);
+            for (int s = 0; s < numSamples; s++)
+                buffer.setSample(0, s, 0.1f * (random.nextFloat() * 2.f - 1.f));
+
+            const auto file = sDirectory.getChildFile(name);
+            juce::WavAudioFormat format;
+            std::unique_ptr<juce::OutputStream> stream = file.createOutputStream();
+            std::unique_ptr<juce::AudioFormatWriter> writer(
+                format.createWriterFor(stream.get(), 48000.0, 1, 16, {}, 0));
+            ASSERT_NE(writer, nullptr);
+            // Owned by the writer now
+            stream.release();
+            writer->writeFromAudioSampleBuffer(buffer, 0, numSamples);
+            sFiles.add(file);
+        };
+
+        // Half a second each, then ten minutes
+        for (int i = 0; i < 500; i++) writeFile("clip" + juce::String(i) + ".wav", 24000);
+        writeFile("long.wav", 10 * 60 * 48000);
+    }
+    static void TearDownTestSuite()
+    {
+        sDirectory.deleteRecursively();
+        sFiles.clear();
+    }
+
+    static inline juce::File sDirectory;
+    static inline juce::Array<juce::File> sFiles;
+};
+
+TEST_F(ScheduleBench, LongFileAmongClips)
+{
+    norm::BatchEngine::Options options;
+    options.mode = norm::BatchEngine::Mode::analyse;
+
+    options.scheduleBySize = false;
+    options.segmentSeconds = 0;
+    const double inOrder = bench::measureBest([&]
+    {
+        EXPECT_EQ(norm::BatchEngine(options).run(sFiles).size(), (size_t)sFiles.size());
+    }, 3);
+
+    options.scheduleBySize = true;
+    options.segmentSeconds = 30.0;
+    const double scheduled = bench::measureBest([&]
+    {
+        EXPECT_EQ(norm::BatchEngine(options).run(sFiles).size(), (size_t)sFiles.size());
+    }, 3);
+
+    bench::report("in_order_makespan", inOrder, "s");
+    bench::report("scheduled_makespan", scheduled, "s");
+    bench::report("speedup", inOrder / scheduled, "x");
+}
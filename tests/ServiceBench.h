@@ -0,0 +1,68 @@
+/*  Requests per second through the analysis service: short clips handed over
+    in shared memory, in batches, the way a pipeline would keep a resident
+    analyser busy instead of starting one per file.
+*/
+
+#pragma once
+
+#include "BenchUtil.h"
+#include <processor/AnalysisService.h>
+
+TEST(ServiceBench, SharedMemoryClips)
+{
+    if (!norm::AnalysisService::isAvailable()) GTEST_SKIP() << "No Unix domain sockets";
+
+    // tmpfs where there is one, the samples never touch a disk then
+    const juce::File shm("/dev/shm");
+    const auto directory = (shm.isDirectory() ? shm : juce::File::getSpecialLocation(juce::File::tempDirectory))
+                               .getNonexistentChildFile("servicebench", {});
+    ASSERT_TRUE(directory.createDirectory());
+
+    // 100 clips of 50ms, mono float, one after the other in one file
+    const int clips = 100;
+    const int clipSamples = 2400;
+    juce::Random random(3);
+    juce::MemoryOutputStream stream;
+    for (int i = 0; i < clips * clipSamples; i++) stream.writeFloat(0.1f * (random.nextFloat() * 2.f - 1.f));
+    const auto samples = directory.getChildFile("clips.pcm");
+    ASSERT_TRUE(samples.replaceWithData(stream.getData(), stream.getDataSize()));
+
+    norm::AnalysisService service({});
+    ASSERT_TRUE(service.start(directory.getChildFile("analysis.sock")));
+    norm::AnalysisClient client;
+    ASSERT_TRUE(client.connect(directory.getChildFile("analysis.sock")));
+
+    std::vector<norm::service::Request> batch(1000);
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        batch[i].kind = norm::service::Kind::analyseSamples;
+        batch[i].file = samples;
+        batch[i].format = { 48000, 1, norm::PcmStreamReader::SampleFormat::float32 };
+        batch[i].offset = (juce::int64)(i % clips) * clipSamples * 4;
+        batch[i].size = clipSamples * 4;
+    }
+
+    const double batchTime = bench::measureBest([&]
+    {
+        const auto responses = client.submit(batch);
+        ASSERT_TRUE(responses.has_value());
+        for (const auto& response : *responses) ASSERT_TRUE(response.ok);
+    }, 5);
+
+    // One at a time: the round trip a single tool would see
+    std::vector<double> latencies;
+    for (int i = 0; i < 200; i++)
+    {
+        latencies.push_back(bench::measureBest([&]
+        {
+            ASSERT_TRUE(client.submit({ batch[(size_t)i] }).has_value());
+        }, 1));
+    }
+
+    bench::report("batched_requests_per_second", (double)batch.size() / batchTime, "1/s");
+    bench::report("single_request_p50", 1e6 * bench::percentile(latencies, 0.5), "us");
+    bench::report("single_request_p99", 1e6 * bench::percentile(latencies, 0.99), "us");
+
+    service.stop();
+    directory.deleteRecursively();
+}
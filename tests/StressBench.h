@@ -0,0 +1,235 @@
+/*  Stress run of the decode - analyse - write pipeline: many AnalysisEngines
+    at once on synthetic files of every awkward kind, odd sample rates, 1 to
+    64 channels, truncated, empty and not audio at all. It is meant to be run
+    under the asan and tsan presets (see CMakePresets.json) as much as for
+    its numbers: a race or an overflow in the reader, the filters or the
+    write stage shows up here long before it does on a user's library.
+
+    NORM_STRESS_FILES and NORM_STRESS_THREADS override the defaults, the
+    sanitizer builds are several times slower.
+*/
+
+#pragma once
+
+#include "BenchUtil.h"
+#include <processor/BatchEngine.h>
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+class StressBench : public testing::Test
+{
+protected:
+    enum class Kind { valid, truncated, empty, notAudio };
+
+    struct SyntheticFile
+    {
+        juce::File file;
+        Kind kind = Kind::valid;
+        juce::int64 numberOfSamples = 0;
+    };
+
+    static int getSetting(const char* name, int fallback)
+    {
+        const char* value = std::getenv(name);
+        return value != nullptr ? juce::jmax(1, juce::String(value).getIntValue()) : fallback;
+    }
+
+    void SetUp() override
+    {
+        mDirectory = juce::File::createTempFile("stress");
+        ASSERT_TRUE(mDirectory.createDirectory());
+
+        juce::Random random(42);
+        const int numberOfFiles = getSetting("NORM_STRESS_FILES", 200);
+        for (int i = 0; i < numberOfFiles; i++) mFiles.push_back(createFile(i, random));
+    }
+    void TearDown() override
+    {
+        mDirectory.deleteRecursively();
+    }
+
+    SyntheticFile createFile(int index, juce::Random& random)
+    {
+        static const double sampleRates[] = { 7350, 8000, 11025, 22050, 37800, 44100,
+                                              48000, 88200, 96000, 176400, 192000 };
+        static const unsigned int bitDepths[] = { 16, 24, 32 };
+
+        SyntheticFile synthetic;
+        synthetic.file = mDirectory.getChildFile("file" + juce::String(index) + ".wav");
+
+        const int roll = random.nextInt(20);
+        synthetic.kind = roll == 0 ? Kind::empty
+                       : roll == 1 ? Kind::notAudio
+                       : roll < 4  ? Kind::truncated
+                                   : Kind::valid;
+
+        if (synthetic.kind == Kind::notAudio)
+        {
+            juce::MemoryBlock garbage((size_t)(16 + random.nextInt(4096)));
+            random.fillBitsRandomly(garbage.getData(), garbage.getSize());
+            synthetic.file.replaceWithData(garbage.getData(), garbage.getSize());
+            return synthetic;
+        }
+
+        const double sampleRate = sampleRates[random.nextInt(11)];
+        // Mostly the usual layouts, every fourth file anything up to 64
+        const int numberOfChannels = random.nextInt(4) == 0 ? 1 + random.nextInt(64)
+                                                            : 1 + random.nextInt(6);
+        // A few million samples per file at most, at least half a second
+        const double maxSeconds = juce::jlimit(0.5, 4.0, 2.0e6 / (numberOfChannels * sampleRate));
+        const double seconds = synthetic.kind == Kind::empty
+                             ? 0.0
+                             : 0.5 + (maxSeconds - 0.5) * random.nextDouble();
+        const int numSamples = (int)(seconds * sampleRate);
+        const float level = juce::Decibels::decibelsToGain(-50.f + 44.f * random.nextFloat());
+
+        juce::WavAudioFormat format;
+        auto stream = synthetic.file.createOutputStream();
+        std::unique_ptr<juce::AudioFormatWriter> writer(
+            format.createWriterFor(stream.get(),
+                                   sampleRate,
+                                   (unsigned int)numberOfChannels,
+                                   bitDepths[random.nextInt(3)],
+                                   {},
+                                   0));
+        if (writer == nullptr)
+        {
+            // Not a layout the writer takes, the reader will not take it either
+            synthetic.kind = Kind::notAudio;
+            return synthetic;
+        }
+        // Owned by the writer now
+        stream.release();
+
+        juce::AudioBuffer<float> buffer(numberOfChannels, 4096);
+        for (int offset = 0; offset < numSamples; offset += buffer.getNumSamples())
+        {
+            const int size = juce::jmin(buffer.getNumSamples(), numSamples - offset);
+            for (int ch = 0; ch < numberOfChannels; ch++)
+                for (int i = 0; i < size; i++)
+                    buffer.setSample(ch, i, level * (random.nextFloat() * 2.f - 1.f));
+            writer->writeFromAudioSampleBuffer(buffer, 0, size);
+        }
+        writer.reset();
+
+        synthetic.numberOfSamples = (juce::int64)numSamples * numberOfChannels;
+
+        if (synthetic.kind == Kind::truncated)
+        {
+            // Anywhere from inside the header to just before the end
+            juce::MemoryBlock data;
+            synthetic.file.loadFileAsData(data);
+            const auto size = (size_t)random.nextInt((int)data.getSize());
+            synthetic.file.replaceWithData(data.getData(), size);
+        }
+
+        return synthetic;
+    }
+
+    juce::File mDirectory;
+    std::vector<SyntheticFile> mFiles;
+};
+
+//==============================================================================
+
+TEST_F(StressBench, PipelineUnderConcurrency)
+{
+    const int numberOfThreads = getSetting("NORM_STRESS_THREADS",
+                                           (int)juce::jmax(2u, std::thread::hardware_concurrency()));
+
+    std::atomic<size_t> next { 0 };
+    std::atomic<int> validFailed { 0 };
+    std::atomic<int> invalidSucceeded { 0 };
+    std::atomic<juce::int64> samplesDone { 0 };
+    std::vector<std::vector<double>> latencies((size_t)numberOfThreads);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numberOfThreads; t++)
+    {
+        threads.emplace_back([&, t]
+        {
+            norm::AnalysisEngine engine;
+
+            for (size_t i = next++; i < mFiles.size(); i = next++)
+            {
+                const auto& synthetic = mFiles[i];
+
+                const auto fileStart = std::chrono::steady_clock::now();
+                const auto result = engine.normalise(synthetic.file, -23.f);
+                const std::chrono::duration<double> elapsed =
+                    std::chrono::steady_clock::now() - fileStart;
+                latencies[(size_t)t].push_back(elapsed.count());
+
+                // Truncated files may or may not have enough audio left
+                if (synthetic.kind == Kind::valid && !result.ok) validFailed++;
+                if ((synthetic.kind == Kind::empty || synthetic.kind == Kind::notAudio)
+                    && result.ok)
+                {
+                    invalidSucceeded++;
+                }
+                if (result.ok) samplesDone += synthetic.numberOfSamples;
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    const std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(validFailed, 0);
+    EXPECT_EQ(invalidSucceeded, 0);
+
+    std::vector<double> all;
+    for (const auto& perThread : latencies) all.insert(all.end(), perThread.begin(), perThread.end());
+    ASSERT_EQ(all.size(), mFiles.size());
+
+    bench::report("threads", numberOfThreads, "");
+    bench::report("throughput", (double)mFiles.size() / wall.count(), "files/s");
+    bench::report("throughput_samples", (double)samplesDone / wall.count() / 1e6, "Msamples/s");
+    bench::report("latency_p50", bench::percentile(all, 0.5) * 1000.0, "ms");
+    bench::report("latency_p99", bench::percentile(all, 0.99) * 1000.0, "ms");
+}
+
+TEST_F(StressBench, BatchEngineUnderConcurrency)
+{
+    juce::TemporaryFile journal(".journal");
+
+    norm::BatchEngine::Options options;
+    options.mode = norm::BatchEngine::Mode::normalise;
+    options.numberOfWorkers = getSetting("NORM_STRESS_THREADS",
+                                         (int)juce::jmax(2u, std::thread::hardware_concurrency()));
+    options.journalFile = journal.getFile();
+
+    juce::Array<juce::File> files;
+    for (const auto& synthetic : mFiles) files.add(synthetic.file);
+
+    std::atomic<int> callbacks { 0 };
+    std::vector<norm::BatchEngine::FileResult> results;
+    const double seconds = bench::measureBest([&]
+    {
+        norm::BatchEngine engine(options);
+        engine.setResultCallback([&](const norm::BatchEngine::FileResult&) { callbacks++; });
+        results = engine.run(files);
+    }, 1);
+
+    ASSERT_EQ(results.size(), mFiles.size());
+    EXPECT_EQ(callbacks, (int)mFiles.size());
+
+    for (const auto& result : results)
+    {
+        const auto synthetic = std::find_if(mFiles.begin(), mFiles.end(),
+                                            [&](const auto& s) { return s.file == result.file; });
+        ASSERT_NE(synthetic, mFiles.end());
+        if (synthetic->kind == Kind::valid)
+            EXPECT_EQ(result.status, norm::FileStatus::verified) << result.file.getFileName();
+    }
+
+    // Everything is in the journal now, a second run has nothing to do
+    norm::BatchEngine again(options);
+    EXPECT_TRUE(again.run(files).empty());
+
+    bench::report("batch_throughput", (double)mFiles.size() / seconds, "files/s");
+}
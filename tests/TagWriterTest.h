@@ -0,0 +1,285 @@
+/*  Tests for writing gain tags without touching the audio. The FLAC and Ogg
+    streams are made up here, headers with the audio frames standing in as
+    bytes, apart from the batch test which encodes a real FLAC file.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/BatchEngine.h>
+#include <processor/TagWriter.h>
+
+class TagWriterTest : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        mDirectory = juce::File::createTempFile("tags");
+        ASSERT_TRUE(mDirectory.createDirectory());
+    }
+    void TearDown() override
+    {
+        mDirectory.deleteRecursively();
+    }
+
+    static juce::MemoryBlock createComments(const juce::StringArray& entries)
+    {
+        juce::MemoryOutputStream stream;
+        stream.writeInt(4);
+        stream.write("test", 4);
+        stream.writeInt(entries.size());
+        for (const auto& entry : entries)
+        {
+            stream.writeInt((int)entry.getNumBytesAsUTF8());
+            stream.write(entry.toRawUTF8(), entry.getNumBytesAsUTF8());
+        }
+        return stream.getMemoryBlock();
+    }
+    static juce::MemoryBlock createAudio(size_t size)
+    {
+        juce::MemoryBlock audio(size);
+        for (size_t i = 0; i < size; i++) audio[i] = (char)(i * 13);
+        return audio;
+    }
+
+    // STREAMINFO, comments, an application block, paddingLength of padding
+    juce::File createFlac(const juce::String& name, int paddingLength)
+    {
+        juce::MemoryOutputStream stream;
+        stream.write("fLaC", 4);
+        auto writeBlock = [&stream](int type, bool isLast, const juce::MemoryBlock& data)
+        {
+            stream.writeByte((char)((isLast ? 0x80 : 0) | type));
+            stream.writeByte((char)(data.getSize() >> 16));
+            stream.writeByte((char)(data.getSize() >> 8));
+            stream.writeByte((char)data.getSize());
+            stream << data;
+        };
+        writeBlock(0, false, juce::MemoryBlock(34, true));
+        writeBlock(4, false, createComments({ "TITLE=Tone", "replaygain_track_gain=-3.00 dB" }));
+        writeBlock(2, paddingLength < 0, juce::MemoryBlock(24, true));
+        if (paddingLength >= 0) writeBlock(1, true, juce::MemoryBlock((size_t)paddingLength, true));
+        stream << createAudio(20000);
+
+        const auto file = mDirectory.getChildFile(name);
+        EXPECT_TRUE(file.replaceWithData(stream.getData(), stream.getDataSize()));
+        return file;
+    }
+    // What follows the last metadata block
+    static juce::MemoryBlock getFlacAudio(const juce::File& file)
+    {
+        juce::MemoryBlock data;
+        file.loadFileAsData(data);
+        const auto* bytes = static_cast<const juce::uint8*>(data.getData());
+
+        size_t position = 4;
+        for (bool isLast = false; !isLast && position + 4 <= data.getSize();)
+        {
+            isLast = (bytes[position] & 0x80) != 0;
+            position += 4 + (((size_t)bytes[position + 1] << 16) | ((size_t)bytes[position + 2] << 8)
+                             | (size_t)bytes[position + 3]);
+        }
+        return juce::MemoryBlock(bytes + position, data.getSize() - juce::jmin(position, data.getSize()));
+    }
+
+    // An Ogg page holding whole packets, no checksum: the writer only
+    // computes its own
+    static void writeOggPage(juce::MemoryOutputStream& stream,
+                             const std::vector<juce::MemoryBlock>& packets,
+                             int headerType,
+                             juce::uint32 sequenceNumber)
+    {
+        std::vector<juce::uint8> segments;
+        for (const auto& packet : packets)
+        {
+            segments.insert(segments.end(), packet.getSize() / 255, 255);
+            segments.push_back((juce::uint8)(packet.getSize() % 255));
+        }
+        stream.write("OggS", 4);
+        stream.writeByte(0);
+        stream.writeByte((char)headerType);
+        stream.writeInt64(sequenceNumber < 2 ? 0 : 1024 * sequenceNumber);
+        stream.writeInt(77);
+        stream.writeInt((int)sequenceNumber);
+        stream.writeInt(0);
+        stream.writeByte((char)segments.size());
+        stream.write(segments.data(), segments.size());
+        for (const auto& packet : packets) stream << packet;
+    }
+    juce::File createOgg(const juce::String& name)
+    {
+        juce::MemoryOutputStream identification;
+        identification.writeByte(1);
+        identification.write("vorbis", 6);
+        identification << juce::MemoryBlock(23, true);
+
+        juce::MemoryOutputStream comments;
+        comments.writeByte(3);
+        comments.write("vorbis", 6);
+        comments << createComments({ "TITLE=Tone" });
+        comments.writeByte(1);
+
+        juce::MemoryOutputStream setup;
+        setup.writeByte(5);
+        setup.write("vorbis", 6);
+        setup << createAudio(3000);
+
+        juce::MemoryOutputStream stream;
+        writeOggPage(stream, { identification.getMemoryBlock() }, 2, 0);
+        writeOggPage(stream, { comments.getMemoryBlock(), setup.getMemoryBlock() }, 0, 1);
+        for (juce::uint32 page = 2; page < 6; page++)
+            writeOggPage(stream, { createAudio(300), createAudio(400) }, page == 5 ? 4 : 0, page);
+
+        const auto file = mDirectory.getChildFile(name);
+        EXPECT_TRUE(file.replaceWithData(stream.getData(), stream.getDataSize()));
+        return file;
+    }
+    // Sequence number of every page
+    static std::vector<juce::uint32> getOggSequence(const juce::File& file)
+    {
+        juce::MemoryBlock data;
+        file.loadFileAsData(data);
+        const auto* bytes = static_cast<const juce::uint8*>(data.getData());
+
+        std::vector<juce::uint32> sequence;
+        for (size_t position = 0; position + 27 <= data.getSize();)
+        {
+            sequence.push_back(juce::ByteOrder::littleEndianInt(bytes + position + 18));
+            const int numberOfSegments = bytes[position + 26];
+            size_t length = 27 + (size_t)numberOfSegments;
+            for (int i = 0; i < numberOfSegments; i++) length += bytes[position + 27 + (size_t)i];
+            position += length;
+        }
+        return sequence;
+    }
+
+    static juce::StringPairArray readFields(const juce::File& file)
+    {
+        std::unique_ptr<juce::InputStream> stream = file.createInputStream();
+        return stream != nullptr ? norm::TagWriter::readFields(*stream) : juce::StringPairArray();
+    }
+    static juce::StringPairArray getGainFields()
+    {
+        juce::StringPairArray fields;
+        fields.set(norm::GainModel::RecordField, "Normalize;source=-17.00;gain=-6.00;signalled=-6.00");
+        fields.set(norm::GainModel::TrackGainField, "-6.00 dB");
+        return fields;
+    }
+
+    juce::File mDirectory;
+};
+
+//==============================================================================
+
+TEST_F(TagWriterTest, FlacTagsGoIntoPadding)
+{
+    const auto file = createFlac("padded.flac", 1024);
+    const auto size = file.getSize();
+    const auto audio = getFlacAudio(file);
+
+    ASSERT_TRUE(norm::TagWriter::writeFields(file, getGainFields()));
+
+    // Nothing moved, the old gain is replaced, not repeated
+    EXPECT_EQ(file.getSize(), size);
+    EXPECT_TRUE(getFlacAudio(file) == audio);
+    const auto fields = readFields(file);
+    EXPECT_EQ(fields.size(), 3);
+    EXPECT_EQ(fields["TITLE"], "Tone");
+    EXPECT_EQ(fields[norm::GainModel::TrackGainField], "-6.00 dB");
+    EXPECT_EQ(fields[norm::GainModel::RecordField], getGainFields()[norm::GainModel::RecordField]);
+
+    // Removing a field gives the room back to the padding
+    juce::StringPairArray removal;
+    removal.set(norm::GainModel::RecordField, {});
+    ASSERT_TRUE(norm::TagWriter::writeFields(file, removal));
+    EXPECT_EQ(file.getSize(), size);
+    EXPECT_FALSE(readFields(file).containsKey(norm::GainModel::RecordField));
+}
+
+TEST_F(TagWriterTest, FlacWithoutPaddingMovesOnce)
+{
+    const auto file = createFlac("tight.flac", -1);
+    const auto audio = getFlacAudio(file);
+
+    ASSERT_TRUE(norm::TagWriter::writeFields(file, getGainFields()));
+    EXPECT_TRUE(getFlacAudio(file) == audio);
+    EXPECT_EQ(readFields(file)[norm::GainModel::TrackGainField], "-6.00 dB");
+
+    // There is padding now for the next time
+    const auto size = file.getSize();
+    auto fields = getGainFields();
+    fields.set(norm::GainModel::TrackGainField, "-16.50 dB");
+    ASSERT_TRUE(norm::TagWriter::writeFields(file, fields));
+    EXPECT_EQ(file.getSize(), size);
+    EXPECT_EQ(readFields(file)[norm::GainModel::TrackGainField], "-16.50 dB");
+}
+
+TEST_F(TagWriterTest, OggPagesStayNumbered)
+{
+    const auto file = createOgg("tone.ogg");
+    ASSERT_EQ(getOggSequence(file), std::vector<juce::uint32>({ 0, 1, 2, 3, 4, 5 }));
+
+    ASSERT_TRUE(norm::TagWriter::writeFields(file, getGainFields()));
+    auto fields = readFields(file);
+    EXPECT_EQ(fields["TITLE"], "Tone");
+    EXPECT_EQ(fields[norm::GainModel::TrackGainField], "-6.00 dB");
+
+    // Comments longer than a page push the audio pages back by one
+    fields.clear();
+    fields.set("LYRICS", juce::String::repeatedString("la", 40000));
+    ASSERT_TRUE(norm::TagWriter::writeFields(file, fields));
+    EXPECT_EQ(getOggSequence(file), std::vector<juce::uint32>({ 0, 1, 2, 3, 4, 5, 6 }));
+    EXPECT_EQ(readFields(file)["LYRICS"].length(), 80000);
+
+    fields.set("LYRICS", {});
+    ASSERT_TRUE(norm::TagWriter::writeFields(file, fields));
+    EXPECT_EQ(getOggSequence(file), std::vector<juce::uint32>({ 0, 1, 2, 3, 4, 5 }));
+    EXPECT_EQ(readFields(file)[norm::GainModel::TrackGainField], "-6.00 dB");
+}
+
+TEST_F(TagWriterTest, TagsOnlyBatchLeavesAudioAlone)
+{
+    // The test tone, encoded to FLAC
+    const auto file = mDirectory.getChildFile("tone.flac");
+    {
+        juce::AudioFormatManager formats;
+        formats.registerBasicFormats();
+        std::unique_ptr<juce::AudioFormatReader> reader(formats.createReaderFor(
+            juce::File(TEST_AUDIO_DIR).getChildFile("HomeMade_997Hz_20LKFS.wav")));
+        ASSERT_NE(reader, nullptr);
+
+        juce::FlacAudioFormat flac;
+        std::unique_ptr<juce::OutputStream> stream = file.createOutputStream();
+        std::unique_ptr<juce::AudioFormatWriter> writer(flac.createWriterFor(
+            stream.get(), reader->sampleRate, reader->numChannels, 16, {}, 0));
+        ASSERT_NE(writer, nullptr);
+        // Owned by the writer now
+        stream.release();
+        ASSERT_TRUE(writer->writeFromAudioReader(*reader, 0, reader->lengthInSamples));
+    }
+    const auto audio = getFlacAudio(file);
+
+    norm::BatchEngine::Options options;
+    options.mode = norm::BatchEngine::Mode::normalise;
+    options.tagsOnly = true;
+    options.numberOfWorkers = 1;
+    const auto results = norm::BatchEngine(options).run({ file });
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0].status, norm::FileStatus::verified);
+    EXPECT_TRUE(getFlacAudio(file) == audio);
+
+    // All of the gain is the player's
+    const auto fields = readFields(file);
+    const auto record = norm::GainModel::fromString(fields[norm::GainModel::RecordField]);
+    ASSERT_TRUE(record.has_value());
+    EXPECT_NEAR(record->getResultLoudness(), options.targetLoudness, 0.01f);
+    EXPECT_FLOAT_EQ(record->signalledGain, record->appliedGain);
+    EXPECT_NEAR(fields[norm::GainModel::TrackGainField].getFloatValue(), record->appliedGain, 0.01f);
+
+    // The next run goes by the tags alone
+    const auto size = file.getSize();
+    const auto again = norm::BatchEngine(options).run({ file });
+    ASSERT_EQ(again.size(), 1u);
+    EXPECT_EQ(again[0].status, norm::FileStatus::verified);
+    EXPECT_EQ(file.getSize(), size);
+}
@@ -17,6 +17,27 @@
 #include "FilterTest.h"
 #include "CircularTest.h"
 #include "LKFSTest.h"
+#include "LoggerTest.h"
+#include "AnalysisEngineTest.h"
+#include "BatchEngineTest.h"
+#include "DirectoryScannerTest.h"
+#include "FileListTest.h"
+#include "WriteStageTest.h"
+#include "TruePeakLimiterTest.h"
+#include "GainModelTest.h"
+#include "GatingHistogramTest.h"
+#include "FolderWatcherTest.h"
+#include "OutputTreeTest.h"
+#include "LaneAnalyserTest.h"
+#include "UringReaderTest.h"
+#include "WorkStealingQueueTest.h"
+#include "Mp3GainWriterTest.h"
+#include "TagWriterTest.h"
+#include "SampleStoreTest.h"
+#include "TraceTest.h"
+#include "PcmStreamReaderTest.h"
+#include "AnalysisServiceTest.h"
+#include "CApiTest.h"
 
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,126 @@
+/*  Tests for the tracer: zones land in the ring of the thread that ran them,
+    full rings keep the newest events, and the export is a Chrome trace that
+    parses.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <util/Trace.h>
+#include <thread>
+
+class TraceTest : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        norm::Tracer::getInstance().clear();
+        norm::Tracer::getInstance().setEnabled(true);
+    }
+    void TearDown() override
+    {
+        norm::Tracer::getInstance().setEnabled(false);
+        norm::Tracer::getInstance().clear();
+    }
+
+    static size_t countEvents(const char* name)
+    {
+        size_t count = 0;
+        for (const auto& thread : norm::Tracer::getInstance().getEvents())
+            for (const auto& event : thread)
+                if (juce::String(event.name) == name) count++;
+        return count;
+    }
+};
+
+//==============================================================================
+
+TEST_F(TraceTest, ZonesNestInTheirThread)
+{
+    {
+        const norm::TraceScope outer("outer");
+        const norm::TraceScope inner("inner");
+        juce::Thread::sleep(2);
+    }
+
+    const auto events = norm::Tracer::getInstance().getEvents();
+    const std::vector<norm::Tracer::Event>* thread = nullptr;
+    for (const auto& candidate : events)
+        if (!candidate.empty()) thread = &candidate;
+    ASSERT_NE(thread, nullptr);
+    ASSERT_EQ(thread->size(), 2u);
+
+    // Recorded as they end, the inner one first
+    const auto& inner = (*thread)[0];
+    const auto& outer = (*thread)[1];
+    EXPECT_STREQ(inner.name, "inner");
+    EXPECT_STREQ(outer.name, "outer");
+    EXPECT_GE(inner.duration, 2000000);
+    EXPECT_LE(outer.start, inner.start);
+    EXPECT_GE(outer.start + outer.duration, inner.start + inner.duration);
+}
+
+TEST_F(TraceTest, DisabledRecordsNothing)
+{
+    norm::Tracer::getInstance().setEnabled(false);
+    {
+        const norm::TraceScope scope("disabled");
+    }
+    EXPECT_EQ(countEvents("disabled"), 0u);
+
+    // A zone started while disabled stays unrecorded
+    {
+        const norm::TraceScope scope("disabled");
+        norm::Tracer::getInstance().setEnabled(true);
+    }
+    EXPECT_EQ(countEvents("disabled"), 0u);
+}
+
+TEST_F(TraceTest, FullRingKeepsTheNewest)
+{
+    std::thread thread([]
+    {
+        const size_t total = norm::Tracer::eventsPerThread + 100;
+        for (size_t i = 0; i < total; i++)
+        {
+            const norm::TraceScope scope(i < 100 ? "old" : "new");
+        }
+    });
+    thread.join();
+
+    EXPECT_EQ(countEvents("old"), 0u);
+    EXPECT_EQ(countEvents("new"), norm::Tracer::eventsPerThread);
+}
+
+TEST_F(TraceTest, ExportsChromeTrace)
+{
+    std::thread first([] { const norm::TraceScope scope("first \"quoted\""); });
+    std::thread second([]
+    {
+        const norm::TraceScope scope("second");
+        juce::Thread::sleep(1);
+    });
+    first.join();
+    second.join();
+
+    const auto file = juce::File::createTempFile("json");
+    ASSERT_TRUE(norm::Tracer::getInstance().writeChromeTrace(file));
+
+    juce::var trace;
+    ASSERT_TRUE(juce::JSON::parse(file.loadFileAsString(), trace).wasOk());
+    file.deleteFile();
+
+    const auto* events = trace["traceEvents"].getArray();
+    ASSERT_NE(events, nullptr);
+
+    juce::StringArray names;
+    for (const auto& event : *events)
+    {
+        if (event["ph"].toString() != "X") continue;
+        names.add(event["name"].toString());
+        EXPECT_GE((double)event["dur"], 0.0);
+        EXPECT_GT((int)event["tid"], 0);
+    }
+    EXPECT_TRUE(names.contains("first \"quoted\""));
+    EXPECT_TRUE(names.contains("second"));
+}
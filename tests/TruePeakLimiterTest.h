@@ -0,0 +1,162 @@
+/*  Tests for the true-peak limiter: the oversampled detector must see peaks
+    between samples, the output must stay under the ceiling, and signals below
+    it must come out untouched, only delayed.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/TruePeakLimiter.h>
+#include <processor/WriteStage.h>
+#include <cmath>
+#include <vector>
+
+class TruePeakLimiterTest : public testing::Test
+{
+protected:
+    const double sampleRate = 48000.0;
+
+    // Loud and quiet halves of a second each, both channels
+    std::vector<std::vector<float>> makeSignal(int numSamples, float gain)
+    {
+        std::vector<std::vector<float>> signal(2, std::vector<float>((size_t)numSamples));
+        for (int i = 0; i < numSamples; i++)
+        {
+            const float envelope = (i / 24000) % 2 == 0 ? 0.3f : 0.99f;
+            signal[0][(size_t)i] = gain * envelope * std::sin(2.f * juce::MathConstants<float>::pi
+                                                              * 11025.f / 48000.f * (float)i + 0.7f);
+            signal[1][(size_t)i] = gain * envelope * 0.5f * std::sin(2.f * juce::MathConstants<float>::pi
+                                                                     * 997.f / 48000.f * (float)i);
+        }
+        return signal;
+    }
+};
+
+//==============================================================================
+
+TEST_F(TruePeakLimiterTest, DetectsPeaksBetweenSamples)
+{
+    // A quarter of the sample rate at 45 degrees: every sample is at 0.707,
+    // the peaks are exactly half way between them
+    std::vector<float> signal(4800);
+    for (size_t i = 0; i < signal.size(); i++)
+        signal[i] = std::sin(juce::MathConstants<float>::halfPi * (float)i
+                             + juce::MathConstants<float>::pi / 4.f);
+
+    const float* channels[] = { signal.data() };
+    EXPECT_NEAR(norm::TruePeakLimiter::measureTruePeak(channels, 1, 4800), 1.f, 0.02f);
+}
+
+TEST_F(TruePeakLimiterTest, StaysUnderCeiling)
+{
+    const int numSamples = 48000 * 3;
+    auto signal = makeSignal(numSamples, 2.f);
+
+    norm::TruePeakLimiter limiter;
+    limiter.prepare(sampleRate, 2, 1000, {});
+    const int latency = limiter.getLatencyInSamples();
+
+    for (auto& channel : signal) channel.resize((size_t)(numSamples + latency), 0.f);
+    float* channels[] = { signal[0].data(), signal[1].data() };
+    limiter.process(channels, numSamples + latency);
+
+    const float* output[] = { signal[0].data() + latency, signal[1].data() + latency };
+    const float truePeak = norm::TruePeakLimiter::measureTruePeak(output, 2, numSamples);
+
+    EXPECT_LT(juce::Decibels::gainToDecibels(truePeak), -1.f + 0.01f);
+    EXPECT_GT(limiter.getMaxGainReductionDB(), 6.f);
+}
+
+TEST_F(TruePeakLimiterTest, QuietSignalOnlyDelayed)
+{
+    const int numSamples = 20000;
+    const auto input = makeSignal(numSamples, 1.f);
+    auto signal = input;
+
+    norm::TruePeakLimiter limiter;
+    limiter.prepare(sampleRate, 2, 4096, {});
+    const int latency = limiter.getLatencyInSamples();
+
+    float* channels[] = { signal[0].data(), signal[1].data() };
+    limiter.process(channels, numSamples);
+
+    // The first 24000 samples stay at 0.3, far under -1 dBTP
+    for (int ch = 0; ch < 2; ch++)
+        for (int i = latency; i < numSamples; i++)
+            ASSERT_EQ(signal[(size_t)ch][(size_t)i], input[(size_t)ch][(size_t)(i - latency)]);
+}
+
+TEST_F(TruePeakLimiterTest, WriteStageCompensatesLatency)
+{
+    const int numSamples = 48000 * 2;
+    const auto signal = makeSignal(numSamples, 1.f);
+    juce::AudioBuffer<float> buffer(2, numSamples);
+    for (int ch = 0; ch < 2; ch++)
+        buffer.copyFrom(ch, 0, signal[(size_t)ch].data(), numSamples);
+
+    // Float output, so nothing but the limiter changes the samples
+    juce::MemoryBlock block;
+    juce::WavAudioFormat format;
+    norm::WriteStage stage;
+    stage.setLimiter(norm::TruePeakLimiter::Options {});
+    {
+        std::unique_ptr<juce::AudioFormatWriter> writer(
+            format.createWriterFor(new juce::MemoryOutputStream(block, false),
+                                   sampleRate, 2, 32, {}, 0));
+        ASSERT_NE(writer, nullptr);
+        ASSERT_TRUE(stage.write(*writer, buffer, 0, numSamples, 2.f));
+    }
+
+    std::unique_ptr<juce::AudioFormatReader> reader(
+        format.createReaderFor(new juce::MemoryInputStream(block, false), true));
+    ASSERT_NE(reader, nullptr);
+    ASSERT_EQ(reader->lengthInSamples, numSamples);
+
+    juce::AudioBuffer<float> result(2, numSamples);
+    reader->read(&result, 0, numSamples, 0, true, true);
+
+    // The quiet start is in place, with the gain
+    for (int i = 0; i < 20000; i++)
+        ASSERT_FLOAT_EQ(result.getSample(0, i), 2.f * buffer.getSample(0, i));
+
+    const float truePeak = norm::TruePeakLimiter::measureTruePeak(
+        result.getArrayOfReadPointers(), 2, numSamples);
+    EXPECT_LT(juce::Decibels::gainToDecibels(truePeak), -1.f + 0.01f);
+    EXPECT_GT(stage.getMaxGainReductionDB(), 6.f);
+}
+
+TEST_F(TruePeakLimiterTest, WriteStageKeepsLimiterAcrossFiles)
+{
+    const int numSamples = 48000;
+    const auto signal = makeSignal(numSamples, 1.f);
+    juce::AudioBuffer<float> buffer(2, numSamples);
+    for (int ch = 0; ch < 2; ch++)
+        buffer.copyFrom(ch, 0, signal[(size_t)ch].data(), numSamples);
+
+    juce::WavAudioFormat format;
+    norm::WriteStage stage;
+    auto writeFile = [&](const norm::TruePeakLimiter::Options& options)
+    {
+        // As the batch engine does it, once for every file
+        stage.setLimiter(options);
+
+        juce::MemoryBlock block;
+        std::unique_ptr<juce::AudioFormatWriter> writer(
+            format.createWriterFor(new juce::MemoryOutputStream(block, false),
+                                   sampleRate, 2, 32, {}, 0));
+        EXPECT_TRUE(writer != nullptr && stage.write(*writer, buffer, 0, numSamples, 2.f));
+        writer.reset();
+        return block;
+    };
+
+    // Nothing of the first file is left in the second
+    const auto first = writeFile({});
+    EXPECT_EQ(writeFile({}), first);
+
+    // New options do take effect
+    norm::TruePeakLimiter::Options lower;
+    lower.ceilingDB = -3.f;
+    const float reduction = stage.getMaxGainReductionDB();
+    writeFile(lower);
+    EXPECT_GT(stage.getMaxGainReductionDB(), reduction + 1.f);
+}
@@ -0,0 +1,114 @@
+/*  Reading many small files: one stream per file read chunk by chunk, as the
+    decoders do, against UringReader at several queue depths, and a whole
+    analysis batch with and without reading ahead.
+
+    Files come from the page cache after the first run, which measures the
+    system call overhead alone. For cold numbers drop the caches between
+    runs (as root: sync; echo 3 > /proc/sys/vm/drop_caches).
+*/
+
+#pragma once
+
+#include "BenchUtil.h"
+#include <processor/BatchEngine.h>
+#include <processor/UringReader.h>
+
+class UringBench : public testing::TestWithParam<int>
+{
+protected:
+    static void SetUpTestSuite()
+    {
+        sDirectory = juce::File::createTempFile("uringbench");
+        ASSERT_TRUE(sDirectory.createDirectory());
+
+        // Half a second of 16 bit mono at 48 kHz, a short sound effect
+        juce::Random random(11);
+        for (int i = 0; i < 2000; i++)
+        {
+            const int numSamples = 24000;
+            juce::AudioBuffer<float> buffer(1, numSamples);
+            for (int s = 0; s < numSamples; s++)
+                buffer.setSample(0, s, 0.1f * (random.nextFloat() * 2.f - 1.f));
+
+            const auto file = sDirectory.getChildFile("file" + juce::String(i) + ".wav");
+            juce::WavAudioFormat format;
+            std::unique_ptr<juce::OutputStream> stream = file.createOutputStream();
+            std::unique_ptr<juce::AudioFormatWriter> writer(
+                format.createWriterFor(stream.get(), 48000.0, 1, 16, {}, 0));
+            ASSERT_NE(writer, nullptr);
+            // Owned by the writer now
+            stream.release();
+            writer->writeFromAudioSampleBuffer(buffer, 0, numSamples);
+
+            sFiles.add(file);
+        }
+        for (const auto& file : sFiles) sBytes += file.getSize();
+    }
+    static void TearDownTestSuite()
+    {
+        sDirectory.deleteRecursively();
+        sFiles.clear();
+        sBytes = 0;
+    }
+
+    static inline juce::File sDirectory;
+    static inline juce::Array<juce::File> sFiles;
+    static inline juce::int64 sBytes = 0;
+};
+
+TEST_P(UringBench, ReadAgainstStreams)
+{
+    const int queueDepth = GetParam();
+    const std::string name = "depth" + std::to_string(queueDepth);
+
+    norm::UringReader::Options options;
+    options.queueDepth = queueDepth;
+    norm::UringReader reader(options);
+    if (!reader.isAvailable()) GTEST_SKIP() << "io_uring is not available here";
+
+    const double streams = bench::measureBest([&]
+    {
+        std::vector<char> chunk((size_t)options.chunkSize);
+        for (const auto& file : sFiles)
+        {
+            juce::FileInputStream stream(file);
+            ASSERT_TRUE(stream.openedOk());
+            while (stream.read(chunk.data(), (int)chunk.size()) > 0) {}
+        }
+    }, 3);
+
+    const double uring = bench::measureBest([&]
+    {
+        for (const auto& completed : reader.read(sFiles)) ASSERT_TRUE(completed.ok);
+    }, 3);
+
+    bench::report("streams_files", (double)sFiles.size() / streams, "files/s");
+    bench::report(name + "_uring_files", (double)sFiles.size() / uring, "files/s");
+    bench::report(name + "_uring_bandwidth", (double)sBytes / uring / 1e6, "MB/s");
+    bench::report(name + "_speedup", streams / uring, "x");
+}
+
+TEST_P(UringBench, AnalysisBatch)
+{
+    const std::string name = "depth" + std::to_string(GetParam());
+
+    norm::BatchEngine::Options options;
+    options.mode = norm::BatchEngine::Mode::analyse;
+
+    const double streams = bench::measureBest([&]
+    {
+        EXPECT_EQ(norm::BatchEngine(options).run(sFiles).size(), (size_t)sFiles.size());
+    }, 3);
+
+    options.ioBackend = norm::BatchEngine::IoBackend::uring;
+    options.ioQueueDepth = GetParam();
+    const double uring = bench::measureBest([&]
+    {
+        EXPECT_EQ(norm::BatchEngine(options).run(sFiles).size(), (size_t)sFiles.size());
+    }, 3);
+
+    bench::report("batch_streams", (double)sFiles.size() / streams, "files/s");
+    bench::report(name + "_batch_uring", (double)sFiles.size() / uring, "files/s");
+}
+
+INSTANTIATE_TEST_SUITE_P(QueueDepths, UringBench, testing::Values(1, 4, 16, 64));
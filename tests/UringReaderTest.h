@@ -0,0 +1,129 @@
+/*  Tests for reading files ahead through io_uring. Where the kernel or a
+    sandbox does not allow io_uring the reader tests are skipped; the batch
+    must give the same results either way.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/BatchEngine.h>
+#include <processor/UringReader.h>
+
+class UringReaderTest : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        mDirectory = juce::File::createTempFile("uring");
+        ASSERT_TRUE(mDirectory.createDirectory());
+    }
+    void TearDown() override
+    {
+        mDirectory.deleteRecursively();
+    }
+
+    juce::File createFile(const juce::String& name, size_t size)
+    {
+        juce::MemoryBlock data(size);
+        mRandom.fillBitsRandomly(data.getData(), data.getSize());
+        const auto file = mDirectory.getChildFile(name);
+        EXPECT_TRUE(file.replaceWithData(data.getData(), data.getSize()));
+        return file;
+    }
+
+    juce::File mDirectory;
+    juce::Random mRandom { 5 };
+};
+
+//==============================================================================
+
+TEST_F(UringReaderTest, ReadsFilesWhole)
+{
+    norm::UringReader::Options options;
+    options.queueDepth = 4;
+    options.chunkSize = 64 * 1024;
+    options.maxFileSize = 1024 * 1024;
+    norm::UringReader reader(options);
+    if (!reader.isAvailable()) GTEST_SKIP() << "io_uring is not available here";
+
+    // Empty, smaller than a chunk, several chunks, over the limit, more
+    // files than the queue is deep
+    juce::Array<juce::File> files { createFile("empty", 0),
+                                    createFile("small", 1000),
+                                    createFile("chunks", 3 * 64 * 1024 + 17),
+                                    createFile("large", 2 * 1024 * 1024),
+                                    mDirectory.getChildFile("missing") };
+    for (int i = 0; i < 10; i++) files.add(createFile("more" + juce::String(i), 5000 + (size_t)i * 20000));
+    files.add(files[1]);
+
+    const auto results = reader.read(files);
+    ASSERT_EQ(results.size(), (size_t)files.size());
+
+    for (int i = 0; i < files.size(); i++)
+    {
+        const auto& result = results[(size_t)i];
+        EXPECT_EQ(result.file, files[i]);
+
+        const bool shouldRead = files[i].existsAsFile()
+                             && files[i].getSize() <= options.maxFileSize;
+        ASSERT_EQ(result.ok, shouldRead) << files[i].getFileName();
+        if (!shouldRead) continue;
+
+        juce::MemoryBlock expected;
+        files[i].loadFileAsData(expected);
+        EXPECT_TRUE(result.data == expected) << files[i].getFileName();
+    }
+}
+
+TEST_F(UringReaderTest, DecodesFromPrefetchedData)
+{
+    const auto file = mDirectory.getChildFile("track.wav");
+    ASSERT_TRUE(juce::File(TEST_AUDIO_DIR).getChildFile("HomeMade_997Hz_20LKFS.wav").copyFileTo(file));
+
+    juce::MemoryBlock data;
+    ASSERT_TRUE(file.loadFileAsData(data));
+    norm::AnalysisEngine engine;
+    const auto fromDisk = engine.analyse(file);
+
+    // Nothing left on disk to read from
+    ASSERT_TRUE(file.deleteFile());
+    engine.getFileHandler().setPrefetchedData(file, std::move(data));
+    const auto fromMemory = engine.analyse(file);
+
+    ASSERT_TRUE(fromMemory.ok);
+    EXPECT_FLOAT_EQ(fromMemory.integratedLoudness, fromDisk.integratedLoudness);
+}
+
+TEST_F(UringReaderTest, BatchReadingAheadMatches)
+{
+    const juce::File dir(TEST_AUDIO_DIR);
+    const juce::Array<juce::File> files { dir.getChildFile("HomeMade_997Hz_20LKFS.wav"),
+                                          dir.getChildFile("1770-2_Comp_AbsGateTest.wav"),
+                                          dir.getChildFile("1770-2_Comp_RelGateTest.wav"),
+                                          createFile("notaudio.wav", 100),
+                                          mDirectory.getChildFile("missing.wav") };
+
+    norm::BatchEngine::Options options;
+    options.mode = norm::BatchEngine::Mode::analyse;
+    options.numberOfWorkers = 2;
+
+    auto byFile = [](std::vector<norm::BatchEngine::FileResult> results)
+    {
+        std::sort(results.begin(), results.end(),
+                  [](const auto& a, const auto& b) { return a.file < b.file; });
+        return results;
+    };
+
+    const auto expected = byFile(norm::BatchEngine(options).run(files));
+    options.ioBackend = norm::BatchEngine::IoBackend::uring;
+    options.ioQueueDepth = 2;
+    const auto results = byFile(norm::BatchEngine(options).run(files));
+
+    ASSERT_EQ(results.size(), expected.size());
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        EXPECT_EQ(results[i].file, expected[i].file);
+        EXPECT_EQ(results[i].status, expected[i].status) << results[i].file.getFileName();
+        EXPECT_FLOAT_EQ(results[i].loudness, expected[i].loudness);
+    }
+}
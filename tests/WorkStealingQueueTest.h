@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <util/WorkStealingQueue.h>
+
+TEST(WorkStealingQueueTest, CostliestFirst)
+{
+    norm::WorkStealingQueue<int> queue(1);
+    queue.push(1, 10.0);
+    queue.push(2, 500.0);
+    queue.push(3, 20.0);
+
+    EXPECT_EQ(queue.tryPop(0).value(), 2);
+    EXPECT_EQ(queue.tryPop(0).value(), 3);
+    EXPECT_EQ(queue.tryPop(0).value(), 1);
+    EXPECT_FALSE(queue.tryPop(0).has_value());
+}
+
+TEST(WorkStealingQueueTest, EqualCostsInOrder)
+{
+    norm::WorkStealingQueue<int> queue(1);
+    for (int i = 0; i < 5; i++) queue.push(int(i), 0.0);
+
+    for (int i = 0; i < 5; i++) EXPECT_EQ(queue.tryPop(0).value(), i);
+}
+
+TEST(WorkStealingQueueTest, IdleWorkerStealsCostliest)
+{
+    norm::WorkStealingQueue<int> queue(2);
+    // Each goes where the least is waiting: 1 to worker 0, 2 and 3 to worker 1
+    queue.push(1, 100.0);
+    queue.push(2, 1.0);
+    queue.push(3, 50.0);
+    ASSERT_EQ(queue.size(), 3u);
+
+    EXPECT_EQ(queue.tryPop(0).value(), 1);
+    EXPECT_EQ(queue.tryPop(0).value(), 3);
+    EXPECT_EQ(queue.tryPop(0).value(), 2);
+    EXPECT_TRUE(queue.isEmpty());
+    EXPECT_FALSE(queue.tryPop(1).has_value());
+}
+
+TEST(WorkStealingQueueTest, EveryTaskTakenOnce)
+{
+    const int workers = 4;
+    const int tasks = 20000;
+    norm::WorkStealingQueue<int> queue(workers);
+
+    std::atomic<bool> pushed { false };
+    std::atomic<long long> sum { 0 };
+    std::atomic<int> count { 0 };
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < workers; w++)
+    {
+        threads.emplace_back([&, w]
+        {
+            for (;;)
+            {
+                if (auto task = queue.tryPop(w))
+                {
+                    sum += *task;
+                    count++;
+                }
+                else if (pushed)
+                {
+                    if (queue.isEmpty()) break;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    for (int i = 1; i <= tasks; i++) queue.push(int(i), (double)(i % 13));
+    pushed = true;
+    for (auto& thread : threads) thread.join();
+
+    EXPECT_EQ(count.load(), tasks);
+    EXPECT_EQ(sum.load(), (long long)tasks * (tasks + 1) / 2);
+    EXPECT_TRUE(queue.isEmpty());
+}
@@ -0,0 +1,64 @@
+/*  Write throughput at 24 bits: gain over the whole buffer followed by the
+    writer's own conversion, against the fused write stage. Both write into
+    memory, so only the conversion and packing are measured.
+*/
+
+#pragma once
+
+#include "BenchUtil.h"
+#include <processor/WriteStage.h>
+#include <cstdlib>
+
+class WriteBench : public testing::TestWithParam<int>
+{
+protected:
+    // Frames per second written
+    double run(bool fused)
+    {
+        const int bitsPerSample = GetParam();
+        const int numSamples = 48000 * 60;
+        juce::AudioBuffer<float> buffer(2, numSamples);
+        for (int ch = 0; ch < 2; ch++)
+            for (int i = 0; i < numSamples; i++)
+                buffer.setSample(ch, i, (float)std::rand() / (float)RAND_MAX - 0.5f);
+
+        juce::WavAudioFormat format;
+        juce::MemoryBlock block;
+        block.ensureSize((size_t)numSamples * 2 * 4);
+        norm::WriteStage stage;
+
+        const double seconds = bench::measureBest([&]
+        {
+            std::unique_ptr<juce::AudioFormatWriter> writer(
+                format.createWriterFor(new juce::MemoryOutputStream(block, false),
+                                       48000, 2, (unsigned int)bitsPerSample, {}, 0));
+
+            if (fused)
+            {
+                stage.write(*writer, buffer, 0, numSamples, 0.7f);
+            }
+            else
+            {
+                juce::AudioBuffer<float> copy(buffer);
+                copy.applyGain(0.7f);
+                writer->writeFromAudioSampleBuffer(copy, 0, numSamples);
+            }
+        }, 5);
+
+        return (double)numSamples / seconds;
+    }
+};
+
+TEST_P(WriteBench, FusedAgainstGainThenWrite)
+{
+    const std::string name = std::to_string(GetParam()) + "bit";
+
+    const double separate = run(false);
+    const double fused = run(true);
+
+    bench::report(name + "_separate", separate / 1e6, "Mframes/s");
+    bench::report(name + "_fused", fused / 1e6, "Mframes/s");
+    bench::report(name + "_speedup", fused / separate, "x");
+}
+
+INSTANTIATE_TEST_SUITE_P(BitDepths, WriteBench, testing::Values(16, 24, 32));
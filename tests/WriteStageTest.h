@@ -0,0 +1,105 @@
+/*  Tests for the write stage: rounding, clipping and justification of the
+    fused conversion, the shape of the dither, and a round trip through a
+    real WAV writer.
+*/
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <processor/WriteStage.h>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+TEST(WriteStageTest, ConvertRoundsAndClips)
+{
+    const float source[] = { 0.f, 0.5f, -0.5f, 1.5f, -1.5f, 1.4f / 32768.f, -1.6f / 32768.f };
+    int dest[7];
+
+    norm::WriteStage::convertToInt(source, dest, nullptr, 7, 1.f, 16);
+
+    // Left-justified, the writer takes the upper 16 bits
+    for (int value : dest) EXPECT_EQ(value & 0xffff, 0);
+    EXPECT_EQ(dest[0] >> 16, 0);
+    EXPECT_EQ(dest[1] >> 16, 16384);
+    EXPECT_EQ(dest[2] >> 16, -16384);
+    EXPECT_EQ(dest[3] >> 16, 32767);
+    EXPECT_EQ(dest[4] >> 16, -32768);
+    EXPECT_EQ(dest[5] >> 16, 1);
+    EXPECT_EQ(dest[6] >> 16, -2);
+}
+
+TEST(WriteStageTest, GainIsApplied)
+{
+    const float source[] = { 0.25f, -0.25f };
+    int dest[2];
+
+    norm::WriteStage::convertToInt(source, dest, nullptr, 2, 2.f, 24);
+    EXPECT_EQ(dest[0] >> 8, 4194304);
+    EXPECT_EQ(dest[1] >> 8, -4194304);
+
+    // 32 bit: full scale must saturate instead of overflowing
+    const float loud[] = { 1.f, -1.f };
+    norm::WriteStage::convertToInt(loud, dest, nullptr, 2, 1.f, 32);
+    EXPECT_GT(dest[0], 2147483000);
+    EXPECT_EQ(dest[1], std::numeric_limits<int>::min());
+}
+
+TEST(WriteStageTest, DitherIsTriangular)
+{
+    std::vector<float> dither(100003);
+    norm::WriteStage::DitherSource source;
+    source.fill(dither.data(), (int)dither.size());
+
+    double mean = 0, variance = 0;
+    for (float d : dither)
+    {
+        ASSERT_GT(d, -1.f);
+        ASSERT_LT(d, 1.f);
+        mean += d;
+        variance += d * d;
+    }
+    mean /= (double)dither.size();
+    variance /= (double)dither.size();
+
+    EXPECT_NEAR(mean, 0.0, 0.01);
+    // Triangular on (-1, 1) has a variance of 1/6
+    EXPECT_NEAR(variance, 1.0 / 6.0, 0.01);
+}
+
+TEST(WriteStageTest, RoundTripThroughWavWriter)
+{
+    const int numSamples = 10000;
+    juce::AudioBuffer<float> buffer(2, numSamples);
+    for (int i = 0; i < numSamples; i++)
+    {
+        buffer.setSample(0, i, 0.5f * std::sin(0.01f * (float)i));
+        buffer.setSample(1, i, -0.25f);
+    }
+
+    juce::MemoryBlock block;
+    juce::WavAudioFormat format;
+    {
+        std::unique_ptr<juce::AudioFormatWriter> writer(
+            format.createWriterFor(new juce::MemoryOutputStream(block, false),
+                                   48000, 2, 24, {}, 0));
+        ASSERT_NE(writer, nullptr);
+
+        norm::WriteStage stage;
+        ASSERT_TRUE(stage.write(*writer, buffer, 0, numSamples, 0.5f));
+    }
+
+    std::unique_ptr<juce::AudioFormatReader> reader(
+        format.createReaderFor(new juce::MemoryInputStream(block, false), true));
+    ASSERT_NE(reader, nullptr);
+    ASSERT_EQ(reader->lengthInSamples, numSamples);
+
+    juce::AudioBuffer<float> result(2, numSamples);
+    reader->read(&result, 0, numSamples, 0, true, true);
+
+    // Gain applied, and off by no more than the dither and rounding
+    const float lsb = 1.f / 8388608.f;
+    for (int ch = 0; ch < 2; ch++)
+        for (int i = 0; i < numSamples; i++)
+            ASSERT_NEAR(result.getSample(ch, i), 0.5f * buffer.getSample(ch, i), 1.5f * lsb);
+}